@@ -6,9 +6,11 @@ dnl substitution variable, and provides the HAVE_SYSTEMD Automake conditional
 dnl to use to control whether to install unit files.
 dnl
 dnl Provides the RRA_LIB_SYSTEMD_DAEMON_OPTIONAL macro, which sets
-dnl SYSTEMD_CFLAGS and SYSTEMD_LIBS substitution variables if
-dnl libsystemd-daemon is available and defines HAVE_SD_NOTIFY.  pkg-config
-dnl support for libsystemd-daemon is required for it to be detected.
+dnl SYSTEMD_DAEMON_CFLAGS and SYSTEMD_DAEMON_LIBS substitution variables if
+dnl libsystemd or libsystemd-daemon is available and defines HAVE_SD_NOTIFY.
+dnl pkg-config support for the library is required for it to be detected.
+dnl libsystemd is preferred, since systemd 209 and later merged
+dnl libsystemd-daemon into it.
 dnl
 dnl Depends on the Autoconf macros that come with pkg-config.
 dnl
@@ -42,6 +44,10 @@ AC_DEFUN([RRA_WITH_SYSTEMD_UNITDIR],
 dnl Check for libsystemd-daemon and define SYSTEMD_DAEMON_{CFLAGS,LIBS} if it
 dnl is available.
 AC_DEFUN([RRA_LIB_SYSTEMD_DAEMON_OPTIONAL],
-[PKG_CHECK_EXISTS([libsystemd-daemon],
-    [PKG_CHECK_MODULES([SYSTEMD_DAEMON], [libsystemd-daemon])
-     AC_DEFINE([HAVE_SD_NOTIFY], 1, [Define if sd_notify is available.])])])
+[PKG_CHECK_EXISTS([libsystemd],
+    [PKG_CHECK_MODULES([SYSTEMD_DAEMON], [libsystemd])
+     AC_DEFINE([HAVE_SD_NOTIFY], 1, [Define if sd_notify is available.])],
+    [PKG_CHECK_EXISTS([libsystemd-daemon],
+        [PKG_CHECK_MODULES([SYSTEMD_DAEMON], [libsystemd-daemon])
+         AC_DEFINE([HAVE_SD_NOTIFY], 1,
+            [Define if sd_notify is available.])])])])
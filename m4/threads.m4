@@ -0,0 +1,78 @@
+dnl Check for POSIX threads and atomic operations.
+dnl
+dnl This file defines two macros for probing for the support needed by
+dnl lock-free, multithreaded code.  RRA_LIB_PTHREAD finds the library needed
+dnl for POSIX threads, sets PTHREAD_LIBS to it (which is empty if no separate
+dnl library is needed), and defines HAVE_PTHREAD if threads are available.
+dnl PTHREAD_LIBS is substituted but not added to LIBS, since only some
+dnl programs need it.
+dnl
+dnl RRA_C_ATOMIC_BUILTINS checks whether the compiler supports the GCC
+dnl __atomic builtins (GCC 4.7 and later and Clang) and defines
+dnl HAVE_ATOMIC_BUILTINS if so.  The check links a program, since some
+dnl platforms need library support for some operations.
+dnl
+dnl RRA_C_THREAD_LOCAL checks for a storage class for thread-local variables,
+dnl trying the C11 _Thread_local and then the GCC __thread extension.  If one
+dnl works, it defines HAVE_THREAD_LOCAL and defines THREAD_LOCAL to it.
+dnl
+dnl The canonical version of this file is maintained in the rra-c-util
+dnl package, available at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+dnl
+dnl Written by Russ Allbery <eagle@eyrie.org>
+dnl
+dnl This file is free software; the authors give unlimited permission to copy
+dnl and/or distribute it, with or without modifications, as long as this
+dnl notice is preserved.
+
+AC_DEFUN([RRA_LIB_PTHREAD],
+[rra_pthread_save_LIBS="$LIBS"
+ LIBS=
+ PTHREAD_LIBS=
+ AC_CHECK_HEADERS([pthread.h])
+ AS_IF([test x"$ac_cv_header_pthread_h" = xyes],
+    [AC_SEARCH_LIBS([pthread_create], [pthread],
+        [PTHREAD_LIBS="$LIBS"
+         AC_DEFINE([HAVE_PTHREAD], 1,
+            [Define if POSIX threads are available.])])])
+ LIBS="$rra_pthread_save_LIBS"
+ AC_SUBST([PTHREAD_LIBS])])
+
+AC_DEFUN([_RRA_C_ATOMIC_BUILTINS_SOURCE], [[
+#include <stddef.h>
+
+int
+main(void) {
+    size_t value = 0, expected = 0;
+
+    __atomic_store_n(&value, 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&value, 1, __ATOMIC_RELAXED);
+    __atomic_compare_exchange_n(&value, &expected, 3, 0, __ATOMIC_ACQ_REL,
+                                __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&value, __ATOMIC_ACQUIRE) == 2 ? 0 : 1;
+}
+]])
+
+AC_DEFUN([RRA_C_ATOMIC_BUILTINS],
+[AC_CACHE_CHECK([for GCC atomic builtins], [rra_cv_c_atomic_builtins],
+    [AC_LINK_IFELSE([AC_LANG_SOURCE([_RRA_C_ATOMIC_BUILTINS_SOURCE])],
+        [rra_cv_c_atomic_builtins=yes],
+        [rra_cv_c_atomic_builtins=no])])
+ AS_IF([test x"$rra_cv_c_atomic_builtins" = xyes],
+    [AC_DEFINE([HAVE_ATOMIC_BUILTINS], 1,
+        [Define if the compiler supports the GCC __atomic builtins.])])])
+
+AC_DEFUN([RRA_C_THREAD_LOCAL],
+[AC_CACHE_CHECK([for thread-local storage], [rra_cv_c_thread_local],
+    [rra_cv_c_thread_local=no
+     for rra_keyword in _Thread_local __thread ; do
+        AC_LINK_IFELSE([AC_LANG_PROGRAM([[static $rra_keyword int value;]],
+                [[value = 1; return value - 1;]])],
+            [rra_cv_c_thread_local="$rra_keyword"
+             break])
+     done])
+ AS_IF([test x"$rra_cv_c_thread_local" != xno],
+    [AC_DEFINE([HAVE_THREAD_LOCAL], 1,
+        [Define if the compiler supports thread-local storage.])
+     AC_DEFINE_UNQUOTED([THREAD_LOCAL], [$rra_cv_c_thread_local],
+        [Define to the storage class for thread-local variables.])])])
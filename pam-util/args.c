@@ -45,18 +45,311 @@
 #include <portable/system.h>
 
 #include <errno.h>
+#include <sys/stat.h>
 
 #include <pam-util/args.h>
 #include <pam-util/logging.h>
 
+/* Used for unused parameters to silence gcc warnings. */
+#define UNUSED __attribute__((__unused__))
+
+
+/*
+ * The name of the PAM data item holding the cached Kerberos context, the
+ * default Kerberos configuration file, and the maximum number and length of
+ * the paths from KRB5_CONFIG that are checked for changes.  The data item is
+ * named after the module, since several modules built from different versions
+ * of this code may be in the same PAM stack and must not see each other's
+ * data.
+ */
+#if defined(MODULE_NAME)
+# define CACHE_DATA    MODULE_NAME "-rra-c-util-krb5-context"
+#elif defined(PACKAGE)
+# define CACHE_DATA    PACKAGE "-rra-c-util-krb5-context"
+#else
+# define CACHE_DATA    "rra-c-util-krb5-context"
+#endif
+#ifndef PATH_KRB5_CONFIG
+# define PATH_KRB5_CONFIG "/etc/krb5.conf"
+#endif
+#define CACHE_FILES    8
+#define CACHE_PATH_MAX 1024
+
+/*
+ * Memory from putil_args_alloc comes from a list of chunks, most of which are
+ * ARENA_SIZE bytes including the header.  Allocations larger than a chunk get
+ * a chunk of their own.  Every allocation is rounded up to a multiple of
+ * ARENA_ALIGN so that the next one is aligned.
+ */
+#define ARENA_SIZE     4096
+#define ARENA_ALIGN    (2 * sizeof(void *))
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define ARENA_HEADER   ARENA_ROUND(sizeof(struct putil_arena))
+
+struct putil_arena {
+    struct putil_arena *next;
+    size_t size;                /* Bytes available after the header. */
+    size_t used;                /* Bytes already allocated. */
+};
+
+#ifdef HAVE_KRB5
+
+/*
+ * A cached Kerberos context along with a stamp of the configuration it was
+ * created from.  The stamp is a hash of the path, inode, size, and
+ * modification time of each configuration file and whether the context is a
+ * secure context.
+ */
+struct context_cache {
+    krb5_context ctx;
+    unsigned long stamp;
+};
+
+/*
+ * The context kept across PAM sessions.  A context is only ever owned by one
+ * PAM handle or by this cache, never shared, so that concurrent sessions in
+ * a threaded application never use the same context.
+ *
+ * This only lasts as long as the module stays loaded.  libpam normally loads
+ * modules when a PAM handle is created and unloads them when it is closed,
+ * so the context only survives into the next session if the module is kept
+ * loaded in the meantime (by another open PAM handle, for instance).  The
+ * cached context is freed when the module is unloaded.
+ */
+static struct context_cache *process_cache = NULL;
+
+#ifdef HAVE_ATOMIC_BUILTINS
+# define CACHE_TAKE()                                                   \
+    __atomic_exchange_n(&process_cache, NULL, __ATOMIC_ACQ_REL)
+# define CACHE_PUT(c, old)                                              \
+    __atomic_compare_exchange_n(&process_cache, (old), (c), false,      \
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#else
+# define CACHE_TAKE()      cache_take()
+# define CACHE_PUT(c, old) cache_put(c, old)
+
+
+/*
+ * Take the cached context, leaving the cache empty, for platforms without
+ * atomic builtins.  Not thread-safe.
+ */
+static struct context_cache *
+cache_take(void)
+{
+    struct context_cache *cache = process_cache;
+
+    process_cache = NULL;
+    return cache;
+}
+
+
+/*
+ * Store a context in the cache if it is empty, for platforms without atomic
+ * builtins, and otherwise return false and set old to the cached context
+ * (matching the compare-and-exchange semantics).  Not thread-safe.
+ */
+static bool
+cache_put(struct context_cache *cache, struct context_cache **old)
+{
+    if (process_cache != *old) {
+        *old = process_cache;
+        return false;
+    }
+    process_cache = cache;
+    return true;
+}
+#endif
+
+
+/*
+ * Mix a block of memory into a running FNV-1a hash.
+ */
+static unsigned long
+stamp_add(unsigned long hash, const void *data, size_t length)
+{
+    const unsigned char *p = data;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+
+/*
+ * Compute the stamp for the current Kerberos configuration.  This uses the
+ * files in KRB5_CONFIG unless we're setuid, in which case the library
+ * ignores the environment, and otherwise PATH_KRB5_CONFIG.  Files included
+ * from those files aren't checked.  If modified isn't NULL, it is set to the
+ * newest modification time of those files.
+ */
+static unsigned long
+config_stamp(bool secure, time_t *modified)
+{
+    const char *config = NULL;
+    const char *start, *end;
+    char path[CACHE_PATH_MAX];
+    struct stat st;
+    unsigned long hash = 2166136261UL;
+    size_t count, length;
+
+    if (modified != NULL)
+        *modified = 0;
+    hash = stamp_add(hash, &secure, sizeof(secure));
+    if (!secure)
+        config = getenv("KRB5_CONFIG");
+    if (config == NULL)
+        config = PATH_KRB5_CONFIG;
+    start = config;
+    for (count = 0; count < CACHE_FILES; count++) {
+        end = strchr(start, ':');
+        length = (end == NULL) ? strlen(start) : (size_t) (end - start);
+        hash = stamp_add(hash, start, length);
+        hash = stamp_add(hash, "", 1);
+        if (length > 0 && length < sizeof(path)) {
+            memcpy(path, start, length);
+            path[length] = '\0';
+            if (stat(path, &st) == 0) {
+                hash = stamp_add(hash, &st.st_ino, sizeof(st.st_ino));
+                hash = stamp_add(hash, &st.st_size, sizeof(st.st_size));
+                hash = stamp_add(hash, &st.st_mtime, sizeof(st.st_mtime));
+                if (modified != NULL && st.st_mtime > *modified)
+                    *modified = st.st_mtime;
+            }
+        }
+        if (end == NULL)
+            break;
+        start = end + 1;
+    }
+    return hash;
+}
+
+
+/*
+ * Free a cached context.
+ */
+static void
+cache_free(struct context_cache *cache)
+{
+    if (cache == NULL)
+        return;
+    krb5_free_context(cache->ctx);
+    free(cache);
+}
+
+
+/*
+ * Free the cached context when the module is unloaded.  Where destructors
+ * aren't supported, the context is leaked instead.
+ */
+static void __attribute__((__destructor__, __unused__))
+cache_unload(void)
+{
+    cache_free(CACHE_TAKE());
+}
+
+
+/*
+ * The cleanup function for the PAM data item, called from pam_end.  Return
+ * the context to the process cache if the cache is empty and the
+ * configuration hasn't changed, and otherwise free it.
+ *
+ * Before it's cached, reset the settings that PAM modules commonly change for
+ * the current session, the default realm and the default credential cache,
+ * so that they're taken from the configuration and environment again for the
+ * next session.
+ */
+static void
+cache_cleanup(pam_handle_t *pamh UNUSED, void *data, int status UNUSED)
+{
+    struct context_cache *cache = data;
+    struct context_cache *old = NULL;
+
+    if (cache->stamp != config_stamp(issetugid(), NULL)) {
+        cache_free(cache);
+        return;
+    }
+    if (krb5_set_default_realm(cache->ctx, NULL) != 0
+        || krb5_cc_set_default_name(cache->ctx, NULL) != 0
+        || !CACHE_PUT(cache, &old))
+        cache_free(cache);
+}
+
+
+/*
+ * Find or create the cached Kerberos context for a PAM handle.  Use the one
+ * already attached to the handle if any, since other pam_args structs for the
+ * same handle may still be using it, then the one in the process cache if the
+ * configuration hasn't changed since it was created, and finally create a new
+ * one.  Returns a Kerberos status code.
+ */
+static krb5_error_code
+cache_context(struct pam_args *args)
+{
+    struct context_cache *cache;
+    PAM_CONST void *data = NULL;
+    bool secure = issetugid();
+    unsigned long stamp;
+    krb5_error_code status;
+
+    if (pam_get_data(args->pamh, CACHE_DATA, &data) == PAM_SUCCESS
+        && data != NULL) {
+        cache = (struct context_cache *) data;
+        args->ctx = cache->ctx;
+        return 0;
+    }
+    stamp = config_stamp(secure, NULL);
+    cache = CACHE_TAKE();
+    if (cache != NULL && cache->stamp != stamp) {
+        cache_free(cache);
+        cache = NULL;
+    }
+    if (cache == NULL) {
+        cache = calloc(1, sizeof(struct context_cache));
+        if (cache == NULL)
+            return ENOMEM;
+        if (secure)
+            status = krb5_init_secure_context(&cache->ctx);
+        else
+            status = krb5_init_context(&cache->ctx);
+        if (status != 0) {
+            free(cache);
+            return status;
+        }
+        cache->stamp = stamp;
+    }
+    if (pam_set_data(args->pamh, CACHE_DATA, cache, cache_cleanup)
+        != PAM_SUCCESS) {
+        cache_free(cache);
+        return ENOMEM;
+    }
+    args->ctx = cache->ctx;
+    return 0;
+}
+
+
+/*
+ * Return the stamp for the current Kerberos configuration, used by other
+ * parts of pam-util to validate their own caches.
+ */
+unsigned long
+putil_args_krb5_stamp(time_t *modified)
+{
+    return config_stamp(issetugid(), modified);
+}
+
+#endif /* HAVE_KRB5 */
+
 
 /*
  * Allocate a new pam_args struct and return it, or NULL on memory allocation
  * or Kerberos initialization failure.  If HAVE_KRB5 is defined, we also
- * allocate a Kerberos context.
+ * allocate a Kerberos context, or take one from the cache if cached is true.
  */
-struct pam_args *
-putil_args_new(pam_handle_t *pamh, int flags)
+static struct pam_args *
+args_new(pam_handle_t *pamh, int flags, bool cached UNUSED)
 {
     struct pam_args *args;
 #ifdef HAVE_KRB5
@@ -72,7 +365,10 @@ putil_args_new(pam_handle_t *pamh, int flags)
     args->silent = ((flags & PAM_SILENT) == PAM_SILENT);
 
 #ifdef HAVE_KRB5
-    if (issetugid())
+    args->ctx_cached = cached;
+    if (cached)
+        status = cache_context(args);
+    else if (issetugid())
         status = krb5_init_secure_context(&args->ctx);
     else
         status = krb5_init_context(&args->ctx);
@@ -87,16 +383,103 @@ putil_args_new(pam_handle_t *pamh, int flags)
 
 
 /*
- * Free a pam_args struct.  The config member must be freed separately.
+ * Allocate a new pam_args struct with its own Kerberos context.
+ */
+struct pam_args *
+putil_args_new(pam_handle_t *pamh, int flags)
+{
+    return args_new(pamh, flags, false);
+}
+
+
+/*
+ * Allocate a new pam_args struct using a cached Kerberos context.
+ */
+struct pam_args *
+putil_args_new_cached(pam_handle_t *pamh, int flags)
+{
+    return args_new(pamh, flags, true);
+}
+
+
+/*
+ * Allocate memory from the chunks owned by a pam_args struct, adding a new
+ * chunk if the first one doesn't have enough room.  A chunk for a single
+ * large allocation is added after the first chunk so that the rest of the
+ * first chunk can still be used.
+ */
+void *
+putil_args_alloc(struct pam_args *args, size_t size)
+{
+    struct putil_arena *chunk = args->arena;
+    size_t length;
+
+    if (size > SIZE_MAX - ARENA_HEADER - ARENA_ALIGN) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size = ARENA_ROUND(size > 0 ? size : 1);
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        length = ARENA_SIZE - ARENA_HEADER;
+        if (size > length)
+            length = size;
+        chunk = malloc(ARENA_HEADER + length);
+        if (chunk == NULL)
+            return NULL;
+        chunk->size = length;
+        chunk->used = 0;
+        if (args->arena != NULL && length > ARENA_SIZE - ARENA_HEADER) {
+            chunk->next = args->arena->next;
+            args->arena->next = chunk;
+        } else {
+            chunk->next = args->arena;
+            args->arena = chunk;
+        }
+    }
+    chunk->used += size;
+    return (char *) chunk + ARENA_HEADER + chunk->used - size;
+}
+
+
+/*
+ * Return whether a pointer points into memory allocated with
+ * putil_args_alloc for this pam_args struct.
+ */
+bool
+putil_args_owns(const struct pam_args *args, const void *pointer)
+{
+    const struct putil_arena *chunk;
+    const char *start;
+
+    for (chunk = args->arena; chunk != NULL; chunk = chunk->next) {
+        start = (const char *) chunk + ARENA_HEADER;
+        if ((const char *) pointer >= start
+            && (const char *) pointer < start + chunk->used)
+            return true;
+    }
+    return false;
+}
+
+
+/*
+ * Free a pam_args struct.  The config member must be freed separately, but
+ * anything in it allocated with putil_args_alloc is freed here.  A cached
+ * Kerberos context belongs to the PAM handle and isn't freed here.
  */
 void
 putil_args_free(struct pam_args *args)
 {
+    struct putil_arena *chunk, *next;
+
     if (args == NULL)
         return;
+    for (chunk = args->arena; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
 #ifdef HAVE_KRB5
     free(args->realm);
-    if (args->ctx != NULL)
+    if (args->ctx != NULL && !args->ctx_cached)
         krb5_free_context(args->ctx);
 #endif
     free(args);
@@ -45,18 +45,27 @@
 #include <portable/pam.h>
 #include <portable/stdbool.h>
 
+#include <time.h>
+
 /* Opaque struct from the PAM utility perspective. */
 struct pam_config;
 
+/* Opaque struct for memory freed with the pam_args struct. */
+struct putil_arena;
+
 struct pam_args {
     pam_handle_t *pamh;         /* Pointer back to the PAM handle. */
     struct pam_config *config;  /* Per-module PAM configuration. */
+    const void *defaults;       /* Shared defaults for config, if any. */
+    bool config_alloc;          /* Allocate config with putil_args_alloc. */
     bool debug;                 /* Log debugging information. */
     bool silent;                /* Do not pass text to the application. */
     const char *user;           /* User being authenticated. */
+    struct putil_arena *arena;  /* Memory freed with this struct. */
 
 #ifdef HAVE_KRB5
     krb5_context ctx;           /* Context for Kerberos operations. */
+    bool ctx_cached;            /* ctx belongs to the PAM handle. */
     char *realm;                /* Kerberos realm for configuration. */
 #endif
 };
@@ -69,11 +78,61 @@ BEGIN_DECLS
 /*
  * Allocate and free the pam_args struct.  We assume that user is a pointer to
  * a string maintained elsewhere and don't free it here.  config must be freed
- * separately by the caller.
+ * separately by the caller, but any part of it allocated with
+ * putil_args_alloc() is freed with the struct.
  */
 struct pam_args *putil_args_new(pam_handle_t *, int flags);
 void putil_args_free(struct pam_args *);
 
+/*
+ * The same as putil_args_new, except that the Kerberos context is cached
+ * rather than created for each call.  The context is attached to the PAM
+ * handle with pam_set_data, under a name that includes MODULE_NAME, and
+ * reused by every later call for the same handle.  When the handle is
+ * closed, the default realm and default credential cache name of the context
+ * are reset and it's kept for the next PAM session in the same process as
+ * long as the Kerberos configuration files don't change.  A context is never
+ * shared between two open PAM handles.  Modules that use this must not change
+ * any other state of the context, since the changes would persist.
+ *
+ * The context is only kept between sessions while the module stays loaded.
+ * libpam usually unloads modules when each PAM handle is closed, in which
+ * case the context (and the other data that pam-util caches for the life of
+ * the process) is freed when the module is unloaded, where the compiler
+ * supports destructors, and the next session creates a new one.  Without
+ * Kerberos support, this is the same as putil_args_new.
+ */
+struct pam_args *putil_args_new_cached(pam_handle_t *, int flags);
+
+/*
+ * Allocate memory that lasts until the pam_args struct is freed.  The memory
+ * is carved out of larger chunks owned by the struct, so many small
+ * allocations cost only a few calls to malloc and are all released together
+ * by putil_args_free(); it can't be freed or resized individually.  The
+ * memory is suitably aligned for any of the types used in a configuration.
+ * Returns NULL on memory allocation failure, without reporting an error.
+ *
+ * putil_args_owns() returns whether a pointer points into memory allocated
+ * this way.
+ */
+void *putil_args_alloc(struct pam_args *, size_t size)
+    __attribute__((__malloc__, __nonnull__));
+bool putil_args_owns(const struct pam_args *, const void *)
+    __attribute__((__nonnull__(1)));
+
+#ifdef HAVE_KRB5
+/*
+ * Return a stamp for the current Kerberos configuration, computed from the
+ * paths, inode numbers, sizes, and modification times of the krb5.conf files
+ * that a new context would read.  The stamp changes when any of those files
+ * are modified or replaced, so it can be used to tell whether data cached
+ * from an earlier context is still current.  Files included by those files
+ * aren't checked.  If the argument isn't NULL, it is set to the newest
+ * modification time of those files.
+ */
+unsigned long putil_args_krb5_stamp(time_t *modified);
+#endif
+
 /* Undo default visibility change. */
 #pragma GCC visibility pop
 
@@ -43,6 +43,14 @@
 #include <pam-util/args.h>
 #include <pam-util/logging.h>
 
+/* The functions below are wrapped by macros in pam-util/logging.h. */
+#undef putil_notice
+#undef putil_notice_pam
+#undef putil_notice_krb5
+#undef putil_debug
+#undef putil_debug_pam
+#undef putil_debug_krb5
+
 #ifndef LOG_AUTHPRIV
 # define LOG_AUTHPRIV LOG_AUTH
 #endif
@@ -50,6 +58,9 @@
 /* Used for iterating through arrays. */
 #define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
 
+/* The size of the buffer on the stack used to format most messages. */
+#define LOG_BUFFER_SIZE 1024
+
 /*
  * Mappings of PAM flags to symbolic names for logging when entering a PAM
  * module function.
@@ -88,46 +99,107 @@ format(const char *fmt, va_list args)
 
 
 /*
- * Log wrapper function that adds the user.  Log a message with the given
+ * Format a log message into a single buffer and log it with the given
  * priority, prefixed by (user <user>) with the account name being
- * authenticated if known.
+ * authenticated if known and followed by a colon and error if error is not
+ * NULL.  The prefix, message, and error are assembled in one pass in a buffer
+ * on the stack, and memory is only allocated for messages that don't fit.
+ * If that allocation fails, the message is truncated rather than lost.
  */
 static void
-log_vplain(struct pam_args *pargs, int priority, const char *fmt, va_list args)
+log_message(struct pam_args *pargs, int priority, const char *error,
+            const char *fmt, va_list args)
 {
-    char *msg;
+    char stack[LOG_BUFFER_SIZE];
+    char *buffer = stack;
+    const char *user = NULL;
+    size_t prefix = 0, suffix = 0, length, user_length = 0, error_length = 0;
+    va_list args_copy;
+    int status;
+
+    /* With nothing to add, let pam_vsyslog do the formatting. */
+    if (pargs != NULL)
+        user = pargs->user;
+    if (pargs != NULL && user == NULL && error == NULL) {
+        pam_vsyslog(pargs->pamh, priority, fmt, args);
+        return;
+    }
+    if (user != NULL) {
+        user_length = strlen(user);
+        prefix = strlen("(user ") + user_length + strlen(") ");
+    }
+    if (error != NULL) {
+        error_length = strlen(error);
+        suffix = strlen(": ") + error_length;
+    }
 
-    if (priority == LOG_DEBUG && (pargs == NULL || !pargs->debug))
+    /*
+     * Format the message after the space for the prefix, leaving room for
+     * the suffix.  If the prefix and suffix alone don't fit, just find the
+     * length of the message.
+     */
+    va_copy(args_copy, args);
+    if (prefix + suffix < sizeof(stack))
+        status = vsnprintf(stack + prefix, sizeof(stack) - prefix - suffix,
+                           fmt, args_copy);
+    else
+        status = vsnprintf(NULL, 0, fmt, args_copy);
+    va_end(args_copy);
+    if (status < 0) {
+        syslog(LOG_CRIT | LOG_AUTHPRIV, "vsnprintf failed: %m");
         return;
-    if (pargs != NULL && pargs->user != NULL) {
-        msg = format(fmt, args);
-        if (msg == NULL)
-            return;
-        pam_syslog(pargs->pamh, priority, "(user %s) %s", pargs->user, msg);
-        free(msg);
-    } else if (pargs != NULL) {
-        pam_vsyslog(pargs->pamh, priority, fmt, args);
-    } else {
-        msg = format(fmt, args);
-        if (msg == NULL)
+    }
+    length = (size_t) status;
+
+    /* If it didn't fit, allocate a buffer of the right size and try again. */
+    if (prefix + length + suffix >= sizeof(stack)) {
+        buffer = malloc(prefix + length + suffix + 1);
+        if (buffer != NULL) {
+            va_copy(args_copy, args);
+            vsnprintf(buffer + prefix, length + 1, fmt, args_copy);
+            va_end(args_copy);
+        } else if (prefix + suffix < sizeof(stack)) {
+            buffer = stack;
+            length = sizeof(stack) - prefix - suffix - 1;
+        } else {
+            syslog(LOG_CRIT | LOG_AUTHPRIV, "malloc failed: %m");
             return;
-        syslog(priority | LOG_AUTHPRIV, "%s", msg);
-        free(msg);
+        }
     }
+
+    /* Fill in the prefix and suffix around the message. */
+    if (user != NULL) {
+        memcpy(buffer, "(user ", strlen("(user "));
+        memcpy(buffer + strlen("(user "), user, user_length);
+        memcpy(buffer + prefix - strlen(") "), ") ", strlen(") "));
+    }
+    if (error != NULL) {
+        memcpy(buffer + prefix + length, ": ", strlen(": "));
+        memcpy(buffer + prefix + length + strlen(": "), error, error_length);
+    }
+    buffer[prefix + length + suffix] = '\0';
+
+    /* Log the result. */
+    if (pargs != NULL)
+        pam_syslog(pargs->pamh, priority, "%s", buffer);
+    else
+        syslog(priority | LOG_AUTHPRIV, "%s", buffer);
+    if (buffer != stack)
+        free(buffer);
 }
 
 
 /*
- * Wrapper around log_vplain with variadic arguments.
+ * Log wrapper function that adds the user.  Log a message with the given
+ * priority, prefixed by (user <user>) with the account name being
+ * authenticated if known.
  */
 static void
-log_plain(struct pam_args *pargs, int priority, const char *fmt, ...)
+log_vplain(struct pam_args *pargs, int priority, const char *fmt, va_list args)
 {
-    va_list args;
-
-    va_start(args, fmt);
-    log_vplain(pargs, priority, fmt, args);
-    va_end(args);
+    if (priority == LOG_DEBUG && (pargs == NULL || !pargs->debug))
+        return;
+    log_message(pargs, priority, NULL, fmt, args);
 }
 
 
@@ -142,21 +214,13 @@ static void
 log_pam(struct pam_args *pargs, int priority, int status, const char *fmt,
         va_list args)
 {
-    char *msg;
+    const char *error = NULL;
 
     if (priority == LOG_DEBUG && (pargs == NULL || !pargs->debug))
         return;
-    msg = format(fmt, args);
-    if (msg == NULL)
-        return;
-    if (pargs == NULL)
-        log_plain(NULL, priority, "%s", msg);
-    else if (status == PAM_SUCCESS)
-        log_plain(pargs, priority, "%s", msg);
-    else
-        log_plain(pargs, priority, "%s: %s", msg,
-                  pam_strerror(pargs->pamh, status));
-    free(msg);
+    if (pargs != NULL && status != PAM_SUCCESS)
+        error = pam_strerror(pargs->pamh, status);
+    log_message(pargs, priority, error, fmt, args);
 }
 
 
@@ -289,21 +353,13 @@ static void
 log_krb5(struct pam_args *pargs, int priority, int status, const char *fmt,
          va_list args)
 {
-    char *msg;
     const char *k5_msg = NULL;
 
     if (priority == LOG_DEBUG && (pargs == NULL || !pargs->debug))
         return;
-    msg = format(fmt, args);
-    if (msg == NULL)
-        return;
-    if (pargs != NULL && pargs->ctx != NULL) {
+    if (pargs != NULL && pargs->ctx != NULL)
         k5_msg = krb5_get_error_message(pargs->ctx, status);
-        log_plain(pargs, priority, "%s: %s", msg, k5_msg);
-    } else {
-        log_plain(pargs, priority, "%s", msg);
-    }
-    free(msg);
+    log_message(pargs, priority, k5_msg, fmt, args);
     if (k5_msg != NULL)
         krb5_free_error_message(pargs->ctx, k5_msg);
 }
@@ -40,8 +40,8 @@
 #include <stddef.h>
 #include <syslog.h>
 
-/* Forward declarations to avoid extra includes. */
-struct pam_args;
+/* The logging macros below look inside struct pam_args. */
+#include <pam-util/args.h>
 
 BEGIN_DECLS
 
@@ -119,4 +119,44 @@ END_DECLS
                    ((pamret) == PAM_SUCCESS) ? "success"                \
                    : (((pamret) == PAM_IGNORE) ? "ignore" : "failure"))
 
+/*
+ * Where variadic macros are available, the debug and notice functions are
+ * wrapped in macros that skip the call, and the evaluation of the message
+ * arguments, when the message would be discarded.  The macros are void
+ * expressions like the function calls they replace.  The debug macros check
+ * args->debug first, so the pam_args argument may be evaluated more than
+ * once.  Define PUTIL_LOG_MAX to a syslog priority (such as LOG_NOTICE)
+ * before including this header to remove messages of lower priority
+ * entirely at compile time.  Define PUTIL_NO_LOG_MACROS to always call the
+ * functions.
+ */
+#ifndef PUTIL_LOG_MAX
+# define PUTIL_LOG_MAX LOG_DEBUG
+#endif
+#if !defined(PUTIL_NO_LOG_MACROS) \
+    && (__STDC_VERSION__ >= 199901L || defined(__GNUC__))
+# define PUTIL_LOG_DEBUG(function, args, ...)                           \
+    ((PUTIL_LOG_MAX >= LOG_DEBUG && (args) != NULL && (args)->debug)    \
+         ? (function)((args), __VA_ARGS__)                              \
+         : (void) 0)
+# define PUTIL_LOG_NOTICE(function, args, ...)                          \
+    ((PUTIL_LOG_MAX >= LOG_NOTICE)                                      \
+         ? (function)((args), __VA_ARGS__)                              \
+         : (void) 0)
+# define putil_notice(args, ...)                                        \
+    PUTIL_LOG_NOTICE(putil_notice, args, __VA_ARGS__)
+# define putil_notice_pam(args, ...)                                    \
+    PUTIL_LOG_NOTICE(putil_notice_pam, args, __VA_ARGS__)
+# define putil_debug(args, ...)                                         \
+    PUTIL_LOG_DEBUG(putil_debug, args, __VA_ARGS__)
+# define putil_debug_pam(args, ...)                                     \
+    PUTIL_LOG_DEBUG(putil_debug_pam, args, __VA_ARGS__)
+# ifdef HAVE_KRB5
+#  define putil_notice_krb5(args, ...)                                  \
+    PUTIL_LOG_NOTICE(putil_notice_krb5, args, __VA_ARGS__)
+#  define putil_debug_krb5(args, ...)                                   \
+    PUTIL_LOG_DEBUG(putil_debug_krb5, args, __VA_ARGS__)
+# endif
+#endif
+
 #endif /* !PAM_UTIL_LOGGING_H */
@@ -0,0 +1,188 @@
+/*
+ * Generate specialized option parsing code for a PAM module.
+ *
+ * putil_args_defaults() and putil_args_parse() walk an option table at
+ * runtime, switching on the type of each option and storing through an
+ * offset into the configuration struct.  This header instead generates, from
+ * a list of options, functions that set each member of the configuration
+ * struct directly: the defaults are a series of assignments, and each PAM
+ * argument is matched against the option names with a comparison of its
+ * length to a constant followed by a fixed-length memcmp.
+ *
+ * To use it, define struct pam_config and then a PAM_OPTIONS macro listing
+ * the options, in sorted order, each as a call to the macro argument with the
+ * name of the option (which must also be the name of the member of struct
+ * pam_config), whether it can be set in krb5.conf, its type (one of the type
+ * macros from pam-util/options.h), and its default value:
+ *
+ *     #define PAM_OPTIONS(O)                          \
+ *         O(aklog_homedir, true,  BOOL,   false)      \
+ *         O(cells,         true,  LIST,   NULL)       \
+ *         O(debug,         false, BOOL,   false)      \
+ *         O(minimum_uid,   true,  NUMBER, 0)          \
+ *         O(program,       true,  STRING, NULL)
+ *
+ *     #include <pam-util/options-gen.h>
+ *
+ * This defines the following static functions:
+ *
+ *     putil_config_defaults(args)
+ *         The same as putil_args_defaults() with the generated table.
+ *     putil_config_krb5(args, section)
+ *         The same as putil_args_krb5() with the generated table.
+ *     putil_config_parse(args, argc, argv)
+ *         The same as putil_args_parse() with the generated table.
+ *     putil_config_free(args)
+ *         The same as putil_args_config_free() with the generated table.
+ *
+ * along with the option table itself, putil_config_options, and its length,
+ * putil_config_optlen, for use with the other pam-util functions.  Since the
+ * generated code stores into the members of struct pam_config with their
+ * declared types, a member whose type doesn't match the option type is
+ * diagnosed by the compiler.
+ *
+ * This header should be included in only one file in a module.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#ifndef PAM_UTIL_OPTIONS_GEN_H
+#define PAM_UTIL_OPTIONS_GEN_H 1
+
+#include <config.h>
+#include <portable/stdbool.h>
+
+#include <stddef.h>
+#include <string.h>
+
+#include <pam-util/args.h>
+#include <pam-util/logging.h>
+#include <pam-util/options.h>
+
+#ifndef PAM_OPTIONS
+# error "PAM_OPTIONS must be defined before including pam-util/options-gen.h"
+#endif
+
+/*
+ * The code for setting the default of each type of option.  Each evaluates
+ * to false on memory allocation failure.
+ */
+#define PUTIL_GEN_DEFAULT_BOOL(a, p, d)   (*(p) = (d), true)
+#define PUTIL_GEN_DEFAULT_NUMBER(a, p, d) (*(p) = (d), true)
+#define PUTIL_GEN_DEFAULT_TIME(a, p, d)   (*(p) = (d), true)
+#define PUTIL_GEN_DEFAULT_STRING          putil_option_default_string
+#define PUTIL_GEN_DEFAULT_LIST            putil_option_default_list
+#define PUTIL_GEN_DEFAULT_STRLIST         putil_option_default_strlist
+
+/* The function for parsing each type of option from a PAM argument. */
+#define PUTIL_GEN_PARSE_BOOL    putil_option_boolean
+#define PUTIL_GEN_PARSE_NUMBER  putil_option_number
+#define PUTIL_GEN_PARSE_TIME    putil_option_time
+#define PUTIL_GEN_PARSE_STRING  putil_option_string
+#define PUTIL_GEN_PARSE_LIST    putil_option_list
+#define PUTIL_GEN_PARSE_STRLIST putil_option_list
+
+/* Expansions of PAM_OPTIONS for the table, defaults, and parsing. */
+#define PUTIL_GEN_TABLE(name, krb5, type, def) \
+    { #name, offsetof(struct pam_config, name), krb5, type(def) },
+#define PUTIL_GEN_DEFAULT(name, krb5, type, def)                        \
+    if (!PUTIL_GEN_DEFAULT_##type(args, &args->config->name, def))      \
+        return false;
+#define PUTIL_GEN_PARSE(name, krb5, type, def)                          \
+    if (length == sizeof(#name) - 1 && memcmp(arg, #name, length) == 0) { \
+        if (!PUTIL_GEN_PARSE_##type(args, arg, &args->config->name))    \
+            return false;                                               \
+        continue;                                                       \
+    }
+
+/* The option table, for putil_args_krb5() and putil_args_config_free(). */
+static const struct option putil_config_options[] = {
+    PAM_OPTIONS(PUTIL_GEN_TABLE)
+};
+static const size_t putil_config_optlen =
+    sizeof(putil_config_options) / sizeof(putil_config_options[0]);
+
+/* A module may not use all of the generated functions. */
+static bool putil_config_defaults(struct pam_args *)
+    __attribute__((__nonnull__, __unused__));
+static bool putil_config_krb5(struct pam_args *, const char *section)
+    __attribute__((__nonnull__, __unused__));
+static bool putil_config_parse(struct pam_args *, int argc,
+                               const char *argv[])
+    __attribute__((__nonnull__, __unused__));
+static void putil_config_free(struct pam_args *)
+    __attribute__((__nonnull__, __unused__));
+
+
+/*
+ * Set the defaults for the PAM configuration.  The config member of the args
+ * struct must already be allocated.  Returns true on success and false on
+ * memory allocation failure, which is also reported with putil_crit().
+ */
+static bool
+putil_config_defaults(struct pam_args *args)
+{
+    args->defaults = NULL;
+    args->config_alloc = false;
+    PAM_OPTIONS(PUTIL_GEN_DEFAULT)
+    return true;
+}
+
+
+/*
+ * Fill out options from krb5.conf.  Returns true on success and false on an
+ * error, which should be considered fatal.
+ */
+static bool
+putil_config_krb5(struct pam_args *args, const char *section)
+{
+    return putil_args_krb5(args, section, putil_config_options,
+                           putil_config_optlen);
+}
+
+
+/*
+ * Parse the PAM arguments into the configuration.  Returns true on success
+ * and false on memory allocation failure, which is also reported with
+ * putil_crit().  Unknown options and invalid values are reported with
+ * putil_err() but are not fatal.
+ */
+static bool
+putil_config_parse(struct pam_args *args, int argc, const char *argv[])
+{
+    int i;
+    const char *arg;
+    size_t length;
+
+    for (i = 0; i < argc; i++) {
+        arg = argv[i];
+        length = strcspn(arg, "=");
+        PAM_OPTIONS(PUTIL_GEN_PARSE)
+        putil_err(args, "unknown option %s", arg);
+    }
+    return true;
+}
+
+
+/*
+ * Free the string and list options in the configuration and set them to
+ * NULL.  The config struct itself must still be freed by the caller.
+ */
+static void
+putil_config_free(struct pam_args *args)
+{
+    putil_args_config_free(args, putil_config_options, putil_config_optlen);
+}
+
+#endif /* !PAM_UTIL_OPTIONS_GEN_H */
@@ -34,10 +34,17 @@
 #include <config.h>
 #ifdef HAVE_KRB5
 # include <portable/krb5.h>
+# ifdef HAVE_K5PROFILE_H
+#  include <k5profile.h>
+# endif
+# ifdef HAVE_PROFILE_H
+#  include <profile.h>
+# endif
 #endif
 #include <portable/system.h>
 
 #include <errno.h>
+#include <time.h>
 
 #include <pam-util/args.h>
 #include <pam-util/logging.h>
@@ -67,6 +74,167 @@
 # define CONF_TIME(c, o) (long *)       (void *)((char *) (c) + (o))
 #endif
 
+/* The characters that separate the elements of a list option. */
+#define LIST_SEPS " \t,"
+
+/*
+ * Whether krb5.conf settings can be read with the profile library, which
+ * allows reading a whole section of [appdefaults] at once.  Otherwise, each
+ * option has to be looked up separately with krb5_appdefault_*.
+ */
+#if defined(HAVE_KRB5) && defined(HAVE_KRB5_GET_PROFILE) \
+    && defined(HAVE_PROFILE_ITERATOR_CREATE)             \
+    && (defined(HAVE_PROFILE_H) || defined(HAVE_K5PROFILE_H))
+# define APPDEFAULTS_WALK 1
+#endif
+
+#ifdef HAVE_KRB5
+/*
+ * The settings read from [appdefaults] for one section and realm, in order of
+ * precedence with only the first setting for each name kept, and the
+ * configuration stamp from when they were read.  MIT Kerberos checks the
+ * configuration files for changes at most once a second, so settings read in
+ * the same second as the last change to the configuration may be stale and
+ * aren't cached.
+ */
+struct appdefault {
+    char *name;
+    char *value;
+};
+struct appdefaults {
+    char *section;
+    char *realm;
+    unsigned long stamp;
+    bool cacheable;
+    size_t count;
+    size_t allocated;
+    struct appdefault *settings;
+};
+#endif
+
+/*
+ * Data built from an option table the first time it is used and kept for
+ * the life of the process: the defaults shared by every configuration set up
+ * with putil_args_defaults_shared, and the index used to look up options by
+ * name.  Each is kept in a list keyed by the address of the table that is
+ * only ever added to, so the lists can be read without locking.
+ */
+struct shared_defaults {
+    const struct option *options;
+    size_t optlen;
+    void *config;
+    struct shared_defaults *next;
+};
+static struct shared_defaults *shared_list = NULL;
+
+/*
+ * The index is a minimal perfect hash of the option names.  Each name is
+ * hashed once, and the hash picks a bucket.  The displacement for that bucket
+ * is either a negative number giving the slot directly (for buckets with one
+ * name) or a positive seed that is mixed with the hash to find the slot.  Each
+ * slot holds the position of an option in the table, so any name can be
+ * found with one probe and one string comparison.  If the index couldn't be
+ * built for a table, its entry in the list has no displacements or slots, so
+ * that the failure is only reported once.
+ */
+struct option_index {
+    const struct option *options;
+    size_t optlen;
+    long *displace;
+    size_t *slots;
+    struct option_index *next;
+};
+static struct option_index *index_list = NULL;
+
+/* The largest seed to try for a bucket before giving up on the index. */
+#define INDEX_MAX_SEED 100000
+
+#ifdef HAVE_ATOMIC_BUILTINS
+# define LIST_LOAD(list) __atomic_load_n(&(list), __ATOMIC_ACQUIRE)
+# define LIST_PUSH(list, d, head)                                       \
+    __atomic_compare_exchange_n(&(list), (head), (d), false,            \
+                                __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)
+#else
+# define LIST_LOAD(list) (list)
+# define LIST_PUSH(list, d, head)                                       \
+    ((list) == *(head) ? ((list) = (d), true) : (*(head) = (list), false))
+#endif
+
+#ifdef APPDEFAULTS_WALK
+/*
+ * The most recently used settings, kept for the next call with the same
+ * section and realm.  As with the Kerberos context cache in args.c, a set of
+ * settings is owned either by one caller or by the cache so that threads
+ * never share one.
+ */
+static struct appdefaults *appdefaults_cache = NULL;
+
+# ifdef HAVE_ATOMIC_BUILTINS
+#  define CACHE_TAKE()                                                  \
+    __atomic_exchange_n(&appdefaults_cache, NULL, __ATOMIC_ACQ_REL)
+#  define CACHE_PUT(d, old)                                             \
+    __atomic_compare_exchange_n(&appdefaults_cache, (old), (d), false,  \
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+# else
+#  define CACHE_TAKE()      cache_take()
+#  define CACHE_PUT(d, old) cache_put((d), (old))
+
+
+/*
+ * Take the cached settings, leaving the cache empty, for platforms without
+ * atomic builtins.  Not thread-safe.
+ */
+static struct appdefaults *
+cache_take(void)
+{
+    struct appdefaults *defaults = appdefaults_cache;
+
+    appdefaults_cache = NULL;
+    return defaults;
+}
+
+
+/*
+ * Store settings in the cache if it is empty, for platforms without atomic
+ * builtins, and otherwise return false and set old to the cached settings.
+ * Not thread-safe.
+ */
+static bool
+cache_put(struct appdefaults *defaults, struct appdefaults **old)
+{
+    if (appdefaults_cache != *old) {
+        *old = appdefaults_cache;
+        return false;
+    }
+    appdefaults_cache = defaults;
+    return true;
+}
+# endif /* !HAVE_ATOMIC_BUILTINS */
+#endif /* APPDEFAULTS_WALK */
+
+
+/*
+ * Set a string argument to its default.  This needs to copy the string so
+ * that we can safely free it when freeing the configuration.  Takes the PAM
+ * argument struct, the pointer in which to store the string, and the default
+ * string.  Returns true if the default was set correctly and false on memory
+ * allocation failure, which is also reported with putil_crit().
+ */
+bool
+putil_option_default_string(struct pam_args *args, char **setting,
+                            const char *defval)
+{
+    *setting = NULL;
+    if (defval != NULL) {
+        *setting = strdup(defval);
+        if (*setting == NULL) {
+            putil_crit(args, "cannot allocate memory: %s", strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
 
 /*
  * Set a vector argument to its default.  This needs to do a deep copy of the
@@ -75,9 +243,9 @@
  * default vector.  Returns true if the default was set correctly and false on
  * memory allocation failure, which is also reported with putil_crit().
  */
-static bool
-copy_default_list(struct pam_args *args, struct vector **setting,
-                  const struct vector *defval)
+bool
+putil_option_default_list(struct pam_args *args, struct vector **setting,
+                          const struct vector *defval)
 {
     struct vector *result = NULL;
 
@@ -96,19 +264,19 @@ copy_default_list(struct pam_args *args, struct vector **setting,
 
 /*
  * Set a vector argument to a default based on a string.  Takes the PAM
- * argument struct,t he pointer into which to store the vector, and the
+ * argument struct, the pointer into which to store the vector, and the
  * default string.  Returns true if the default was set correctly and false on
  * memory allocation failure, which is also reported with putil_crit().
  */
-static bool
-default_list_string(struct pam_args *args, struct vector **setting,
-                    const char *defval)
+bool
+putil_option_default_strlist(struct pam_args *args, struct vector **setting,
+                             const char *defval)
 {
     struct vector *result = NULL;
 
     *setting = NULL;
     if (defval != NULL) {
-        result = vector_split_multi(defval, " \t,", NULL);
+        result = vector_split_multi(defval, LIST_SEPS, NULL);
         if (result == NULL) {
             putil_crit(args, "cannot allocate memory: %s", strerror(errno));
             return false;
@@ -120,18 +288,14 @@ default_list_string(struct pam_args *args, struct vector **setting,
 
 
 /*
- * Set the defaults for the PAM configuration.  Takes the PAM arguments, an
- * option table defined as above, and the number of entries in the table.  The
- * config member of the args struct must already be allocated.  Returns true
- * on success and false on error (generally out of memory).  Errors will
- * already be reported using putil_crit().
- *
- * This function must be called before either putil_args_krb5() or
- * putil_args_parse(), since neither of those functions set defaults.
+ * Set the defaults for the options in an option table in a configuration
+ * struct, which may be either args->config or a shared default
+ * configuration.  Returns true on success and false on memory allocation
+ * failure, which is also reported with putil_crit().
  */
-bool
-putil_args_defaults(struct pam_args *args, const struct option options[],
-                    size_t optlen)
+static bool
+set_defaults(struct pam_args *args, void *config,
+             const struct option options[], size_t optlen)
 {
     size_t opt;
 
@@ -148,38 +312,33 @@ putil_args_defaults(struct pam_args *args, const struct option options[],
 
         switch (options[opt].type) {
         case TYPE_BOOLEAN:
-            bp = CONF_BOOL(args->config, options[opt].location);
+            bp = CONF_BOOL(config, options[opt].location);
             *bp = options[opt].defaults.boolean;
             break;
         case TYPE_NUMBER:
-            lp = CONF_NUMBER(args->config, options[opt].location);
+            lp = CONF_NUMBER(config, options[opt].location);
             *lp = options[opt].defaults.number;
             break;
         case TYPE_TIME:
-            tp = CONF_TIME(args->config, options[opt].location);
+            tp = CONF_TIME(config, options[opt].location);
             *tp = options[opt].defaults.number;
             break;
         case TYPE_STRING:
-            sp = CONF_STRING(args->config, options[opt].location);
-            if (options[opt].defaults.string == NULL)
-                *sp = NULL;
-            else {
-                *sp = strdup(options[opt].defaults.string);
-                if (*sp == NULL) {
-                    putil_crit(args, "cannot allocate memory: %s",
-                               strerror(errno));
-                    return false;
-                }
-            }
+            sp = CONF_STRING(config, options[opt].location);
+            if (!putil_option_default_string(args, sp,
+                                             options[opt].defaults.string))
+                return false;
             break;
         case TYPE_LIST:
-            vp = CONF_LIST(args->config, options[opt].location);
-            if (!copy_default_list(args, vp, options[opt].defaults.list))
+            vp = CONF_LIST(config, options[opt].location);
+            if (!putil_option_default_list(args, vp,
+                                           options[opt].defaults.list))
                 return false;
             break;
         case TYPE_STRLIST:
-            vp = CONF_LIST(args->config, options[opt].location);
-            if (!default_list_string(args, vp, options[opt].defaults.string))
+            vp = CONF_LIST(config, options[opt].location);
+            if (!putil_option_default_strlist(args, vp,
+                                              options[opt].defaults.string))
                 return false;
             break;
         }
@@ -188,7 +347,709 @@ putil_args_defaults(struct pam_args *args, const struct option options[],
 }
 
 
-#ifdef HAVE_KRB5
+/*
+ * Set the defaults for the PAM configuration.  Takes the PAM arguments, an
+ * option table defined as above, and the number of entries in the table.  The
+ * config member of the args struct must already be allocated.  Returns true
+ * on success and false on error (generally out of memory).  Errors will
+ * already be reported using putil_crit().
+ *
+ * This function must be called before either putil_args_krb5() or
+ * putil_args_parse(), since neither of those functions set defaults.
+ */
+bool
+putil_args_defaults(struct pam_args *args, const struct option options[],
+                    size_t optlen)
+{
+    args->defaults = NULL;
+    args->config_alloc = false;
+    return set_defaults(args, args->config, options, optlen);
+}
+
+
+/*
+ * Return the size of the storage for an option of the given type.
+ */
+static size_t
+option_size(enum type type)
+{
+    switch (type) {
+    case TYPE_BOOLEAN: return sizeof(bool);
+    case TYPE_NUMBER:  return sizeof(long);
+#ifdef HAVE_KRB5
+    case TYPE_TIME:    return sizeof(krb5_deltat);
+#else
+    case TYPE_TIME:    return sizeof(long);
+#endif
+    case TYPE_STRING:  return sizeof(char *);
+    case TYPE_LIST:
+    case TYPE_STRLIST: return sizeof(struct vector *);
+    }
+    return 0;
+}
+
+
+/*
+ * Free a set of shared defaults.
+ */
+static void
+shared_free(struct shared_defaults *defaults)
+{
+    size_t opt;
+
+    for (opt = 0; opt < defaults->optlen; opt++) {
+        const struct option *option = &defaults->options[opt];
+
+        switch (option->type) {
+        case TYPE_STRING:
+            free(*CONF_STRING(defaults->config, option->location));
+            break;
+        case TYPE_LIST:
+        case TYPE_STRLIST:
+            vector_free(*CONF_LIST(defaults->config, option->location));
+            break;
+        case TYPE_BOOLEAN:
+        case TYPE_NUMBER:
+        case TYPE_TIME:
+            break;
+        }
+    }
+    free(defaults->config);
+    free(defaults);
+}
+
+
+/*
+ * Find the shared defaults for an option table, building them if this is
+ * the first time the table has been seen.  The shared defaults are stored in
+ * memory laid out like the configuration struct, but only as large as needed
+ * to hold the options in the table.  They are freed only when the module is
+ * unloaded.  Returns NULL on memory allocation failure, which is also
+ * reported with putil_crit().
+ */
+static const struct shared_defaults *
+shared_defaults(struct pam_args *args, const struct option options[],
+                size_t optlen)
+{
+    struct shared_defaults *head, *defaults, *shared;
+    size_t i, end, size = 0;
+
+    for (shared = LIST_LOAD(shared_list); shared != NULL;
+         shared = shared->next)
+        if (shared->options == options && shared->optlen == optlen)
+            return shared;
+
+    /* Not found, so build the shared defaults for this table. */
+    for (i = 0; i < optlen; i++) {
+        end = options[i].location + option_size(options[i].type);
+        if (end > size)
+            size = end;
+    }
+    defaults = calloc(1, sizeof(struct shared_defaults));
+    if (defaults == NULL) {
+        putil_crit(args, "cannot allocate memory: %s", strerror(errno));
+        return NULL;
+    }
+    defaults->options = options;
+    defaults->optlen = optlen;
+    defaults->config = calloc(1, size > 0 ? size : 1);
+    if (defaults->config == NULL) {
+        putil_crit(args, "cannot allocate memory: %s", strerror(errno));
+        free(defaults);
+        return NULL;
+    }
+    if (!set_defaults(args, defaults->config, options, optlen)) {
+        shared_free(defaults);
+        return NULL;
+    }
+
+    /*
+     * Add the new defaults to the list unless another thread added defaults
+     * for the same table in the meantime, in which case use those.
+     */
+    head = LIST_LOAD(shared_list);
+    do {
+        for (shared = head; shared != NULL; shared = shared->next)
+            if (shared->options == options && shared->optlen == optlen) {
+                shared_free(defaults);
+                return shared;
+            }
+        defaults->next = head;
+    } while (!LIST_PUSH(shared_list, defaults, &head));
+    return defaults;
+}
+
+
+/*
+ * The same as putil_args_defaults, except that the default strings and lists
+ * aren't copied.  Instead, they point to a shared copy of the defaults built
+ * the first time the option table is seen.
+ */
+bool
+putil_args_defaults_shared(struct pam_args *args,
+                           const struct option options[], size_t optlen)
+{
+    const struct shared_defaults *shared;
+    size_t opt, size;
+
+    shared = shared_defaults(args, options, optlen);
+    if (shared == NULL)
+        return false;
+    args->defaults = shared->config;
+    args->config_alloc = true;
+    for (opt = 0; opt < optlen; opt++) {
+        size = option_size(options[opt].type);
+        memcpy((char *) args->config + options[opt].location,
+               (const char *) shared->config + options[opt].location, size);
+    }
+    return true;
+}
+
+
+/*
+ * Return whether the string or list option stored at the given location in
+ * args->config is a shared default or was allocated with putil_args_alloc,
+ * and therefore must not be modified or freed.
+ */
+static bool
+is_shared(struct pam_args *args, const void *setting)
+{
+    size_t offset;
+    const void *value, *shared;
+
+    memcpy(&value, setting, sizeof(value));
+    if (value == NULL)
+        return false;
+    if (putil_args_owns(args, value))
+        return true;
+    if (args->defaults == NULL)
+        return false;
+    offset = (size_t) ((const char *) setting - (const char *) args->config);
+    memcpy(&shared, (const char *) args->defaults + offset, sizeof(shared));
+    return value == shared;
+}
+
+
+/*
+ * Free a string or list option unless it is a shared default.
+ */
+static void
+free_string(struct pam_args *args, char **setting)
+{
+    if (!is_shared(args, setting))
+        free(*setting);
+}
+
+static void
+free_list(struct pam_args *args, struct vector **setting)
+{
+    if (!is_shared(args, setting))
+        vector_free(*setting);
+}
+
+
+/*
+ * Split a list option on whitespace and commas into a vector that is a
+ * single block of memory allocated with putil_args_alloc, with the strings
+ * pointing into a copy of the value at the end of the block.  Returns NULL
+ * on memory allocation failure.
+ */
+static struct vector *
+arena_list(struct pam_args *args, const char *value)
+{
+    struct vector *list;
+    const char *p;
+    char *copy, *q;
+    size_t count = 0;
+    size_t length;
+
+    for (p = value + strspn(value, LIST_SEPS); *p != '\0';
+         p += strspn(p, LIST_SEPS)) {
+        count++;
+        p += strcspn(p, LIST_SEPS);
+    }
+    length = strlen(value) + 1;
+    list = putil_args_alloc(args, sizeof(struct vector)
+                                      + count * sizeof(char *) + length);
+    if (list == NULL)
+        return NULL;
+    list->count = 0;
+    list->allocated = count;
+    list->strings = (char **) (void *) (list + 1);
+    copy = (char *) (list->strings + count);
+    memcpy(copy, value, length);
+    for (q = copy + strspn(copy, LIST_SEPS); *q != '\0';
+         q += strspn(q, LIST_SEPS)) {
+        list->strings[list->count++] = q;
+        q += strcspn(q, LIST_SEPS);
+        if (*q != '\0')
+            *q++ = '\0';
+    }
+    return list;
+}
+
+
+/*
+ * Set a string option to a copy of a string, freeing the old value unless it
+ * is shared.  If the configuration was set up with putil_args_defaults_shared,
+ * the copy is allocated with putil_args_alloc and freed with the PAM
+ * arguments.  Returns false on memory allocation failure, which is also
+ * reported with putil_crit().
+ */
+static bool
+set_string(struct pam_args *args, const char *value, char **result)
+{
+    char *copy;
+    size_t length;
+
+    if (!args->config_alloc)
+        copy = strdup(value);
+    else {
+        length = strlen(value) + 1;
+        copy = putil_args_alloc(args, length);
+        if (copy != NULL)
+            memcpy(copy, value, length);
+    }
+    if (copy == NULL) {
+        putil_crit(args, "cannot allocate memory: %s", strerror(errno));
+        return false;
+    }
+    free_string(args, result);
+    *result = copy;
+    return true;
+}
+
+
+/*
+ * Set a list option by splitting a string on whitespace and commas, freeing
+ * the old value unless it is shared.  If the configuration was set up with
+ * putil_args_defaults_shared, the list is allocated in one block with
+ * putil_args_alloc and freed with the PAM arguments.  Returns false on memory
+ * allocation failure, which is also reported with putil_crit().
+ */
+static bool
+set_list(struct pam_args *args, const char *value, struct vector **result)
+{
+    struct vector *list;
+
+    if (!args->config_alloc)
+        list = vector_split_multi(value, LIST_SEPS, NULL);
+    else
+        list = arena_list(args, value);
+    if (list == NULL) {
+        putil_crit(args, "cannot allocate vector: %s", strerror(errno));
+        return false;
+    }
+    free_list(args, result);
+    *result = list;
+    return true;
+}
+
+
+/*
+ * Free the string and list options in the configuration, other than shared
+ * defaults and memory owned by the PAM arguments, and set them to NULL.
+ * Options set later for a new configuration are allocated normally unless it
+ * is also set up with putil_args_defaults_shared.
+ */
+void
+putil_args_config_free(struct pam_args *args, const struct option options[],
+                       size_t optlen)
+{
+    size_t opt;
+    char **sp;
+    struct vector **vp;
+
+    args->config_alloc = false;
+    if (args->config == NULL)
+        return;
+    for (opt = 0; opt < optlen; opt++)
+        switch (options[opt].type) {
+        case TYPE_STRING:
+            sp = CONF_STRING(args->config, options[opt].location);
+            free_string(args, sp);
+            *sp = NULL;
+            break;
+        case TYPE_LIST:
+        case TYPE_STRLIST:
+            vp = CONF_LIST(args->config, options[opt].location);
+            free_list(args, vp);
+            *vp = NULL;
+            break;
+        case TYPE_BOOLEAN:
+        case TYPE_NUMBER:
+        case TYPE_TIME:
+            break;
+        }
+}
+
+
+/*
+ * bsearch comparison function for finding PAM arguments in an array of struct
+ * options.  We only compare up to the first '=' in the key so that we don't
+ * have to munge the string before searching.
+ */
+static int
+option_compare(const void *key, const void *member)
+{
+    const char *string = key;
+    const struct option *option = member;
+    const char *p;
+    size_t length;
+    int result;
+
+    p = strchr(string, '=');
+    if (p == NULL)
+        return strcmp(string, option->name);
+    else {
+        length = (size_t) (p - string);
+        if (length == 0)
+            return -1;
+        result = strncmp(string, option->name, length);
+        if (result == 0 && strlen(option->name) > length)
+            return -1;
+        return result;
+    }
+}
+
+/*
+ * Hash an option name, or the name part of a PAM argument of the form
+ * name=value, with FNV-1a.  Stores the length of the name in length.
+ */
+static unsigned long
+option_hash(const char *key, size_t *length)
+{
+    unsigned long hash = 2166136261UL;
+    const char *p;
+
+    for (p = key; *p != '\0' && *p != '='; p++) {
+        hash ^= (unsigned char) *p;
+        hash *= 16777619UL;
+    }
+    *length = (size_t) (p - key);
+    return hash;
+}
+
+
+/*
+ * Mix an option hash with a bucket seed to get a slot in an index of the
+ * given size.
+ */
+static size_t
+option_slot(unsigned long hash, long seed, size_t size)
+{
+    hash ^= (unsigned long) seed * 2654435761UL;
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bUL;
+    hash ^= hash >> 16;
+    return hash % size;
+}
+
+
+/*
+ * Free an option index.
+ */
+static void
+index_free(struct option_index *index)
+{
+    if (index == NULL)
+        return;
+    free(index->displace);
+    free(index->slots);
+    free(index);
+}
+
+
+/*
+ * Find a seed that places every option in a bucket into a distinct free
+ * slot, mark those slots as used, and return the seed, or return 0 if no
+ * seed was found.  Takes the index being built, the positions in the table
+ * of the options in the bucket, their hashes, the number of options in the
+ * bucket, and which slots are already used.
+ */
+static long
+index_place(struct option_index *index, const size_t *members,
+            const unsigned long *hashes, size_t count, bool *used)
+{
+    size_t i, j, slot;
+    long seed;
+    bool okay;
+
+    for (seed = 1; seed <= INDEX_MAX_SEED; seed++) {
+        okay = true;
+        for (i = 0; okay && i < count; i++) {
+            slot = option_slot(hashes[members[i]], seed, index->optlen);
+            if (used[slot])
+                okay = false;
+            for (j = 0; okay && j < i; j++)
+                if (slot == option_slot(hashes[members[j]], seed,
+                                        index->optlen))
+                    okay = false;
+        }
+        if (okay) {
+            for (i = 0; i < count; i++) {
+                slot = option_slot(hashes[members[i]], seed, index->optlen);
+                used[slot] = true;
+                index->slots[slot] = members[i];
+            }
+            return seed;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Build the index for an option table.  Buckets are placed from the largest
+ * to the smallest, since large buckets are the hardest to place, and then
+ * buckets with a single option are given the remaining slots.  If the table
+ * has a duplicate name or no seed can be found for a bucket, the problem is
+ * reported and an index without displacements or slots is returned, and the
+ * caller should then fall back on a binary search.  Returns NULL on memory
+ * allocation failure, which is also reported.
+ */
+static struct option_index *
+index_build(struct pam_args *args, const struct option options[],
+            size_t optlen)
+{
+    struct option_index *index;
+    unsigned long *hashes = NULL;
+    size_t *sizes = NULL;
+    size_t *members = NULL;
+    bool *used = NULL;
+    size_t i, j, bucket, count, size, largest, length;
+    size_t slot = 0;
+    long seed;
+
+    index = calloc(1, sizeof(struct option_index));
+    if (index == NULL)
+        goto fail;
+    index->options = options;
+    index->optlen = optlen;
+    index->displace = calloc(optlen, sizeof(long));
+    index->slots = calloc(optlen, sizeof(size_t));
+    hashes = calloc(optlen, sizeof(unsigned long));
+    sizes = calloc(optlen, sizeof(size_t));
+    members = calloc(optlen, sizeof(size_t));
+    used = calloc(optlen, sizeof(bool));
+    if (index->displace == NULL || index->slots == NULL || hashes == NULL
+        || sizes == NULL || members == NULL || used == NULL)
+        goto fail;
+
+    /* Hash each name and count the options in each bucket. */
+    largest = 0;
+    for (i = 0; i < optlen; i++) {
+        hashes[i] = option_hash(options[i].name, &length);
+        bucket = hashes[i] % optlen;
+        sizes[bucket]++;
+        if (sizes[bucket] > largest)
+            largest = sizes[bucket];
+    }
+
+    /* Place the buckets with more than one option, largest first. */
+    for (size = largest; size > 1; size--)
+        for (bucket = 0; bucket < optlen; bucket++) {
+            if (sizes[bucket] != size)
+                continue;
+            count = 0;
+            for (i = 0; i < optlen; i++)
+                if (hashes[i] % optlen == bucket)
+                    members[count++] = i;
+            for (i = 0; i < count; i++)
+                for (j = 0; j < i; j++)
+                    if (strcmp(options[members[i]].name,
+                               options[members[j]].name)
+                        == 0) {
+                        putil_err(args, "duplicate option %s in option table",
+                                  options[members[i]].name);
+                        goto done;
+                    }
+            seed = index_place(index, members, hashes, count, used);
+            if (seed == 0) {
+                putil_err(args, "cannot build index for option table");
+                goto done;
+            }
+            index->displace[bucket] = seed;
+        }
+
+    /* Give the buckets with one option the remaining slots. */
+    for (i = 0; i < optlen; i++) {
+        bucket = hashes[i] % optlen;
+        if (sizes[bucket] != 1)
+            continue;
+        while (used[slot])
+            slot++;
+        used[slot] = true;
+        index->slots[slot] = i;
+        index->displace[bucket] = -(long) slot - 1;
+    }
+    free(hashes);
+    free(sizes);
+    free(members);
+    free(used);
+    return index;
+
+done:
+    free(index->displace);
+    free(index->slots);
+    index->displace = NULL;
+    index->slots = NULL;
+    free(hashes);
+    free(sizes);
+    free(members);
+    free(used);
+    return index;
+
+fail:
+    putil_crit(args, "cannot allocate memory: %s", strerror(errno));
+    index_free(index);
+    free(hashes);
+    free(sizes);
+    free(members);
+    free(used);
+    return NULL;
+}
+
+
+/*
+ * Return an index from the list, or NULL if the index couldn't be built for
+ * that table.
+ */
+static const struct option_index *
+index_usable(const struct option_index *index)
+{
+    return (index->slots == NULL) ? NULL : index;
+}
+
+
+/*
+ * Find the index for an option table, building it if this is the first time
+ * the table has been seen.  Also check that the table is sorted, since the
+ * binary search used if there is no index requires that, and report an
+ * error if it isn't.  The index doesn't depend on the order of the table, so
+ * it's still used for an unsorted table.  Returns NULL if the index couldn't
+ * be built, in which case the problem is only reported the first time.
+ */
+static const struct option_index *
+option_index(struct pam_args *args, const struct option options[],
+             size_t optlen)
+{
+    struct option_index *head, *index, *found;
+    size_t i;
+
+    for (found = LIST_LOAD(index_list); found != NULL; found = found->next)
+        if (found->options == options && found->optlen == optlen)
+            return index_usable(found);
+    if (optlen == 0)
+        return NULL;
+    for (i = 1; i < optlen; i++)
+        if (strcmp(options[i - 1].name, options[i].name) > 0) {
+            putil_err(args, "option table not sorted: %s before %s",
+                      options[i - 1].name, options[i].name);
+            break;
+        }
+    index = index_build(args, options, optlen);
+    if (index == NULL)
+        return NULL;
+
+    /* Add the index to the list unless another thread just added one. */
+    head = LIST_LOAD(index_list);
+    do {
+        for (found = head; found != NULL; found = found->next)
+            if (found->options == options && found->optlen == optlen) {
+                index_free(index);
+                return index_usable(found);
+            }
+        index->next = head;
+    } while (!LIST_PUSH(index_list, index, &head));
+    return index_usable(index);
+}
+
+
+/*
+ * Find the option matching a key, which is either an option name or a PAM
+ * argument of the form name=value, using the index if there is one and
+ * otherwise a binary search of the option table.  Returns NULL if there is
+ * no matching option.
+ */
+static const struct option *
+option_find(const struct option_index *index, const char *key,
+            const struct option options[], size_t optlen)
+{
+    const struct option *option;
+    unsigned long hash;
+    size_t length, slot;
+    long displace;
+
+    if (index == NULL)
+        return bsearch(key, options, optlen, sizeof(struct option),
+                       option_compare);
+    hash = option_hash(key, &length);
+    displace = index->displace[hash % index->optlen];
+    if (displace == 0)
+        return NULL;
+    else if (displace < 0)
+        slot = (size_t) (-displace - 1);
+    else
+        slot = option_slot(hash, displace, index->optlen);
+    option = &index->options[index->slots[slot]];
+    if (strncmp(option->name, key, length) != 0
+        || option->name[length] != '\0')
+        return NULL;
+    return option;
+}
+
+
+
+#ifdef HAVE_KRB5
+/*
+ * Set a number option from a string read from krb5.conf, reporting an error
+ * and leaving the option unchanged if the string isn't a valid number.  An
+ * empty string is ignored.
+ */
+static void
+set_number(struct pam_args *args, const char *opt, const char *value,
+           long *result)
+{
+    char *end;
+    long number;
+
+    if (value[0] == '\0')
+        return;
+    errno = 0;
+    number = strtol(value, &end, 10);
+    if (errno != 0 || *end != '\0')
+        putil_err(args, "invalid number in krb5.conf setting for %s: %s", opt,
+                  value);
+    else
+        *result = number;
+}
+
+
+/*
+ * Set a time option from a string read from krb5.conf, converting it with
+ * krb5_string_to_deltat and reporting an error and leaving the option
+ * unchanged if that fails.  An empty string is ignored.  The string is only
+ * non-const because of the prototype of krb5_string_to_deltat.
+ */
+static void
+set_time(struct pam_args *args, const char *opt, char *value,
+         krb5_deltat *result)
+{
+    krb5_deltat time;
+    krb5_error_code retval;
+
+    if (value[0] == '\0')
+        return;
+    retval = krb5_string_to_deltat(value, &time);
+    if (retval != 0)
+        putil_err(args, "invalid time in krb5.conf setting for %s: %s", opt,
+                  value);
+    else
+        *result = time;
+}
+
+
 /*
  * Load a boolean option from Kerberos appdefaults.  Takes the PAM argument
  * struct, the section name, the realm, the option, and the result location.
@@ -238,8 +1099,6 @@ default_number(struct pam_args *args, const char *section, const char *realm,
                const char *opt, long *result)
 {
     char *tmp = NULL;
-    char *end;
-    long value;
 #ifdef HAVE_KRB5_REALM
     krb5_const_realm rdata = realm;
 #else
@@ -257,15 +1116,8 @@ default_number(struct pam_args *args, const char *section, const char *realm,
 #endif
 
     krb5_appdefault_string(args->ctx, section, rdata, opt, "", &tmp);
-    if (tmp != NULL && tmp[0] != '\0') {
-        errno = 0;
-        value = strtol(tmp, &end, 10);
-        if (errno != 0 || *end != '\0')
-            putil_err(args, "invalid number in krb5.conf setting for %s: %s",
-                      opt, tmp);
-        else
-            *result = value;
-    }
+    if (tmp != NULL)
+        set_number(args, opt, tmp, result);
     free(tmp);
 }
 
@@ -281,8 +1133,6 @@ default_time(struct pam_args *args, const char *section, const char *realm,
              const char *opt, krb5_deltat *result)
 {
     char *tmp = NULL;
-    krb5_deltat value;
-    krb5_error_code retval;
 #ifdef HAVE_KRB5_REALM
     krb5_const_realm rdata = realm;
 #else
@@ -300,14 +1150,8 @@ default_time(struct pam_args *args, const char *section, const char *realm,
 #endif
 
     krb5_appdefault_string(args->ctx, section, rdata, opt, "", &tmp);
-    if (tmp != NULL && tmp[0] != '\0') {
-        retval = krb5_string_to_deltat(tmp, &value);
-        if (retval != 0)
-            putil_err(args, "invalid time in krb5.conf setting for %s: %s",
-                      opt, tmp);
-        else
-            *result = value;
-    }
+    if (tmp != NULL)
+        set_time(args, opt, tmp, result);
     free(tmp);
 }
 
@@ -348,8 +1192,7 @@ default_string(struct pam_args *args, const char *section, const char *realm,
         if (value[0] == '\0')
             free(value);
         else {
-            if (*result != NULL)
-                free(*result);
+            free_string(args, result);
             *result = value;
         }
     }
@@ -368,54 +1211,30 @@ default_list(struct pam_args *args, const char *section, const char *realm,
              const char *opt, struct vector **result)
 {
     char *tmp = NULL;
-    struct vector *value;
+    bool okay = true;
 
     default_string(args, section, realm, opt, &tmp);
     if (tmp != NULL) {
-        value = vector_split_multi(tmp, " \t,", NULL);
-        if (value == NULL) {
-            free(tmp);
-            putil_crit(args, "cannot allocate vector: %s", strerror(errno));
-            return false;
-        }
-        if (*result != NULL)
-            vector_free(*result);
-        *result = value;
+        okay = set_list(args, tmp, result);
         free(tmp);
     }
-    return true;
+    return okay;
 }
 
 
 /*
- * The public interface for getting configuration information from krb5.conf.
- * Takes the PAM arguments, the krb5.conf section, the options specification,
- * and the number of options in the options table.  The config member of the
- * args struct must already be allocated.  Iterate through the option list
- * and, for every option where krb5_config is true, see if it's set in the
- * Kerberos configuration.
- *
- * This looks obviously slow, but there haven't been any reports of problems
- * and there's no better interface.  But if you wonder where the cycles in
- * your computer are getting wasted, well, here's one place.
+ * Load options from krb5.conf one at a time with the krb5_appdefault_*
+ * functions, which check the section and realm, the section, the realm, and
+ * then the top level of [appdefaults] for each option.  This is the fallback
+ * when the profile library can't be used to read the whole section at once.
+ * Returns false on a fatal error.
  */
-bool
-putil_args_krb5(struct pam_args *args, const char *section,
-                const struct option options[], size_t optlen)
+static bool
+args_krb5_each(struct pam_args *args, const char *section, const char *realm,
+               const struct option options[], size_t optlen)
 {
     size_t i;
-    char *realm;
-    bool free_realm = false;
 
-    /* Having no local realm may be intentional, so don't report an error. */
-    if (args->realm != NULL)
-        realm = args->realm;
-    else {
-        if (krb5_get_default_realm(args->ctx, &realm) < 0)
-            realm = NULL;
-        else
-            free_realm = true;
-    }
     for (i = 0; i < optlen; i++) {
         const struct option *opt = &options[i];
 
@@ -446,65 +1265,398 @@ putil_args_krb5(struct pam_args *args, const char *section,
             break;
         }
     }
-    if (free_realm)
-        krb5_free_default_realm(args->ctx, realm);
     return true;
 }
 
-#else /* !HAVE_KRB5 */
 
+#ifdef APPDEFAULTS_WALK
 /*
- * Stub function for getting configuration information from krb5.conf used
- * when the PAM module is not built with Kerberos support so that the function
- * can be called unconditionally.
+ * Parse a boolean the way that MIT Kerberos's krb5_appdefault_boolean does,
+ * where anything not recognized as true is false.
  */
-bool
-putil_args_krb5(struct pam_args *args UNUSED, const char *section UNUSED,
-                const struct option options[] UNUSED, size_t optlen UNUSED)
+static bool
+appdefault_boolean(const char *value)
+{
+    static const char *const yes[] = { "y", "yes", "true", "t", "1", "on" };
+    size_t i;
+
+    for (i = 0; i < sizeof(yes) / sizeof(yes[0]); i++)
+        if (strcasecmp(value, yes[i]) == 0)
+            return true;
+    return false;
+}
+
+
+/*
+ * Free a set of settings read from [appdefaults].
+ */
+static void
+appdefaults_free(struct appdefaults *defaults)
+{
+    size_t i;
+
+    if (defaults == NULL)
+        return;
+    for (i = 0; i < defaults->count; i++) {
+        free(defaults->settings[i].name);
+        free(defaults->settings[i].value);
+    }
+    free(defaults->settings);
+    free(defaults->section);
+    free(defaults->realm);
+    free(defaults);
+}
+
+
+/*
+ * Add a setting to a set of settings unless a setting with that name is
+ * already present, since the first value found takes precedence.  Returns
+ * false on memory allocation failure.
+ */
+static bool
+appdefaults_add(struct appdefaults *defaults, const char *name,
+                const char *value)
 {
+    struct appdefault *settings, *setting;
+    size_t i, size;
+
+    for (i = 0; i < defaults->count; i++)
+        if (strcmp(defaults->settings[i].name, name) == 0)
+            return true;
+    if (defaults->count == defaults->allocated) {
+        size = (defaults->allocated == 0) ? 16 : defaults->allocated * 2;
+        settings = reallocarray(defaults->settings, size,
+                                sizeof(struct appdefault));
+        if (settings == NULL)
+            return false;
+        defaults->settings = settings;
+        defaults->allocated = size;
+    }
+    setting = &defaults->settings[defaults->count];
+    setting->name = strdup(name);
+    setting->value = strdup(value);
+    if (setting->name == NULL || setting->value == NULL) {
+        free(setting->name);
+        free(setting->value);
+        return false;
+    }
+    defaults->count++;
     return true;
 }
 
-#endif /* !HAVE_KRB5 */
+
+/*
+ * Add all of the relations directly inside one section of the profile, given
+ * as a NULL-terminated path, to a set of settings.  A missing section is not
+ * an error.  Returns false on memory allocation failure.
+ */
+static bool
+appdefaults_walk(struct appdefaults *defaults, profile_t profile,
+                 const char *const *names)
+{
+    void *iter;
+    char *name, *value;
+    bool okay = true;
+    int flags = PROFILE_ITER_LIST_SECTION | PROFILE_ITER_RELATIONS_ONLY;
+
+    if (profile_iterator_create(profile, names, flags, &iter) != 0)
+        return true;
+    while (okay && profile_iterator(&iter, &name, &value) == 0) {
+        if (name == NULL)
+            break;
+        if (value != NULL)
+            okay = appdefaults_add(defaults, name, value);
+        profile_release_string(name);
+        profile_release_string(value);
+    }
+    profile_iterator_free(&iter);
+    return okay;
+}
 
 
 /*
- * bsearch comparison function for finding PAM arguments in an array of struct
- * options.  We only compare up to the first '=' in the key so that we don't
- * have to munge the string before searching.
+ * Read all settings that apply to a section and realm from [appdefaults] in
+ * the same order of precedence as krb5_appdefault_string: the realm inside
+ * the section, the section, the realm, and then the top level of
+ * [appdefaults].  The realm may be NULL.  Returns NULL if the profile isn't
+ * available or on memory allocation failure, in which case the caller should
+ * fall back on looking up each option separately.
  */
-static int
-option_compare(const void *key, const void *member)
+static struct appdefaults *
+appdefaults_load(struct pam_args *args, const char *section,
+                 const char *realm, unsigned long stamp, time_t modified)
 {
-    const char *string = key;
-    const struct option *option = member;
-    const char *p;
-    size_t length;
-    int result;
+    struct appdefaults *defaults;
+    profile_t profile;
+    const char *names[4];
+    bool okay = true;
+
+    if (krb5_get_profile(args->ctx, &profile) != 0)
+        return NULL;
+    defaults = calloc(1, sizeof(struct appdefaults));
+    if (defaults == NULL)
+        goto fail;
+    defaults->stamp = stamp;
+    defaults->cacheable = (time(NULL) > modified);
+    defaults->section = strdup(section);
+    if (defaults->section == NULL)
+        goto fail;
+    if (realm != NULL) {
+        defaults->realm = strdup(realm);
+        if (defaults->realm == NULL)
+            goto fail;
+    }
+    names[0] = "appdefaults";
+    if (realm != NULL) {
+        names[1] = section;
+        names[2] = realm;
+        names[3] = NULL;
+        okay = appdefaults_walk(defaults, profile, names);
+    }
+    names[1] = section;
+    names[2] = NULL;
+    okay = okay && appdefaults_walk(defaults, profile, names);
+    if (realm != NULL) {
+        names[1] = realm;
+        okay = okay && appdefaults_walk(defaults, profile, names);
+    }
+    names[1] = NULL;
+    okay = okay && appdefaults_walk(defaults, profile, names);
+    if (!okay)
+        goto fail;
+    profile_release(profile);
+    return defaults;
+
+fail:
+    appdefaults_free(defaults);
+    profile_release(profile);
+    return NULL;
+}
 
-    p = strchr(string, '=');
-    if (p == NULL)
-        return strcmp(string, option->name);
+
+/*
+ * Return the [appdefaults] settings for a section and realm, taking them
+ * from the process cache if they were read for the same section and realm
+ * and the Kerberos configuration hasn't changed since, and otherwise reading
+ * them from the profile.  Returns NULL if they couldn't be read.  The result
+ * should be passed to appdefaults_release when no longer needed.
+ */
+static struct appdefaults *
+appdefaults_get(struct pam_args *args, const char *section, const char *realm)
+{
+    struct appdefaults *defaults;
+    unsigned long stamp;
+    time_t modified;
+
+    stamp = putil_args_krb5_stamp(&modified);
+    defaults = CACHE_TAKE();
+    if (defaults != NULL && defaults->stamp == stamp
+        && strcmp(defaults->section, section) == 0
+        && (realm == NULL
+                ? defaults->realm == NULL
+                : (defaults->realm != NULL
+                   && strcmp(defaults->realm, realm) == 0)))
+        return defaults;
+    appdefaults_free(defaults);
+    return appdefaults_load(args, section, realm, stamp, modified);
+}
+
+
+/*
+ * Return a set of settings to the process cache if they can be cached and
+ * the cache is empty, and otherwise free them.
+ */
+static void
+appdefaults_release(struct appdefaults *defaults)
+{
+    struct appdefaults *old = NULL;
+
+    if (!defaults->cacheable || !CACHE_PUT(defaults, &old))
+        appdefaults_free(defaults);
+}
+
+
+/*
+ * Apply a set of settings from [appdefaults] to the configuration, looking
+ * up each setting in the option table and ignoring those that don't match an
+ * option that can be set in krb5.conf.  As with the lookups of individual
+ * options, empty values don't replace string, list, or time options.  Returns
+ * false on a fatal error.
+ */
+static bool
+appdefaults_apply(struct pam_args *args, const struct appdefaults *defaults,
+                  const struct option options[], size_t optlen)
+{
+    const struct option *opt;
+    const struct option_index *index;
+    const struct appdefault *setting;
+    size_t i;
+
+    index = option_index(args, options, optlen);
+    for (i = 0; i < defaults->count; i++) {
+        setting = &defaults->settings[i];
+        opt = option_find(index, setting->name, options, optlen);
+        if (opt == NULL || !opt->krb5_config)
+            continue;
+        switch (opt->type) {
+        case TYPE_BOOLEAN:
+            *(CONF_BOOL(args->config, opt->location))
+                = appdefault_boolean(setting->value);
+            break;
+        case TYPE_NUMBER:
+            set_number(args, opt->name, setting->value,
+                       CONF_NUMBER(args->config, opt->location));
+            break;
+        case TYPE_TIME:
+            set_time(args, opt->name, setting->value,
+                     CONF_TIME(args->config, opt->location));
+            break;
+        case TYPE_STRING:
+            if (setting->value[0] == '\0')
+                break;
+            if (!set_string(args, setting->value,
+                            CONF_STRING(args->config, opt->location)))
+                return false;
+            break;
+        case TYPE_LIST:
+        case TYPE_STRLIST:
+            if (setting->value[0] == '\0')
+                break;
+            if (!set_list(args, setting->value,
+                          CONF_LIST(args->config, opt->location)))
+                return false;
+            break;
+        }
+    }
+    return true;
+}
+
+#else /* !APPDEFAULTS_WALK */
+
+/*
+ * Stub functions used when the profile library isn't available, which make
+ * putil_args_krb5 always look up each option separately.
+ */
+static struct appdefaults *
+appdefaults_get(struct pam_args *args UNUSED, const char *section UNUSED,
+                const char *realm UNUSED)
+{
+    return NULL;
+}
+
+static void
+appdefaults_release(struct appdefaults *defaults UNUSED)
+{
+}
+
+static bool
+appdefaults_apply(struct pam_args *args UNUSED,
+                  const struct appdefaults *defaults UNUSED,
+                  const struct option options[] UNUSED, size_t optlen UNUSED)
+{
+    return true;
+}
+
+#endif /* !APPDEFAULTS_WALK */
+
+
+/*
+ * Free the data kept for the life of the process when the module is unloaded.
+ * libpam usually unloads modules whenever a PAM handle is closed, so without
+ * this every PAM session would leak it.  Where destructors aren't supported,
+ * the data is leaked instead.
+ */
+static void __attribute__((__destructor__, __unused__))
+options_unload(void)
+{
+    struct shared_defaults *shared, *next_shared;
+    struct option_index *index, *next_index;
+
+    for (shared = shared_list; shared != NULL; shared = next_shared) {
+        next_shared = shared->next;
+        shared_free(shared);
+    }
+    shared_list = NULL;
+    for (index = index_list; index != NULL; index = next_index) {
+        next_index = index->next;
+        index_free(index);
+    }
+    index_list = NULL;
+#ifdef APPDEFAULTS_WALK
+    appdefaults_free(CACHE_TAKE());
+#endif
+}
+
+
+/*
+ * The public interface for getting configuration information from krb5.conf.
+ * Takes the PAM arguments, the krb5.conf section, the options specification,
+ * and the number of options in the options table.  The config member of the
+ * args struct must already be allocated.  For every option where krb5_config
+ * is true, see if it's set in the Kerberos configuration.
+ *
+ * Where the profile library is available, read the relevant parts of
+ * [appdefaults] in one pass and then apply every setting found, caching the
+ * result for the next call with the same section and realm.  Otherwise, look
+ * up each option separately, which costs up to four profile lookups per
+ * option.
+ */
+bool
+putil_args_krb5(struct pam_args *args, const char *section,
+                const struct option options[], size_t optlen)
+{
+    struct appdefaults *defaults;
+    char *realm;
+    bool free_realm = false;
+    bool okay;
+
+    /* Having no local realm may be intentional, so don't report an error. */
+    if (args->realm != NULL)
+        realm = args->realm;
     else {
-        length = (size_t) (p - string);
-        if (length == 0)
-            return -1;
-        result = strncmp(string, option->name, length);
-        if (result == 0 && strlen(option->name) > length)
-            return -1;
-        return result;
+        if (krb5_get_default_realm(args->ctx, &realm) < 0)
+            realm = NULL;
+        else
+            free_realm = true;
+    }
+    defaults = appdefaults_get(args, section, realm);
+    if (defaults == NULL)
+        okay = args_krb5_each(args, section, realm, options, optlen);
+    else {
+        okay = appdefaults_apply(args, defaults, options, optlen);
+        appdefaults_release(defaults);
     }
+    if (free_realm)
+        krb5_free_default_realm(args->ctx, realm);
+    return okay;
+}
+
+#else /* !HAVE_KRB5 */
+
+/*
+ * Stub function for getting configuration information from krb5.conf used
+ * when the PAM module is not built with Kerberos support so that the function
+ * can be called unconditionally.
+ */
+bool
+putil_args_krb5(struct pam_args *args UNUSED, const char *section UNUSED,
+                const struct option options[] UNUSED, size_t optlen UNUSED)
+{
+    return true;
 }
 
+#endif /* !HAVE_KRB5 */
+
 
 /*
  * Given a PAM argument, convert the value portion of the argument to a
  * boolean and store it in the provided location.  If the value is missing,
  * that's equivalent to a true value.  If the value is invalid, report an
- * error and leave the location unchanged.
+ * error and leave the location unchanged.  Always returns true, since an
+ * invalid value isn't a fatal error.
  */
-static void
-convert_boolean(struct pam_args *args, const char *arg, bool *setting)
+bool
+putil_option_boolean(struct pam_args *args, const char *arg, bool *setting)
 {
     const char *value;
 
@@ -526,16 +1678,18 @@ convert_boolean(struct pam_args *args, const char *arg, bool *setting)
         else
             putil_err(args, "invalid boolean in setting: %s", arg);
     }
+    return true;
 }
 
 
 /*
  * Given a PAM argument, convert the value portion of the argument to a number
  * and store it in the provided location.  If the value is missing or isn't a
- * number, report an error and leave the location unchanged.
+ * number, report an error and leave the location unchanged.  Always returns
+ * true, since an invalid value isn't a fatal error.
  */
-static void
-convert_number(struct pam_args *args, const char *arg, long *setting)
+bool
+putil_option_number(struct pam_args *args, const char *arg, long *setting)
 {
     const char *value;
     char *end;
@@ -544,15 +1698,16 @@ convert_number(struct pam_args *args, const char *arg, long *setting)
     value = strchr(arg, '=');
     if (value == NULL || value[1] == '\0') {
         putil_err(args, "value missing for option %s", arg);
-        return;
+        return true;
     }
     errno = 0;
     result = strtol(value + 1, &end, 10);
     if (errno != 0 || *end != '\0') {
         putil_err(args, "invalid number in setting: %s", arg);
-        return;
+        return true;
     }
     *setting = result;
+    return true;
 }
 
 
@@ -560,11 +1715,13 @@ convert_number(struct pam_args *args, const char *arg, long *setting)
  * Given a PAM argument, convert the value portion of the argument from a
  * Kerberos time string to a krb5_deltat and store it in the provided
  * location.  If the value is missing or isn't a number, report an error and
- * leave the location unchanged.
+ * leave the location unchanged.  Always returns true, since an invalid value
+ * isn't a fatal error.
  */
 #ifdef HAVE_KRB5
-static void
-convert_time(struct pam_args *args, const char *arg, krb5_deltat *setting)
+bool
+putil_option_time(struct pam_args *args, const char *arg,
+                  krb5_deltat *setting)
 {
     const char *value;
     krb5_deltat result;
@@ -573,21 +1730,22 @@ convert_time(struct pam_args *args, const char *arg, krb5_deltat *setting)
     value = strchr(arg, '=');
     if (value == NULL || value[1] == '\0') {
         putil_err(args, "value missing for option %s", arg);
-        return;
+        return true;
     }
     retval = krb5_string_to_deltat((char *) value + 1, &result);
     if (retval != 0)
         putil_err(args, "bad time value in setting: %s", arg);
     else
         *setting = result;
+    return true;
 }
 
 #else /* HAVE_KRB5 */
 
-static void
-convert_time(struct pam_args *args, const char *arg, long *setting)
+bool
+putil_option_time(struct pam_args *args, const char *arg, long *setting)
 {
-    convert_number(args, arg, setting);
+    return putil_option_number(args, arg, setting);
 }
 
 #endif /* !HAVE_KRB5 */
@@ -600,25 +1758,17 @@ convert_time(struct pam_args *args, const char *arg, long *setting)
  * non-fatal error.  If memory allocation fails, return false, since PAM setup
  * should abort.
  */
-static bool
-convert_string(struct pam_args *args, const char *arg, char **setting)
+bool
+putil_option_string(struct pam_args *args, const char *arg, char **setting)
 {
     const char *value;
-    char *result;
 
     value = strchr(arg, '=');
     if (value == NULL) {
         putil_err(args, "value missing for option %s", arg);
         return true;
     }
-    result = strdup(value + 1);
-    if (result == NULL) {
-        putil_crit(args, "cannot allocate memory: %s", strerror(errno));
-        return false;
-    }
-    free(*setting);
-    *setting = result;
-    return true;
+    return set_string(args, value + 1, setting);
 }
 
 
@@ -629,25 +1779,18 @@ convert_string(struct pam_args *args, const char *arg, char **setting)
  * non-fatal error.  If memory allocation fails, return false, since PAM setup
  * should abort.
  */
-static bool
-convert_list(struct pam_args *args, const char *arg, struct vector **setting)
+bool
+putil_option_list(struct pam_args *args, const char *arg,
+                  struct vector **setting)
 {
     const char *value;
-    struct vector *result;
 
     value = strchr(arg, '=');
     if (value == NULL) {
         putil_err(args, "value missing for option %s", arg);
         return true;
     }
-    result = vector_split_multi(value + 1, " \t,", NULL);
-    if (result == NULL) {
-        putil_crit(args, "cannot allocate vector: %s", strerror(errno));
-        return false;
-    }
-    vector_free(*setting);
-    *setting = result;
-    return true;
+    return set_list(args, value + 1, setting);
 }
 
 
@@ -669,40 +1812,42 @@ putil_args_parse(struct pam_args *args, int argc, const char *argv[],
 {
     int i;
     const struct option *option;
+    const struct option_index *index;
 
     /*
      * Second pass: find each option we were given and set the corresponding
      * configuration parameter.
      */
+    index = option_index(args, options, optlen);
     for (i = 0; i < argc; i++) {
-        option = bsearch(argv[i], options, optlen, sizeof(struct option),
-                         option_compare);
+        option = option_find(index, argv[i], options, optlen);
         if (option == NULL) {
             putil_err(args, "unknown option %s", argv[i]);
             continue;
         }
         switch (option->type) {
         case TYPE_BOOLEAN:
-            convert_boolean(args, argv[i],
-                            CONF_BOOL(args->config, option->location));
+            putil_option_boolean(args, argv[i],
+                                 CONF_BOOL(args->config, option->location));
             break;
         case TYPE_NUMBER:
-            convert_number(args, argv[i],
-                           CONF_NUMBER(args->config, option->location));
+            putil_option_number(args, argv[i],
+                                CONF_NUMBER(args->config, option->location));
             break;
         case TYPE_TIME:
-            convert_time(args, argv[i],
-                         CONF_TIME(args->config, option->location));
+            putil_option_time(args, argv[i],
+                              CONF_TIME(args->config, option->location));
             break;
         case TYPE_STRING:
-            if (!convert_string(args, argv[i],
-                                CONF_STRING(args->config, option->location)))
+            if (!putil_option_string(args, argv[i],
+                                     CONF_STRING(args->config,
+                                                 option->location)))
                 return false;
             break;
         case TYPE_LIST:
         case TYPE_STRLIST:
-            if (!convert_list(args, argv[i],
-                              CONF_LIST(args->config, option->location)))
+            if (!putil_option_list(args, argv[i],
+                                   CONF_LIST(args->config, option->location)))
                 return false;
             break;
         }
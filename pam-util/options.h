@@ -126,8 +126,13 @@ struct option {
  *     };
  *
  * which provides a nice, succinct syntax for creating the table.  The options
- * MUST be in sorted order, since the options parsing code does a binary
- * search.
+ * MUST be in sorted order and each name may appear only once.  The first time
+ * a table is used, a hash index is built for it so that each option is found
+ * with a single comparison.  An unsorted table or a duplicate name is reported
+ * then with putil_err.  The index doesn't depend on the order of the table,
+ * so it's still used for an unsorted table, but if it can't be built (for a
+ * table with a duplicate name, for instance), lookups fall back to a binary
+ * search, which requires the table to be sorted.
  */
 
 BEGIN_DECLS
@@ -149,6 +154,44 @@ bool putil_args_defaults(struct pam_args *, const struct option options[],
                          size_t optlen)
     __attribute__((__nonnull__));
 
+/*
+ * The same as putil_args_defaults(), except that default strings and lists
+ * aren't copied into the configuration.  The first time an option table is
+ * seen, its defaults are built once into a shared, read-only copy, and the
+ * string and list options in the configuration point into that copy until
+ * putil_args_krb5() or putil_args_parse() replaces them.  This avoids
+ * allocating memory for the defaults on every PAM call.
+ *
+ * The string and list options later set by putil_args_krb5() or
+ * putil_args_parse() in a configuration set up this way are allocated with
+ * putil_args_alloc() rather than malloc.  Each list is a single block holding
+ * the struct vector, its array of strings, and the strings themselves, and
+ * all of them are freed at once by putil_args_free().  Parsing the same
+ * options repeatedly with the same PAM arguments therefore uses more memory
+ * each time until the arguments are freed.
+ *
+ * The shared defaults are keyed by the address of the option table, so the
+ * table and its defaults must not change while the process is running.
+ * Callers must not modify or free string or list options that may still be
+ * shared or allocated with putil_args_alloc(); use putil_args_config_free()
+ * to free them.
+ */
+bool putil_args_defaults_shared(struct pam_args *,
+                                const struct option options[], size_t optlen)
+    __attribute__((__nonnull__));
+
+/*
+ * Free the string and list options in the config member of the args struct,
+ * other than shared defaults and memory allocated with putil_args_alloc(),
+ * and set them to NULL.  The config struct itself must still be freed by the
+ * caller.  This can be used whether or not the configuration was set up with
+ * putil_args_defaults_shared(), and afterwards the args struct no longer
+ * refers to shared defaults.
+ */
+void putil_args_config_free(struct pam_args *, const struct option options[],
+                            size_t optlen)
+    __attribute__((__nonnull__));
+
 /*
  * Fill out options from krb5.conf.  Takes the PAM args structure, the name of
  * the section for the software being configured, an option table defined as
@@ -161,6 +204,11 @@ bool putil_args_defaults(struct pam_args *, const struct option options[],
  * function.  If that's done based on a configuration option, one may need to
  * pre-parse the configuration options.
  *
+ * Where the Kerberos profile library is available, the relevant settings are
+ * read in one pass and cached for later calls with the same section and
+ * realm until the Kerberos configuration files change.  The option table
+ * must be sorted, as for putil_args_parse().
+ *
  * Returns true on success and false on an error.  An error return should be
  * considered fatal.  Errors will already be reported using putil_crit*() or
  * putil_err*() as appropriate.  If Kerberos is not available, returns without
@@ -192,6 +240,46 @@ bool putil_args_parse(struct pam_args *, int argc, const char *argv[],
                       const struct option options[], size_t optlen)
     __attribute__((__nonnull__));
 
+/*
+ * The typed functions used by putil_args_defaults() and putil_args_parse()
+ * for each option, exposed for the code generated by pam-util/options-gen.h,
+ * which calls them directly with the address of the member of the
+ * configuration struct.
+ *
+ * The putil_option_default_* functions set a string or list option to a copy
+ * of its default (splitting the string on comma, space, and tab for
+ * putil_option_default_strlist).  The other functions convert the value
+ * portion of a PAM argument of the form <option>=<value> and store it, the
+ * same as putil_args_parse() would.  All of them return false only on memory
+ * allocation failure, which is reported with putil_crit() and should be
+ * considered fatal.  Invalid values are reported with putil_err() and leave
+ * the setting unchanged.
+ */
+bool putil_option_default_string(struct pam_args *, char **,
+                                 const char *defval)
+    __attribute__((__nonnull__(1, 2)));
+bool putil_option_default_list(struct pam_args *, struct vector **,
+                               const struct vector *defval)
+    __attribute__((__nonnull__(1, 2)));
+bool putil_option_default_strlist(struct pam_args *, struct vector **,
+                                  const char *defval)
+    __attribute__((__nonnull__(1, 2)));
+bool putil_option_boolean(struct pam_args *, const char *arg, bool *)
+    __attribute__((__nonnull__));
+bool putil_option_number(struct pam_args *, const char *arg, long *)
+    __attribute__((__nonnull__));
+#ifdef HAVE_KRB5
+bool putil_option_time(struct pam_args *, const char *arg, krb5_deltat *)
+    __attribute__((__nonnull__));
+#else
+bool putil_option_time(struct pam_args *, const char *arg, long *)
+    __attribute__((__nonnull__));
+#endif
+bool putil_option_string(struct pam_args *, const char *arg, char **)
+    __attribute__((__nonnull__));
+bool putil_option_list(struct pam_args *, const char *arg, struct vector **)
+    __attribute__((__nonnull__));
+
 /* Undo default visibility change. */
 #pragma GCC visibility pop
 
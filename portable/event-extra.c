@@ -77,7 +77,6 @@ bufferevent_socket_new(struct event_base *base, evutil_socket_t fd,
 int
 evbuffer_drain_fixed(struct evbuffer *ev, size_t length)
 {
-    fprintf(stderr, "internal draining %lu\n", (unsigned long) length);
     evbuffer_drain(ev, length);
     return 0;
 }
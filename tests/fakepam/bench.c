@@ -0,0 +1,303 @@
+/*
+ * Benchmark PAM interaction scripts.
+ *
+ * Provides an interface that loads a PAM interaction script once and then
+ * runs it repeatedly, possibly in several threads at once, timing each run.
+ * This is used to measure the throughput and latency of a PAM module through
+ * the same fake PAM library used by its tests.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/pam.h>
+#include <portable/system.h>
+
+#include <errno.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+#include <time.h>
+
+#include <tests/fakepam/bench.h>
+#include <tests/fakepam/internal.h>
+#include <tests/fakepam/pam.h>
+#include <tests/fakepam/script.h>
+#include <tests/tap/basic.h>
+
+/* Whether we can run scripts in more than one thread. */
+#if defined(HAVE_PTHREAD) && defined(HAVE_THREAD_LOCAL)
+# define BENCH_THREADS 1
+#endif
+
+/* The state of one thread running the script. */
+struct worker {
+    const struct work *work;            /* The parsed script. */
+    const struct script_config *config; /* The script configuration. */
+    struct prompts prompts;             /* Our copy of the prompts. */
+    unsigned long runs;                 /* Number of runs to do. */
+    unsigned long failures;             /* Runs with an unexpected status. */
+    double *latencies;                  /* Time of each run. */
+    double phases[BENCH_PHASES];        /* Total time in each phase. */
+};
+
+/* The worker for the current thread, used to accumulate phase times. */
+#ifdef HAVE_THREAD_LOCAL
+static THREAD_LOCAL struct worker *current = NULL;
+#else
+static struct worker *current = NULL;
+#endif
+
+
+/*
+ * Return the time elapsed between two timespecs in microseconds.
+ */
+static double
+elapsed(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000.0
+           + (end->tv_nsec - start->tv_nsec) / 1000.0;
+}
+
+
+/*
+ * Compare two doubles, for sorting the run times.
+ */
+static int
+compare_double(const void *a, const void *b)
+{
+    const double *x = a;
+    const double *y = b;
+
+    return (*x > *y) - (*x < *y);
+}
+
+
+/*
+ * The PAM conversation function.  This is like the one used by run_script,
+ * except that the prompts aren't checked.  Each message is answered with the
+ * response to the next prompt if its style matches, and with no response
+ * otherwise.
+ */
+static int
+converse(int num_msg, const struct pam_message **msg,
+         struct pam_response **resp, void *appdata_ptr)
+{
+    struct prompts *prompts = appdata_ptr;
+    struct prompt *prompt;
+    int i;
+
+    *resp = bcalloc(num_msg, sizeof(struct pam_response));
+    for (i = 0; i < num_msg; i++) {
+        if (prompts->current >= prompts->size)
+            continue;
+        prompt = &prompts->prompts[prompts->current];
+        prompts->current++;
+        if (prompt->style == msg[i]->msg_style && prompt->response != NULL) {
+            (*resp)[i].resp = bstrdup(prompt->response);
+            (*resp)[i].resp_retcode = 0;
+        }
+    }
+    return PAM_SUCCESS;
+}
+
+
+/*
+ * Run the script once, returning true if every PAM call returned the
+ * expected status and false otherwise.
+ */
+static bool
+run_once(struct worker *worker)
+{
+    const struct work *work = worker->work;
+    const struct script_config *config = worker->config;
+    const struct options *opts;
+    const struct action *action;
+    struct pam_conv conv = { NULL, NULL };
+    pam_handle_t *pamh;
+    int status;
+    bool okay = true;
+    const char *argv_empty[] = { NULL };
+
+    if (work->prompts != NULL) {
+        worker->prompts.current = 0;
+        conv.conv = converse;
+        conv.appdata_ptr = &worker->prompts;
+    }
+    status = pam_start("test", config->user, &conv, &pamh);
+    if (status != PAM_SUCCESS)
+        sysbail("cannot create PAM handle");
+    if (config->authtok != NULL)
+        pamh->authtok = bstrdup(config->authtok);
+    if (config->oldauthtok != NULL)
+        pamh->oldauthtok = bstrdup(config->oldauthtok);
+    for (action = work->actions; action != NULL; action = action->next) {
+        if (work->options[action->group].argv == NULL)
+            status = (*action->call)(pamh, action->flags, 0, argv_empty);
+        else {
+            opts = &work->options[action->group];
+            status = (*action->call)(pamh, action->flags, opts->argc,
+                                     (const char **) opts->argv);
+        }
+        if (status != action->status)
+            okay = false;
+    }
+    pam_output_free(pam_output());
+    pam_end(pamh, PAM_SUCCESS);
+    return okay;
+}
+
+
+/*
+ * Do all the runs for one worker.  This is the thread start routine when
+ * running in several threads.
+ */
+static void *
+run_worker(void *data)
+{
+    struct worker *worker = data;
+    struct timespec start, end;
+    unsigned long i;
+
+    current = worker;
+    for (i = 0; i < worker->runs; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!run_once(worker))
+            worker->failures++;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        worker->latencies[i] = elapsed(&start, &end);
+    }
+    current = NULL;
+    return NULL;
+}
+
+
+/*
+ * Load the script and run it runs times in each of threads threads, storing
+ * the results in the provided struct.
+ */
+void
+bench_script(const char *file, const struct script_config *config,
+             unsigned long runs, unsigned int threads,
+             struct bench_results *results)
+{
+    struct work *work;
+    struct worker *workers;
+    struct timespec start, end;
+    double *latencies;
+    unsigned int i;
+    size_t j, count;
+#ifdef BENCH_THREADS
+    pthread_t *ids;
+    int status;
+#endif
+
+    /* Only one thread without thread-local output in the fake PAM library. */
+#ifndef BENCH_THREADS
+    threads = 1;
+#endif
+    if (runs == 0 || threads == 0)
+        bail("invalid benchmark run or thread count");
+
+    /* Load the script and set up one worker per thread. */
+    work = load_script(file, config);
+    workers = bcalloc(threads, sizeof(struct worker));
+    for (i = 0; i < threads; i++) {
+        workers[i].work = work;
+        workers[i].config = config;
+        if (work->prompts != NULL)
+            workers[i].prompts = *work->prompts;
+        workers[i].runs = runs;
+        workers[i].latencies = bcalloc(runs, sizeof(double));
+    }
+
+    /* Do the runs. */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+#ifdef BENCH_THREADS
+    if (threads == 1)
+        run_worker(&workers[0]);
+    else {
+        ids = bcalloc(threads, sizeof(pthread_t));
+        for (i = 0; i < threads; i++) {
+            status = pthread_create(&ids[i], NULL, run_worker, &workers[i]);
+            if (status != 0) {
+                errno = status;
+                sysbail("cannot create thread");
+            }
+        }
+        for (i = 0; i < threads; i++) {
+            status = pthread_join(ids[i], NULL);
+            if (status != 0) {
+                errno = status;
+                sysbail("cannot join thread");
+            }
+        }
+        free(ids);
+    }
+#else
+    run_worker(&workers[0]);
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /* Merge the results of each worker. */
+    memset(results, 0, sizeof(*results));
+    results->threads = threads;
+    results->runs = runs * threads;
+    results->seconds = elapsed(&start, &end) / 1000000.0;
+    count = (size_t) results->runs;
+    latencies = bcalloc(count, sizeof(double));
+    for (i = 0; i < threads; i++) {
+        results->failures += workers[i].failures;
+        for (j = 0; j < BENCH_PHASES; j++)
+            results->phases[j] += workers[i].phases[j];
+        memcpy(latencies + i * runs, workers[i].latencies,
+               runs * sizeof(double));
+        free(workers[i].latencies);
+    }
+    qsort(latencies, count, sizeof(double), compare_double);
+    results->p50 = latencies[(count - 1) * 50 / 100];
+    results->p99 = latencies[(count - 1) * 99 / 100];
+    results->p999 = latencies[(count - 1) * 999 / 1000];
+
+    /* Clean up. */
+    free(latencies);
+    free(workers);
+    free_work(work);
+}
+
+
+/*
+ * Store the current time for a later call to bench_phase.
+ */
+void
+bench_time(struct timespec *now)
+{
+    clock_gettime(CLOCK_MONOTONIC, now);
+}
+
+
+/*
+ * Add the time since start to the total for the given phase of the current
+ * run, if any.
+ */
+void
+bench_phase(size_t phase, const struct timespec *start)
+{
+    struct timespec now;
+
+    if (current == NULL || phase >= BENCH_PHASES)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    current->phases[phase] += elapsed(start, &now);
+}
@@ -0,0 +1,85 @@
+/*
+ * Benchmark interface for the fake PAM library.
+ *
+ * Provides an interface that runs a PAM interaction script repeatedly,
+ * possibly in several threads at once, and reports the throughput and the
+ * distribution of the time taken by each run.  The module being measured can
+ * also attribute the time it spends to numbered phases, which are summed over
+ * every run.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#ifndef TESTS_FAKEPAM_BENCH_H
+#define TESTS_FAKEPAM_BENCH_H 1
+
+#include <config.h>
+#include <portable/macros.h>
+
+#include <stddef.h>
+#include <time.h>
+
+/* Forward declarations to avoid unnecessary includes. */
+struct script_config;
+
+/* The maximum number of phases that can be timed. */
+#define BENCH_PHASES 16
+
+/* The results of a benchmark.  All times are in microseconds. */
+struct bench_results {
+    unsigned int threads;         /* Threads actually used. */
+    unsigned long runs;           /* Total runs of the script. */
+    unsigned long failures;       /* Runs where a call had the wrong status. */
+    double seconds;               /* Elapsed time for all runs. */
+    double p50;                   /* Median time for one run. */
+    double p99;                   /* 99th percentile time for one run. */
+    double p999;                  /* 99.9th percentile time for one run. */
+    double phases[BENCH_PHASES];  /* Total time in each phase. */
+};
+
+BEGIN_DECLS
+
+/*
+ * Load the given script (which may be a full path or relative to SOURCE or
+ * BUILD) and then run it runs times in each of threads threads, storing the
+ * results in the provided struct.  Unlike run_script, this doesn't check the
+ * prompts or output or report anything via TAP, and the callback in the
+ * script configuration isn't called; each run only counts as a failure if a
+ * PAM call doesn't return the expected status.  Prompts are answered with
+ * the responses in the script.
+ *
+ * Several threads can only be used if the platform supports POSIX threads
+ * and thread-local variables, since the fake PAM library keeps the logged
+ * output per thread.  Otherwise, only one thread is used.  Calls bail on any
+ * error.
+ */
+void bench_script(const char *file, const struct script_config *,
+                  unsigned long runs, unsigned int threads,
+                  struct bench_results *)
+    __attribute__((__nonnull__));
+
+/*
+ * Used by the module being measured to time its phases.  bench_time stores
+ * the current time, and bench_phase adds the time since the given start time
+ * to the total for the given phase, which must be less than BENCH_PHASES.
+ * bench_phase does nothing if not called from a run of bench_script.
+ */
+void bench_time(struct timespec *)
+    __attribute__((__nonnull__));
+void bench_phase(size_t phase, const struct timespec *start)
+    __attribute__((__nonnull__));
+
+END_DECLS
+
+#endif /* !TESTS_FAKEPAM_BENCH_H */
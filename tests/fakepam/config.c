@@ -42,6 +42,7 @@
 #include <syslog.h>
 
 #include <tests/fakepam/internal.h>
+#include <tests/fakepam/pam.h>
 #include <tests/fakepam/script.h>
 #include <tests/tap/basic.h>
 #include <tests/tap/string.h>
@@ -126,6 +127,13 @@ static const struct {
     { "CRIT",   LOG_CRIT   },
 };
 
+/* The state of reading lines from the contents of a script. */
+struct reader {
+    const char *current;        /* Start of the next line. */
+    const char *end;            /* End of the script contents. */
+    const char *line;           /* Start of the last line read. */
+};
+
 
 /*
  * Given a pointer to a string, skip any leading whitespace and return a
@@ -141,30 +149,32 @@ skip_whitespace(char *p)
 
 
 /*
- * Read a line from a file into a BUFSIZ buffer, failing if the line was too
- * long to fit into the buffer, and returns a copy of that line in newly
- * allocated memory.  Ignores blank lines and comments.  Caller is responsible
- * for freeing.  Returns NULL on end of file and fails on read errors.
+ * Read the next line from the script contents and return a copy of that line
+ * in newly allocated memory.  Ignores blank lines and comments.  Caller is
+ * responsible for freeing.  Returns NULL at the end of the script.
  */
 static char *
-readline(FILE *file)
+readline(struct reader *reader)
 {
-    char buffer[BUFSIZ];
+    const char *start, *end;
     char *line, *first;
 
     do {
-        line = fgets(buffer, sizeof(buffer), file);
-        if (line == NULL) {
-            if (feof(file))
-                return NULL;
-            sysbail("cannot read line from script");
+        if (reader->current >= reader->end)
+            return NULL;
+        start = reader->current;
+        end = memchr(start, '\n', reader->end - start);
+        if (end == NULL)
+            end = reader->end;
+        reader->line = start;
+        reader->current = (end < reader->end) ? end + 1 : end;
+        line = bstrndup(start, end - start);
+        first = skip_whitespace(line);
+        if (first[0] == '#' || first[0] == '\0') {
+            free(line);
+            line = NULL;
         }
-        if (buffer[strlen(buffer) - 1] != '\n')
-            bail("script line too long");
-        buffer[strlen(buffer) - 1] = '\0';
-        first = skip_whitespace(buffer);
-    } while (first[0] == '#' || first[0] == '\0');
-    line = bstrdup(buffer);
+    } while (line == NULL);
     return line;
 }
 
@@ -273,16 +283,13 @@ string_to_style(const char *name)
 
 
 /*
- * We found a section delimiter while parsing another section.  Rewind our
- * input file back before the section delimiter so that we'll read it again.
- * Takes the length of the line we read, which is used to determine how far to
- * rewind.
+ * We found a section delimiter while parsing another section.  Back up to the
+ * start of the line with the section delimiter so that we'll read it again.
  */
 static void
-rewind_section(FILE *script, size_t length)
+rewind_section(struct reader *reader)
 {
-    if (fseek(script, -length - 1, SEEK_CUR) != 0)
-        sysbail("cannot rewind file");
+    reader->current = reader->line;
 }
 
 
@@ -396,11 +403,11 @@ expand_string(const char *template, const struct script_config *config)
 
 /*
  * Given a whitespace-delimited string of PAM options, split it into an argv
- * array and argc count and store it in the provided option struct.
+ * array and argc count and store it in the provided option struct.  The
+ * options are not yet %-escape expanded.
  */
 static void
-split_options(char *string, struct options *options,
-              const struct script_config *config)
+split_options(char *string, struct options *options)
 {
     char *opt;
     size_t size, count;
@@ -408,13 +415,13 @@ split_options(char *string, struct options *options,
     for (opt = strtok(string, " "); opt != NULL; opt = strtok(NULL, " ")) {
         if (options->argv == NULL) {
             options->argv = bcalloc(2, sizeof(const char *));
-            options->argv[0] = expand_string(opt, config);
+            options->argv[0] = bstrdup(opt);
             options->argc = 1;
         } else {
             count = (options->argc + 2);
             size = sizeof(const char *);
             options->argv = breallocarray(options->argv, count, size);
-            options->argv[options->argc] = expand_string(opt, config);
+            options->argv[options->argc] = bstrdup(opt);
             options->argv[options->argc + 1] = NULL;
             options->argc++;
         }
@@ -435,15 +442,12 @@ split_options(char *string, struct options *options,
  * Takes the work struct as an argument and puts values into its array.
  */
 static void
-parse_options(FILE *script, struct work *work,
-              const struct script_config *config)
+parse_options(struct reader *script, struct work *work)
 {
     char *line, *group, *token;
-    size_t length;
     enum group_type type;
 
     for (line = readline(script); line != NULL; line = readline(script)) {
-        length = strlen(line);
         group = strtok(line, " ");
         if (group == NULL)
             bail("malformed script line");
@@ -454,12 +458,12 @@ parse_options(FILE *script, struct work *work,
         if (token == NULL || strcmp(token, "=") != 0)
             bail("malformed action line near %s", token);
         token = strtok(NULL, "");
-        split_options(token, &work->options[type], config);
+        split_options(token, &work->options[type]);
         free(line);
     }
     if (line != NULL) {
         free(line);
-        rewind_section(script, length);
+        rewind_section(script);
     }
 }
 
@@ -499,14 +503,12 @@ parse_call(char *token, struct action *action)
  * a linked list of actions.  Fails on any error in parsing.
  */
 static struct action *
-parse_run(FILE *script)
+parse_run(struct reader *script)
 {
     struct action *head = NULL, *current, *next;
     char *line, *token, *call;
-    size_t length;
 
     for (line = readline(script); line != NULL; line = readline(script)) {
-        length = strlen(line);
         token = strtok(line, " ");
         if (token[0] == '[')
             break;
@@ -531,7 +533,7 @@ parse_run(FILE *script)
         bail("empty run section in script");
     if (line != NULL) {
         free(line);
-        rewind_section(script, length);
+        rewind_section(script);
     }
     return head;
 }
@@ -545,13 +547,13 @@ parse_run(FILE *script)
  *     PRIORITY /output regex/
  *
  * where PRIORITY is replaced by the numeric syslog priority corresponding to
- * that priority and the rest of the output undergoes %-esacape expansion.
+ * that priority and the rest of the output will undergo %-escape expansion.
  * Returns the accumulated output as a vector.
  */
 static struct output *
-parse_output(FILE *script, const struct script_config *config)
+parse_output(struct reader *script)
 {
-    char *line, *token, *message;
+    char *line, *token;
     struct output *output = NULL;
     int priority;
 
@@ -564,9 +566,7 @@ parse_output(FILE *script, const struct script_config *config)
         token = strtok(NULL, "");
         if (token == NULL)
             bail("malformed line %s", line);
-        message = expand_string(token, config);
-        output_add(output, priority, message);
-        free(message);
+        output_add(output, priority, token);
         free(line);
     }
     return output;
@@ -584,18 +584,18 @@ parse_output(FILE *script, const struct script_config *config)
  *
  * If the type is error_msg or info, there is no response.  Otherwise,
  * everything after the last | is taken to be the response that should be
- * provided to that prompt.  The response undergoes %-escape expansion.
+ * provided to that prompt.  The prompt and response will undergo %-escape
+ * expansion.
  */
 static struct prompts *
-parse_prompts(FILE *script, const struct script_config *config)
+parse_prompts(struct reader *script)
 {
     struct prompts *prompts = NULL;
     struct prompt *prompt;
     char *line, *token, *style, *end;
-    size_t size, count, i, length;
+    size_t size, count, i;
 
     for (line = readline(script); line != NULL; line = readline(script)) {
-        length = strlen(line);
         token = strtok(line, " ");
         if (token[0] == '[')
             break;
@@ -621,53 +621,56 @@ parse_prompts(FILE *script, const struct script_config *config)
         prompt->style = string_to_style(style);
         token = strtok(NULL, "");
         if (prompt->style == PAM_ERROR_MSG || prompt->style == PAM_TEXT_INFO)
-            prompt->prompt = expand_string(token, config);
+            prompt->prompt = bstrdup(token);
         else {
             end = strrchr(token, '|');
             if (end == NULL)
                 bail("malformed prompt line near %s", prompt->prompt);
             *end = '\0';
-            prompt->prompt = expand_string(token, config);
+            prompt->prompt = bstrdup(token);
             token = end + 1;
-            prompt->response = expand_string(token, config);
+            prompt->response = bstrdup(token);
         }
         prompts->size++;
         free(line);
     }
     if (line != NULL) {
         free(line);
-        rewind_section(script, length);
+        rewind_section(script);
     }
     return prompts;
 }
 
 
 /*
- * Parse a PAM interaction script.  This handles parsing of the top-level
- * section markers and dispatches the parsing to other functions.  Returns the
- * total work to do as a work struct.
+ * Parse a PAM interaction script from its contents.  This handles parsing of
+ * the top-level section markers and dispatches the parsing to other
+ * functions.  Returns the total work to do as a work struct, with none of the
+ * strings yet %-escape expanded.
  */
 struct work *
-parse_script(FILE *script, const struct script_config *config)
+parse_script(const char *data, size_t length)
 {
     struct work *work;
+    struct reader reader;
     char *line, *token;
 
-    work = bmalloc(sizeof(struct work));
-    memset(work, 0, sizeof(struct work));
-    work->actions = NULL;
-    for (line = readline(script); line != NULL; line = readline(script)) {
+    reader.current = data;
+    reader.end = data + length;
+    reader.line = data;
+    work = bcalloc(1, sizeof(struct work));
+    for (line = readline(&reader); line != NULL; line = readline(&reader)) {
         token = strtok(line, " ");
         if (token[0] != '[')
             bail("line outside of section: %s", line);
         if (strcmp(token, "[options]") == 0)
-            parse_options(script, work, config);
+            parse_options(&reader, work);
         else if (strcmp(token, "[run]") == 0)
-            work->actions = parse_run(script);
+            work->actions = parse_run(&reader);
         else if (strcmp(token, "[output]") == 0)
-            work->output = parse_output(script, config);
+            work->output = parse_output(&reader);
         else if (strcmp(token, "[prompts]") == 0)
-            work->prompts = parse_prompts(script, config);
+            work->prompts = parse_prompts(&reader);
         else
             bail("unknown section: %s", token);
         free(line);
@@ -676,3 +679,70 @@ parse_script(FILE *script, const struct script_config *config)
         bail("no run section defined");
     return work;
 }
+
+
+/*
+ * Given the work parsed from a script, return a copy of it with all of the
+ * strings %-escape expanded using the provided configuration.  This allows a
+ * script to be parsed once and then run with any number of configurations.
+ */
+struct work *
+expand_work(const struct work *script, const struct script_config *config)
+{
+    struct work *work;
+    const struct action *action;
+    struct action *copy, **next;
+    const struct options *options;
+    const struct prompts *prompts;
+    char *line;
+    size_t i, j;
+
+    work = bcalloc(1, sizeof(struct work));
+    for (i = 0; i < ARRAY_SIZE(script->options); i++) {
+        options = &script->options[i];
+        if (options->argv == NULL)
+            continue;
+        work->options[i].argc = options->argc;
+        work->options[i].argv = bcalloc(options->argc + 1, sizeof(char *));
+        for (j = 0; j < (size_t) options->argc; j++) {
+            line = expand_string(options->argv[j], config);
+            work->options[i].argv[j] = line;
+        }
+    }
+    next = &work->actions;
+    for (action = script->actions; action != NULL; action = action->next) {
+        copy = bmalloc(sizeof(struct action));
+        *copy = *action;
+        copy->name = bstrdup(action->name);
+        copy->next = NULL;
+        *next = copy;
+        next = &copy->next;
+    }
+    if (script->output != NULL) {
+        work->output = output_new();
+        if (work->output == NULL)
+            sysbail("cannot allocate vector");
+        for (i = 0; i < script->output->count; i++) {
+            line = expand_string(script->output->lines[i].line, config);
+            output_add(work->output, script->output->lines[i].priority, line);
+            free(line);
+        }
+    }
+    if (script->prompts != NULL) {
+        prompts = script->prompts;
+        work->prompts = bcalloc(1, sizeof(struct prompts));
+        work->prompts->prompts = bcalloc(prompts->size,
+                                         sizeof(struct prompt));
+        work->prompts->size = prompts->size;
+        work->prompts->allocated = prompts->size;
+        for (i = 0; i < prompts->size; i++) {
+            work->prompts->prompts[i].style = prompts->prompts[i].style;
+            work->prompts->prompts[i].prompt
+                = expand_string(prompts->prompts[i].prompt, config);
+            if (prompts->prompts[i].response != NULL)
+                work->prompts->prompts[i].response
+                    = expand_string(prompts->prompts[i].response, config);
+        }
+    }
+    return work;
+}
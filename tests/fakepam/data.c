@@ -40,6 +40,96 @@
 /* Used for unused parameters to silence gcc warnings. */
 #define UNUSED __attribute__((__unused__))
 
+/*
+ * The initial size of the environment and data indexes, which must be a
+ * power of two.  An index is doubled in size whenever it would become more
+ * than half full.
+ */
+#define INDEX_MIN 16
+
+
+/*
+ * Hash a name of the given length with FNV-1a.
+ */
+static size_t
+hash_name(const char *name, size_t length)
+{
+    size_t hash = 2166136261UL;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+
+/*
+ * Return the slot in the data index for the given name, which either holds
+ * the data item of that name or is empty.  The index must exist.
+ */
+static size_t
+data_slot(const pam_handle_t *pamh, const char *name)
+{
+    size_t mask = pamh->data_buckets - 1;
+    size_t slot;
+
+    slot = hash_name(name, strlen(name)) & mask;
+    while (pamh->data_index[slot] != NULL) {
+        if (strcmp(pamh->data_index[slot]->name, name) == 0)
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+
+/*
+ * Replace the data index with a new one of the given size holding all of the
+ * current data items.  Returns false on memory allocation failure, leaving
+ * the existing index unchanged.
+ */
+static bool
+data_reindex(pam_handle_t *pamh, size_t buckets)
+{
+    struct fakepam_data **index;
+    struct fakepam_data *item;
+
+    index = calloc(buckets, sizeof(struct fakepam_data *));
+    if (index == NULL)
+        return false;
+    free(pamh->data_index);
+    pamh->data_index = index;
+    pamh->data_buckets = buckets;
+    for (item = pamh->data; item != NULL; item = item->next)
+        index[data_slot(pamh, item->name)] = item;
+    return true;
+}
+
+
+/*
+ * Return the slot in the environment index for the variable whose name has
+ * the given length, which either holds the position of that variable or is
+ * empty.  The index must exist.
+ */
+static size_t
+env_slot(const pam_handle_t *pamh, const char *name, size_t length)
+{
+    size_t mask = pamh->env_buckets - 1;
+    size_t slot, position;
+    const char *setting;
+
+    slot = hash_name(name, length) & mask;
+    while ((position = pamh->env_index[slot]) != 0) {
+        setting = pamh->environ[position - 1];
+        if (strncmp(setting, name, length) == 0 && setting[length] == '=')
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
 
 /*
  * Return a stored PAM data element in the provided data variable.  As a
@@ -50,14 +140,13 @@ pam_get_data(const pam_handle_t *pamh, const char *name, const void **data)
 {
     struct fakepam_data *item;
 
-    for (item = pamh->data; item != NULL; item = item->next)
-        if (strcmp(item->name, name) == 0) {
-            if (item->data == NULL)
-                return PAM_NO_MODULE_DATA;
-            *data = item->data;
-            return PAM_SUCCESS;
-        }
-    return PAM_NO_MODULE_DATA;
+    if (pamh->data_index == NULL)
+        return PAM_NO_MODULE_DATA;
+    item = pamh->data_index[data_slot(pamh, name)];
+    if (item == NULL || item->data == NULL)
+        return PAM_NO_MODULE_DATA;
+    *data = item->data;
+    return PAM_SUCCESS;
 }
 
 
@@ -70,15 +159,28 @@ pam_set_data(pam_handle_t *pamh, const char *item, void *data,
              void (*cleanup)(pam_handle_t *, void *, int))
 {
     struct fakepam_data *p;
+    size_t slot;
 
-    for (p = pamh->data; p != NULL; p = p->next)
-        if (strcmp(p->name, item) == 0) {
-            if (p->cleanup != NULL)
-                p->cleanup (pamh, p->data, PAM_SUCCESS);
-            p->data = data;
-            p->cleanup = cleanup;
-            return PAM_SUCCESS;
-        }
+    /* Create or grow the index if needed before adding a new item. */
+    if (pamh->data_index == NULL)
+        if (!data_reindex(pamh, INDEX_MIN))
+            return PAM_BUF_ERR;
+    slot = data_slot(pamh, item);
+    p = pamh->data_index[slot];
+    if (p != NULL) {
+        if (p->cleanup != NULL)
+            p->cleanup (pamh, p->data, PAM_SUCCESS);
+        p->data = data;
+        p->cleanup = cleanup;
+        return PAM_SUCCESS;
+    }
+    if ((pamh->data_count + 1) * 2 > pamh->data_buckets) {
+        if (!data_reindex(pamh, pamh->data_buckets * 2))
+            return PAM_BUF_ERR;
+        slot = data_slot(pamh, item);
+    }
+
+    /* Add the new item. */
     p = malloc(sizeof(struct fakepam_data));
     if (p == NULL)
         return PAM_BUF_ERR;
@@ -91,6 +193,8 @@ pam_set_data(pam_handle_t *pamh, const char *item, void *data,
     p->cleanup = cleanup;
     p->next = pamh->data;
     pamh->data = p;
+    pamh->data_index[slot] = p;
+    pamh->data_count++;
     return PAM_SUCCESS;
 }
 
@@ -208,15 +312,15 @@ pam_get_user(pam_handle_t *pamh, PAM_CONST char **user,
 PAM_CONST char *
 pam_getenv(pam_handle_t *pamh, const char *name)
 {
-    size_t i;
+    size_t length, position;
 
-    if (pamh->environ == NULL)
+    if (pamh->env_index == NULL)
         return NULL;
-    for (i = 0; pamh->environ[i] != NULL; i++)
-        if (strncmp(name, pamh->environ[i], strlen(name)) == 0
-            && pamh->environ[i][strlen(name)] == '=')
-            return pamh->environ[i] + strlen(name) + 1;
-    return NULL;
+    length = strlen(name);
+    position = pamh->env_index[env_slot(pamh, name, length)];
+    if (position == 0)
+        return NULL;
+    return pamh->environ[position - 1] + length + 1;
 }
 
 
@@ -235,10 +339,9 @@ pam_getenvlist(pam_handle_t *pamh)
         if (pamh->environ == NULL)
             return NULL;
         pamh->environ[0] = NULL;
+        pamh->env_allocated = 1;
     }
-    for (i = 0; pamh->environ[i] != NULL; i++)
-        ;
-    env = calloc(i + 1, sizeof(char *));
+    env = calloc(pamh->env_count + 1, sizeof(char *));
     if (env == NULL)
         return NULL;
     for (i = 0; pamh->environ[i] != NULL; i++) {
@@ -257,6 +360,37 @@ fail:
 }
 
 
+#ifdef HAVE_PAM_GETENV
+
+/*
+ * Rebuild the environment index at the given size from environ, reusing the
+ * current index if it's already that size.  Returns false on memory
+ * allocation failure, leaving the existing index unchanged.
+ */
+static bool
+env_reindex(pam_handle_t *pamh, size_t buckets)
+{
+    size_t *index;
+    size_t i, length;
+
+    if (pamh->env_index != NULL && pamh->env_buckets == buckets)
+        memset(pamh->env_index, 0, buckets * sizeof(size_t));
+    else {
+        index = calloc(buckets, sizeof(size_t));
+        if (index == NULL)
+            return false;
+        free(pamh->env_index);
+        pamh->env_index = index;
+        pamh->env_buckets = buckets;
+    }
+    for (i = 0; i < pamh->env_count; i++) {
+        length = strcspn(pamh->environ[i], "=");
+        pamh->env_index[env_slot(pamh, pamh->environ[i], length)] = i + 1;
+    }
+    return true;
+}
+
+
 /*
  * Add a setting to the PAM environment.  If there is another existing
  * variable with the same value, the value is replaced, unless the setting
@@ -268,16 +402,13 @@ fail:
  * main environment.  For our tests to work on that platform, we therefore
  * have to do the same thing.
  */
-#ifdef HAVE_PAM_GETENV
 int
 pam_putenv(pam_handle_t *pamh, const char *setting)
 {
-    char *copy;
+    char *copy = NULL;
     const char *equals;
-    size_t namelen;
+    size_t namelen, slot, position, i, size;
     bool delete = false;
-    bool found = false;
-    size_t i, j;
     char **env;
 
     if (setting == NULL)
@@ -289,56 +420,65 @@ pam_putenv(pam_handle_t *pamh, const char *setting)
         delete = true;
         namelen = strlen(setting);
     }
-    if (!delete) {
-        copy = strdup(setting);
-        if (copy == NULL)
-            return PAM_BUF_ERR;
-    }
 
-    /* Handle the first call to pam_putenv. */
-    if (pamh->environ == NULL) {
+    /* Look up any existing variable of that name. */
+    if (pamh->env_index == NULL) {
         if (delete)
             return PAM_SYMBOL_ERR;
-        pamh->environ = calloc(2, sizeof(char *));
-        if (pamh->environ == NULL) {
-            free(copy);
+        if (!env_reindex(pamh, INDEX_MIN))
             return PAM_BUF_ERR;
-        }
-        pamh->environ[0] = copy;
-        pamh->environ[1] = NULL;
-        return PAM_SUCCESS;
     }
+    slot = env_slot(pamh, setting, namelen);
+    position = pamh->env_index[slot];
 
     /*
-     * We have an existing array.  See if we're replacing a value, deleting a
-     * value, or adding a new one.  When deleting, waste a bit of memory but
-     * save some time by not bothering to reduce the size of the array.
+     * When deleting, keep the order of the remaining variables, which means
+     * the positions of all the later ones change and the index has to be
+     * rebuilt.  Waste a bit of memory but save some time by not bothering to
+     * reduce the size of the array.
      */
-    for (i = 0; pamh->environ[i] != NULL; i++)
-        if (strncmp(setting, pamh->environ[i], namelen) == 0
-            && pamh->environ[i][namelen] == '=') {
-            if (delete) {
-                free(pamh->environ[i]);
-                for (j = i + 1; pamh->environ[j] != NULL; i++, j++)
-                    pamh->environ[i] = pamh->environ[j];
-                pamh->environ[i] = NULL;
-            } else {
-                free(pamh->environ[i]);
-                pamh->environ[i] = copy;
-            }
-            found = true;
-            break;
-        }
-    if (!found) {
-        if (delete)
+    if (delete) {
+        if (position == 0)
             return PAM_SYMBOL_ERR;
-        env = reallocarray(pamh->environ, (i + 2), sizeof(char *));
-        if (env == NULL)
+        i = position - 1;
+        free(pamh->environ[i]);
+        memmove(pamh->environ + i, pamh->environ + i + 1,
+                (pamh->env_count - i) * sizeof(char *));
+        pamh->env_count--;
+        env_reindex(pamh, pamh->env_buckets);
+        return PAM_SUCCESS;
+    }
+
+    /* We're replacing a value or adding a new one. */
+    copy = strdup(setting);
+    if (copy == NULL)
+        return PAM_BUF_ERR;
+    if (position != 0) {
+        free(pamh->environ[position - 1]);
+        pamh->environ[position - 1] = copy;
+        return PAM_SUCCESS;
+    }
+    if (pamh->env_count + 2 > pamh->env_allocated) {
+        size = pamh->env_allocated < 4 ? 8 : pamh->env_allocated * 2;
+        env = reallocarray(pamh->environ, size, sizeof(char *));
+        if (env == NULL) {
+            free(copy);
             return PAM_BUF_ERR;
+        }
         pamh->environ = env;
-        pamh->environ[i] = copy;
-        pamh->environ[i + 1] = NULL;
+        pamh->env_allocated = size;
+    }
+    if ((pamh->env_count + 1) * 2 > pamh->env_buckets) {
+        if (!env_reindex(pamh, pamh->env_buckets * 2)) {
+            free(copy);
+            return PAM_BUF_ERR;
+        }
+        slot = env_slot(pamh, setting, namelen);
     }
+    pamh->environ[pamh->env_count] = copy;
+    pamh->env_count++;
+    pamh->environ[pamh->env_count] = NULL;
+    pamh->env_index[slot] = pamh->env_count;
     return PAM_SUCCESS;
 }
 
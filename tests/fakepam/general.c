@@ -85,6 +85,7 @@ pam_end(pam_handle_t *pamh, int status)
             free(pamh->environ[i]);
         free(pamh->environ);
     }
+    free(pamh->env_index);
     free(pamh->authtok);
     free(pamh->oldauthtok);
     free(pamh->rhost);
@@ -98,6 +99,7 @@ pam_end(pam_handle_t *pamh, int status)
         free(item);
         item = next;
     }
+    free(pamh->data_index);
     free(pamh);
     return PAM_SUCCESS;
 }
@@ -32,6 +32,7 @@
 
 #include <portable/pam.h>
 #include <sys/types.h>
+#include <time.h>
 
 /* Forward declarations to avoid unnecessary includes. */
 struct output;
@@ -93,6 +94,24 @@ struct work {
     struct output *output;
 };
 
+/*
+ * A script that has been read and parsed but not yet %-escape expanded, along
+ * with the identity of the file it was read from so that a cached copy can be
+ * checked against the file.  Modification times only have a resolution of a
+ * second, so a script read in the same second that it was modified could
+ * still change without the identity changing and is never reused.
+ */
+struct script {
+    char *file;                 /* Name the script was loaded with. */
+    struct work *work;          /* Parsed but unexpanded script. */
+    dev_t device;               /* Device of the script file. */
+    ino_t inode;                /* Inode of the script file. */
+    off_t size;                 /* Size of the script file. */
+    time_t mtime;               /* Modification time of the script file. */
+    bool cacheable;             /* Whether read after the mtime second. */
+    struct script *next;        /* Next script in the cache. */
+};
+
 BEGIN_DECLS
 
 
@@ -104,10 +123,22 @@ void output_add(struct output *, int, const char *);
 
 
 /*
- * Parse a PAM interaction script.  Returns the total work to do as a work
- * struct.
+ * Parse the contents of a PAM interaction script.  Returns the total work to
+ * do as a work struct, with none of the strings yet %-escape expanded.
+ * expand_work returns a copy of such a work struct with the strings expanded
+ * using the given configuration.
+ */
+struct work *parse_script(const char *, size_t);
+struct work *expand_work(const struct work *, const struct script_config *);
+
+/*
+ * Load a PAM interaction script, which may be a path or relative to SOURCE or
+ * BUILD, and return the work to do, expanded using the given configuration.
+ * The parsed script is cached, so loading it again doesn't read the file
+ * unless it has changed.  free_work frees the resulting work struct.
  */
-struct work *parse_script(FILE *, const struct script_config *);
+struct work *load_script(const char *file, const struct script_config *);
+void free_work(struct work *);
 
 END_DECLS
 
@@ -44,8 +44,16 @@
 /* Used for unused parameters to silence gcc warnings. */
 #define UNUSED __attribute__((__unused__))
 
-/* The struct used to accumulate log messages. */
+/*
+ * The struct used to accumulate log messages.  Where possible, each thread
+ * has its own so that the benchmark harness can run scripts in several
+ * threads at once.
+ */
+#ifdef HAVE_THREAD_LOCAL
+static THREAD_LOCAL struct output *messages = NULL;
+#else
 static struct output *messages = NULL;
+#endif
 
 
 /*
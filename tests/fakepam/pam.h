@@ -47,7 +47,12 @@ struct fakepam_data {
     struct fakepam_data *next;
 };
 
-/* This is an opaque data structure, so we can put whatever we want in it. */
+/*
+ * This is an opaque data structure, so we can put whatever we want in it.
+ * The environment and the data items are each indexed by name with an open
+ * addressing hash table whose size is a power of two.  env_index holds the
+ * position in environ of each variable plus one, and zero for an empty slot.
+ */
 struct pam_handle {
     const char *service;
     const char *user;
@@ -58,7 +63,14 @@ struct pam_handle {
     char *tty;
     const struct pam_conv *conversation;
     char **environ;
+    size_t env_count;
+    size_t env_allocated;
+    size_t *env_index;
+    size_t env_buckets;
     struct fakepam_data *data;
+    struct fakepam_data **data_index;
+    size_t data_count;
+    size_t data_buckets;
     struct passwd *pwd;
 };
 
@@ -39,10 +39,16 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #ifdef HAVE_REGCOMP
 # include <regex.h>
 #endif
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
+#include <sys/stat.h>
 #include <syslog.h>
+#include <time.h>
 
 #include <tests/fakepam/internal.h>
 #include <tests/fakepam/pam.h>
@@ -51,6 +57,9 @@
 #include <tests/tap/macros.h>
 #include <tests/tap/string.h>
 
+/* Scripts already loaded, so that running one again doesn't parse it again. */
+static struct script *cache = NULL;
+
 
 /*
  * Compare a regex to a string.  If regular expression support isn't
@@ -251,27 +260,14 @@ check_output(const struct output *wanted, const struct output *seen)
         
 
 /*
- * The core of the work.  Given the path to a PAM interaction script, which
- * may be relative to SOURCE or BUILD, the user (may be NULL), and the stored
- * password (may be NULL), run that script, outputing the results in TAP
- * format.
+ * Given the name of a PAM interaction script, which may be relative to SOURCE
+ * or BUILD, return the path to it in newly allocated memory.
  */
-void
-run_script(const char *file, const struct script_config *config)
+static char *
+script_path(const char *file)
 {
     char *path;
-    struct output *output;
-    FILE *script;
-    struct work *work;
-    struct options *opts;
-    struct action *action, *oaction;
-    struct pam_conv conv = { NULL, NULL };
-    pam_handle_t *pamh;
-    int status;
-    size_t i, j;
-    const char *argv_empty[] = { NULL };
 
-    /* Open and parse the script. */
     if (access(file, R_OK) == 0)
         path = bstrdup(file);
     else {
@@ -279,12 +275,232 @@ run_script(const char *file, const struct script_config *config)
         if (path == NULL)
             bail("cannot find PAM script %s", file);
     }
-    script = fopen(path, "r");
-    if (script == NULL)
+    return path;
+}
+
+
+/*
+ * Read and parse the script at the given path, recording the identity of the
+ * file.  The contents are mapped into memory where possible rather than
+ * copied.  Calls bail on any error.
+ */
+static struct script *
+read_script(const char *file, const char *path)
+{
+    struct script *script;
+    struct stat st;
+    const char *contents = "";
+    char *data = NULL;
+    size_t length;
+    int fd;
+#ifndef HAVE_MMAP
+    ssize_t status;
+    size_t done;
+#endif
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
         sysbail("cannot open %s", path);
-    work = parse_script(script, config);
-    fclose(script);
-    diag("Starting %s", file);
+    if (fstat(fd, &st) < 0)
+        sysbail("cannot stat %s", path);
+    length = (size_t) st.st_size;
+#ifdef HAVE_MMAP
+    if (length > 0) {
+        data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+            sysbail("cannot map %s", path);
+        contents = data;
+    }
+#else
+    data = bmalloc(length + 1);
+    for (done = 0; done < length; done += (size_t) status) {
+        status = read(fd, data + done, length - done);
+        if (status < 0)
+            sysbail("cannot read %s", path);
+        if (status == 0)
+            break;
+    }
+    length = done;
+    contents = data;
+#endif
+    close(fd);
+
+    /* Parse the script and record where it came from. */
+    script = bcalloc(1, sizeof(struct script));
+    script->file = bstrdup(file);
+    script->work = parse_script(contents, length);
+    script->device = st.st_dev;
+    script->inode = st.st_ino;
+    script->size = st.st_size;
+    script->mtime = st.st_mtime;
+    script->cacheable = (time(NULL) > st.st_mtime);
+#ifdef HAVE_MMAP
+    if (data != NULL)
+        munmap(data, length);
+#else
+    free(data);
+#endif
+    return script;
+}
+
+
+/*
+ * Free the cache of loaded scripts.  Registered as a test cleanup function.
+ */
+static void
+cache_free(int success UNUSED, int primary UNUSED)
+{
+    struct script *script, *next;
+
+    for (script = cache; script != NULL; script = next) {
+        next = script->next;
+        free_script(script);
+    }
+    cache = NULL;
+}
+
+
+/*
+ * Return the parsed script for the given file name from the cache, loading
+ * it first if it isn't there or if the file has changed since it was loaded.
+ * A script read in the second it was last modified is always read again,
+ * since a rewrite of the same size within that second wouldn't change its
+ * modification time.  Calls bail on any error.
+ */
+static const struct script *
+cached_script(const char *file)
+{
+    struct script *script, **prev;
+    struct stat st;
+    char *path;
+
+    path = script_path(file);
+    if (stat(path, &st) < 0)
+        sysbail("cannot stat %s", path);
+    for (prev = &cache; *prev != NULL; prev = &(*prev)->next) {
+        script = *prev;
+        if (strcmp(script->file, file) != 0)
+            continue;
+        if (script->cacheable && script->device == st.st_dev
+            && script->inode == st.st_ino && script->size == st.st_size
+            && script->mtime == st.st_mtime) {
+            free(path);
+            return script;
+        }
+        *prev = script->next;
+        free_script(script);
+        break;
+    }
+    if (cache == NULL)
+        test_cleanup_register(cache_free);
+    script = read_script(file, path);
+    free(path);
+    script->next = cache;
+    cache = script;
+    return script;
+}
+
+
+/*
+ * Given the path to a PAM interaction script, which may be relative to SOURCE
+ * or BUILD, load it and expand it with the given configuration.  Calls bail
+ * on any error.
+ */
+struct work *
+load_script(const char *file, const struct script_config *config)
+{
+    return expand_work(cached_script(file)->work, config);
+}
+
+
+/*
+ * Free the work struct for a script.
+ */
+void
+free_work(struct work *work)
+{
+    struct action *action, *oaction;
+    size_t i, j;
+
+    action = work->actions;
+    while (action != NULL) {
+        free(action->name);
+        oaction = action;
+        action = action->next;
+        free(oaction);
+    }
+    for (i = 0; i < ARRAY_SIZE(work->options); i++)
+        if (work->options[i].argv != NULL) {
+            for (j = 0; work->options[i].argv[j] != NULL; j++)
+                free(work->options[i].argv[j]);
+            free(work->options[i].argv);
+        }
+    if (work->output)
+        pam_output_free(work->output);
+    if (work->prompts != NULL) {
+        for (i = 0; i < work->prompts->size; i++) {
+            free(work->prompts->prompts[i].prompt);
+            free(work->prompts->prompts[i].response);
+        }
+        free(work->prompts->prompts);
+        free(work->prompts);
+    }
+    free(work);
+}
+
+
+/*
+ * Read and parse a PAM interaction script, which may be relative to SOURCE or
+ * BUILD, so that it can be run repeatedly.  Calls bail on any error.
+ */
+struct script *
+compile_script(const char *file)
+{
+    struct script *script;
+    char *path;
+
+    path = script_path(file);
+    script = read_script(file, path);
+    free(path);
+    return script;
+}
+
+
+/*
+ * Free a compiled script.
+ */
+void
+free_script(struct script *script)
+{
+    if (script == NULL)
+        return;
+    free_work(script->work);
+    free(script->file);
+    free(script);
+}
+
+
+/*
+ * The core of the work.  Given a compiled PAM interaction script and the
+ * configuration, including the user (may be NULL) and the stored password
+ * (may be NULL), run that script, outputing the results in TAP format.
+ */
+void
+run_compiled_script(const struct script *script,
+                    const struct script_config *config)
+{
+    struct output *output;
+    struct work *work;
+    struct options *opts;
+    struct action *action;
+    struct pam_conv conv = { NULL, NULL };
+    pam_handle_t *pamh;
+    int status;
+    const char *argv_empty[] = { NULL };
+
+    /* Expand the script for this configuration. */
+    work = expand_work(script->work, config);
+    diag("Starting %s", script->file);
     if (work->prompts != NULL) {
         conv.conv = converse;
         conv.appdata_ptr = work->prompts;
@@ -320,31 +536,19 @@ run_script(const char *file, const struct script_config *config)
 
     /* Free memory and return. */
     pam_end(pamh, PAM_SUCCESS);
-    action = work->actions;
-    while (action != NULL) {
-        free(action->name);
-        oaction = action;
-        action = action->next;
-        free(oaction);
-    }
-    for (i = 0; i < ARRAY_SIZE(work->options); i++)
-        if (work->options[i].argv != NULL) {
-            for (j = 0; work->options[i].argv[j] != NULL; j++)
-                free(work->options[i].argv[j]);
-            free(work->options[i].argv);
-        }
-    if (work->output)
-        pam_output_free(work->output);
-    if (work->prompts != NULL) {
-        for (i = 0; i < work->prompts->size; i++) {
-            free(work->prompts->prompts[i].prompt);
-            free(work->prompts->prompts[i].response);
-        }
-        free(work->prompts->prompts);
-        free(work->prompts);
-    }
-    free(work);
-    free(path);
+    free_work(work);
+}
+
+
+/*
+ * Given the path to a PAM interaction script, which may be relative to SOURCE
+ * or BUILD, and the configuration, run that script, outputing the results in
+ * TAP format.
+ */
+void
+run_script(const char *file, const struct script_config *config)
+{
+    run_compiled_script(cached_script(file), config);
 }
 
 
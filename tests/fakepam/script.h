@@ -44,6 +44,9 @@ struct script_config;
 typedef void (*script_callback)(pam_handle_t *, const struct script_config *,
                                 void *);
 
+/* A compiled PAM interaction script. */
+struct script;
+
 /* Configuration for the PAM interaction script API. */
 struct script_config {
     const char *user;           /* Username to pass into pam_start (%u). */
@@ -62,11 +65,25 @@ BEGIN_DECLS
  * Given the file name of an interaction script (which may be a full path or
  * relative to SOURCE or BUILD) and configuration containing other parameters
  * such as the user, run that script, reporting the results via the TAP
- * format.
+ * format.  The parsed script is kept, so running the same script again, such
+ * as with a different configuration, only reads it again if the file has
+ * changed.
  */
 void run_script(const char *file, const struct script_config *)
     __attribute__((__nonnull__));
 
+/*
+ * Read and parse an interaction script once so that it can be run any number
+ * of times, with different configurations, by run_compiled_script without
+ * touching the file again.  The %-escapes are expanded for each run.  The
+ * compiled script must be freed with free_script.
+ */
+struct script *compile_script(const char *file)
+    __attribute__((__malloc__, __nonnull__));
+void run_compiled_script(const struct script *, const struct script_config *)
+    __attribute__((__nonnull__));
+void free_script(struct script *);
+
 /*
  * The same as run_script, but run every script found in the given directory,
  * skipping file names that contain characters other than alphanumerics and -.
@@ -31,9 +31,12 @@
 #include <portable/pam.h>
 #include <portable/system.h>
 
+#include <fcntl.h>
+
 #include <pam-util/args.h>
 #include <tests/fakepam/pam.h>
 #include <tests/tap/basic.h>
+#include <tests/tap/string.h>
 
 
 int
@@ -42,8 +45,18 @@ main(void)
     pam_handle_t *pamh;
     struct pam_conv conv = { NULL, NULL };
     struct pam_args *args;
+    char *small, *large, *block;
+    bool okay;
+    size_t i;
+#ifdef HAVE_KRB5
+    pam_handle_t *other;
+    struct pam_args *other_args;
+    krb5_context ctx;
+    char *tmpdir, *path, *realm;
+    int fd;
+#endif
 
-    plan(12);
+    plan(23);
 
     if (pam_start("test", NULL, &conv, &pamh) != PAM_SUCCESS)
         sysbail("Fake PAM initialization failed");
@@ -75,10 +88,93 @@ main(void)
         is_int(args->silent, true, "...and silent is true");
     putil_args_free(args);
 
+    /* Memory allocated with the args struct. */
+    args = putil_args_new(pamh, 0);
+    if (args == NULL)
+        bail("cannot create args struct");
+    small = putil_args_alloc(args, 10);
+    ok(small != NULL && (uintptr_t) small % sizeof(void *) == 0,
+       "Allocating memory with the args struct");
+    large = putil_args_alloc(args, 100000);
+    ok(large != NULL, "...including more than a chunk");
+    memset(large, 'a', 100000);
+    okay = true;
+    for (i = 0; i < 1000; i++) {
+        block = putil_args_alloc(args, 100);
+        if (block == NULL || !putil_args_owns(args, block + 99))
+            okay = false;
+        else
+            memset(block, 'b', 100);
+    }
+    ok(okay, "...and many small allocations");
+    ok(putil_args_owns(args, small) && putil_args_owns(args, large + 99999),
+       "...which the args struct owns");
+    ok(!putil_args_owns(args, args), "...but not other memory");
+    putil_args_free(args);
+
     putil_args_free(NULL);
     ok(1, "Freeing a NULL args struct works");
 
     pam_end(pamh, 0);
 
+    /* Cached Kerberos contexts. */
+#ifdef HAVE_KRB5
+    if (pam_start("test", NULL, &conv, &pamh) != PAM_SUCCESS)
+        sysbail("Fake PAM initialization failed");
+    args = putil_args_new_cached(pamh, 0);
+    if (args == NULL)
+        bail("cannot create cached args struct");
+    ok(args->ctx != NULL, "Cached Kerberos context is initialized");
+    ctx = args->ctx;
+    putil_args_free(args);
+    args = putil_args_new_cached(pamh, 0);
+    ok(args->ctx == ctx, "...and reused within a PAM session");
+    if (pam_start("test", NULL, &conv, &other) != PAM_SUCCESS)
+        sysbail("Fake PAM initialization failed");
+    other_args = putil_args_new_cached(other, 0);
+    ok(other_args->ctx != ctx, "...and not shared with another session");
+    putil_args_free(other_args);
+    if (krb5_set_default_realm(args->ctx, "CACHE.INVALID") != 0)
+        bail("cannot set default realm");
+    putil_args_free(args);
+    pam_end(pamh, 0);
+    pam_end(other, 0);
+    if (pam_start("test", NULL, &conv, &pamh) != PAM_SUCCESS)
+        sysbail("Fake PAM initialization failed");
+    args = putil_args_new_cached(pamh, 0);
+    ok(args->ctx == ctx, "...and reused by the next session");
+    realm = NULL;
+    if (krb5_get_default_realm(args->ctx, &realm) != 0)
+        realm = NULL;
+    ok(realm == NULL || strcmp(realm, "CACHE.INVALID") != 0,
+       "...with the default realm reset");
+    if (realm != NULL)
+        krb5_free_default_realm(args->ctx, realm);
+    putil_args_free(args);
+    pam_end(pamh, 0);
+
+    /* A configuration change discards the cached context. */
+    tmpdir = test_tmpdir();
+    basprintf(&path, "%s/args-krb5.conf", tmpdir);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        sysbail("cannot create %s", path);
+    close(fd);
+    if (setenv("KRB5_CONFIG", path, 1) < 0)
+        sysbail("cannot set KRB5_CONFIG");
+    if (pam_start("test", NULL, &conv, &pamh) != PAM_SUCCESS)
+        sysbail("Fake PAM initialization failed");
+    args = putil_args_new_cached(pamh, 0);
+    ok(args != NULL && args->ctx != NULL,
+       "New cached context after configuration change");
+    putil_args_free(args);
+    pam_end(pamh, 0);
+    unlink(path);
+    free(path);
+    test_tmpdir_free(tmpdir);
+#else
+    skip_block(6, "Kerberos support not configured");
+#endif
+
     return 0;
 }
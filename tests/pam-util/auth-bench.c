@@ -0,0 +1,327 @@
+/*
+ * End-to-end benchmark for a PAM module built with pam-util.
+ *
+ * Defines a minimal PAM module that does what a typical module built with
+ * pam-util does on every call (creating the PAM arguments, setting the option
+ * defaults, reading options from krb5.conf, parsing the PAM arguments,
+ * logging entry and debugging messages, and prompting for a password when
+ * authenticating) and runs an authentication script against it through the
+ * fake PAM library, in one or more threads.  Reports the authentication rate,
+ * the latency percentiles of each authentication, and how much of that time
+ * was spent in each of the pam-util phases.
+ *
+ * Usage: auth-bench [<runs> [<threads>]]
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/pam.h>
+#include <portable/system.h>
+
+#include <time.h>
+#include <utime.h>
+
+#include <pam-util/args.h>
+#include <pam-util/logging.h>
+#include <pam-util/options.h>
+#include <pam-util/vector.h>
+#include <tests/fakepam/bench.h>
+#include <tests/fakepam/pam.h>
+#include <tests/fakepam/script.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/string.h>
+
+/* The phases of each PAM call that are timed. */
+enum phase {
+    PHASE_ARGS,
+    PHASE_DEFAULTS,
+    PHASE_KRB5,
+    PHASE_PARSE,
+    PHASE_LOGGING,
+    PHASE_CLEANUP,
+    PHASE_MAX
+};
+static const char *const phase_names[PHASE_MAX] = {
+    "args_new", "defaults", "krb5 config", "parse", "logging", "cleanup"
+};
+
+/* The configuration of the benchmark module. */
+struct pam_config {
+    struct vector *cells;
+    bool debug;
+#ifdef HAVE_KRB5
+    krb5_deltat expires;
+#else
+    long expires;
+#endif
+    bool ignore_root;
+    long minimum_uid;
+    char *program;
+};
+
+/* The options of the benchmark module. */
+#define K(name) (#name), offsetof(struct pam_config, name)
+static const struct option options[] = {
+    { K(cells),       true,  LIST    (NULL)         },
+    { K(debug),       true,  BOOL    (false)        },
+    { K(expires),     true,  TIME    (10)           },
+    { K(ignore_root), false, BOOL    (true)         },
+    { K(minimum_uid), true,  NUMBER  (0)            },
+    { K(program),     true,  STRING  ("/bin/false") },
+};
+static const size_t optlen = sizeof(options) / sizeof(options[0]);
+
+/* The script run by the benchmark. */
+static const char script[] = "[options]\n"
+    "    auth = debug cells=stanford.edu,ir.stanford.edu expires=3600"
+    " minimum_uid=1000 program=/bin/true\n"
+    "\n"
+    "[run]\n"
+    "    authenticate = PAM_SUCCESS\n"
+    "    setcred(ESTABLISH_CRED) = PAM_SUCCESS\n"
+    "\n"
+    "[prompts]\n"
+    "    echo_off = Password: |%p\n";
+
+#ifdef HAVE_KRB5
+/* The krb5.conf file used by the benchmark. */
+static const char krb5_conf[] = "[libdefaults]\n"
+    "    default_realm = BENCH.REALM\n"
+    "\n"
+    "[appdefaults]\n"
+    "    bench = {\n"
+    "        expires = 1800\n"
+    "        ignore_root = true\n"
+    "    }\n"
+    "    minimum_uid = 100\n";
+#endif
+
+
+/*
+ * Prompt for the password through the conversation function, the way a
+ * module authenticating the user would, and return a PAM status.
+ */
+static int
+prompt_password(pam_handle_t *pamh)
+{
+    const struct pam_conv *conv;
+    const struct pam_message message = { PAM_PROMPT_ECHO_OFF, "Password: " };
+    const struct pam_message *messages = &message;
+    struct pam_response *response = NULL;
+    int status;
+
+    status = pam_get_item(pamh, PAM_CONV, (PAM_CONST void **) &conv);
+    if (status != PAM_SUCCESS || conv == NULL || conv->conv == NULL)
+        return PAM_CONV_ERR;
+    status = conv->conv(1, &messages, &response, conv->appdata_ptr);
+    if (status != PAM_SUCCESS)
+        return status;
+    if (response == NULL)
+        return PAM_CONV_ERR;
+    if (response->resp == NULL)
+        status = PAM_AUTH_ERR;
+    free(response->resp);
+    free(response);
+    return status;
+}
+
+
+/*
+ * The body of every call of the benchmark module, timing each phase.
+ */
+static int
+run_module(pam_handle_t *pamh, const char *func, int flags, int argc,
+           const char **argv, bool prompt)
+{
+    struct pam_args *args;
+    struct pam_config *config;
+    struct timespec start;
+    int status = PAM_SUCCESS;
+
+    bench_time(&start);
+    args = putil_args_new_cached(pamh, flags);
+    if (args == NULL)
+        return PAM_SERVICE_ERR;
+    bench_phase(PHASE_ARGS, &start);
+
+    bench_time(&start);
+    config = calloc(1, sizeof(struct pam_config));
+    if (config == NULL) {
+        putil_args_free(args);
+        return PAM_BUF_ERR;
+    }
+    args->config = config;
+    if (!putil_args_defaults_shared(args, options, optlen))
+        status = PAM_BUF_ERR;
+    bench_phase(PHASE_DEFAULTS, &start);
+
+    bench_time(&start);
+    if (status == PAM_SUCCESS && !putil_args_krb5(args, "bench", options,
+                                                  optlen))
+        status = PAM_SERVICE_ERR;
+    bench_phase(PHASE_KRB5, &start);
+
+    bench_time(&start);
+    if (status == PAM_SUCCESS
+        && !putil_args_parse(args, argc, argv, options, optlen))
+        status = PAM_SERVICE_ERR;
+    args->debug = config->debug;
+    bench_phase(PHASE_PARSE, &start);
+
+    bench_time(&start);
+    putil_log_entry(args, func, flags);
+    putil_debug(args, "minimum UID %ld, program %s", config->minimum_uid,
+                config->program);
+    bench_phase(PHASE_LOGGING, &start);
+
+    if (status == PAM_SUCCESS && prompt)
+        status = prompt_password(pamh);
+
+    bench_time(&start);
+    putil_args_config_free(args, options, optlen);
+    free(config);
+    args->config = NULL;
+    putil_args_free(args);
+    bench_phase(PHASE_CLEANUP, &start);
+    return status;
+}
+
+
+/* The PAM module interface. */
+int
+pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc,
+                    const char **argv)
+{
+    return run_module(pamh, "pam_sm_authenticate", flags, argc, argv, true);
+}
+
+int
+pam_sm_setcred(pam_handle_t *pamh, int flags, int argc, const char **argv)
+{
+    return run_module(pamh, "pam_sm_setcred", flags, argc, argv, false);
+}
+
+int
+pam_sm_acct_mgmt(pam_handle_t *pamh, int flags, int argc, const char **argv)
+{
+    return run_module(pamh, "pam_sm_acct_mgmt", flags, argc, argv, false);
+}
+
+int
+pam_sm_chauthtok(pam_handle_t *pamh, int flags, int argc, const char **argv)
+{
+    return run_module(pamh, "pam_sm_chauthtok", flags, argc, argv, false);
+}
+
+int
+pam_sm_open_session(pam_handle_t *pamh, int flags, int argc,
+                    const char **argv)
+{
+    return run_module(pamh, "pam_sm_open_session", flags, argc, argv, false);
+}
+
+int
+pam_sm_close_session(pam_handle_t *pamh, int flags, int argc,
+                     const char **argv)
+{
+    return run_module(pamh, "pam_sm_close_session", flags, argc, argv, false);
+}
+
+
+/*
+ * Write the given contents to a file and set its modification time into the
+ * past so that data read from it can be cached.
+ */
+static void
+write_file(const char *path, const char *contents)
+{
+    FILE *file;
+    struct utimbuf times;
+
+    file = fopen(path, "w");
+    if (file == NULL)
+        sysbail("cannot create %s", path);
+    if (fputs(contents, file) == EOF)
+        sysbail("cannot write %s", path);
+    if (fclose(file) == EOF)
+        sysbail("cannot write %s", path);
+    times.actime = time(NULL) - 10;
+    times.modtime = times.actime;
+    if (utime(path, &times) < 0)
+        sysbail("cannot set modification time of %s", path);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    struct script_config config;
+    struct bench_results results;
+    char *tmpdir, *path;
+#ifdef HAVE_KRB5
+    char *krb5_path;
+#endif
+    double per_run, phase;
+    unsigned long runs = 10000;
+    unsigned int threads = 1;
+    size_t i;
+
+    if (argc > 1)
+        runs = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        threads = (unsigned int) strtoul(argv[2], NULL, 10);
+    if (runs == 0 || threads == 0)
+        bail("invalid run or thread count");
+
+    /* Write the script and the Kerberos configuration. */
+    tmpdir = test_tmpdir();
+    basprintf(&path, "%s/auth-bench", tmpdir);
+    write_file(path, script);
+#ifdef HAVE_KRB5
+    basprintf(&krb5_path, "%s/krb5.conf", tmpdir);
+    write_file(krb5_path, krb5_conf);
+    if (setenv("KRB5_CONFIG", krb5_path, 1) < 0)
+        sysbail("cannot set KRB5_CONFIG");
+#endif
+
+    /* Run the benchmark. */
+    memset(&config, 0, sizeof(config));
+    config.user = "bench";
+    config.password = "password";
+    bench_script(path, &config, runs, threads, &results);
+
+    /* Report the results. */
+    printf("%lu authentications in %u threads, %lu failures\n",
+           results.runs, results.threads, results.failures);
+    printf("%.0f auths/s, p50 %.1fus, p99 %.1fus, p999 %.1fus\n",
+           results.runs / results.seconds, results.p50, results.p99,
+           results.p999);
+    per_run = results.seconds * 1000000.0 * results.threads / results.runs;
+    for (i = 0; i < PHASE_MAX; i++) {
+        phase = results.phases[i] / results.runs;
+        printf("  %-12s %7.2fus %5.1f%%\n", phase_names[i], phase,
+               phase * 100 / per_run);
+    }
+
+    /* Clean up. */
+    unlink(path);
+    free(path);
+#ifdef HAVE_KRB5
+    unlink(krb5_path);
+    free(krb5_path);
+#endif
+    test_tmpdir_free(tmpdir);
+    return 0;
+}
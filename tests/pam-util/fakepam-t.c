@@ -37,6 +37,23 @@
 
 #include <tests/fakepam/pam.h>
 #include <tests/tap/basic.h>
+#include <tests/tap/string.h>
+
+/* The number of variables and data items used to test the indexes. */
+#define MANY 1000
+
+/* Counts the number of calls to the data cleanup function. */
+static size_t cleanups = 0;
+
+
+/*
+ * Cleanup function for data items, which just counts the calls.
+ */
+static void
+cleanup(pam_handle_t *pamh UNUSED, void *data UNUSED, int status UNUSED)
+{
+    cleanups++;
+}
 
 
 int
@@ -45,7 +62,11 @@ main(void)
     pam_handle_t *pamh;
     struct pam_conv conv = { NULL, NULL };
     char **env;
+    char *setting, *value;
+    const void *data;
     size_t i;
+    bool okay;
+    static int values[MANY];
 
     /*
      * Skip this test if the native PAM library doesn't support a PAM
@@ -56,7 +77,7 @@ main(void)
     skip_all("system doesn't support PAM environment");
 #endif
 
-    plan(33);
+    plan(48);
 
     /* Basic environment manipulation. */
     if (pam_start("test", NULL, &conv, &pamh) != PAM_SUCCESS)
@@ -113,7 +134,74 @@ main(void)
     is_string("FOO=foo", pamh->environ[3], "pamh environ FOO");
     ok(pamh->environ[4] == NULL, "pamh environ length");
 
+    /* Many variables, enough to grow the index several times. */
+    for (i = 0; i < MANY; i++) {
+        basprintf(&setting, "VAR%lu=%lu", (unsigned long) i,
+                  (unsigned long) i);
+        if (pam_putenv(pamh, setting) != PAM_SUCCESS)
+            break;
+        free(setting);
+    }
+    is_int(MANY, i, "putenv many variables");
+    for (okay = true, i = 0; okay && i < MANY; i++) {
+        basprintf(&value, "%lu", (unsigned long) i);
+        basprintf(&setting, "VAR%lu", (unsigned long) i);
+        if (pam_getenv(pamh, setting) == NULL)
+            okay = false;
+        else if (strcmp(pam_getenv(pamh, setting), value) != 0)
+            okay = false;
+        free(setting);
+        free(value);
+    }
+    ok(okay, "getenv many variables");
+    is_string("foo", pam_getenv(pamh, "FOO"), "...and earlier variables");
+
+    /* Delete every other one and check that the order is preserved. */
+    for (i = 0; i < MANY; i += 2) {
+        basprintf(&setting, "VAR%lu", (unsigned long) i);
+        if (pam_putenv(pamh, setting) != PAM_SUCCESS)
+            break;
+        free(setting);
+    }
+    is_int(MANY, i, "putenv delete many variables");
+    ok(pam_getenv(pamh, "VAR0") == NULL, "...VAR0 deleted");
+    is_string("999", pam_getenv(pamh, "VAR999"), "...VAR999 kept");
+    for (okay = true, i = 1; okay && i < MANY; i += 2) {
+        basprintf(&setting, "VAR%lu=%lu", (unsigned long) i,
+                  (unsigned long) i);
+        if (strcmp(pamh->environ[4 + i / 2], setting) != 0)
+            okay = false;
+        free(setting);
+    }
+    ok(okay, "...and order preserved");
+    ok(pamh->environ[4 + MANY / 2] == NULL, "...and length");
+    is_string("FOO=foo", pamh->environ[3], "...and earlier variables");
+
+    /* Many data items. */
+    is_int(PAM_NO_MODULE_DATA, pam_get_data(pamh, "data0", &data),
+           "get_data when none set");
+    for (i = 0; i < MANY; i++) {
+        basprintf(&setting, "data%lu", (unsigned long) i);
+        if (pam_set_data(pamh, setting, &values[i], cleanup) != PAM_SUCCESS)
+            break;
+        free(setting);
+    }
+    is_int(MANY, i, "set_data many items");
+    for (okay = true, i = 0; okay && i < MANY; i++) {
+        basprintf(&setting, "data%lu", (unsigned long) i);
+        if (pam_get_data(pamh, setting, &data) != PAM_SUCCESS)
+            okay = false;
+        else if (data != &values[i])
+            okay = false;
+        free(setting);
+    }
+    ok(okay, "get_data many items");
+    is_int(PAM_SUCCESS, pam_set_data(pamh, "data1", NULL, NULL),
+           "set_data replace with NULL");
+    is_int(PAM_NO_MODULE_DATA, pam_get_data(pamh, "data1", &data),
+           "...and get_data reports no data");
     pam_end(pamh, 0);
+    is_int(MANY, cleanups, "cleanup called for each item");
 
     return 0;
 }
@@ -0,0 +1,124 @@
+/*
+ * Benchmark for the PAM logging functions.
+ *
+ * Times the putil_* logging functions through the fake PAM library for the
+ * kinds of messages an authentication-heavy module logs: plain messages,
+ * messages with the user prefix, messages with a PAM error, and disabled
+ * debug messages.  The accumulated fake syslog output is discarded between
+ * batches outside of the timed section.
+ *
+ * Usage: logging-bench [<calls>]
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/pam.h>
+#include <portable/system.h>
+
+#include <sys/time.h>
+
+#include <pam-util/args.h>
+#include <pam-util/logging.h>
+#include <tests/fakepam/pam.h>
+#include <tests/tap/basic.h>
+
+/* The number of calls between discarding the logged output. */
+#define BATCH 1000
+
+/* The kinds of messages to time. */
+enum kind {
+    KIND_PLAIN,
+    KIND_USER,
+    KIND_PAM,
+    KIND_DEBUG
+};
+
+
+/*
+ * Log one message of the given kind.
+ */
+static void
+log_one(struct pam_args *args, enum kind kind, size_t i)
+{
+    switch (kind) {
+    case KIND_PLAIN:
+    case KIND_USER:
+        putil_err(args, "authentication failure for attempt %lu",
+                  (unsigned long) i);
+        break;
+    case KIND_PAM:
+        putil_err_pam(args, PAM_SYSTEM_ERR, "cannot get password for %lu",
+                      (unsigned long) i);
+        break;
+    case KIND_DEBUG:
+        putil_debug(args, "entering attempt %lu", (unsigned long) i);
+        break;
+    }
+}
+
+
+/*
+ * Time count calls logging messages of the given kind and print the mean
+ * cost per call.
+ */
+static void
+run(struct pam_args *args, const char *name, enum kind kind, size_t count)
+{
+    struct timeval start, end;
+    double total = 0;
+    size_t i, j;
+
+    args->user = (kind == KIND_PLAIN) ? NULL : "alice";
+    for (i = 0; i < count; i += BATCH) {
+        gettimeofday(&start, NULL);
+        for (j = i; j < i + BATCH && j < count; j++)
+            log_one(args, kind, j);
+        gettimeofday(&end, NULL);
+        total += (end.tv_sec - start.tv_sec) * 1000000.0
+                 + (end.tv_usec - start.tv_usec);
+        pam_output_free(pam_output());
+    }
+    printf("%-12s %8.1f ns/call\n", name, total * 1000.0 / count);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    pam_handle_t *pamh;
+    struct pam_args *args;
+    struct pam_conv conv = { NULL, NULL };
+    size_t count = 200000;
+
+    if (argc > 1)
+        count = strtoul(argv[1], NULL, 10);
+    if (count == 0)
+        bail("invalid call count");
+    if (pam_start("bench", NULL, &conv, &pamh) != PAM_SUCCESS)
+        sysbail("fake PAM initialization failed");
+    args = putil_args_new(pamh, 0);
+    if (args == NULL)
+        bail("cannot create PAM argument struct");
+
+    run(args, "plain", KIND_PLAIN, count);
+    run(args, "user", KIND_USER, count);
+    run(args, "pam error", KIND_PAM, count);
+    run(args, "debug off", KIND_DEBUG, count);
+
+    args->user = NULL;
+    putil_args_free(args);
+    pam_end(pamh, 0);
+    return 0;
+}
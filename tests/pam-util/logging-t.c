@@ -39,6 +39,9 @@
 #include <tests/tap/basic.h>
 #include <tests/tap/string.h>
 
+/* The length of a message that doesn't fit in the stack buffer. */
+#define LONG_SIZE 4000
+
 /* Test a normal PAM logging function. */
 #define TEST(func, p, n)                                                \
     do {                                                                \
@@ -90,14 +93,15 @@ main(void)
     pam_handle_t *pamh;
     struct pam_args *args;
     struct pam_conv conv = { NULL, NULL };
-    char *expected;
+    char *expected, *long_message;
     struct output *seen;
+    int evaluated = 0;
 #ifdef HAVE_KRB5
     krb5_error_code code;
     krb5_principal princ;
 #endif
 
-    plan(27);
+    plan(31);
 
     if (pam_start("test", NULL, &conv, &pamh) != PAM_SUCCESS)
         sysbail("Fake PAM initialization failed");
@@ -108,6 +112,8 @@ main(void)
     TEST(putil_err,   LOG_ERR,   "putil_err");
     putil_debug(args, "%s", "foo");
     ok(pam_output() == NULL, "putil_debug without debug on");
+    putil_debug(args, "%d", ++evaluated);
+    is_int(0, evaluated, "...and arguments not evaluated");
     args->debug = true;
     TEST(putil_debug, LOG_DEBUG, "putil_debug");
     args->debug = false;
@@ -123,6 +129,31 @@ main(void)
     TEST_PAM(putil_debug_pam, PAM_SUCCESS,    LOG_DEBUG, "putil_debug_pam ok");
     args->debug = false;
 
+    /* The user prefix, and messages too long for the stack buffer. */
+    args->user = "alice";
+    putil_err_pam(args, PAM_SYSTEM_ERR, "%s", "bar");
+    seen = pam_output();
+    basprintf(&expected, "(user alice) bar: %s",
+              pam_strerror(args->pamh, PAM_SYSTEM_ERR));
+    is_string(expected, seen->lines[0].line, "user prefix");
+    pam_output_free(seen);
+    free(expected);
+    long_message = bcalloc(LONG_SIZE + 1, 1);
+    memset(long_message, 'x', LONG_SIZE);
+    putil_err_pam(args, PAM_BUF_ERR, "%s", long_message);
+    seen = pam_output();
+    basprintf(&expected, "(user alice) %s: %s", long_message,
+              pam_strerror(args->pamh, PAM_BUF_ERR));
+    is_string(expected, seen->lines[0].line, "long message");
+    pam_output_free(seen);
+    free(expected);
+    args->user = NULL;
+    putil_crit(args, "%s", long_message);
+    seen = pam_output();
+    is_string(long_message, seen->lines[0].line, "long message without user");
+    pam_output_free(seen);
+    free(long_message);
+
 #ifdef HAVE_KRB5
     TEST_KRB5(putil_crit_krb5,  LOG_CRIT,  "putil_crit_krb5");
     TEST_KRB5(putil_err_krb5,   LOG_ERR,   "putil_err_krb5");
@@ -133,7 +164,7 @@ main(void)
     TEST_KRB5(putil_debug_krb5, LOG_DEBUG, "putil_debug_krb5");
     args->debug = false;
 #else
-    skip_block(4, "not built with Kerberos support");
+    skip_block(7, "not built with Kerberos support");
 #endif
 
     putil_args_free(args);
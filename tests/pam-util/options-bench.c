@@ -0,0 +1,339 @@
+/*
+ * Benchmark for parsing PAM options.
+ *
+ * Builds an option table with the given number of options of every type and
+ * times putil_args_parse with a module argument line setting every option.
+ * It then times whole sessions (creating the PAM arguments, setting the
+ * defaults, parsing that argument line, and freeing everything) with the
+ * defaults copied and with shared defaults.  Then, if built with Kerberos
+ * support, writes a krb5.conf file that sets some of the options at each
+ * level of [appdefaults] (the section inside the realm, the section, the
+ * realm, and the top level) and times putil_args_krb5 with that table.  The
+ * first call of each is reported separately since it builds the option index
+ * and may cache settings.
+ *
+ * Usage: options-bench [<options> [<calls>]]
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/pam.h>
+#include <portable/system.h>
+
+#include <sys/time.h>
+#include <time.h>
+#include <utime.h>
+
+#include <pam-util/args.h>
+#include <pam-util/options.h>
+#include <pam-util/vector.h>
+#include <tests/fakepam/pam.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/string.h>
+
+/* The section and realm used for the settings. */
+#define SECTION "bench"
+#define REALM   "BENCH.REALM"
+
+/* Storage for one option in the configuration. */
+union value {
+    bool boolean;
+    long number;
+#ifdef HAVE_KRB5
+    krb5_deltat time;
+#endif
+    char *string;
+    struct vector *list;
+};
+
+
+/*
+ * Return a value for an option of the given type.
+ */
+static const char *
+option_value(enum type type)
+{
+    switch (type) {
+    case TYPE_BOOLEAN: return "true";
+    case TYPE_NUMBER:  return "1000";
+    case TYPE_TIME:    return "1800";
+    case TYPE_STRING:  return "/usr/bin/true";
+    case TYPE_LIST:
+    case TYPE_STRLIST: return "one,two three";
+    }
+    return "";
+}
+
+
+/*
+ * Build the option table with count options, cycling through the types.
+ * The table has to be sorted, which the zero-padded names ensure.
+ */
+static struct option *
+options_new(size_t count)
+{
+    static const enum type types[] = {
+        TYPE_BOOLEAN, TYPE_NUMBER, TYPE_TIME, TYPE_STRING, TYPE_LIST
+    };
+    struct option *options;
+    char *name;
+    size_t i;
+
+    options = bcalloc(count, sizeof(struct option));
+    for (i = 0; i < count; i++) {
+        basprintf(&name, "option%06lu", (unsigned long) i);
+        options[i].name = name;
+        options[i].location = i * sizeof(union value);
+        options[i].krb5_config = true;
+        options[i].type = types[i % ARRAY_SIZE(types)];
+    }
+    return options;
+}
+
+
+/*
+ * Return the elapsed time between two timevals in microseconds.
+ */
+static double
+elapsed(const struct timeval *start, const struct timeval *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000.0
+           + (end->tv_usec - start->tv_usec);
+}
+
+
+/*
+ * Time putil_args_parse with an argument line setting every option.
+ */
+static void
+time_parse(struct pam_args *args, const struct option *options, size_t count,
+           size_t calls)
+{
+    const char **argv;
+    char *arg;
+    struct timeval start, end;
+    double first;
+    size_t i;
+
+    argv = bcalloc(count, sizeof(const char *));
+    for (i = 0; i < count; i++) {
+        basprintf(&arg, "%s=%s", options[i].name,
+                  option_value(options[i].type));
+        argv[i] = arg;
+    }
+    gettimeofday(&start, NULL);
+    if (!putil_args_parse(args, (int) count, argv, options, count))
+        bail("cannot parse options");
+    gettimeofday(&end, NULL);
+    first = elapsed(&start, &end);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < calls; i++)
+        if (!putil_args_parse(args, (int) count, argv, options, count))
+            bail("cannot parse options");
+    gettimeofday(&end, NULL);
+    printf("parse %lu options: first call %.1fus, later calls %.1fus\n",
+           (unsigned long) count, first, elapsed(&start, &end) / calls);
+    for (i = 0; i < count; i++)
+        free((char *) argv[i]);
+    free(argv);
+}
+
+
+/*
+ * Time sessions that set up a configuration from scratch, parse an argument
+ * line setting every option, and free everything again.  If shared is true,
+ * use shared defaults, so that the options are allocated with the PAM
+ * arguments.
+ */
+static void
+time_session(pam_handle_t *pamh, const struct option *options, size_t count,
+             size_t calls, bool shared)
+{
+    struct pam_args *args;
+    const char **argv;
+    char *arg;
+    union value *values;
+    struct timeval start, end;
+    size_t i;
+    bool okay;
+
+    argv = bcalloc(count, sizeof(const char *));
+    for (i = 0; i < count; i++) {
+        basprintf(&arg, "%s=%s", options[i].name,
+                  option_value(options[i].type));
+        argv[i] = arg;
+    }
+    values = bcalloc(count, sizeof(union value));
+    gettimeofday(&start, NULL);
+    for (i = 0; i < calls; i++) {
+        args = putil_args_new(pamh, 0);
+        if (args == NULL)
+            bail("cannot create PAM argument struct");
+        args->config = (void *) values;
+        if (shared)
+            okay = putil_args_defaults_shared(args, options, count);
+        else
+            okay = putil_args_defaults(args, options, count);
+        if (!okay || !putil_args_parse(args, (int) count, argv, options,
+                                       count))
+            bail("cannot set up configuration");
+        putil_args_config_free(args, options, count);
+        args->config = NULL;
+        putil_args_free(args);
+    }
+    gettimeofday(&end, NULL);
+    printf("session %lu options, %s defaults: %.1fus\n",
+           (unsigned long) count, shared ? "shared" : "copied",
+           elapsed(&start, &end) / calls);
+    for (i = 0; i < count; i++)
+        free((char *) argv[i]);
+    free(argv);
+    free(values);
+}
+
+
+#ifdef HAVE_KRB5
+/*
+ * Write a krb5.conf file setting every fifth option in the section inside
+ * the realm, every fourth in the section, every third in the realm, and every
+ * other one at the top level, and set its modification time into the past so
+ * that settings read from it can be cached.
+ */
+static void
+write_config(const char *path, const struct option *options, size_t count)
+{
+    FILE *file;
+    struct utimbuf times;
+    size_t i;
+
+    file = fopen(path, "w");
+    if (file == NULL)
+        sysbail("cannot create %s", path);
+    fprintf(file, "[appdefaults]\n    %s = {\n        %s = {\n", SECTION,
+            REALM);
+    for (i = 0; i < count; i += 5)
+        fprintf(file, "            %s = %s\n", options[i].name,
+                option_value(options[i].type));
+    fprintf(file, "        }\n");
+    for (i = 0; i < count; i += 4)
+        fprintf(file, "        %s = %s\n", options[i].name,
+                option_value(options[i].type));
+    fprintf(file, "    }\n    %s = {\n", REALM);
+    for (i = 0; i < count; i += 3)
+        fprintf(file, "        %s = %s\n", options[i].name,
+                option_value(options[i].type));
+    fprintf(file, "    }\n");
+    for (i = 0; i < count; i += 2)
+        fprintf(file, "    %s = %s\n", options[i].name,
+                option_value(options[i].type));
+    if (fclose(file) == EOF)
+        sysbail("cannot write %s", path);
+    times.actime = time(NULL) - 10;
+    times.modtime = times.actime;
+    if (utime(path, &times) < 0)
+        sysbail("cannot set modification time of %s", path);
+}
+
+
+/*
+ * Time putil_args_krb5 with a krb5.conf file that sets some of the options.
+ */
+static void
+time_krb5(struct pam_args *args, const struct option *options, size_t count,
+          size_t calls)
+{
+    struct timeval start, end;
+    char *tmpdir, *path;
+    double first;
+    size_t i;
+
+    tmpdir = test_tmpdir();
+    basprintf(&path, "%s/krb5.conf", tmpdir);
+    write_config(path, options, count);
+    if (setenv("KRB5_CONFIG", path, 1) < 0)
+        sysbail("cannot set KRB5_CONFIG");
+    krb5_free_context(args->ctx);
+    if (krb5_init_context(&args->ctx) != 0)
+        bail("cannot parse test krb5.conf file");
+    args->realm = bstrdup(REALM);
+    gettimeofday(&start, NULL);
+    if (!putil_args_krb5(args, SECTION, options, count))
+        bail("cannot read options from krb5.conf");
+    gettimeofday(&end, NULL);
+    first = elapsed(&start, &end);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < calls; i++)
+        if (!putil_args_krb5(args, SECTION, options, count))
+            bail("cannot read options from krb5.conf");
+    gettimeofday(&end, NULL);
+    printf("krb5 %lu options: first call %.1fus, later calls %.1fus\n",
+           (unsigned long) count, first, elapsed(&start, &end) / calls);
+    unlink(path);
+    free(path);
+    test_tmpdir_free(tmpdir);
+}
+#endif /* HAVE_KRB5 */
+
+
+int
+main(int argc, char *argv[])
+{
+    pam_handle_t *pamh;
+    struct pam_args *args;
+    struct pam_conv conv = { NULL, NULL };
+    struct option *options;
+    union value *values;
+    size_t count = 200;
+    size_t calls = 10000;
+    size_t i;
+
+    if (argc > 1)
+        count = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        calls = strtoul(argv[2], NULL, 10);
+    if (count == 0 || calls == 0)
+        bail("invalid option or call count");
+
+    /* Set up the option table and the configuration. */
+    options = options_new(count);
+    values = bcalloc(count, sizeof(union value));
+    if (pam_start("bench", NULL, &conv, &pamh) != PAM_SUCCESS)
+        sysbail("fake PAM initialization failed");
+    args = putil_args_new(pamh, 0);
+    if (args == NULL)
+        bail("cannot create PAM argument struct");
+    args->config = (void *) values;
+    if (!putil_args_defaults(args, options, count))
+        bail("cannot set option defaults");
+
+    /* Run the benchmarks. */
+    time_parse(args, options, count, calls);
+    time_session(pamh, options, count, calls, false);
+    time_session(pamh, options, count, calls, true);
+#ifdef HAVE_KRB5
+    time_krb5(args, options, count, calls);
+#endif
+
+    /* Clean up. */
+    putil_args_config_free(args, options, count);
+    for (i = 0; i < count; i++)
+        free((char *) options[i].name);
+    free(options);
+    free(values);
+    args->config = NULL;
+    putil_args_free(args);
+    pam_end(pamh, 0);
+    return 0;
+}
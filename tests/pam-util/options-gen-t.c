@@ -0,0 +1,181 @@
+/*
+ * Test suite for generated PAM option parsing code.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/pam.h>
+#include <portable/system.h>
+
+#include <syslog.h>
+
+#include <pam-util/args.h>
+#include <pam-util/vector.h>
+#include <tests/fakepam/pam.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/string.h>
+
+/* The configuration struct we will use for testing. */
+struct pam_config {
+    struct vector *cells;
+    bool debug;
+#ifdef HAVE_KRB5
+    krb5_deltat expires;
+#else
+    long expires;
+#endif
+    bool ignore_root;
+    long minimum_uid;
+    char *program;
+};
+
+/* The options, from which the parsing code is generated. */
+#define PAM_OPTIONS(O)                                  \
+    O(cells,       true,  STRLIST, "foo.com,bar.com")   \
+    O(debug,       true,  BOOL,    false)               \
+    O(expires,     true,  TIME,    10)                  \
+    O(ignore_root, false, BOOL,    true)                \
+    O(minimum_uid, true,  NUMBER,  0)                   \
+    O(program,     true,  STRING,  "/bin/false")
+
+#include <pam-util/options-gen.h>
+
+/*
+ * A macro used to test error reporting from putil_config_parse().  This
+ * reuses the argv_err variable, setting it to the first value provided and
+ * then calling putil_config_parse() on it.  It then recovers the error
+ * message and expects it to match the error message given.
+ */
+#define TEST_ERROR(a, e)                                                \
+    do {                                                                \
+        argv_err[0] = (a);                                              \
+        status = putil_config_parse(args, 1, argv_err);                 \
+        seen = pam_output();                                            \
+        ok(status && seen != NULL && seen->lines[0].priority == LOG_ERR \
+               && strcmp(seen->lines[0].line, (e)) == 0,                \
+           "Error for %s", (a));                                        \
+        pam_output_free(seen);                                          \
+    } while (0);
+
+
+int
+main(void)
+{
+    pam_handle_t *pamh;
+    struct pam_args *args;
+    struct pam_conv conv = { NULL, NULL };
+    struct output *seen;
+    bool status;
+    const char *argv_err[2] = { NULL, NULL };
+    const char *argv_all[] = {
+        "cells=stanford.edu,ir.stanford.edu", "debug=false", "expires=3600",
+        "ignore_root=no", "minimum_uid=1000", "program=/bin/true"
+    };
+#ifdef HAVE_KRB5
+    char *krb5conf;
+#endif
+
+    if (pam_start("test", NULL, &conv, &pamh) != PAM_SUCCESS)
+        sysbail("cannot create pam_handle_t");
+    args = putil_args_new(pamh, 0);
+    if (args == NULL)
+        bail("cannot create PAM argument struct");
+
+    plan(27);
+
+    /* Check the generated table. */
+    is_int(6, (int) putil_config_optlen, "Generated table length");
+    is_string("expires", putil_config_options[2].name, "...and names");
+    ok(putil_config_options[3].location
+           == offsetof(struct pam_config, ignore_root)
+       && !putil_config_options[3].krb5_config
+       && putil_config_options[3].type == TYPE_BOOLEAN
+       && putil_config_options[3].defaults.boolean,
+       "...and option settings");
+
+    /* Check the defaults. */
+    args->config = bcalloc(1, sizeof(struct pam_config));
+    status = putil_config_defaults(args);
+    ok(status, "Setting the defaults");
+    ok(args->config->cells != NULL && args->config->cells->count == 2,
+       "...cells default");
+    if (args->config->cells == NULL)
+        ok_block(2, false, "...cells default");
+    else {
+        is_string("foo.com", args->config->cells->strings[0],
+                  "...first cell");
+        is_string("bar.com", args->config->cells->strings[1],
+                  "...second cell");
+    }
+    is_int(false, args->config->debug, "...debug default");
+    is_int(10, args->config->expires, "...expires default");
+    is_int(true, args->config->ignore_root, "...ignore_root default");
+    is_int(0, args->config->minimum_uid, "...minimum_uid default");
+    is_string("/bin/false", args->config->program, "...program default");
+
+    /* Parse a setting for every option. */
+    status = putil_config_parse(args, 6, argv_all);
+    ok(status, "Parse of all options");
+    ok(pam_output() == NULL, "...with no output");
+    ok(args->config->cells != NULL && args->config->cells->count == 2,
+       "...cells");
+    is_int(false, args->config->debug, "...debug");
+    is_int(3600, args->config->expires, "...expires");
+    is_int(false, args->config->ignore_root, "...ignore_root");
+    is_int(1000, args->config->minimum_uid, "...minimum_uid");
+    is_string("/bin/true", args->config->program, "...program");
+
+    /* Booleans without a value and errors. */
+    argv_err[0] = "debug";
+    status = putil_config_parse(args, 1, argv_err);
+    ok(status && args->config->debug, "Parse of debug without a value");
+    TEST_ERROR("debu", "unknown option debu");
+    TEST_ERROR("debugx=1", "unknown option debugx=1");
+    TEST_ERROR("=debug", "unknown option =debug");
+    TEST_ERROR("minimum_uid=1000foo",
+               "invalid number in setting: minimum_uid=1000foo");
+    putil_config_free(args);
+    ok(args->config->cells == NULL && args->config->program == NULL,
+       "Freeing the configuration");
+
+    /* Options from krb5.conf through the generated table. */
+#ifdef HAVE_KRB5
+    krb5conf = test_file_path("data/krb5-pam.conf");
+    if (krb5conf == NULL)
+        bail("cannot find data/krb5-pam.conf");
+    if (setenv("KRB5_CONFIG", krb5conf, 1) < 0)
+        sysbail("cannot set KRB5_CONFIG");
+    krb5_free_context(args->ctx);
+    if (krb5_init_context(&args->ctx) != 0)
+        bail("cannot parse test krb5.conf file");
+    if (!putil_config_defaults(args))
+        bail("cannot set defaults");
+    status = putil_config_krb5(args, "testing");
+    ok(status && args->config->minimum_uid == 1000
+           && args->config->expires == 1800 && args->config->ignore_root,
+       "Options from krb5.conf");
+    putil_config_free(args);
+    test_file_path_free(krb5conf);
+#else
+    skip("Kerberos support not configured");
+#endif
+
+    /* Clean up. */
+    free(args->config);
+    args->config = NULL;
+    putil_args_free(args);
+    pam_end(pamh, 0);
+    return 0;
+}
@@ -32,6 +32,8 @@
 #include <portable/system.h>
 
 #include <syslog.h>
+#include <time.h>
+#include <utime.h>
 
 #include <pam-util/args.h>
 #include <pam-util/options.h>
@@ -67,6 +69,31 @@ struct option options[] = {
 };
 const size_t optlen = sizeof(options) / sizeof(options[0]);
 
+/* Rules with string and list defaults, used to test shared defaults. */
+static const struct option options_shared[] = {
+    { K(cells),       true,  STRLIST ("foo.com,bar.com") },
+    { K(debug),       true,  BOOL    (false)             },
+    { K(expires),     true,  TIME    (10)                },
+    { K(ignore_root), false, BOOL    (true)              },
+    { K(minimum_uid), true,  NUMBER  (0)                 },
+    { K(program),     true,  STRING  ("/bin/false")      },
+};
+static const size_t optlen_shared =
+    sizeof(options_shared) / sizeof(options_shared[0]);
+
+/* Rules that aren't sorted, and rules with a duplicate name. */
+static const struct option options_unsorted[] = {
+    { K(program), true, STRING (NULL)  },
+    { K(debug),   true, BOOL   (false) },
+    { K(cells),   true, LIST   (NULL)  },
+};
+static const struct option options_duplicate[] = {
+    { K(cells),   true, LIST   (NULL)  },
+    { K(debug),   true, BOOL   (false) },
+    { K(debug),   true, BOOL   (false) },
+    { K(program), true, STRING (NULL)  },
+};
+
 /*
  * A macro used to parse the various ways of spelling booleans.  This reuses
  * the argv_bool variable, setting it to the first value provided and then
@@ -130,6 +157,33 @@ config_free(struct pam_config *config)
 }
 
 
+
+#ifdef HAVE_KRB5
+/*
+ * Write a krb5.conf file that sets minimum_uid in the testing section.  Set
+ * the modification time into the past so that settings read from it can be
+ * cached.
+ */
+static void
+write_krb5_conf(const char *path, long minimum_uid)
+{
+    FILE *file;
+    struct utimbuf times;
+
+    file = fopen(path, "w");
+    if (file == NULL)
+        sysbail("cannot create %s", path);
+    fprintf(file, "[appdefaults]\n    testing = {\n        minimum_uid = %ld\n"
+            "    }\n", minimum_uid);
+    if (fclose(file) == EOF)
+        sysbail("cannot write %s", path);
+    times.actime = time(NULL) - 10;
+    times.modtime = times.actime;
+    if (utime(path, &times) < 0)
+        sysbail("cannot set modification time of %s", path);
+}
+#endif
+
 int
 main(void)
 {
@@ -137,18 +191,21 @@ main(void)
     struct pam_args *args;
     struct pam_conv conv = { NULL, NULL };
     bool status;
+    struct pam_config *config;
     struct vector *cells;
     char *program;
     struct output *seen;
     const char *argv_bool[2] = { NULL, NULL };
     const char *argv_err[2] = { NULL, NULL };
     const char *argv_empty[] = { NULL };
+    const char *argv_shared[] = { "cells=example.com", "program=/bin/true" };
+    const char *argv_list[] = { "cells=,foo.com  bar.com,,baz.com," };
 #ifdef HAVE_KRB5
     const char *argv_all[] = {
         "cells=stanford.edu,ir.stanford.edu", "debug", "expires=1d",
         "ignore_root", "minimum_uid=1000", "program=/bin/true"
     };
-    char *krb5conf;
+    char *krb5conf, *tmpdir, *path;
 #else
     const char *argv_all[] = {
         "cells=stanford.edu,ir.stanford.edu", "debug", "expires=86400",
@@ -162,7 +219,7 @@ main(void)
     if (args == NULL)
         bail("cannot create PAM argument struct");
 
-    plan(161);
+    plan(198);
 
     /* First, check just the defaults. */
     args->config = config_new();
@@ -283,6 +340,58 @@ main(void)
     options[0].type = TYPE_LIST;
     options[0].defaults.string = NULL;
 
+    /* Test shared defaults. */
+    config = config_new();
+    args->config = config;
+    status = putil_args_defaults_shared(args, options_shared, optlen_shared);
+    ok(status, "Setting shared defaults");
+    is_string("/bin/false", config->program, "...program is set");
+    ok(config->cells != NULL && config->cells->count == 2
+           && strcmp(config->cells->strings[1], "bar.com") == 0,
+       "...cells is set");
+    is_int(10, config->expires, "...expires is set");
+    args->config = config_new();
+    status = putil_args_defaults_shared(args, options_shared, optlen_shared);
+    ok(status && args->config->program == config->program
+           && args->config->cells == config->cells,
+       "...and shared between configurations");
+    status = putil_args_parse(args, 2, argv_shared, options_shared,
+                              optlen_shared);
+    ok(status, "Parse with shared defaults");
+    ok(args->config->cells->count == 1
+           && strcmp(args->config->cells->strings[0], "example.com") == 0,
+       "...cells is set");
+    is_string("/bin/true", args->config->program, "...program is set");
+    ok(config->cells->count == 2, "...cells default is unchanged");
+    is_string("/bin/false", config->program, "...program default unchanged");
+    ok(putil_args_owns(args, args->config->cells)
+           && putil_args_owns(args, args->config->cells->strings[0])
+           && putil_args_owns(args, args->config->program),
+       "...and parsed options are allocated with the args struct");
+    status = putil_args_parse(args, 1, argv_list, options_shared,
+                              optlen_shared);
+    ok(status && args->config->cells->count == 3,
+       "Parse of list with extra separators");
+    ok(args->config->cells->count == 3
+           && strcmp(args->config->cells->strings[0], "foo.com") == 0
+           && strcmp(args->config->cells->strings[1], "bar.com") == 0
+           && strcmp(args->config->cells->strings[2], "baz.com") == 0,
+       "...and values are correct");
+    putil_args_config_free(args, options_shared, optlen_shared);
+    ok(args->config->cells == NULL && args->config->program == NULL,
+       "Freeing a configuration with shared defaults");
+    free(args->config);
+    args->config = config;
+    putil_args_config_free(args, options_shared, optlen_shared);
+    free(config);
+    args->config = config_new();
+    status = putil_args_defaults_shared(args, options_shared, optlen_shared);
+    is_string("/bin/false", args->config->program,
+              "...and the shared defaults are still there");
+    putil_args_config_free(args, options_shared, optlen_shared);
+    free(args->config);
+    args->config = NULL;
+
     /* Should be no errors so far. */
     ok(pam_output() == NULL, "No errors so far");
 
@@ -322,6 +431,42 @@ main(void)
                "invalid number in setting: minimum_uid=1000foo");
     TEST_ERROR("program", LOG_ERR, "value missing for option program");
     TEST_ERROR("cells", LOG_ERR, "value missing for option cells");
+    TEST_ERROR("debu", LOG_ERR, "unknown option debu");
+    TEST_ERROR("debugx=1", LOG_ERR, "unknown option debugx=1");
+    TEST_ERROR("=debug", LOG_ERR, "unknown option =debug");
+    config_free(args->config);
+    args->config = NULL;
+
+    /* Option tables that aren't sorted or that have duplicate names. */
+    args->config = config_new();
+    status = putil_args_parse(args, 2, argv_shared, options_unsorted,
+                              ARRAY_SIZE(options_unsorted));
+    ok(status, "Parse with unsorted option table");
+    is_string("/bin/true", args->config->program, "...program is set");
+    ok(args->config->cells != NULL && args->config->cells->count == 1,
+       "...cells is set");
+    seen = pam_output();
+    is_string("option table not sorted: program before debug",
+              seen == NULL ? NULL : seen->lines[0].line,
+              "...and error is reported");
+    pam_output_free(seen);
+    status = putil_args_parse(args, 2, argv_shared, options_unsorted,
+                              ARRAY_SIZE(options_unsorted));
+    ok(status && pam_output() == NULL, "...but only the first time");
+    config_free(args->config);
+    args->config = config_new();
+    status = putil_args_parse(args, 2, argv_shared, options_duplicate,
+                              ARRAY_SIZE(options_duplicate));
+    ok(status && args->config->program != NULL,
+       "Parse with duplicate options");
+    seen = pam_output();
+    is_string("duplicate option debug in option table",
+              seen == NULL ? NULL : seen->lines[0].line,
+              "...and error is reported");
+    pam_output_free(seen);
+    status = putil_args_parse(args, 2, argv_shared, options_duplicate,
+                              ARRAY_SIZE(options_duplicate));
+    ok(status && pam_output() == NULL, "...but only the first time");
     config_free(args->config);
     args->config = NULL;
 
@@ -440,11 +585,53 @@ main(void)
     config_free(args->config);
     args->config = NULL;
 
+    /*
+     * Empty values in krb5.conf don't replace strings or lists.  Heimdal
+     * doesn't support quoted values, so it can't represent an empty value.
+     */
+#ifdef HAVE_KRB5_REALM
+    skip_block(3, "empty values not supported by Heimdal");
+#else
+    args->config = config_new();
+    putil_args_parse(args, 2, argv_shared, options, optlen);
+    status = putil_args_krb5(args, "empty", options, optlen);
+    ok(status, "Options from krb5.conf (empty)");
+    ok(args->config->cells != NULL && args->config->cells->count == 1,
+       "...cells is unchanged");
+    is_string("/bin/true", args->config->program, "...program is unchanged");
+    config_free(args->config);
+    args->config = NULL;
+#endif
+
     test_file_path_free(krb5conf);
 
+    /* Settings from krb5.conf are read again when the file changes. */
+    tmpdir = test_tmpdir();
+    basprintf(&path, "%s/krb5.conf", tmpdir);
+    write_krb5_conf(path, 1);
+    if (setenv("KRB5_CONFIG", path, 1) < 0)
+        sysbail("cannot set KRB5_CONFIG");
+    krb5_free_context(args->ctx);
+    if (krb5_init_context(&args->ctx) != 0)
+        bail("cannot parse test krb5.conf file");
+    args->config = config_new();
+    putil_args_krb5(args, "testing", options, optlen);
+    is_int(1, args->config->minimum_uid, "minimum_uid from new krb5.conf");
+    write_krb5_conf(path, 22);
+    krb5_free_context(args->ctx);
+    if (krb5_init_context(&args->ctx) != 0)
+        bail("cannot parse test krb5.conf file");
+    putil_args_krb5(args, "testing", options, optlen);
+    is_int(22, args->config->minimum_uid, "...and read again after a change");
+    config_free(args->config);
+    args->config = NULL;
+    unlink(path);
+    free(path);
+    test_tmpdir_free(tmpdir);
+
 #else /* !HAVE_KRB5 */
 
-    skip_block(37, "Kerberos support not configured");
+    skip_block(45, "Kerberos support not configured");
 
 #endif
 
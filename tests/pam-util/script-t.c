@@ -0,0 +1,206 @@
+/*
+ * Test suite for the fake PAM library's interaction scripts.
+ *
+ * Like fakepam-t, this is a test of the fake PAM library rather than of the
+ * pam-util layer.  It defines a trivial PAM module, writes an interaction
+ * script for it, and runs that script with different configurations, both
+ * through run_script and as a compiled script, and checks that a script that
+ * changes on disk is read again, even if its size and modification time
+ * don't change.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/pam.h>
+#include <portable/system.h>
+
+#include <syslog.h>
+#include <time.h>
+#include <utime.h>
+
+#include <tests/fakepam/pam.h>
+#include <tests/fakepam/script.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/macros.h>
+#include <tests/tap/string.h>
+
+/*
+ * The script used for testing, which has comments and blank lines and no
+ * newline at the end of the last line.  The second version adds an action
+ * between the two halves, and the third adds a comment of the same length
+ * instead.
+ */
+static const char script_start[] = "# Test script.\n"
+    "[options]\n"
+    "    auth = user=%u other\n"
+    "\n"
+    "[run]\n"
+    "    authenticate = PAM_SUCCESS\n"
+    "    # No credentials.\n"
+    "    setcred(ESTABLISH_CRED|SILENT) = PAM_IGNORE\n";
+static const char script_end[] = "\n"
+    "[prompts]\n"
+    "    echo_off = Password: |%p\n"
+    "\n"
+    "[output]\n"
+    "    NOTICE user %u password %p flags 0";
+static const char extra_action[] = "    acct_mgmt = PAM_IGNORE\n";
+static const char extra_comment[] = "    # No acct_mgmt action.\n";
+
+
+/*
+ * Prompt for a password and log the user option and the password.
+ */
+int
+pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc,
+                    const char **argv)
+{
+    const struct pam_conv *conv;
+    const struct pam_message message = { PAM_PROMPT_ECHO_OFF, "Password: " };
+    const struct pam_message *messages = &message;
+    struct pam_response *response = NULL;
+    const char *user = "";
+    int i, status;
+
+    for (i = 0; i < argc; i++)
+        if (strncmp(argv[i], "user=", strlen("user=")) == 0)
+            user = argv[i] + strlen("user=");
+    status = pam_get_item(pamh, PAM_CONV, (PAM_CONST void **) &conv);
+    if (status != PAM_SUCCESS)
+        return status;
+    status = conv->conv(1, &messages, &response, conv->appdata_ptr);
+    if (status != PAM_SUCCESS || response == NULL)
+        return PAM_CONV_ERR;
+    pam_syslog(pamh, LOG_NOTICE, "user %s password %s flags %d", user,
+               response->resp, flags);
+    free(response->resp);
+    free(response);
+    return PAM_SUCCESS;
+}
+
+
+/* The other calls do nothing. */
+int
+pam_sm_setcred(pam_handle_t *pamh UNUSED, int flags UNUSED, int argc UNUSED,
+               const char **argv UNUSED)
+{
+    return PAM_IGNORE;
+}
+
+int
+pam_sm_acct_mgmt(pam_handle_t *pamh UNUSED, int flags UNUSED,
+                 int argc UNUSED, const char **argv UNUSED)
+{
+    return PAM_IGNORE;
+}
+
+int
+pam_sm_chauthtok(pam_handle_t *pamh UNUSED, int flags UNUSED,
+                 int argc UNUSED, const char **argv UNUSED)
+{
+    return PAM_IGNORE;
+}
+
+int
+pam_sm_open_session(pam_handle_t *pamh UNUSED, int flags UNUSED,
+                    int argc UNUSED, const char **argv UNUSED)
+{
+    return PAM_IGNORE;
+}
+
+int
+pam_sm_close_session(pam_handle_t *pamh UNUSED, int flags UNUSED,
+                     int argc UNUSED, const char **argv UNUSED)
+{
+    return PAM_IGNORE;
+}
+
+
+/*
+ * Write the test script to the given path, with the given extra line (if not
+ * NULL) in the middle, and set its modification time to the given offset from
+ * the current time.
+ */
+static void
+write_script(const char *path, const char *extra, time_t offset)
+{
+    FILE *file;
+    struct utimbuf times;
+
+    file = fopen(path, "w");
+    if (file == NULL)
+        sysbail("cannot create %s", path);
+    if (fputs(script_start, file) == EOF)
+        sysbail("cannot write %s", path);
+    if (extra != NULL && fputs(extra, file) == EOF)
+        sysbail("cannot write %s", path);
+    if (fputs(script_end, file) == EOF)
+        sysbail("cannot write %s", path);
+    if (fclose(file) == EOF)
+        sysbail("cannot write %s", path);
+    times.actime = time(NULL) + offset;
+    times.modtime = times.actime;
+    if (utime(path, &times) < 0)
+        sysbail("cannot set modification time of %s", path);
+}
+
+
+int
+main(void)
+{
+    struct script_config config;
+    struct script *compiled;
+    char *tmpdir, *path;
+
+    /* Each run is 7 tests, or 8 with the extra action. */
+    plan(43);
+
+    tmpdir = test_tmpdir();
+    basprintf(&path, "%s/script", tmpdir);
+    write_script(path, NULL, -10);
+
+    /* Run the script with two configurations. */
+    memset(&config, 0, sizeof(config));
+    config.user = "testuser";
+    config.password = "testpass";
+    run_script(path, &config);
+    config.user = "other";
+    config.password = "otherpass";
+    run_script(path, &config);
+
+    /* Run a compiled copy of the script, which is unaffected by changes. */
+    compiled = compile_script(path);
+    run_compiled_script(compiled, &config);
+    write_script(path, extra_action, 0);
+    run_compiled_script(compiled, &config);
+    free_script(compiled);
+
+    /* run_script notices that the script changed. */
+    run_script(path, &config);
+
+    /*
+     * A rewrite of the same size is noticed as well.  The script was
+     * modified in the current second, so the rewrite has either the same
+     * modification time or a newer one.
+     */
+    write_script(path, extra_comment, 0);
+    run_script(path, &config);
+
+    /* Clean up. */
+    unlink(path);
+    free(path);
+    test_tmpdir_free(tmpdir);
+    return 0;
+}
@@ -3,8 +3,8 @@
  *
  * Usage:
  *
- *      runtests [-b <build-dir>] [-s <source-dir>] -l <test-list>
- *      runtests [-b <build-dir>] [-s <source-dir>] <test> [<test> ...]
+ *      runtests [<options>] -l <test-list>
+ *      runtests [<options>] <test> [<test> ...]
  *      runtests -o [-b <build-dir>] [-s <source-dir>] <test>
  *
  * In the first case, expects a list of executables located in the given file,
@@ -48,6 +48,26 @@
  * output.  This is intended for use with failing tests so that the person
  * running the test suite can get more details about what failed.
  *
+ * If the -j option is given, up to that many test programs are run at the
+ * same time.  The output of each is kept until all earlier tests have been
+ * reported, so the results are still reported in the order of the list of
+ * tests.  Tests run this way must not share temporary files.
+ *
+ * The wall clock time, CPU time, and maximum resident set size of each test
+ * program is recorded.  With the -n option, the given number of test sets
+ * that took the longest are listed after the results.  With the -r or -x
+ * options, the results of each test set are also written to a file as JSON
+ * or as JUnit XML respectively, for use by other tools.
+ *
+ * The -t option sets the number of seconds each test program may run, and the
+ * -T option sets the number of seconds the whole batch of tests may run.  The
+ * RUNTESTS_TIMEOUT and RUNTESTS_BATCH_TIMEOUT environment variables set the
+ * same timeouts if the options aren't given.  Each test program is run in its
+ * own process group, and when a timeout expires, that process group is
+ * killed and the test set is reported as aborted with the results it had
+ * reported so far.  Once the batch timeout expires, no further tests are
+ * started.
+ *
  * If built with the C preprocessor symbols SOURCE and BUILD defined, C TAP
  * Harness will export those values in the environment so that tests can find
  * the source and build directory and will look for tests under both
@@ -80,17 +100,25 @@
  * DEALINGS IN THE SOFTWARE.
 */
 
-/* Required for fdopen(), getopt(), and putenv(). */
+/*
+ * Required for fdopen(), getopt(), and putenv(), and with glibc for wait4(),
+ * which isn't in POSIX but is available on all modern systems.
+ */
 #if defined(__STRICT_ANSI__) || defined(PEDANTIC)
 # ifndef _XOPEN_SOURCE
 #  define _XOPEN_SOURCE 500
 # endif
+# ifndef _DEFAULT_SOURCE
+#  define _DEFAULT_SOURCE 1
+# endif
 #endif
 
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -150,6 +178,13 @@ enum test_status {
     TEST_INVALID
 };
 
+/* Indicates whether a test set ran out of time. */
+enum timeout_status {
+    TIMEOUT_NONE,               /* No timeout. */
+    TIMEOUT_TEST,               /* The test set ran for too long. */
+    TIMEOUT_BATCH               /* The batch of tests ran for too long. */
+};
+
 /* Indicates the state of our plan. */
 enum plan_status {
     PLAN_INIT,                  /* Nothing seen yet. */
@@ -182,6 +217,17 @@ struct testset {
     int status;                 /* The exit status of the test. */
     unsigned int all_skipped;   /* Whether all tests were skipped. */
     char *reason;               /* Why all tests were skipped. */
+    pid_t pid;                  /* Running test program, 0 once reaped. */
+    int fd;                     /* Output of the test program, or -1. */
+    char *output;               /* Output kept when running in parallel. */
+    size_t outlen;              /* Length of the kept output. */
+    size_t outsize;             /* Allocated size of the output buffer. */
+    int error;                  /* Whether reading the output failed. */
+    int success;                /* Whether the set ran and all tests passed. */
+    struct timeval started;     /* When the test program was started. */
+    double elapsed;             /* Wall clock time of the test program. */
+    struct rusage usage;        /* Resource usage of the test program. */
+    enum timeout_status timeout; /* Whether the test set timed out. */
 };
 
 /* Structure to hold a linked list of test sets. */
@@ -190,22 +236,66 @@ struct testlist {
     struct testlist *next;
 };
 
+/* Structure to hold the options for running a batch of tests. */
+struct options {
+    const char *source;         /* The source directory. */
+    const char *build;          /* The build directory. */
+    unsigned int jobs;          /* Maximum number of tests to run at once. */
+    unsigned int slowest;       /* Number of slowest test sets to report. */
+    const char *json;           /* File to write JSON results to. */
+    const char *junit;          /* File to write JUnit XML results to. */
+    unsigned int timeout;       /* Seconds a test may run, or 0. */
+    unsigned int batch_timeout; /* Seconds the batch may run, or 0. */
+};
+
+/* Structure to hold the state of tests running in parallel. */
+struct jobs {
+    struct testlist *next;      /* The next test set to start. */
+    unsigned int limit;         /* Maximum number of tests to run at once. */
+    unsigned int running;       /* Number of test programs not yet reaped. */
+    struct pollfd *fds;         /* Array of descriptors for poll. */
+    const char *source;         /* The source directory. */
+    const char *build;          /* The build directory. */
+    unsigned int timeout;       /* Seconds a test may run, or 0. */
+    unsigned int batch_timeout; /* Seconds the batch may run, or 0. */
+    struct timeval started;     /* When the batch was started. */
+    int expired;                /* Whether the batch has run out of time. */
+    pid_t *groups;              /* Process groups of running tests, or NULL. */
+};
+
 /*
- * Usage message.  Should be used as a printf format with four arguments: the
- * path to runtests, given three times, and the usage_description.  This is
- * split into variables to satisfy the pedantic ISO C90 limit on strings.
+ * The process groups of the running test programs if they are run in their
+ * own process groups, used to kill them if runtests is killed.  Otherwise,
+ * they wouldn't see signals sent to our process group from the terminal.
+ */
+static pid_t *test_groups = NULL;
+static unsigned int test_groups_size = 0;
+
+/*
+ * Usage message.  Should be used as a printf format with six arguments: the
+ * path to runtests, given three times, usage_options, usage_files, and
+ * usage_extra.  This is split into variables to satisfy the pedantic ISO C90
+ * limit on strings.
  */
 static const char usage_message[] = "\
-Usage: %s [-b <build-dir>] [-s <source-dir>] <test> ...\n\
-       %s [-b <build-dir>] [-s <source-dir>] -l <test-list>\n\
+Usage: %s [<options>] <test> ...\n\
+       %s [<options>] -l <test-list>\n\
        %s -o [-b <build-dir>] [-s <source-dir>] <test>\n\
-\n%s";
-static const char usage_extra[] = "\
+\n%s%s%s";
+static const char usage_options[] = "\
 Options:\n\
     -b <build-dir>      Set the build directory to <build-dir>\n\
+    -j <jobs>           Run up to <jobs> tests at the same time\n\
     -l <list>           Take the list of tests to run from <test-list>\n\
-    -o                  Run a single test rather than a list of tests\n\
+    -n <count>          Report the <count> test sets that took longest\n\
+    -o                  Run a single test rather than a list of tests\n";
+static const char usage_files[] = "\
+    -r <file>           Write the results as JSON to <file>\n\
     -s <source-dir>     Set the source directory to <source-dir>\n\
+    -T <seconds>        Abort the tests still running after <seconds>\n\
+    -t <seconds>        Abort a test that runs for more than <seconds>\n\
+    -x <file>           Write the results as JUnit XML to <file>\n";
+static const char usage_extra[] = "\
 \n\
 runtests normally runs each test listed on the command line.  With the -l\n\
 option, it instead runs every test listed in a file.  With the -o option,\n\
@@ -224,6 +314,11 @@ static const char header[] = "\n\
 Failed Set                 Fail/Total (%) Skip Stat  Failing Tests\n\
 -------------------------- -------------- ---- ----  ------------------------";
 
+/* Header for reports of the slowest tests. */
+static const char slow_header[] = "\n\
+Slowest Set                Wall (s) User (s)  Sys (s)   RSS (KB)\n\
+-------------------------- -------- -------- -------- ----------";
+
 /* Include the file name and line number in malloc failures. */
 #define xcalloc(n, size)      x_calloc((n), (size), __FILE__, __LINE__)
 #define xmalloc(size)         x_malloc((size), __FILE__, __LINE__)
@@ -473,10 +568,12 @@ skip_whitespace(const char *p)
 /*
  * Start a program, connecting its stdout to a pipe on our end and its stderr
  * to /dev/null, and storing the file descriptor to read from in the two
- * argument.  Returns the PID of the new process.  Errors are fatal.
+ * argument.  If group is true, the program is put in a new process group with
+ * the same ID as its PID.  Returns the PID of the new process.  Errors are
+ * fatal.
  */
 static pid_t
-test_start(const char *path, int *fd)
+test_start(const char *path, int *fd, int group)
 {
     int fds[2], infd, errfd;
     pid_t child;
@@ -498,6 +595,8 @@ test_start(const char *path, int *fd)
 
     /* In the child.  Set up our standard output. */
     case 0:
+        if (group)
+            setpgid(0, 0);
         close(fds[0]);
         close(STDOUT_FILENO);
         if (dup2(fds[1], STDOUT_FILENO) < 0)
@@ -530,9 +629,15 @@ test_start(const char *path, int *fd)
         if (execl(path, path, (char *) 0) == -1)
             _exit(CHILDERR_EXEC);
 
-    /* In parent.  Close the extra file descriptor. */
+    /*
+     * In parent.  Close the extra file descriptor, and don't let other test
+     * programs started while this one is running inherit our end of the pipe.
+     */
     default:
         close(fds[1]);
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        if (group)
+            setpgid(child, child);
         break;
     }
     *fd = fds[0];
@@ -949,7 +1054,18 @@ test_analyze(struct testset *ts)
 {
     if (ts->reported)
         return 0;
-    if (ts->all_skipped) {
+    if (ts->timeout != TIMEOUT_NONE) {
+        if (ts->timeout == TIMEOUT_TEST)
+            fputs("ABORTED (timed out", stdout);
+        else
+            fputs("ABORTED (batch timed out", stdout);
+        if (ts->count > 0)
+            printf(", passed %lu/%lu", ts->passed, ts->count - ts->skipped);
+        puts(")");
+        ts->aborted = 1;
+        ts->all_skipped = 0;
+        return 0;
+    } else if (ts->all_skipped) {
         if (ts->reason == NULL)
             puts("skipped");
         else
@@ -989,6 +1105,47 @@ test_analyze(struct testset *ts)
 }
 
 
+/*
+ * Record the wall clock time taken by a test program that has just exited.
+ */
+static void
+test_elapsed(struct testset *ts)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    ts->elapsed = tv_diff(&now, &ts->started);
+}
+
+
+/*
+ * Finish a test set once its output has been read and its exit status
+ * retrieved, passing it to test_analyze() for output.  Returns true if the
+ * test set was successfully run and all tests passed, false otherwise.
+ */
+static int
+test_finish(struct testset *ts)
+{
+    int status;
+    unsigned long i;
+
+    if (ts->all_skipped)
+        ts->aborted = 0;
+    status = test_analyze(ts);
+
+    /* Convert missing tests to failed tests. */
+    for (i = 0; i < ts->count; i++) {
+        if (ts->results[i] == TEST_INVALID) {
+            ts->failed++;
+            ts->results[i] = TEST_FAIL;
+            status = 0;
+        }
+    }
+    ts->success = status;
+    return status;
+}
+
+
 /*
  * Runs a single test set, accumulating and then reporting the results.
  * Returns true if the test set was successfully run and all tests passed,
@@ -998,13 +1155,13 @@ static int
 test_run(struct testset *ts)
 {
     pid_t testpid, child;
-    int outfd, status;
-    unsigned long i;
+    int outfd;
     FILE *output;
     char buffer[BUFSIZ];
 
     /* Run the test program. */
-    testpid = test_start(ts->path, &outfd);
+    gettimeofday(&ts->started, NULL);
+    testpid = test_start(ts->path, &outfd, 0);
     output = fdopen(outfd, "r");
     if (!output) {
         puts("ABORTED");
@@ -1021,13 +1178,13 @@ test_run(struct testset *ts)
 
     /*
      * Consume the rest of the test output, close the output descriptor,
-     * retrieve the exit status, and pass that information to test_analyze()
+     * retrieve the exit status, and pass that information to test_finish()
      * for eventual output.
      */
     while (fgets(buffer, sizeof(buffer), output))
         ;
     fclose(output);
-    child = waitpid(testpid, &ts->status, 0);
+    child = wait4(testpid, &ts->status, 0, &ts->usage);
     if (child == (pid_t) -1) {
         if (!ts->reported) {
             puts("ABORTED");
@@ -1035,19 +1192,8 @@ test_run(struct testset *ts)
         }
         sysdie("waitpid for %u failed", (unsigned int) testpid);
     }
-    if (ts->all_skipped)
-        ts->aborted = 0;
-    status = test_analyze(ts);
-
-    /* Convert missing tests to failed tests. */
-    for (i = 0; i < ts->count; i++) {
-        if (ts->results[i] == TEST_INVALID) {
-            ts->failed++;
-            ts->results[i] = TEST_FAIL;
-            status = 0;
-        }
-    }
-    return status;
+    test_elapsed(ts);
+    return test_finish(ts);
 }
 
 
@@ -1099,6 +1245,257 @@ test_fail_summary(const struct testlist *fails)
 }
 
 
+/*
+ * Return the maximum resident set size from a struct rusage in kilobytes.
+ * macOS reports it in bytes rather than kilobytes.
+ */
+static long
+test_rss(const struct rusage *usage)
+{
+#ifdef __APPLE__
+    return usage->ru_maxrss / 1024;
+#else
+    return usage->ru_maxrss;
+#endif
+}
+
+
+/*
+ * Compare two test sets by the time they took, for sorting the slowest test
+ * sets first.
+ */
+static int
+test_compare_elapsed(const void *a, const void *b)
+{
+    const struct testset *ts1 = *(struct testset * const *) a;
+    const struct testset *ts2 = *(struct testset * const *) b;
+
+    return (ts1->elapsed < ts2->elapsed) - (ts1->elapsed > ts2->elapsed);
+}
+
+
+/*
+ * Summarize the given number of test sets that took the longest, along with
+ * their CPU time and maximum resident set size.
+ */
+static void
+test_slow_summary(const struct testlist *tests, unsigned int count,
+                  unsigned int slowest)
+{
+    struct testset **sets;
+    struct testset *ts;
+    unsigned int i;
+
+    sets = xcalloc(count, sizeof(struct testset *));
+    for (i = 0; tests != NULL && i < count; tests = tests->next)
+        sets[i++] = tests->ts;
+    qsort(sets, count, sizeof(struct testset *), test_compare_elapsed);
+    puts(slow_header);
+    for (i = 0; i < count && i < slowest; i++) {
+        ts = sets[i];
+        printf("%-26.26s %8.2f %8.2f %8.2f %10ld\n", ts->file, ts->elapsed,
+               tv_seconds(&ts->usage.ru_utime),
+               tv_seconds(&ts->usage.ru_stime), test_rss(&ts->usage));
+    }
+    free(sets);
+}
+
+
+/*
+ * Return the outcome of a test set as a string for the results files.
+ */
+static const char *
+test_outcome(const struct testset *ts)
+{
+    if (ts->timeout != TIMEOUT_NONE)
+        return "timeout";
+    else if (ts->all_skipped)
+        return "skipped";
+    else if (ts->aborted)
+        return "aborted";
+    else if (ts->success)
+        return "passed";
+    else
+        return "failed";
+}
+
+
+/*
+ * Write a string to a file as a JSON string, escaping quotes, backslashes,
+ * and control characters.
+ */
+static void
+json_string(FILE *file, const char *string)
+{
+    const char *p;
+
+    putc('"', file);
+    for (p = string; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\')
+            fprintf(file, "\\%c", *p);
+        else if ((unsigned char) *p < 0x20)
+            fprintf(file, "\\u%04x", (unsigned int) (unsigned char) *p);
+        else
+            putc(*p, file);
+    }
+    putc('"', file);
+}
+
+
+/*
+ * Write a string to a file for use in an XML attribute, escaping the special
+ * characters and replacing control characters, which XML doesn't allow.
+ */
+static void
+xml_string(FILE *file, const char *string)
+{
+    const char *p;
+
+    for (p = string; *p != '\0'; p++) {
+        switch (*p) {
+        case '&':  fputs("&amp;", file);  break;
+        case '<':  fputs("&lt;", file);   break;
+        case '>':  fputs("&gt;", file);   break;
+        case '"':  fputs("&quot;", file); break;
+        case '\t':
+        case '\n':
+        case '\r':
+            putc(*p, file);
+            break;
+        default:
+            putc(((unsigned char) *p < 0x20) ? '?' : *p, file);
+            break;
+        }
+    }
+}
+
+
+/*
+ * Write the results of a batch of tests to the given file as JSON.  Takes
+ * the list of tests, the elapsed wall clock time, and the resource usage of
+ * all the test programs.  Errors are fatal.
+ */
+static void
+test_results_json(const char *path, const struct testlist *tests,
+                  double elapsed, const struct rusage *usage)
+{
+    FILE *file;
+    const struct testset *ts;
+
+    file = fopen(path, "w");
+    if (file == NULL)
+        sysdie("can't create %s", path);
+    fputs("{\n  \"sets\": [", file);
+    for (; tests != NULL; tests = tests->next) {
+        ts = tests->ts;
+        fputs("\n    { \"name\": ", file);
+        json_string(file, ts->file);
+        fprintf(file, ", \"outcome\": \"%s\",\n", test_outcome(ts));
+        fprintf(file, "      \"tests\": %lu, \"passed\": %lu, \"failed\": %lu,"
+                " \"skipped\": %lu,\n", ts->count, ts->passed, ts->failed,
+                ts->skipped);
+        fprintf(file, "      \"exit\": %d, \"signal\": %d,",
+                WIFEXITED(ts->status) ? WEXITSTATUS(ts->status) : -1,
+                WIFSIGNALED(ts->status) ? WTERMSIG(ts->status) : 0);
+        fprintf(file, " \"wall\": %.3f, \"user\": %.3f, \"system\": %.3f,\n",
+                ts->elapsed, tv_seconds(&ts->usage.ru_utime),
+                tv_seconds(&ts->usage.ru_stime));
+        fprintf(file, "      \"maxrss\": %ld }%s", test_rss(&ts->usage),
+                (tests->next != NULL) ? "," : "");
+    }
+    fprintf(file, "\n  ],\n  \"wall\": %.3f, \"user\": %.3f,", elapsed,
+            tv_seconds(&usage->ru_utime));
+    fprintf(file, " \"system\": %.3f\n}\n", tv_seconds(&usage->ru_stime));
+    if (ferror(file) || fclose(file) == EOF)
+        sysdie("can't write %s", path);
+}
+
+
+/*
+ * Write the results of a batch of tests to the given file as JUnit XML, with
+ * each test set as a test suite and each numbered test in it as a test case.
+ * A test set that was aborted has an additional test case with an error, and
+ * one that was skipped entirely has a single skipped test case.  Takes the
+ * list of tests and the elapsed wall clock time.  Errors are fatal.
+ */
+static void
+test_results_junit(const char *path, const struct testlist *tests,
+                   double elapsed)
+{
+    FILE *file;
+    const struct testlist *current;
+    const struct testset *ts;
+    unsigned long i;
+    unsigned long total = 0;
+    unsigned long failed = 0;
+    unsigned long skipped = 0;
+    unsigned long aborted = 0;
+
+    file = fopen(path, "w");
+    if (file == NULL)
+        sysdie("can't create %s", path);
+    for (current = tests; current != NULL; current = current->next) {
+        ts = current->ts;
+        total += ts->count + ts->all_skipped + ts->aborted;
+        failed += ts->failed;
+        skipped += ts->skipped + ts->all_skipped;
+        aborted += ts->aborted;
+    }
+    fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n", file);
+    fprintf(file, "<testsuites tests=\"%lu\" failures=\"%lu\" errors=\"%lu\""
+            " skipped=\"%lu\" time=\"%.3f\">\n", total, failed, aborted,
+            skipped, elapsed);
+    for (current = tests; current != NULL; current = current->next) {
+        ts = current->ts;
+        fputs("  <testsuite name=\"", file);
+        xml_string(file, ts->file);
+        fprintf(file, "\" tests=\"%lu\" failures=\"%lu\" errors=\"%u\""
+                " skipped=\"%lu\" time=\"%.3f\">\n",
+                ts->count + ts->all_skipped + ts->aborted, ts->failed,
+                ts->aborted, ts->skipped + ts->all_skipped, ts->elapsed);
+        fputs("    <properties>\n", file);
+        fprintf(file, "      <property name=\"user\" value=\"%.3f\"/>\n",
+                tv_seconds(&ts->usage.ru_utime));
+        fprintf(file, "      <property name=\"system\" value=\"%.3f\"/>\n",
+                tv_seconds(&ts->usage.ru_stime));
+        fprintf(file, "      <property name=\"maxrss\" value=\"%ld\"/>\n",
+                test_rss(&ts->usage));
+        fputs("    </properties>\n", file);
+        for (i = 0; i < ts->count; i++) {
+            fputs("    <testcase classname=\"", file);
+            xml_string(file, ts->file);
+            fprintf(file, "\" name=\"%lu\"", i + 1);
+            if (ts->results[i] == TEST_FAIL)
+                fputs("><failure message=\"not ok\"/></testcase>\n", file);
+            else if (ts->results[i] == TEST_SKIP)
+                fputs("><skipped/></testcase>\n", file);
+            else
+                fputs("/>\n", file);
+        }
+        if (ts->aborted || ts->all_skipped) {
+            fputs("    <testcase classname=\"", file);
+            xml_string(file, ts->file);
+            fputs("\" name=\"", file);
+            xml_string(file, ts->file);
+            if (ts->timeout != TIMEOUT_NONE)
+                fputs("\"><error message=\"timed out\"/></testcase>\n",
+                      file);
+            else if (ts->aborted)
+                fputs("\"><error message=\"aborted\"/></testcase>\n", file);
+            else {
+                fputs("\"><skipped message=\"", file);
+                xml_string(file, (ts->reason != NULL) ? ts->reason : "");
+                fputs("\"/></testcase>\n", file);
+            }
+        }
+        fputs("  </testsuite>\n", file);
+    }
+    fputs("</testsuites>\n", file);
+    if (ferror(file) || fclose(file) == EOF)
+        sysdie("can't write %s", path);
+}
+
+
 /*
  * Check whether a given file path is a valid test.  Currently, this checks
  * whether it is executable and is a regular file.  Returns true or false.
@@ -1270,14 +1667,259 @@ free_testset(struct testset *ts)
 
 
 /*
- * Run a batch of tests.  Takes two additional parameters: the root of the
- * source directory and the root of the build directory.  Test programs will
- * be first searched for in the current directory, then the build directory,
- * then the source directory.  Returns true iff all tests passed, and always
- * frees the test list that's passed in.
+ * Signal handler for signals that kill runtests when test programs are run in
+ * their own process groups.  Kill the test programs and then die from the
+ * same signal.
+ */
+static void
+test_interrupted(int sig)
+{
+    unsigned int i;
+
+    for (i = 0; i < test_groups_size; i++)
+        if (test_groups[i] > 0)
+            kill(-test_groups[i], SIGKILL);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+
+/*
+ * Start test programs from the list until the maximum number are running or
+ * all have been started.  If the batch has run out of time, instead mark all
+ * the remaining test sets as timed out without starting them.
+ */
+static void
+jobs_start(struct jobs *jobs)
+{
+    struct testset *ts;
+    unsigned int i;
+
+    while (jobs->next != NULL
+           && (jobs->running < jobs->limit || jobs->expired)) {
+        ts = jobs->next->ts;
+        jobs->next = jobs->next->next;
+        if (jobs->expired) {
+            ts->fd = -1;
+            ts->timeout = TIMEOUT_BATCH;
+            continue;
+        }
+        ts->path = find_test(ts->file, jobs->source, jobs->build);
+        gettimeofday(&ts->started, NULL);
+        ts->pid = test_start(ts->path, &ts->fd, jobs->groups != NULL);
+        jobs->running++;
+        if (jobs->groups != NULL)
+            for (i = 0; i < jobs->limit; i++)
+                if (jobs->groups[i] == 0) {
+                    jobs->groups[i] = ts->pid;
+                    break;
+                }
+    }
+}
+
+
+/*
+ * Record that a test program has been reaped.
+ */
+static void
+jobs_reaped(struct testset *ts, struct jobs *jobs)
+{
+    unsigned int i;
+
+    if (jobs->groups != NULL)
+        for (i = 0; i < jobs->limit; i++)
+            if (jobs->groups[i] == ts->pid)
+                jobs->groups[i] = 0;
+    test_elapsed(ts);
+    ts->pid = 0;
+    jobs->running--;
+}
+
+
+/*
+ * Check the running test programs against the timeouts, killing the process
+ * group of each test program that has run out of time.  Returns the number
+ * of milliseconds until the next timeout expires, or -1 if there are no
+ * timeouts to wait for.
  */
 static int
-test_batch(struct testlist *tests, const char *source, const char *build)
+jobs_expire(struct testlist *head, struct jobs *jobs)
+{
+    struct testlist *current;
+    struct testset *ts;
+    struct timeval now;
+    double left;
+    double next = -1;
+
+    if (jobs->groups == NULL)
+        return -1;
+    gettimeofday(&now, NULL);
+    if (jobs->batch_timeout > 0) {
+        left = jobs->batch_timeout - tv_diff(&now, &jobs->started);
+        if (left <= 0)
+            jobs->expired = 1;
+        else
+            next = left;
+    }
+    for (current = head; current != jobs->next; current = current->next) {
+        ts = current->ts;
+        if (ts->pid == 0 || ts->timeout != TIMEOUT_NONE)
+            continue;
+        if (jobs->expired)
+            ts->timeout = TIMEOUT_BATCH;
+        else if (jobs->timeout > 0) {
+            left = jobs->timeout - tv_diff(&now, &ts->started);
+            if (left <= 0)
+                ts->timeout = TIMEOUT_TEST;
+            else if (next < 0 || left < next)
+                next = left;
+        }
+        if (ts->timeout != TIMEOUT_NONE)
+            kill(-ts->pid, SIGKILL);
+    }
+
+    /* Round up and wake up at least once a minute. */
+    if (next < 0)
+        return -1;
+    return (next > 60) ? 60 * 1000 : (int) (next * 1000) + 1;
+}
+
+
+/*
+ * Read the available output from a running test program into its buffer,
+ * closing the descriptor at end of file or on a read error.
+ */
+static void
+jobs_read(struct testset *ts)
+{
+    ssize_t status;
+
+    if (ts->outsize - ts->outlen < BUFSIZ) {
+        ts->outsize += (ts->outsize > BUFSIZ) ? ts->outsize : BUFSIZ;
+        ts->output = xreallocarray(ts->output, ts->outsize, 1);
+    }
+    status = read(ts->fd, ts->output + ts->outlen, ts->outsize - ts->outlen);
+    if (status > 0)
+        ts->outlen += status;
+    else if (status == 0 || (errno != EINTR && errno != EAGAIN)) {
+        if (status < 0)
+            ts->error = 1;
+        close(ts->fd);
+        ts->fd = -1;
+    }
+}
+
+
+/*
+ * Wait for the test programs that have been started, starting more as others
+ * finish, until the test set at the head of the list has exited and all of
+ * its output has been read.  The head of the list is the earliest test set
+ * that hasn't yet been reported, so all test sets that are running are
+ * between it and the next test set to start.
+ */
+static void
+jobs_wait(struct testlist *head, struct jobs *jobs)
+{
+    struct testlist *current;
+    struct testset *ts;
+    unsigned int i, nfds;
+    int timeout, expire;
+    pid_t child;
+
+    jobs_start(jobs);
+    while (head->ts->fd != -1 || head->ts->pid != 0) {
+        expire = jobs_expire(head, jobs);
+        nfds = 0;
+        timeout = -1;
+        for (current = head; current != jobs->next; current = current->next) {
+            ts = current->ts;
+            if (ts->fd != -1) {
+                jobs->fds[nfds].fd = ts->fd;
+                jobs->fds[nfds].events = POLLIN;
+                nfds++;
+            } else if (ts->pid != 0)
+                timeout = 10;
+        }
+        if (expire >= 0 && (timeout < 0 || expire < timeout))
+            timeout = expire;
+
+        /*
+         * Wait for output from any of the test programs.  Test programs that
+         * have closed their output may not have exited yet, so if there are
+         * any, check periodically whether they have.  Also wake up when the
+         * next timeout expires.
+         */
+        if (poll(jobs->fds, nfds, timeout) < 0 && errno != EINTR)
+            sysdie("poll failed");
+        i = 0;
+        for (current = head; current != jobs->next; current = current->next) {
+            ts = current->ts;
+            if (ts->fd != -1) {
+                if (jobs->fds[i].revents != 0)
+                    jobs_read(ts);
+                i++;
+            }
+            if (ts->fd == -1 && ts->pid != 0) {
+                child = wait4(ts->pid, &ts->status, WNOHANG, &ts->usage);
+                if (child == (pid_t) -1)
+                    sysdie("waitpid for %u failed", (unsigned int) ts->pid);
+                else if (child != 0)
+                    jobs_reaped(ts, jobs);
+            }
+        }
+        jobs_start(jobs);
+    }
+}
+
+
+/*
+ * Report the results of a test set run in parallel.  Waits for the test set
+ * to finish and then passes its output to test_checkline() a line at a time,
+ * split the same way that test_run() would split it, so that the results are
+ * the same as if it were run by itself.  Returns true if the test set was
+ * successfully run and all tests passed, false otherwise.
+ */
+static int
+test_replay(struct testlist *head, struct jobs *jobs)
+{
+    struct testset *ts = head->ts;
+    char buffer[BUFSIZ];
+    const char *p, *end, *newline;
+    size_t length;
+
+    jobs_wait(head, jobs);
+    p = ts->output;
+    end = ts->output + ts->outlen;
+    while (!ts->aborted && p < end) {
+        length = end - p;
+        if (length > sizeof(buffer) - 1)
+            length = sizeof(buffer) - 1;
+        newline = memchr(p, '\n', length);
+        if (newline != NULL)
+            length = newline - p + 1;
+        memcpy(buffer, p, length);
+        buffer[length] = '\0';
+        test_checkline(buffer, ts);
+        p += length;
+    }
+    if (ts->error || ts->plan == PLAN_INIT)
+        ts->aborted = 1;
+    test_backspace(ts);
+    free(ts->output);
+    ts->output = NULL;
+    return test_finish(ts);
+}
+
+
+/*
+ * Run a batch of tests.  Takes the options for the batch, which include the
+ * root of the source directory and the root of the build directory.  Test
+ * programs will be first searched for in the current directory, then the
+ * build directory, then the source directory.  Returns true iff all tests
+ * passed, and always frees the test list that's passed in.
+ */
+static int
+test_batch(struct testlist *tests, const struct options *options)
 {
     size_t length;
     unsigned int i;
@@ -1289,7 +1931,8 @@ test_batch(struct testlist *tests, const char *source, const char *build)
     struct testlist *failhead = NULL;
     struct testlist *failtail = NULL;
     struct testlist *current, *next;
-    int succeeded;
+    struct jobs jobs;
+    int parallel, succeeded;
     unsigned long total = 0;
     unsigned long passed = 0;
     unsigned long skipped = 0;
@@ -1314,6 +1957,33 @@ test_batch(struct testlist *tests, const char *source, const char *build)
     /* Start the wall clock timer. */
     gettimeofday(&start, NULL);
 
+    /*
+     * Set up running tests in parallel if requested.  This is also how tests
+     * are run if there are timeouts, in which case each test is run in its
+     * own process group so that it can be killed along with its children.
+     */
+    parallel = (options->jobs > 1 || options->timeout > 0
+                || options->batch_timeout > 0);
+    if (parallel) {
+        memset(&jobs, 0, sizeof(jobs));
+        jobs.next = tests;
+        jobs.limit = options->jobs;
+        jobs.fds = xcalloc(options->jobs, sizeof(struct pollfd));
+        jobs.source = options->source;
+        jobs.build = options->build;
+        jobs.timeout = options->timeout;
+        jobs.batch_timeout = options->batch_timeout;
+        jobs.started = start;
+        if (jobs.timeout > 0 || jobs.batch_timeout > 0) {
+            jobs.groups = xcalloc(options->jobs, sizeof(pid_t));
+            test_groups = jobs.groups;
+            test_groups_size = jobs.limit;
+            signal(SIGHUP, test_interrupted);
+            signal(SIGINT, test_interrupted);
+            signal(SIGTERM, test_interrupted);
+        }
+    }
+
     /* Now, plow through our tests again, running each one. */
     for (current = tests; current != NULL; current = current->next) {
         ts = current->ts;
@@ -1325,9 +1995,13 @@ test_batch(struct testlist *tests, const char *source, const char *build)
         if (isatty(STDOUT_FILENO))
             fflush(stdout);
 
-        /* Run the test. */
-        ts->path = find_test(ts->file, source, build);
-        succeeded = test_run(ts);
+        /* Run the test, or wait for it if it's running in parallel. */
+        if (parallel)
+            succeeded = test_replay(current, &jobs);
+        else {
+            ts->path = find_test(ts->file, options->source, options->build);
+            succeeded = test_run(ts);
+        }
         fflush(stdout);
 
         /* Record cumulative statistics. */
@@ -1356,6 +2030,17 @@ test_batch(struct testlist *tests, const char *source, const char *build)
     /* Stop the timer and get our child resource statistics. */
     gettimeofday(&end, NULL);
     getrusage(RUSAGE_CHILDREN, &stats);
+    if (parallel) {
+        if (jobs.groups != NULL) {
+            signal(SIGHUP, SIG_DFL);
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            test_groups = NULL;
+            test_groups_size = 0;
+            free(jobs.groups);
+        }
+        free(jobs.fds);
+    }
 
     /* Summarize the failures and free the failure list. */
     if (failhead != NULL) {
@@ -1367,6 +2052,15 @@ test_batch(struct testlist *tests, const char *source, const char *build)
         }
     }
 
+    /* Report the slowest tests and write the results files if requested. */
+    if (options->slowest > 0)
+        test_slow_summary(tests, count, options->slowest);
+    if (options->json != NULL)
+        test_results_json(options->json, tests, tv_diff(&end, &start),
+                          &stats);
+    if (options->junit != NULL)
+        test_results_junit(options->junit, tests, tv_diff(&end, &start));
+
     /* Free the memory used by the test lists. */
     while (tests != NULL) {
         next = tests->next;
@@ -1420,6 +2114,28 @@ test_single(const char *program, const char *source, const char *build)
 }
 
 
+/*
+ * Parse a count given as the argument to a command-line option, exiting with
+ * an error if it isn't a number of at least the given minimum.  Takes a
+ * description of the count for the error message.
+ */
+static unsigned int
+parse_count(const char *arg, unsigned int minimum, const char *what)
+{
+    long count;
+    char *end;
+
+    errno = 0;
+    count = strtol(arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0' || count < (long) minimum
+        || count > INT_MAX) {
+        fprintf(stderr, "runtests: invalid %s %s\n", what, arg);
+        exit(1);
+    }
+    return (unsigned int) count;
+}
+
+
 /*
  * Main routine.  Set the SOURCE and BUILD environment variables and then,
  * given a file listing tests, run each test listed.
@@ -1430,33 +2146,61 @@ main(int argc, char *argv[])
     int option;
     int status = 0;
     int single = 0;
+    struct options options;
     char *source_env = NULL;
     char *build_env = NULL;
     const char *program;
     const char *shortlist;
     const char *list = NULL;
-    const char *source = SOURCE;
-    const char *build = BUILD;
     struct testlist *tests;
 
+    memset(&options, 0, sizeof(options));
+    options.source = SOURCE;
+    options.build = BUILD;
+    options.jobs = 1;
+    if (getenv("RUNTESTS_TIMEOUT") != NULL)
+        options.timeout = parse_count(getenv("RUNTESTS_TIMEOUT"), 0,
+                                      "timeout");
+    if (getenv("RUNTESTS_BATCH_TIMEOUT") != NULL)
+        options.batch_timeout = parse_count(getenv("RUNTESTS_BATCH_TIMEOUT"),
+                                            0, "batch timeout");
     program = argv[0];
-    while ((option = getopt(argc, argv, "b:hl:os:")) != EOF) {
+    while ((option = getopt(argc, argv, "b:hj:l:n:or:s:T:t:x:")) != EOF) {
         switch (option) {
         case 'b':
-            build = optarg;
+            options.build = optarg;
             break;
         case 'h':
-            printf(usage_message, program, program, program, usage_extra);
+            printf(usage_message, program, program, program, usage_options,
+                   usage_files, usage_extra);
             exit(0);
             break;
+        case 'j':
+            options.jobs = parse_count(optarg, 1, "job count");
+            break;
         case 'l':
             list = optarg;
             break;
+        case 'n':
+            options.slowest = parse_count(optarg, 0, "test set count");
+            break;
         case 'o':
             single = 1;
             break;
+        case 'r':
+            options.json = optarg;
+            break;
         case 's':
-            source = optarg;
+            options.source = optarg;
+            break;
+        case 'T':
+            options.batch_timeout = parse_count(optarg, 0, "batch timeout");
+            break;
+        case 't':
+            options.timeout = parse_count(optarg, 0, "timeout");
+            break;
+        case 'x':
+            options.junit = optarg;
             break;
         default:
             exit(1);
@@ -1465,25 +2209,26 @@ main(int argc, char *argv[])
     argv += optind;
     argc -= optind;
     if ((list == NULL && argc < 1) || (list != NULL && argc > 0)) {
-        fprintf(stderr, usage_message, program, program, program, usage_extra);
+        fprintf(stderr, usage_message, program, program, program,
+                usage_options, usage_files, usage_extra);
         exit(1);
     }
 
     /* Set SOURCE and BUILD environment variables. */
-    if (source != NULL) {
-        source_env = concat("SOURCE=", source, (const char *) 0);
+    if (options.source != NULL) {
+        source_env = concat("SOURCE=", options.source, (const char *) 0);
         if (putenv(source_env) != 0)
             sysdie("cannot set SOURCE in the environment");
     }
-    if (build != NULL) {
-        build_env = concat("BUILD=", build, (const char *) 0);
+    if (options.build != NULL) {
+        build_env = concat("BUILD=", options.build, (const char *) 0);
         if (putenv(build_env) != 0)
             sysdie("cannot set BUILD in the environment");
     }
 
     /* Run the tests as instructed. */
     if (single)
-        test_single(argv[0], source, build);
+        test_single(argv[0], options.source, options.build);
     else if (list != NULL) {
         shortlist = strrchr(list, '/');
         if (shortlist == NULL)
@@ -1492,10 +2237,10 @@ main(int argc, char *argv[])
             shortlist++;
         printf(banner, shortlist);
         tests = read_test_list(list);
-        status = test_batch(tests, source, build) ? 0 : 1;
+        status = test_batch(tests, &options) ? 0 : 1;
     } else {
         tests = build_test_list(argv, argc);
-        status = test_batch(tests, source, build) ? 0 : 1;
+        status = test_batch(tests, &options) ? 0 : 1;
     }
 
     /* For valgrind cleanliness, free all our memory. */
@@ -858,10 +858,17 @@ test_file_path_free(char *path)
 
 
 /*
- * Create a temporary directory, tmp, under BUILD if set and the current
- * directory if it does not.  Returns the path to the temporary directory in
- * newly allocated memory, and calls bail on any failure.  The return value
- * should be freed with test_tmpdir_free.
+ * Create a temporary directory for this test, named after the process ID
+ * under a directory tmp under BUILD if set and the current directory if it
+ * does not.  Returns the path to the temporary directory in newly allocated
+ * memory, and calls bail on any failure.  The return value should be freed
+ * with test_tmpdir_free.
+ *
+ * Each test gets its own directory so that tests run in parallel don't use
+ * the same files, and so that one test removing the shared tmp directory
+ * when it finishes doesn't race with another creating files in it.  If
+ * another test removes tmp between our creating it and creating our own
+ * directory in it, try again.
  *
  * This function uses sprintf because it attempts to be independent of all
  * other portability layers.  The use immediately after a memory allocation
@@ -871,29 +878,48 @@ char *
 test_tmpdir(void)
 {
     const char *build;
-    char *path = NULL;
+    char *base, *path;
+    int tries;
 
     build = getenv("BUILD");
     if (build == NULL)
         build = ".";
-    path = concat(build, "/tmp", (const char *) 0);
-    if (access(path, X_OK) < 0)
-        if (mkdir(path, 0777) < 0)
-            sysbail("error creating temporary directory %s", path);
-    return path;
+    base = concat(build, "/tmp", (const char *) 0);
+    path = bmalloc(strlen(base) + 1 + 3 * sizeof(unsigned long) + 1);
+    sprintf(path, "%s/%lu", base, (unsigned long) getpid());
+    for (tries = 0; tries < 100; tries++) {
+        if (mkdir(base, 0777) < 0 && errno != EEXIST)
+            sysbail("error creating temporary directory %s", base);
+        if (mkdir(path, 0777) == 0 || errno == EEXIST) {
+            free(base);
+            return path;
+        }
+        if (errno != ENOENT)
+            break;
+    }
+    sysbail("error creating temporary directory %s", path);
 }
 
 
 /*
  * Free a path returned from test_tmpdir() and attempt to remove the
- * directory.  If we can't delete the directory, don't worry; something else
- * that hasn't yet cleaned up may still be using it.
+ * directory and the shared tmp directory above it.  If we can't delete the
+ * directories, don't worry; something else that hasn't yet cleaned up may
+ * still be using them.
  */
 void
 test_tmpdir_free(char *path)
 {
-    if (path != NULL)
+    char *end;
+
+    if (path != NULL) {
         rmdir(path);
+        end = strrchr(path, '/');
+        if (end != NULL) {
+            *end = '\0';
+            rmdir(path);
+        }
+    }
     free(path);
 }
 
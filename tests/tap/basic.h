@@ -143,8 +143,9 @@ char *test_file_path(const char *file)
 void test_file_path_free(char *path);
 
 /*
- * Create a temporary directory relative to BUILD and return the path.  The
- * returned path should be freed with test_tmpdir_free.
+ * Create a temporary directory for this test, tmp/<pid> relative to BUILD,
+ * and return the path.  The returned path should be freed with
+ * test_tmpdir_free, which also removes the directory and tmp if empty.
  */
 char *test_tmpdir(void)
     __attribute__((__malloc__, __warn_unused_result__));
@@ -49,8 +49,15 @@ plan_lazy () {
     trap finish 0
 }
 
-# Report the test status on exit.
+# Report the test status on exit and remove the temporary directory for this
+# test, and the shared directory above it, if they're empty.
 finish () {
+    tap_tmpdir=`tap_tmpdir_path`
+    if [ -d "$tap_tmpdir" ] ; then
+        tap_tmpbase=`dirname "$tap_tmpdir"`
+        rmdir "$tap_tmpdir" 2>/dev/null
+        rmdir "$tap_tmpbase" 2>/dev/null
+    fi
     tap_highest=`expr "$count" - 1`
     if [ "$planned" = 0 ] ; then
         echo "1..$tap_highest"
@@ -228,19 +235,29 @@ test_file_path () {
     fi
 }
 
-# Create $BUILD/tmp for use by tests for storing temporary files and return
-# the path (via standard output).
+# Create a temporary directory for this test, named after the process ID of
+# the test script under $BUILD/tmp, and return the path (via standard
+# output).  Each test gets its own directory so that tests run in parallel
+# don't interfere with each other.  If another test removes $BUILD/tmp while
+# we're creating it, try again.  finish removes the directory if it's empty.
 #
 # This macro uses puts, so don't run it using backticks inside double quotes
 # or bizarre quoting behavior will happen with Solaris sh.
 test_tmpdir () {
-    if [ -z "$BUILD" ] ; then
-        tap_tmpdir="./tmp"
-    else
-        tap_tmpdir="$BUILD"/tmp
-    fi
+    tap_tmpdir=`tap_tmpdir_path`
     if [ ! -d "$tap_tmpdir" ] ; then
-        mkdir "$tap_tmpdir" || bail "Error creating $tap_tmpdir"
+        mkdir -p "$tap_tmpdir" || mkdir -p "$tap_tmpdir" \
+            || bail "Error creating $tap_tmpdir"
     fi
     puts "$tap_tmpdir"
 }
+
+# Return the path to the temporary directory for this test, without creating
+# it.  Used by test_tmpdir and finish.
+tap_tmpdir_path () {
+    if [ -z "$BUILD" ] ; then
+        echo "./tmp/$$"
+    else
+        echo "$BUILD/tmp/$$"
+    fi
+}
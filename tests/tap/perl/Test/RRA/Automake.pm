@@ -20,6 +20,7 @@ use warnings;
 ## no critic (ClassHierarchies::ProhibitExplicitISA)
 
 use Exporter;
+use File::Basename qw(dirname);
 use File::Spec;
 use Test::More;
 use Test::RRA::Config qw($LIBRARY_PATH);
@@ -219,9 +220,11 @@ sub test_file_path {
 }
 
 # Create a temporary directory for tests to use for transient files and return
-# the path to that directory.  The directory is automatically removed on
-# program exit.  The directory permissions use the current umask.  Calls
-# BAIL_OUT if the directory could not be created.
+# the path to that directory.  Each test gets its own directory, named after
+# its process ID, under a tmp directory shared by all tests, so that tests run
+# in parallel don't interfere with each other.  The directory is automatically
+# removed on program exit.  The directory permissions use the current umask.
+# Calls BAIL_OUT if the directory could not be created.
 #
 # Returns: Path to a writable temporary directory
 sub test_tmpdir {
@@ -233,14 +236,21 @@ sub test_tmpdir {
         $path = $TMPDIR;
     } else {
         my $base = defined($ENV{BUILD}) ? $ENV{BUILD} : File::Spec->curdir;
-        $path = File::Spec->catdir($base, 'tmp');
+        $path = File::Spec->catdir($base, 'tmp', $$);
     }
 
-    # Create the directory if it doesn't exist.
-    if (!-d $path) {
-        if (!mkdir($path, 0777)) {
-            BAIL_OUT("cannot create directory $path: $!");
+    # Create the directory if it doesn't exist.  Another test may remove the
+    # shared tmp directory while we're creating it, so try more than once.
+    my $shared = dirname($path);
+    for (1 .. 100) {
+        last if -d $path;
+        if (!mkdir($shared, 0777) && !-d $shared) {
+            BAIL_OUT("cannot create directory $shared: $!");
         }
+        last if mkdir($path, 0777);
+    }
+    if (!-d $path) {
+        BAIL_OUT("cannot create directory $path: $!");
     }
 
     # Store the directory name for cleanup and return it.
@@ -248,7 +258,8 @@ sub test_tmpdir {
     return $path;
 }
 
-# On program exit, remove $TMPDIR if set and if possible.  Report errors with
+# On program exit, remove $TMPDIR if set and if possible, and then the shared
+# tmp directory above it if it's empty.  Report errors removing $TMPDIR with
 # diag but otherwise ignore them.
 END {
     if (defined($TMPDIR) && -d $TMPDIR) {
@@ -256,6 +267,7 @@ END {
         if (!rmdir($TMPDIR)) {
             diag("cannot remove temporary directory $TMPDIR: $!");
         }
+        rmdir(dirname($TMPDIR));
     }
 }
 
@@ -344,8 +356,10 @@ calls BAIL_OUT if FILE could not be found.
 =item test_tmpdir()
 
 Create a temporary directory for tests to use for transient files and
-return the path to that directory.  The directory is created relative to
-the BUILD environment variable, which must be set.  Permissions on the
+return the path to that directory.  The directory is created as tmp/PID
+relative to the BUILD environment variable, which must be set, where PID
+is the process ID of the test, so that tests run in parallel each have
+their own directory.  Permissions on the
 directory are set using the current umask.  test_tmpdir() returns the full
 path to the temporary directory or calls BAIL_OUT if it could not be
 created.
@@ -0,0 +1,226 @@
+/*
+ * Benchmark for zero-copy access to libevent buffers.
+ *
+ * Parses a stream of length-prefixed frames out of an evbuffer two ways: by
+ * copying each frame into a struct buffer with evbuffer_remove, and by
+ * parsing it in place with buffer_peek_evbuffer and buffer_drain_evbuffer.
+ * The stream is added to the evbuffer in 4KB chains to mimic data read from
+ * a socket, so some frames span chains.
+ *
+ * Usage: buffer-event-bench [<frame-size> [<megabytes>]]
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/event.h>
+#include <portable/system.h>
+
+#include <sys/time.h>
+
+#include <util/buffer.h>
+#include <util/buffer-event.h>
+#include <util/messages.h>
+#include <util/xmalloc.h>
+
+/* Size of the chains added to the evbuffer, like a typical socket read. */
+#define CHAIN_SIZE 4096
+
+
+/*
+ * Build a stream of frames of the given size totalling about the given
+ * number of bytes.  Each frame is a four-byte network byte order length
+ * followed by that many bytes of data.  Returns the stream and stores its
+ * length in length.
+ */
+static unsigned char *
+stream_new(size_t frame, size_t total, size_t *length)
+{
+    unsigned char *stream;
+    size_t count, i, j;
+    unsigned char *p;
+
+    count = total / (frame + 4) + 1;
+    stream = xmalloc(count * (frame + 4));
+    for (p = stream, i = 0; i < count; i++) {
+        *p++ = (frame >> 24) & 0xff;
+        *p++ = (frame >> 16) & 0xff;
+        *p++ = (frame >> 8) & 0xff;
+        *p++ = frame & 0xff;
+        for (j = 0; j < frame; j++)
+            *p++ = (unsigned char) (i + j);
+    }
+    *length = count * (frame + 4);
+    return stream;
+}
+
+
+/*
+ * Fill an evbuffer with the stream in CHAIN_SIZE pieces.  Adding by reference
+ * keeps the chains separate and keeps the setup cost out of the timings.
+ */
+static void
+stream_load(struct evbuffer *source, const unsigned char *stream,
+            size_t length)
+{
+    size_t offset, size;
+
+    for (offset = 0; offset < length; offset += size) {
+        size = length - offset;
+        if (size > CHAIN_SIZE)
+            size = CHAIN_SIZE;
+        if (evbuffer_add_reference(source, stream + offset, size, NULL,
+                                   NULL) < 0)
+            die("cannot add data to evbuffer");
+    }
+}
+
+
+/*
+ * Parse a frame, returning a checksum of its contents so that the parsing
+ * can't be optimized away.
+ */
+static unsigned long
+frame_sum(const unsigned char *data, size_t length)
+{
+    unsigned long sum = 0;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+        sum += data[i];
+    return sum;
+}
+
+
+/*
+ * Return the length of a frame given its header.
+ */
+static size_t
+frame_length(const unsigned char *header)
+{
+    return ((size_t) header[0] << 24) | ((size_t) header[1] << 16)
+           | ((size_t) header[2] << 8) | (size_t) header[3];
+}
+
+
+/*
+ * Parse all the frames in the evbuffer by copying each one out into a
+ * struct buffer.
+ */
+static unsigned long
+parse_copy(struct evbuffer *source, struct buffer *buffer)
+{
+    unsigned char header[4];
+    unsigned long sum = 0;
+    size_t length;
+
+    while (evbuffer_get_length(source) >= 4) {
+        if (evbuffer_remove(source, header, 4) != 4)
+            die("cannot read frame header");
+        length = frame_length(header);
+        buffer_resize(buffer, length);
+        if (evbuffer_remove(source, buffer->data, length) != (int) length)
+            die("cannot read frame");
+        buffer->used = 0;
+        buffer->left = length;
+        sum += frame_sum((unsigned char *) buffer->data, buffer->left);
+    }
+    return sum;
+}
+
+
+/*
+ * Parse all the frames in the evbuffer in place.
+ */
+static unsigned long
+parse_view(struct evbuffer *source)
+{
+    struct buffer view;
+    unsigned long sum = 0;
+    size_t length;
+
+    while (evbuffer_get_length(source) >= 4) {
+        if (!buffer_peek_evbuffer(&view, source, 4))
+            die("cannot peek at frame header");
+        length = frame_length((unsigned char *) view.data);
+        if (view.left < length + 4)
+            if (!buffer_peek_evbuffer(&view, source, length + 4))
+                die("cannot peek at frame");
+        sum += frame_sum((unsigned char *) view.data + 4, length);
+        view.used = length + 4;
+        buffer_drain_evbuffer(&view, source);
+    }
+    return sum;
+}
+
+
+/*
+ * Return the elapsed time between two timevals in seconds.
+ */
+static double
+elapsed(const struct timeval *start, const struct timeval *end)
+{
+    return (end->tv_sec - start->tv_sec)
+           + (end->tv_usec - start->tv_usec) / 1000000.0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    struct evbuffer *source;
+    struct buffer *buffer;
+    struct timeval start, end;
+    unsigned char *stream;
+    size_t frame, total, length;
+    unsigned long sum_copy, sum_view;
+    double copy, view;
+
+    message_program_name = "buffer-event-bench";
+    frame = (argc > 1) ? strtoul(argv[1], NULL, 10) : 256;
+    total = ((argc > 2) ? strtoul(argv[2], NULL, 10) : 256) * 1024 * 1024;
+    stream = stream_new(frame, total, &length);
+    source = evbuffer_new();
+    if (source == NULL)
+        die("cannot create evbuffer");
+
+    /* Time the copying parser. */
+    buffer = buffer_new();
+    stream_load(source, stream, length);
+    gettimeofday(&start, NULL);
+    sum_copy = parse_copy(source, buffer);
+    gettimeofday(&end, NULL);
+    copy = elapsed(&start, &end);
+    buffer_free(buffer);
+
+    /* Time the zero-copy parser. */
+    stream_load(source, stream, length);
+    gettimeofday(&start, NULL);
+    sum_view = parse_view(source);
+    gettimeofday(&end, NULL);
+    view = elapsed(&start, &end);
+
+    /* Report the results. */
+    if (sum_copy != sum_view)
+        die("checksum mismatch: %lu != %lu", sum_copy, sum_view);
+    printf("%lu byte frames, %.1f MB\n", (unsigned long) frame,
+           length / (1024.0 * 1024.0));
+    printf("copy: %8.3fs %10.1f MB/s\n", copy,
+           length / (1024.0 * 1024.0) / copy);
+    printf("view: %8.3fs %10.1f MB/s\n", view,
+           length / (1024.0 * 1024.0) / view);
+    evbuffer_free(source);
+    free(stream);
+    return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Test suite for zero-copy access to libevent buffers.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#ifdef HAVE_EVBUFFER_PEEK
+# include <portable/event.h>
+#endif
+#include <portable/system.h>
+
+#include <tests/tap/basic.h>
+#include <util/buffer.h>
+#include <util/buffer-event.h>
+
+#ifndef HAVE_EVBUFFER_PEEK
+
+int
+main(void)
+{
+    skip_all("requires libevent 2.0.2-alpha or later");
+    return 0;
+}
+
+#else /* HAVE_EVBUFFER_PEEK */
+
+/* Two strings added by reference so that they land in separate chains. */
+static const char test_string1[] = "This is a test";
+static const char test_string2[] = " of the buffer system";
+
+
+/*
+ * Test peeking at and draining data in an evbuffer.
+ */
+static void
+test_peek(void)
+{
+    struct evbuffer *source;
+    struct buffer view;
+    size_t length1, length2;
+    char *copy;
+
+    /* An empty evbuffer produces an empty view. */
+    source = evbuffer_new();
+    if (source == NULL)
+        bail("cannot create evbuffer");
+    ok(buffer_peek_evbuffer(&view, source, 0), "peek at empty evbuffer");
+    is_int(0, view.left, "...with no data");
+    ok(!buffer_peek_evbuffer(&view, source, 1), "peek for too much fails");
+
+    /* Add two strings in separate chains without copying them. */
+    length1 = strlen(test_string1);
+    length2 = strlen(test_string2);
+    if (evbuffer_add_reference(source, test_string1, length1, NULL, NULL) < 0)
+        bail("cannot add data to evbuffer");
+    if (evbuffer_add_reference(source, test_string2, length2, NULL, NULL) < 0)
+        bail("cannot add data to evbuffer");
+
+    /* Peeking at the first chain shouldn't copy. */
+    ok(buffer_peek_evbuffer(&view, source, length1), "peek at first chain");
+    ok(view.data == test_string1, "...without copying");
+    is_int(length1, view.left, "...with the right length");
+    is_int(0, view.used, "...and nothing used");
+
+    /* Peeking across the chains has to rearrange the evbuffer. */
+    ok(buffer_peek_evbuffer(&view, source, length1 + 5), "peek across chains");
+    is_int(length1 + 5, view.left, "...with the right length");
+    copy = bstrndup(view.data, view.left);
+    is_string("This is a test of t", copy, "...and the right data");
+    free(copy);
+
+    /* Consume part of the data. */
+    view.used = 5;
+    view.left -= 5;
+    buffer_drain_evbuffer(&view, source);
+    is_int(length1 + length2 - 5, evbuffer_get_length(source),
+           "drain removes the used data");
+    ok(view.data == NULL && view.size == 0, "...and clears the view");
+    ok(buffer_peek_evbuffer(&view, source, 0), "peek at the remainder");
+    copy = bstrndup(view.data, view.left);
+    ok(strncmp("is a test of the buffer system", copy, view.left) == 0,
+       "...and it starts in the right place");
+    free(copy);
+
+    /* Draining without using anything leaves the evbuffer alone. */
+    buffer_drain_evbuffer(&view, source);
+    is_int(length1 + length2 - 5, evbuffer_get_length(source),
+           "drain with nothing used changes nothing");
+    evbuffer_free(source);
+}
+
+
+/*
+ * Test reserving and committing space at the end of an evbuffer.
+ */
+static void
+test_reserve(void)
+{
+    struct evbuffer *sink;
+    struct buffer view;
+    char *copy;
+    size_t length;
+
+    sink = evbuffer_new();
+    if (sink == NULL)
+        bail("cannot create evbuffer");
+    if (evbuffer_add(sink, "start ", 6) < 0)
+        bail("cannot add data to evbuffer");
+
+    /* Reserve space and write into it in two steps. */
+    ok(buffer_reserve_evbuffer(&view, sink, 100), "reserve space");
+    ok(view.size >= 100, "...of at least the requested size");
+    is_int(0, view.used + view.left, "...with no data");
+    length = strlen(test_string1);
+    memcpy(view.data, test_string1, length);
+    view.left = length;
+    is_int(6, evbuffer_get_length(sink), "...and nothing added yet");
+    ok(buffer_commit_evbuffer(&view, sink), "commit the data");
+    ok(view.data == NULL && view.size == 0, "...and clears the view");
+    is_int(6 + length, evbuffer_get_length(sink), "...and adds the data");
+    copy = bstrndup((char *) evbuffer_pullup(sink, -1),
+                    evbuffer_get_length(sink));
+    is_string("start This is a test", copy, "...in the right place");
+    free(copy);
+
+    /* Committing more than was reserved is rejected. */
+    ok(buffer_reserve_evbuffer(&view, sink, 10), "reserve more space");
+    view.left = view.size + 1;
+    ok(!buffer_commit_evbuffer(&view, sink), "...and overflow is rejected");
+    is_int(6 + length, evbuffer_get_length(sink), "...without adding data");
+    evbuffer_free(sink);
+}
+
+
+int
+main(void)
+{
+    plan(15 + 11);
+
+    test_peek();
+    test_reserve();
+    return 0;
+}
+
+#endif /* HAVE_EVBUFFER_PEEK */
@@ -0,0 +1,328 @@
+/*
+ * Test suite for asynchronous message handlers.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include <tests/tap/basic.h>
+#include <tests/tap/process.h>
+#include <tests/tap/string.h>
+#include <util/buffer.h>
+#include <util/messages.h>
+#include <util/messages-async.h>
+
+/* The number of threads and messages per thread in the threaded test. */
+#define THREADS  4
+#define MESSAGES 1000
+
+
+/*
+ * Open a new, empty temporary file for output and return the descriptor.
+ */
+static int
+output_open(const char *tmpdir, const char *name, char **path)
+{
+    int fd;
+
+    basprintf(path, "%s/%s", tmpdir, name);
+    fd = open(*path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        sysbail("cannot create %s", *path);
+    return fd;
+}
+
+
+/*
+ * Return the contents of an output file as a nul-terminated string, which
+ * the caller must free.
+ */
+static char *
+output_read(const char *path)
+{
+    struct buffer *buffer;
+    char *result;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        sysbail("cannot open %s", path);
+    buffer = buffer_new();
+    if (!buffer_read_file(buffer, fd))
+        sysbail("cannot read %s", path);
+    close(fd);
+    result = bstrndup(buffer->data, buffer->left);
+    buffer_free(buffer);
+    return result;
+}
+
+
+/*
+ * Count the lines in a string that start with the given prefix.
+ */
+static unsigned long
+count_lines(const char *data, const char *prefix)
+{
+    const char *p;
+    unsigned long count = 0;
+
+    for (p = data; *p != '\0'; p = strchr(p, '\n') + 1) {
+        if (strncmp(p, prefix, strlen(prefix)) == 0)
+            count++;
+        if (strchr(p, '\n') == NULL)
+            break;
+    }
+    return count;
+}
+
+
+/*
+ * A test function for is_function_output that logs through an asynchronous
+ * handler without starting asynchronous logging.
+ */
+static void
+test_sync(void *data UNUSED)
+{
+    message_handlers_warn(1, message_log_async_stdout);
+    warn("sync");
+}
+
+
+/*
+ * A test function for is_function_output that dies with the message queued
+ * by an asynchronous handler.
+ */
+static void
+test_die(void *data UNUSED)
+{
+    message_handlers_die(1, message_log_async_stderr);
+    if (!message_async_start(0, MESSAGE_ASYNC_BLOCK, -1))
+        sysdie("cannot start asynchronous logging");
+    die("fatal error %d", 42);
+}
+
+
+/*
+ * A message_fatal_cleanup function, used to check that the cleanup function
+ * installed by message_async_start calls it.
+ */
+static int
+test_cleanup(void)
+{
+    fprintf(stderr, "cleanup\n");
+    return 3;
+}
+
+
+/*
+ * Like test_die, but with a message_fatal_cleanup function set.
+ */
+static void
+test_die_cleanup(void *data)
+{
+    message_fatal_cleanup = test_cleanup;
+    test_die(data);
+}
+
+
+#ifdef HAVE_PTHREAD
+
+/*
+ * The thread function for the threaded test.  Logs MESSAGES messages tagged
+ * with the thread number.
+ */
+static void *
+test_thread(void *data)
+{
+    int *id = data;
+    int i;
+
+    for (i = 0; i < MESSAGES; i++)
+        warn("thread %d message %d", *id, i);
+    return NULL;
+}
+
+
+/*
+ * Check that the messages from the threaded test are all present and that
+ * each thread's messages are in order.
+ */
+static bool
+check_threads(const char *data)
+{
+    int next[THREADS] = { 0 };
+    const char *p;
+    int id, n;
+
+    p = strstr(data, "test: thread ");
+    for (; p != NULL; p = strstr(p + 1, "test: thread ")) {
+        if (sscanf(p, "test: thread %d message %d", &id, &n) != 2)
+            return false;
+        if (id < 0 || id >= THREADS || n != next[id])
+            return false;
+        next[id]++;
+    }
+    for (id = 0; id < THREADS; id++)
+        if (next[id] != MESSAGES)
+            return false;
+    return true;
+}
+
+
+/*
+ * Log from several threads at once and check that nothing is lost or
+ * reordered within a thread.  Uses the block policy.
+ */
+static void
+test_threads(const char *tmpdir)
+{
+    pthread_t threads[THREADS];
+    int ids[THREADS];
+    char *path, *output;
+    int fd, i;
+
+    fd = output_open(tmpdir, "threads", &path);
+    ok(message_async_start(1024, MESSAGE_ASYNC_BLOCK, fd),
+       "start with a small queue");
+    for (i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        if (pthread_create(&threads[i], NULL, test_thread, &ids[i]) != 0)
+            sysbail("cannot create thread");
+    }
+    for (i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+    message_async_flush();
+    output = output_read(path);
+    ok(check_threads(output), "all messages from all threads in order");
+    is_int(0, message_async_dropped(), "...and none dropped");
+    message_async_stop();
+    close(fd);
+    unlink(path);
+    free(output);
+    free(path);
+}
+
+#else /* !HAVE_PTHREAD */
+
+static void
+test_threads(const char *tmpdir UNUSED)
+{
+    skip_block(3, "threads not supported");
+}
+
+#endif /* !HAVE_PTHREAD */
+
+
+int
+main(void)
+{
+    char *tmpdir, *path, *output, *expected;
+    unsigned long delivered, dropped;
+    int fd, i;
+
+    /* Without thread support, there's nothing to test. */
+    if (!message_async_start(0, MESSAGE_ASYNC_BLOCK, -1) && errno == ENOSYS)
+        skip_all("asynchronous logging not supported");
+    message_async_stop();
+
+    plan(22);
+    tmpdir = test_tmpdir();
+    message_program_name = "test";
+
+    /* Basic messages, including errno reporting. */
+    fd = output_open(tmpdir, "basic", &path);
+    ok(message_async_start(0, MESSAGE_ASYNC_BLOCK, fd), "start");
+    ok(!message_async_start(0, MESSAGE_ASYNC_BLOCK, fd), "...only once");
+    is_int(EBUSY, errno, "...with EBUSY");
+    message_handlers_warn(1, message_log_async_file);
+    warn("first %d", 1);
+    errno = EPERM;
+    syswarn("second");
+    message_async_flush();
+    output = output_read(path);
+    basprintf(&expected, "test: first 1\ntest: second: %s\n",
+              strerror(EPERM));
+    is_string(expected, output, "messages are written on flush");
+    free(expected);
+    free(output);
+
+    /* Messages longer than half the queue are truncated. */
+    message_async_stop();
+    if (ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0)
+        sysbail("cannot truncate %s", path);
+    ok(message_async_start(1024, MESSAGE_ASYNC_BLOCK, fd),
+       "restart with a small queue");
+    warn("%02000d", 0);
+    message_async_stop();
+    output = output_read(path);
+    ok(strlen(output) > 100 && strlen(output) < 600,
+       "long message is truncated");
+    ok(strncmp(output, "test: 000", 9) == 0, "...and starts correctly");
+    free(output);
+    close(fd);
+    unlink(path);
+    free(path);
+
+    /* After stopping, the handlers are synchronous. */
+    is_function_output(test_sync, NULL, 0, "test: sync\n",
+                       "handlers are synchronous when stopped");
+
+    /* Threaded logging. */
+    test_threads(tmpdir);
+
+    /*
+     * With the count policy and a tiny queue, some messages may be dropped,
+     * but every message is either written or counted, and drops are
+     * reported.
+     */
+    fd = output_open(tmpdir, "count", &path);
+    ok(message_async_start(1024, MESSAGE_ASYNC_COUNT, fd),
+       "start with count policy");
+    for (i = 0; i < MESSAGES; i++)
+        warn("message %04d with some padding to fill the queue quickly", i);
+    message_async_stop();
+    output = output_read(path);
+    delivered = count_lines(output, "test: message ");
+    dropped = message_async_dropped();
+    is_int(MESSAGES, delivered + dropped, "every message written or counted");
+    if (dropped > 0)
+        ok(strstr(output, "log messages dropped (queue full)") != NULL,
+           "...and drops are reported");
+    else
+        skip("no messages dropped");
+    free(output);
+    close(fd);
+    unlink(path);
+    free(path);
+
+    /* die flushes the queue before exiting. */
+    message_handlers_reset();
+    is_function_output(test_die, NULL, 1, "test: fatal error 42\n",
+                       "die flushes queued messages");
+    is_function_output(test_die_cleanup, NULL, 3,
+                       "test: fatal error 42\ncleanup\n",
+                       "...and calls the original cleanup");
+
+    /* Clean up. */
+    test_tmpdir_free(tmpdir);
+    return 0;
+}
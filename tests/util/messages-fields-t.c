@@ -0,0 +1,171 @@
+/*
+ * Test suite for structured logging.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+#include <portable/socket.h>
+
+#include <errno.h>
+
+#include <tests/tap/basic.h>
+#include <tests/tap/process.h>
+#include <tests/tap/string.h>
+#include <util/buffer.h>
+#include <util/macros.h>
+#include <util/messages.h>
+#include <util/messages-fields.h>
+
+
+/*
+ * Check the contents of a buffer against a string and then clear it.
+ */
+static void
+is_buffer(struct buffer *buffer, const char *expected, const char *name)
+{
+    char *seen;
+
+    seen = bstrndup(buffer->data, buffer->left);
+    is_string(expected, seen, "%s", name);
+    free(seen);
+    buffer_set(buffer, NULL, 0);
+}
+
+
+/*
+ * Test functions for is_function_output.
+ */
+static void
+test_warn(void *data UNUSED)
+{
+    message_program_name = "test";
+    warn_fields("failed", MESSAGE_INT("count", 3), MESSAGE_FIELD_END);
+}
+
+static void
+test_logfmt(void *data UNUSED)
+{
+    message_fields_output(STDOUT_FILENO, MESSAGE_FIELDS_LOGFMT);
+    notice_fields("started", MESSAGE_STRING("mode", "fast"),
+                  MESSAGE_FIELD_END);
+    debug_fields("hidden", MESSAGE_FIELD_END);
+    message_handlers_notice(0);
+    notice_fields("also hidden", MESSAGE_FIELD_END);
+    message_handlers_debug(1, message_log_stdout);
+    debug_fields("shown", MESSAGE_FIELD_END);
+    message_fields_free();
+}
+
+
+int
+main(void)
+{
+    struct buffer *buffer;
+    struct sockaddr_in sin;
+    char *expected;
+#ifdef HAVE_INET6
+    struct sockaddr_in6 sin6;
+#endif
+
+    plan(14);
+    buffer = buffer_new();
+
+    /* Each type of field in JSON. */
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(25);
+    sin.sin_addr.s_addr = htonl(0x7f000001UL);
+    buffer_append_fields(buffer, MESSAGE_FIELDS_JSON, "warn", "hello",
+                         MESSAGE_STRING("user", "alice"),
+                         MESSAGE_INT("count", -42),
+                         MESSAGE_ERRNO("error", EPERM),
+                         MESSAGE_SOCKADDR("peer", &sin),
+                         MESSAGE_STRING("none", NULL), MESSAGE_FIELD_END);
+    basprintf(&expected, "{\"level\":\"warn\",\"message\":\"hello\","
+              "\"user\":\"alice\",\"count\":-42,\"error\":\"%s\","
+              "\"peer\":\"127.0.0.1:25\",\"none\":null}\n", strerror(EPERM));
+    is_buffer(buffer, expected, "JSON fields");
+    free(expected);
+
+    /* The same in logfmt. */
+    buffer_append_fields(buffer, MESSAGE_FIELDS_LOGFMT, "warn", "hello",
+                         MESSAGE_STRING("user", "alice"),
+                         MESSAGE_INT("count", -42),
+                         MESSAGE_SOCKADDR("peer", &sin),
+                         MESSAGE_STRING("none", NULL), MESSAGE_FIELD_END);
+    is_buffer(buffer, "level=warn message=hello user=alice count=-42"
+              " peer=127.0.0.1:25 none=\n", "logfmt fields");
+
+    /* Escaping. */
+    buffer_append_fields(buffer, MESSAGE_FIELDS_JSON, "warn", "a \"b\"\\c",
+                         MESSAGE_STRING("text", "line\nnext\ttab\001"),
+                         MESSAGE_FIELD_END);
+    is_buffer(buffer, "{\"level\":\"warn\",\"message\":\"a \\\"b\\\"\\\\c\","
+              "\"text\":\"line\\nnext\\ttab\\u0001\"}\n", "JSON escaping");
+    buffer_append_fields(buffer, MESSAGE_FIELDS_LOGFMT, "warn", "two words",
+                         MESSAGE_STRING("eq", "a=b"),
+                         MESSAGE_STRING("empty", ""),
+                         MESSAGE_STRING("quote", "say \"hi\""),
+                         MESSAGE_FIELD_END);
+    is_buffer(buffer, "level=warn message=\"two words\" eq=\"a=b\" empty=\"\""
+              " quote=\"say \\\"hi\\\"\"\n", "logfmt quoting");
+
+    /* Appending doesn't disturb earlier data. */
+    buffer_set(buffer, "x", 1);
+    buffer_append_fields(buffer, MESSAGE_FIELDS_LOGFMT, "debug", "m",
+                         MESSAGE_FIELD_END);
+    is_buffer(buffer, "xlevel=debug message=m\n", "append to existing data");
+
+    /* An unknown field type ends the list without leaving a bare key. */
+    buffer_append_fields(buffer, MESSAGE_FIELDS_JSON, "warn", "m",
+                         MESSAGE_INT("count", 1), 99, "bogus", 1L,
+                         MESSAGE_FIELD_END);
+    is_buffer(buffer, "{\"level\":\"warn\",\"message\":\"m\",\"count\":1}\n",
+              "JSON unknown field type");
+    buffer_append_fields(buffer, MESSAGE_FIELDS_LOGFMT, "warn", "m",
+                         MESSAGE_INT("count", 1), 99, "bogus", 1L,
+                         MESSAGE_FIELD_END);
+    is_buffer(buffer, "level=warn message=m count=1\n",
+              "logfmt unknown field type");
+
+    /* IPv6 addresses are in brackets. */
+#ifdef HAVE_INET6
+    memset(&sin6, 0, sizeof(sin6));
+    sin6.sin6_family = AF_INET6;
+    sin6.sin6_port = htons(443);
+    sin6.sin6_addr.s6_addr[15] = 1;
+    buffer_append_fields(buffer, MESSAGE_FIELDS_LOGFMT, "warn", "m",
+                         MESSAGE_SOCKADDR("peer", &sin6), MESSAGE_FIELD_END);
+    is_buffer(buffer, "level=warn message=m peer=[::1]:443\n",
+              "IPv6 address");
+#else
+    skip("IPv6 not supported");
+#endif
+
+    /* The logging functions. */
+    is_function_output(test_warn, NULL, 0,
+                       "{\"level\":\"warn\",\"program\":\"test\","
+                       "\"message\":\"failed\",\"count\":3}\n",
+                       "warn_fields");
+    is_function_output(test_logfmt, NULL, 0,
+                       "level=notice message=started mode=fast\n"
+                       "level=debug message=shown\n",
+                       "notice_fields and debug_fields");
+
+    /* Clean up. */
+    buffer_free(buffer);
+    return 0;
+}
@@ -0,0 +1,211 @@
+/*
+ * Test suite for rate-limited message handlers.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <errno.h>
+
+#include <tests/tap/basic.h>
+#include <tests/tap/process.h>
+#include <tests/tap/string.h>
+#include <util/buffer.h>
+#include <util/macros.h>
+#include <util/messages.h>
+#include <util/messages-ratelimit.h>
+
+/* Collects the messages passed on by the rate-limited handler. */
+static struct buffer *seen;
+
+/*
+ * Distinct format strings for testing collisions, more than enough that some
+ * of them will hash to the same place.
+ */
+#define FORMAT_COUNT 200
+static char formats[FORMAT_COUNT][8];
+
+
+/*
+ * A message handler that records each message, with the errno value if any,
+ * as a line in seen.
+ */
+static void
+record(size_t len UNUSED, const char *format, va_list args, int err)
+{
+    buffer_append_vsprintf(seen, format, args);
+    if (err != 0)
+        buffer_append_sprintf(seen, " [%d]", err);
+    buffer_append(seen, "\n", 1);
+}
+
+
+/*
+ * Return the recorded messages as a string and clear them.  The caller must
+ * free the result.
+ */
+static char *
+recorded(void)
+{
+    char *result;
+
+    result = bstrndup(seen->data, seen->left);
+    buffer_set(seen, NULL, 0);
+    return result;
+}
+
+
+/*
+ * Log a message the given number of times from a single call site.
+ */
+static void
+repeat(int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        warn("message %d", i);
+}
+
+
+/*
+ * Pass a message directly to the rate-limited handler, used with format
+ * strings that aren't literals.
+ */
+static void
+log_format(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    message_log_ratelimit(strlen(format), format, args, 0);
+    va_end(args);
+}
+
+
+/*
+ * A test function for is_function_output that uses the default handler.
+ */
+static void
+test_default(void *data UNUSED)
+{
+    message_handlers_warn(1, message_log_ratelimit);
+    message_program_name = "test";
+    warn("default");
+}
+
+
+int
+main(void)
+{
+    char *output, *expected, *p;
+    int i, j, count;
+    struct buffer *wanted;
+
+    plan(11);
+    seen = buffer_new();
+    message_ratelimit_handlers(1, record);
+    message_handlers_warn(1, message_log_ratelimit);
+
+    /* Only the burst gets through, followed by a summary on flush. */
+    message_ratelimit_set(3, 60);
+    repeat(10);
+    output = recorded();
+    is_string("message 0\nmessage 1\nmessage 2\n", output, "burst allowed");
+    free(output);
+    message_ratelimit_flush();
+    output = recorded();
+    is_string("last message repeated 7 times (message %d)\n", output,
+              "summary on flush");
+    free(output);
+    message_ratelimit_flush();
+    output = recorded();
+    is_string("", output, "...and only once");
+    free(output);
+
+    /* Each call site has its own limit, and errno is passed through. */
+    for (i = 0; i < 5; i++) {
+        errno = EPERM;
+        syswarn("first %d", i);
+        warn("second %d", i);
+    }
+    output = recorded();
+    basprintf(&expected, "first 0 [%d]\nsecond 0\nfirst 1 [%d]\nsecond 1\n"
+              "first 2 [%d]\nsecond 2\n", EPERM, EPERM, EPERM);
+    is_string(expected, output, "separate limits per call site");
+    free(expected);
+    free(output);
+
+    /* After the interval, tokens are refilled and the summary is logged. */
+    message_ratelimit_reset();
+    message_ratelimit_handlers(1, record);
+    message_ratelimit_set(2, 1);
+    repeat(5);
+    free(recorded());
+    sleep(1);
+    repeat(1);
+    output = recorded();
+    is_string("last message repeated 3 times (message %d)\nmessage 0\n",
+              output, "refill after interval");
+    free(output);
+
+    /* With a burst of 0, nothing is limited. */
+    message_ratelimit_set(0, 1);
+    repeat(20);
+    output = recorded();
+    ok(strstr(output, "message 19\n") != NULL, "no limit with burst of 0");
+    free(output);
+
+    /*
+     * Format strings that collide keep their own buckets, so each one gets
+     * exactly its burst through and has its own summary.
+     */
+    message_ratelimit_reset();
+    message_ratelimit_handlers(1, record);
+    message_ratelimit_set(1, 60);
+    wanted = buffer_new();
+    for (i = 0; i < FORMAT_COUNT; i++) {
+        snprintf(formats[i], sizeof(formats[i]), "f%03d", i);
+        buffer_append_sprintf(wanted, "%s\n", formats[i]);
+    }
+    for (j = 0; j < 3; j++)
+        for (i = 0; i < FORMAT_COUNT; i++)
+            log_format(formats[i]);
+    output = recorded();
+    expected = bstrndup(wanted->data, wanted->left);
+    is_string(expected, output, "colliding formats limited separately");
+    free(expected);
+    free(output);
+    buffer_free(wanted);
+    message_ratelimit_flush();
+    output = recorded();
+    count = 0;
+    for (p = output; (p = strstr(p, "repeated 2 times")) != NULL; p++)
+        count++;
+    is_int(FORMAT_COUNT, count, "...and each has its own summary");
+    free(output);
+
+    /* Without a handler list, messages go to standard error. */
+    message_ratelimit_reset();
+    is_function_output(test_default, NULL, 0, "test: default\n",
+                       "default handler");
+
+    /* Clean up. */
+    message_handlers_reset();
+    message_ratelimit_reset();
+    buffer_free(seen);
+    return 0;
+}
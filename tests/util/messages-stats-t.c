@@ -0,0 +1,199 @@
+/*
+ * Test suite for message statistics and sampling.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <errno.h>
+
+#include <tests/tap/basic.h>
+#include <tests/tap/string.h>
+#include <util/buffer.h>
+#include <util/macros.h>
+#include <util/messages.h>
+#include <util/messages-stats.h>
+
+/* The number of messages seen by the counting handler. */
+static unsigned long seen = 0;
+
+
+/*
+ * A message handler that just counts messages.
+ */
+static void
+count(size_t len UNUSED, const char *format UNUSED, va_list args UNUSED,
+      int err UNUSED)
+{
+    seen++;
+}
+
+
+/*
+ * A second handler, used to test handlers without names.
+ */
+static void
+count_other(size_t len UNUSED, const char *format UNUSED,
+            va_list args UNUSED, int err UNUSED)
+{
+}
+
+
+/*
+ * Return the sum of the latency buckets for a handler.
+ */
+static unsigned long
+bucket_total(const struct message_stats_handler *handler)
+{
+    unsigned long total = 0;
+    size_t i;
+
+    for (i = 0; i < MESSAGE_STATS_BUCKETS; i++)
+        total += handler->buckets[i];
+    return total;
+}
+
+
+int
+main(void)
+{
+    struct message_stats stats;
+    struct buffer *buffer;
+    char *output;
+    int i;
+
+    plan(19);
+
+    /* The per-level counters. */
+    message_handlers_warn(1, count);
+    message_handlers_notice(1, count);
+    warn("abc");
+    warn("%d", 12345);
+    errno = EPERM;
+    syswarn("x");
+    notice("notice");
+    debug("not counted");
+    message_stats_get(&stats);
+    is_int(3, (int) stats.levels[MESSAGE_LEVEL_WARN].messages,
+           "warn messages");
+    is_int(9, (int) stats.levels[MESSAGE_LEVEL_WARN].bytes, "warn bytes");
+    is_int(1, (int) stats.levels[MESSAGE_LEVEL_NOTICE].messages,
+           "notice messages");
+    is_int(0, (int) stats.levels[MESSAGE_LEVEL_DEBUG].messages,
+           "debug without handlers not counted");
+    is_int(0, (int) stats.count, "no handler statistics by default");
+
+    /* The counters in Prometheus format. */
+    buffer = buffer_new();
+    message_stats_prometheus(buffer, "test");
+    output = bstrndup(buffer->data, buffer->left);
+    is_string("# HELP test_messages_total Messages passed to message"
+              " handlers.\n"
+              "# TYPE test_messages_total counter\n"
+              "test_messages_total{level=\"debug\"} 0\n"
+              "test_messages_total{level=\"notice\"} 1\n"
+              "test_messages_total{level=\"warn\"} 3\n"
+              "test_messages_total{level=\"die\"} 0\n"
+              "# HELP test_message_bytes_total Length of messages passed to"
+              " message handlers.\n"
+              "# TYPE test_message_bytes_total counter\n"
+              "test_message_bytes_total{level=\"debug\"} 0\n"
+              "test_message_bytes_total{level=\"notice\"} 6\n"
+              "test_message_bytes_total{level=\"warn\"} 9\n"
+              "test_message_bytes_total{level=\"die\"} 0\n"
+              "# HELP test_messages_suppressed_total Messages dropped by"
+              " sampling.\n"
+              "# TYPE test_messages_suppressed_total counter\n"
+              "test_messages_suppressed_total{level=\"debug\"} 0\n"
+              "test_messages_suppressed_total{level=\"notice\"} 0\n"
+              "test_messages_suppressed_total{level=\"warn\"} 0\n"
+              "test_messages_suppressed_total{level=\"die\"} 0\n",
+              output, "Prometheus counters");
+    free(output);
+    buffer_set(buffer, NULL, 0);
+
+    /* Sampling of debug messages. */
+    message_handlers_debug(1, count);
+    message_stats_reset();
+    seen = 0;
+    message_sample_debug(0);
+    for (i = 0; i < 100; i++)
+        debug("message %d", i);
+    is_int(0, (int) seen, "sampling at 0 drops everything");
+    message_stats_get(&stats);
+    is_int(100, (int) stats.levels[MESSAGE_LEVEL_DEBUG].suppressed,
+           "...and counts suppressed messages");
+    is_int(0, (int) stats.levels[MESSAGE_LEVEL_DEBUG].messages,
+           "...and doesn't count them as logged");
+    message_sample_debug(0.5);
+    for (i = 0; i < 10000; i++)
+        debug("message %d", i);
+    ok(seen > 4000 && seen < 6000, "sampling at 0.5 keeps about half");
+    message_stats_get(&stats);
+    is_int(10100, (int) (stats.levels[MESSAGE_LEVEL_DEBUG].messages
+                         + stats.levels[MESSAGE_LEVEL_DEBUG].suppressed),
+           "...and every message is either logged or suppressed");
+    seen = 0;
+    message_sample_debug(1);
+    for (i = 0; i < 100; i++)
+        debug("message %d", i);
+    is_int(100, (int) seen, "sampling at 1 keeps everything");
+
+    /* Per-handler statistics. */
+    message_stats_reset();
+    message_stats_timing(true);
+    ok(message_stats_name(count, "counter"), "naming a handler");
+    message_handlers_warn(2, count, count_other);
+    message_handlers_notice(1, message_log_stderr);
+    warn("one");
+    warn("two");
+    notice("to stderr");
+    message_stats_timing(false);
+    warn("not timed");
+    message_stats_get(&stats);
+    is_int(3, (int) stats.count, "three handlers seen");
+    ok(stats.handlers[0].handler == count
+           && strcmp(stats.handlers[0].name, "counter") == 0
+           && stats.handlers[0].calls == 2,
+       "named handler statistics");
+    ok(stats.handlers[1].handler == count_other
+           && stats.handlers[1].name == NULL,
+       "unnamed handler statistics");
+    ok(stats.handlers[2].handler == message_log_stderr
+           && strcmp(stats.handlers[2].name, "stderr") == 0,
+       "default handler names");
+    is_int(2, (int) bucket_total(&stats.handlers[0]), "latency buckets");
+
+    /* The handler statistics in Prometheus format. */
+    message_stats_prometheus(buffer, "test");
+    output = bstrndup(buffer->data, buffer->left);
+    ok(strstr(output, "# TYPE test_handler_duration_seconds histogram\n")
+           != NULL
+       && strstr(output, "test_handler_duration_seconds_bucket"
+                 "{handler=\"counter\",le=\"+Inf\"} 2\n") != NULL
+       && strstr(output, "test_handler_duration_seconds_count"
+                 "{handler=\"handler1\"} 2\n") != NULL
+       && strstr(output, "test_handler_duration_seconds_count"
+                 "{handler=\"stderr\"} 1\n") != NULL,
+       "Prometheus histograms");
+    free(output);
+
+    /* Clean up. */
+    buffer_free(buffer);
+    message_handlers_reset();
+    message_stats_reset();
+    return 0;
+}
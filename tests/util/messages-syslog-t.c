@@ -0,0 +1,201 @@
+/*
+ * Test suite for logging directly to the syslog daemon.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+#include <portable/socket.h>
+#include <portable/socket-unix.h>
+
+#include <errno.h>
+#include <syslog.h>
+
+#include <tests/tap/basic.h>
+#include <tests/tap/string.h>
+#include <util/messages.h>
+
+/* Large enough for any datagram the tests generate. */
+#define DATAGRAM_SIZE 8192
+
+
+/*
+ * Receive one datagram from the fake syslog daemon and return it as a
+ * nul-terminated string, which the caller must free.
+ */
+static char *
+receive(socket_type fd)
+{
+    char buffer[DATAGRAM_SIZE];
+    ssize_t length;
+
+    length = recv(fd, buffer, sizeof(buffer) - 1, 0);
+    if (length < 0)
+        sysbail("cannot receive datagram");
+    buffer[length] = '\0';
+    return bstrdup(buffer);
+}
+
+
+/*
+ * Check the header of an RFC 5424 datagram.  The priority, version, hostname,
+ * application name, and process ID have to match, and the timestamp has to
+ * look like a UTC timestamp with microseconds.  Returns a pointer to the
+ * message following the header, or NULL if the header is wrong.
+ */
+static const char *
+check_header(const char *datagram, int pri)
+{
+    char hostname[256], *prefix;
+    const char *p;
+    size_t length;
+
+    basprintf(&prefix, "<%d>1 ", pri);
+    length = strlen(prefix);
+    if (strncmp(datagram, prefix, length) != 0) {
+        free(prefix);
+        return NULL;
+    }
+    free(prefix);
+    p = datagram + length;
+    if (strlen(p) < 27 || p[10] != 'T' || p[19] != '.' || p[26] != 'Z')
+        return NULL;
+    p += 27;
+    if (gethostname(hostname, sizeof(hostname)) < 0)
+        sysbail("cannot get hostname");
+    hostname[sizeof(hostname) - 1] = '\0';
+    basprintf(&prefix, " %s test %ld - - ", hostname, (long) getpid());
+    length = strlen(prefix);
+    if (strncmp(p, prefix, length) != 0) {
+        free(prefix);
+        return NULL;
+    }
+    free(prefix);
+    return p + length;
+}
+
+
+int
+main(void)
+{
+    struct sockaddr_un sun;
+    socket_type fd;
+    char *tmpdir, *path, *datagram, *expected, *long_message;
+    const char *message;
+
+    plan(14);
+    tmpdir = test_tmpdir();
+    basprintf(&path, "%s/log", tmpdir);
+    message_program_name = "test";
+
+    /* Opening a socket that doesn't exist fails. */
+    ok(!message_syslog_open(path, LOG_DAEMON), "open of missing socket");
+    is_int(ENOENT, errno, "...with ENOENT");
+
+    /* Create the fake syslog daemon. */
+    fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd == INVALID_SOCKET)
+        sysbail("cannot create socket");
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strlcpy(sun.sun_path, path, sizeof(sun.sun_path));
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &sun, SUN_LEN(&sun)) < 0)
+        sysbail("cannot bind to %s", path);
+    ok(message_syslog_open(path, LOG_DAEMON), "open");
+
+    /* A simple message. */
+    message_handlers_warn(1, message_log_syslog_warning);
+    warn("simple %d", 1);
+    datagram = receive(fd);
+    message = check_header(datagram, LOG_DAEMON | LOG_WARNING);
+    ok(message != NULL, "header of simple message");
+    is_string("simple 1", message, "...and message");
+    free(datagram);
+
+    /* A message with an error string, at a different priority. */
+    message_handlers_warn(1, message_log_syslog_err);
+    errno = EPERM;
+    syswarn("failed");
+    datagram = receive(fd);
+    message = check_header(datagram, LOG_DAEMON | LOG_ERR);
+    ok(message != NULL, "header of error message");
+    basprintf(&expected, "failed: %s", strerror(EPERM));
+    is_string(expected, message, "...and message");
+    free(expected);
+    free(datagram);
+
+    /* A message too long for the buffer on the stack. */
+    long_message = bcalloc(4001, 1);
+    memset(long_message, 'a', 4000);
+    errno = EPERM;
+    syswarn("%s", long_message);
+    datagram = receive(fd);
+    message = check_header(datagram, LOG_DAEMON | LOG_ERR);
+    ok(message != NULL, "header of long message");
+    basprintf(&expected, "%s: %s", long_message, strerror(EPERM));
+    is_string(expected, message, "...and message");
+    free(expected);
+    free(datagram);
+    free(long_message);
+
+    /* Without a program name, the application name is a hyphen. */
+    message_program_name = NULL;
+    message_handlers_notice(1, message_log_syslog_info);
+    notice("anonymous");
+    datagram = receive(fd);
+    basprintf(&expected, "<%d>1 ", LOG_DAEMON | LOG_INFO);
+    ok(strncmp(datagram, expected, strlen(expected)) == 0,
+       "priority of anonymous message");
+    free(expected);
+    basprintf(&expected, " - %ld - - anonymous", (long) getpid());
+    message = strstr(datagram, expected);
+    ok(message != NULL, "...and application name");
+    free(expected);
+    free(datagram);
+    message_program_name = "test";
+
+    /* Messages survive a restart of the syslog daemon. */
+    close(fd);
+    unlink(path);
+    fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd == INVALID_SOCKET)
+        sysbail("cannot create socket");
+    if (bind(fd, (struct sockaddr *) &sun, SUN_LEN(&sun)) < 0)
+        sysbail("cannot bind to %s", path);
+    message_handlers_warn(1, message_log_syslog_warning);
+    warn("after restart");
+    datagram = receive(fd);
+    message = check_header(datagram, LOG_DAEMON | LOG_WARNING);
+    ok(message != NULL, "header after restart");
+    is_string("after restart", message, "...and message");
+    free(datagram);
+
+    /* Opening a path that's too long fails. */
+    long_message = bcalloc(sizeof(sun.sun_path) + 1, 1);
+    memset(long_message, 'a', sizeof(sun.sun_path));
+    ok(!message_syslog_open(long_message, LOG_DAEMON),
+       "open of overly long path");
+    free(long_message);
+
+    /* Clean up. */
+    message_syslog_close();
+    message_handlers_reset();
+    close(fd);
+    unlink(path);
+    free(path);
+    test_tmpdir_free(tmpdir);
+    return 0;
+}
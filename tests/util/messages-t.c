@@ -154,6 +154,52 @@ static void test24(void *data UNUSED) {
     notice("third");
 }
 
+/*
+ * Count calls, used to check whether the arguments to a disabled message are
+ * evaluated.
+ */
+static int evaluated = 0;
+static int evaluate(void) { return ++evaluated; }
+
+static void test25(void *data UNUSED) {
+    void (*function)(const char *, ...) = debug;
+
+    debug("%d", evaluate());
+    message_handlers_notice(0);
+    notice("%d", evaluate());
+    (void) (sysnotice("%d", evaluate()), 0);
+    printf("%d\n", evaluated);
+    message_handlers_debug(1, message_log_stdout);
+    function("%d", evaluate());
+}
+
+/*
+ * The remaining test functions are compiled with debug and notice messages
+ * removed at compile time.
+ */
+#undef MESSAGE_LEVEL_MIN
+#define MESSAGE_LEVEL_MIN MESSAGE_LEVEL_WARN
+
+static void test26(void *data UNUSED) {
+    message_handlers_debug(1, message_log_stdout);
+    debug("%d", evaluate());
+    notice("%d", evaluate());
+    sysnotice("%d", evaluate());
+    warn("%d", evaluated);
+}
+
+/* Switching back and forth between handler lists, which are reused. */
+static void test27(void *data UNUSED) {
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        message_handlers_warn(1, log_msg);
+        warn("one");
+        message_handlers_warn(2, log_msg, message_log_stderr);
+        warn("two");
+    }
+}
+
 
 /*
  * Given the intended status, intended message sans the appended strerror
@@ -182,7 +228,7 @@ main(void)
     char buff[32];
     char *output;
 
-    plan(24 * 3);
+    plan(27 * 3);
 
     is_function_output(test1, NULL, 0, "warning\n", "test1");
     is_function_output(test2, NULL, 1, "fatal\n", "test2");
@@ -222,5 +268,14 @@ main(void)
     is_function_output(test23, NULL, 0, "", "test23");
     is_function_output(test24, NULL, 0, "first\nthird\n", "test24");
 
+    /* Disabled messages don't evaluate their arguments. */
+    is_function_output(test25, NULL, 0, "0\n1\n", "test25");
+    is_function_output(test26, NULL, 0, "0\n", "test26");
+
+    /* Handler lists with the same handlers can be set repeatedly. */
+    is_function_output(test27, NULL, 0,
+                       "3 0 one\n3 0 two\ntwo\n3 0 one\n3 0 two\ntwo\n"
+                       "3 0 one\n3 0 two\ntwo\n", "test27");
+
     return 0;
 }
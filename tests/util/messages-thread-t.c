@@ -0,0 +1,236 @@
+/*
+ * Test suite for message handlers in threaded programs.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <errno.h>
+#include <sched.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include <tests/tap/basic.h>
+#include <util/macros.h>
+#include <util/messages.h>
+
+/*
+ * The number of threads in the threaded test, the number of messages logged
+ * by one thread, and the number of times to switch handlers.
+ */
+#define THREADS  4
+#define MESSAGES 10000
+#define SWITCHES 100
+
+#if defined(HAVE_PTHREAD) && defined(HAVE_ATOMIC_BUILTINS)
+
+/* Counts of messages seen by each handler. */
+static unsigned long count_global = 0;
+static unsigned long count_thread = 0;
+static unsigned long count_a = 0;
+static unsigned long count_b = 0;
+
+/* Messages sent by the logging threads, and whether they should stop. */
+static unsigned long sent = 0;
+static bool stop = false;
+
+/* The results of the checks made in the override thread. */
+struct override_result {
+    bool set;
+    int level;
+    unsigned long thread;
+    unsigned long global;
+};
+
+
+/*
+ * Message handlers that just count the messages they see.
+ */
+static void
+handle_global(size_t len UNUSED, const char *format UNUSED,
+              va_list args UNUSED, int err UNUSED)
+{
+    __atomic_add_fetch(&count_global, 1, __ATOMIC_RELAXED);
+}
+
+static void
+handle_thread(size_t len UNUSED, const char *format UNUSED,
+              va_list args UNUSED, int err UNUSED)
+{
+    __atomic_add_fetch(&count_thread, 1, __ATOMIC_RELAXED);
+}
+
+static void
+handle_a(size_t len UNUSED, const char *format UNUSED, va_list args UNUSED,
+         int err UNUSED)
+{
+    __atomic_add_fetch(&count_a, 1, __ATOMIC_RELAXED);
+}
+
+static void
+handle_b(size_t len UNUSED, const char *format UNUSED, va_list args UNUSED,
+         int err UNUSED)
+{
+    __atomic_add_fetch(&count_b, 1, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Set thread handlers for warn and debug, log some messages, and record what
+ * happened.  The debug message should go through the macro even though there
+ * are no global debug handlers.
+ */
+static void *
+override_thread(void *data)
+{
+    struct override_result *result = data;
+
+    result->set = message_thread_handlers_warn(1, handle_thread);
+    message_thread_handlers_debug(1, handle_thread);
+    result->level = message_level;
+    warn("thread warning");
+    debug("thread debug");
+    result->thread = count_thread;
+    result->global = count_global;
+    message_thread_handlers_reset();
+    warn("back to global");
+    return NULL;
+}
+
+
+/*
+ * Log a fixed number of warnings.
+ */
+static void *
+logging_thread(void *data UNUSED)
+{
+    int i;
+
+    for (i = 0; i < MESSAGES; i++)
+        warn("message %d", i);
+    return NULL;
+}
+
+
+/*
+ * Log warnings until told to stop while the main thread changes the
+ * handlers, counting the messages sent.
+ */
+static void *
+switching_thread(void *data UNUSED)
+{
+    int i = 0;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        warn("message %d", i++);
+        __atomic_add_fetch(&sent, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+
+/*
+ * Wait for a counter to be incremented by another thread.
+ */
+static void
+wait_for(unsigned long *count)
+{
+    unsigned long start;
+
+    start = __atomic_load_n(count, __ATOMIC_RELAXED);
+    while (__atomic_load_n(count, __ATOMIC_RELAXED) == start)
+        sched_yield();
+}
+
+
+int
+main(void)
+{
+    pthread_t thread, threads[THREADS];
+    struct override_result result;
+    int i;
+
+    /* Make sure thread handlers are supported. */
+    if (!message_thread_handlers_warn(0) && errno == ENOSYS)
+        skip_all("thread-local storage not supported");
+    message_thread_handlers_reset();
+
+    plan(9);
+
+    /* A thread's own handlers override the global ones in that thread. */
+    message_handlers_warn(1, handle_global);
+    memset(&result, 0, sizeof(result));
+    if (pthread_create(&thread, NULL, override_thread, &result) != 0)
+        sysbail("cannot create thread");
+    pthread_join(thread, NULL);
+    ok(result.set, "setting thread handlers succeeds");
+    is_int(MESSAGE_LEVEL_DEBUG, result.level, "...and enables debug");
+    is_int(2, (int) result.thread, "...and messages go to thread handlers");
+    is_int(0, (int) result.global, "...and not to the global handlers");
+    is_int(1, (int) count_global, "global handlers after thread reset");
+    is_int(MESSAGE_LEVEL_NOTICE, message_level, "...and debug is disabled");
+
+    /* Other threads are unaffected by this thread's handlers. */
+    count_global = 0;
+    message_thread_handlers_warn(1, handle_thread);
+    count_thread = 0;
+    if (pthread_create(&thread, NULL, logging_thread, NULL) != 0)
+        sysbail("cannot create thread");
+    pthread_join(thread, NULL);
+    message_thread_handlers_reset();
+    ok(count_global == MESSAGES && count_thread == 0,
+       "other threads use global handlers");
+
+    /*
+     * Switch the global handlers back and forth while threads are logging.
+     * Every message should be seen by exactly one of the handlers.  Wait
+     * for each new handler to see a message so that the switches overlap
+     * with logging.
+     */
+    message_handlers_warn(1, handle_a);
+    for (i = 0; i < THREADS; i++)
+        if (pthread_create(&threads[i], NULL, switching_thread, NULL) != 0)
+            sysbail("cannot create thread");
+    for (i = 0; i < SWITCHES; i++) {
+        message_handlers_warn(1, handle_b);
+        wait_for(&count_b);
+        message_handlers_warn(1, handle_a);
+        wait_for(&count_a);
+    }
+    __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+    for (i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+    ok(sent > 0 && count_a + count_b == sent,
+       "no messages lost while changing handlers");
+    ok(count_a >= SWITCHES && count_b >= SWITCHES,
+       "...and both handlers were used");
+
+    /* Clean up. */
+    message_handlers_reset();
+    return 0;
+}
+
+#else /* !(HAVE_PTHREAD && HAVE_ATOMIC_BUILTINS) */
+
+int
+main(void)
+{
+    skip_all("POSIX threads or atomic builtins not available");
+    return 0;
+}
+
+#endif /* !(HAVE_PTHREAD && HAVE_ATOMIC_BUILTINS) */
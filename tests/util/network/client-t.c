@@ -33,10 +33,15 @@
 #include <portable/socket.h>
 
 #include <errno.h>
+#ifdef HAVE_NETINET_TCP_H
+# include <netinet/tcp.h>
+#endif
 #include <sys/wait.h>
 #include <signal.h>
 
 #include <tests/tap/basic.h>
+#include <util/buffer.h>
+#include <util/fdflag.h>
 #include <util/macros.h>
 #include <util/messages.h>
 #include <util/network.h>
@@ -422,11 +427,196 @@ test_network_write(void)
 }
 
 
+/*
+ * Test the nonblocking buffer read and write functions.  Use a socketpair so
+ * that we control exactly what data is available on each side.
+ */
+static void
+test_network_buffer(void)
+{
+    socket_type fds[2];
+    struct buffer *in, *out;
+    enum network_io status;
+    size_t total, size;
+    char *data;
+    int i;
+    bool stable;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        sysbail("cannot create socketpair");
+    if (!fdflag_nonblocking(fds[0], true) || !fdflag_nonblocking(fds[1], true))
+        sysbail("cannot make sockets nonblocking");
+    in = buffer_new();
+    out = buffer_new();
+
+    /* Nothing to read yet. */
+    status = network_read_buffer(fds[0], in, 10);
+    is_int(NETWORK_IO_AGAIN, status, "network_read_buffer with no data");
+    is_int(0, in->left, "...and nothing read");
+
+    /* A partial read records progress and a later read completes it. */
+    buffer_set(out, "hello", 5);
+    status = network_write_buffer(fds[1], out);
+    is_int(NETWORK_IO_DONE, status, "network_write_buffer");
+    is_int(0, out->left, "...and buffer consumed");
+    status = network_read_buffer(fds[0], in, 10);
+    is_int(NETWORK_IO_AGAIN, status, "...partial read");
+    is_int(5, in->left, "...with partial data");
+    buffer_set(out, " world", 6);
+    network_write_buffer(fds[1], out);
+    status = network_read_buffer(fds[0], in, 10);
+    is_int(NETWORK_IO_DONE, status, "...completed read");
+    ok(in->left >= 10, "...with all requested data");
+
+    /* Reading with a total of 0 drains everything available. */
+    status = network_read_buffer(fds[0], in, 0);
+    is_int(NETWORK_IO_AGAIN, status, "...draining read");
+    is_int(11, in->left, "...with all available data");
+    ok(memcmp(in->data + in->used, "hello world", 11) == 0,
+       "...and the correct data");
+
+    /*
+     * A write larger than the socket buffers can absorb returns
+     * NETWORK_IO_AGAIN with partial progress, and completes once the other
+     * side reads the data.
+     */
+    data = bcalloc(8 * 1024 * 1024, 1);
+    buffer_set(out, data, 8 * 1024 * 1024);
+    free(data);
+    status = network_write_buffer(fds[1], out);
+    is_int(NETWORK_IO_AGAIN, status, "large network_write_buffer blocks");
+    ok(out->used > 0 && out->left > 0, "...after partial progress");
+    buffer_set(in, NULL, 0);
+    total = 0;
+    do {
+        status = network_write_buffer(fds[1], out);
+        if (network_read_buffer(fds[0], in, 0) == NETWORK_IO_ERROR)
+            break;
+        total += in->left;
+        buffer_set(in, NULL, 0);
+    } while (status == NETWORK_IO_AGAIN);
+    if (network_read_buffer(fds[0], in, 0) == NETWORK_IO_AGAIN)
+        total += in->left;
+    is_int(NETWORK_IO_DONE, status, "...and finishes once read");
+    is_int(8 * 1024 * 1024, total, "...with all the data");
+
+    /*
+     * Repeated draining reads that leave a partial frame unconsumed reuse the
+     * free space in the buffer rather than growing it each time.
+     */
+    buffer_set(in, NULL, 0);
+    size = 0;
+    stable = true;
+    for (i = 0; i < 12; i++) {
+        buffer_set(out, "0123456789", 10);
+        network_write_buffer(fds[1], out);
+        if (network_read_buffer(fds[0], in, 0) != NETWORK_IO_AGAIN)
+            stable = false;
+        in->used += in->left - 3;
+        in->left = 3;
+        if (i == 0)
+            size = in->size;
+        else if (in->size != size)
+            stable = false;
+    }
+    ok(stable, "...and buffer size stays stable with leftover data");
+
+    /* Closing the write side is reported as EOF. */
+    socket_close(fds[1]);
+    buffer_set(in, NULL, 0);
+    status = network_read_buffer(fds[0], in, 1);
+    is_int(NETWORK_IO_EOF, status, "network_read_buffer at EOF");
+
+    /* Clean up. */
+    socket_close(fds[0]);
+    buffer_free(in);
+    buffer_free(out);
+}
+
+
+/*
+ * Return the integer value of a socket option, bailing on failure.
+ */
+static int
+get_option(socket_type fd, int level, int option)
+{
+    int value = 0;
+    socklen_t length = sizeof(value);
+
+    if (getsockopt(fd, level, option, (void *) &value, &length) < 0)
+        sysbail("cannot get socket option %d", option);
+    return value;
+}
+
+
+/*
+ * Test the socket options profile with network_bind_ipv4_options,
+ * network_connect_options, and network_client_create_options.  Fast Open is
+ * requested on both ends, which should work whether or not the kernel allows
+ * it, since the connection falls back on a normal handshake.
+ */
+static void
+test_network_options(void)
+{
+    struct network_options options;
+    struct addrinfo hints, *ai;
+    socket_type fd, client, c;
+    char buffer[5];
+
+    /* Bind and listen with a profile. */
+    memset(&options, 0, sizeof(options));
+    options.nodelay = true;
+    options.fastopen = 16;
+    options.rcvbuf = 32 * 1024;
+    fd = network_bind_ipv4_options(SOCK_STREAM, "127.0.0.1", 11119, &options);
+    if (fd == INVALID_SOCKET)
+        sysbail("cannot create or bind socket");
+    if (listen(fd, 1) < 0)
+        sysbail("cannot listen to socket");
+    ok(get_option(fd, SOL_SOCKET, SO_RCVBUF) >= 32 * 1024,
+       "network_bind_ipv4_options sets SO_RCVBUF");
+    ok(get_option(fd, IPPROTO_TCP, TCP_NODELAY), "...and TCP_NODELAY");
+
+    /* Connect with a profile and pass some data. */
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo("127.0.0.1", "11119", &hints, &ai) != 0)
+        bail("cannot resolve 127.0.0.1");
+    alarm(10);
+    client = network_connect_options(ai, NULL, 5, &options);
+    freeaddrinfo(ai);
+    ok(client != INVALID_SOCKET, "network_connect_options");
+    if (client == INVALID_SOCKET)
+        sysbail("cannot connect");
+    ok(get_option(client, IPPROTO_TCP, TCP_NODELAY), "...sets TCP_NODELAY");
+    ok(network_write(client, "hello", 5, 5), "...and can write");
+    c = accept(fd, NULL, NULL);
+    if (c == INVALID_SOCKET)
+        sysbail("cannot accept on socket");
+    ok(network_read(c, buffer, 5, 5), "...and the server can read");
+    ok(memcmp(buffer, "hello", 5) == 0, "...the correct data");
+    alarm(0);
+    socket_close(c);
+    socket_close(client);
+    socket_close(fd);
+
+    /* TCP options are ignored for UDP sockets, but buffer sizes apply. */
+    options.sndbuf = 32 * 1024;
+    client = network_client_create_options(PF_INET, SOCK_DGRAM, NULL,
+                                           &options);
+    ok(client != INVALID_SOCKET, "network_client_create_options");
+    ok(get_option(client, SOL_SOCKET, SO_SNDBUF) >= 32 * 1024,
+       "...sets SO_SNDBUF");
+    socket_close(client);
+}
+
+
 int
 main(void)
 {
     /* Set up the plan. */
-    plan(22);
+    plan(48);
 
     /* Test network_client_create. */
     test_create_ipv4(NULL);
@@ -438,5 +628,11 @@ main(void)
     /* Test network_read and network_write. */
     test_network_read();
     test_network_write();
+
+    /* Test network_read_buffer and network_write_buffer. */
+    test_network_buffer();
+
+    /* Test the socket options profile. */
+    test_network_options();
     return 0;
 }
@@ -0,0 +1,175 @@
+/*
+ * Benchmark for the socket options profile on loopback.
+ *
+ * Forks a server that answers each connection with a short reply and then
+ * closes it, and then times a client that reconnects for every request,
+ * first with no options, then with TCP_NODELAY, and then with TCP Fast Open
+ * as well.  Fast Open only saves the round trip if it is enabled for both
+ * client and server in the net.ipv4.tcp_fastopen sysctl (a value of 3).
+ *
+ * Usage: connect-bench [<requests>]
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+#include <portable/socket.h>
+
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <util/messages.h>
+#include <util/network.h>
+#include <util/xmalloc.h>
+
+/* Size of the request and reply. */
+#define MESSAGE_SIZE 64
+
+
+/*
+ * Run the server: accept connections forever, reading a request from each
+ * and sending back a reply before closing it.
+ */
+static void __attribute__((__noreturn__))
+server(socket_type fd)
+{
+    char buffer[MESSAGE_SIZE];
+    socket_type c;
+
+    for (;;) {
+        c = accept(fd, NULL, NULL);
+        if (c == INVALID_SOCKET)
+            continue;
+        if (network_read(c, buffer, sizeof(buffer), 5))
+            network_write(c, buffer, sizeof(buffer), 5);
+        socket_close(c);
+    }
+}
+
+
+/*
+ * Comparison function for sorting latencies.
+ */
+static int
+compare(const void *a, const void *b)
+{
+    const double *x = a;
+    const double *y = b;
+
+    return (*x > *y) - (*x < *y);
+}
+
+
+/*
+ * Time count requests, each on a new connection with the given options, and
+ * print a summary of the latencies.
+ */
+static void
+run(const char *name, const struct addrinfo *ai, size_t count,
+    const struct network_options *options)
+{
+    char buffer[MESSAGE_SIZE];
+    struct timeval start, end;
+    double *latency, total;
+    socket_type fd;
+    size_t i;
+
+    memset(buffer, 'x', sizeof(buffer));
+    latency = xcalloc(count, sizeof(double));
+    total = 0;
+    for (i = 0; i < count; i++) {
+        gettimeofday(&start, NULL);
+        fd = network_connect_options(ai, NULL, 5, options);
+        if (fd == INVALID_SOCKET)
+            sysdie("cannot connect");
+        if (!network_write(fd, buffer, sizeof(buffer), 5))
+            sysdie("cannot send request");
+        if (!network_read(fd, buffer, sizeof(buffer), 5))
+            sysdie("cannot read reply");
+        socket_close(fd);
+        gettimeofday(&end, NULL);
+        latency[i] = (end.tv_sec - start.tv_sec) * 1000000.0
+                     + (end.tv_usec - start.tv_usec);
+        total += latency[i];
+    }
+    qsort(latency, count, sizeof(double), compare);
+    printf("%-16s mean %8.1fus  p50 %8.1fus  p99 %8.1fus\n", name,
+           total / count, latency[count / 2], latency[count * 99 / 100]);
+    free(latency);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    struct network_options options;
+    struct addrinfo hints, *ai;
+    struct sockaddr_storage ss;
+    socklen_t length;
+    char port[16];
+    socket_type fd;
+    size_t count;
+    pid_t child;
+
+    message_program_name = "connect-bench";
+    count = (argc > 1) ? strtoul(argv[1], NULL, 10) : 10000;
+    if (count == 0)
+        die("invalid request count");
+
+    /* Start the server with Fast Open enabled. */
+    memset(&options, 0, sizeof(options));
+    options.nodelay = true;
+    options.fastopen = 256;
+    fd = network_bind_ipv4_options(SOCK_STREAM, "127.0.0.1", 0, &options);
+    if (fd == INVALID_SOCKET)
+        die("cannot bind server socket");
+    if (listen(fd, 128) < 0)
+        sysdie("cannot listen on server socket");
+    child = fork();
+    if (child < 0)
+        sysdie("cannot fork");
+    else if (child == 0)
+        server(fd);
+
+    /* Look up the address of the server for the client. */
+    length = sizeof(ss);
+    if (getsockname(fd, (struct sockaddr *) &ss, &length) < 0)
+        sysdie("cannot get server port");
+    snprintf(port, sizeof(port), "%hu",
+             network_sockaddr_port((struct sockaddr *) &ss));
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo("127.0.0.1", port, &hints, &ai) != 0)
+        die("cannot resolve 127.0.0.1");
+    socket_close(fd);
+
+    /* Run the client with each profile. */
+    run("default", ai, count, NULL);
+    memset(&options, 0, sizeof(options));
+    options.nodelay = true;
+    run("nodelay", ai, count, &options);
+    options.quickack = true;
+    run("nodelay+quickack", ai, count, &options);
+    options.fastopen = 1;
+    run("+fastopen", ai, count, &options);
+
+    /* Clean up. */
+    freeaddrinfo(ai);
+    kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+    return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * Test suite for batched network datagram functions.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+#include <portable/socket.h>
+
+#include <errno.h>
+#include <signal.h>
+
+#include <tests/tap/basic.h>
+#include <util/macros.h>
+#include <util/network.h>
+
+/* The number of datagrams to send in the large batch test. */
+#define LARGE_BATCH 150
+
+
+/*
+ * Allocate an array of count datagrams, each with a buffer of the given size.
+ */
+static struct network_datagram *
+datagrams_new(size_t count, size_t size)
+{
+    struct network_datagram *dgrams;
+    size_t i;
+
+    dgrams = bcalloc(count, sizeof(struct network_datagram));
+    for (i = 0; i < count; i++) {
+        dgrams[i].data = bmalloc(size);
+        dgrams[i].size = size;
+    }
+    return dgrams;
+}
+
+
+/*
+ * Free an array of datagrams allocated by datagrams_new.
+ */
+static void
+datagrams_free(struct network_datagram *dgrams, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        free(dgrams[i].data);
+    free(dgrams);
+}
+
+
+/*
+ * Send count numbered datagrams from client to the address of server and
+ * then receive them on server, checking that all of them arrive intact and
+ * in order.  Produces four tests.
+ */
+static void
+test_batch(socket_type server, socket_type client, size_t count)
+{
+    struct network_datagram *out, *in;
+    struct sockaddr_in sin;
+    socklen_t length;
+    ssize_t status;
+    size_t i, got;
+    bool okay;
+
+    /* Prepare the datagrams to send to the server's address. */
+    length = sizeof(sin);
+    if (getsockname(server, (struct sockaddr *) &sin, &length) < 0)
+        sysbail("cannot getsockname");
+    out = datagrams_new(count, 32);
+    for (i = 0; i < count; i++) {
+        out[i].length = snprintf(out[i].data, out[i].size, "datagram %lu",
+                                 (unsigned long) i);
+        memcpy(&out[i].addr, &sin, sizeof(sin));
+        out[i].addrlen = sizeof(sin);
+    }
+    status = network_datagram_send(client, out, count, 5);
+    is_int(count, status, "sent %lu datagrams", (unsigned long) count);
+
+    /*
+     * Receive them all.  The receive function may return fewer than the full
+     * set if it catches the kernel between datagrams, so keep calling it.
+     */
+    in = datagrams_new(count, 64);
+    got = 0;
+    do {
+        status = network_datagram_recv(server, in + got, count - got, 5);
+        if (status > 0)
+            got += status;
+    } while (status > 0 && got < count);
+    is_int(count, got, "...and received %lu", (unsigned long) count);
+
+    /* Check the contents and source addresses. */
+    okay = true;
+    for (i = 0; i < got; i++) {
+        if (in[i].length != out[i].length)
+            okay = false;
+        else if (memcmp(in[i].data, out[i].data, in[i].length) != 0)
+            okay = false;
+        if (in[i].segment != 0)
+            okay = false;
+    }
+    ok(okay, "...with the correct contents");
+    length = sizeof(sin);
+    if (getsockname(client, (struct sockaddr *) &sin, &length) < 0)
+        sysbail("cannot getsockname");
+    okay = (got > 0);
+    for (i = 0; i < got; i++) {
+        if (in[i].addr.ss_family != AF_INET)
+            okay = false;
+        else if (network_sockaddr_port((struct sockaddr *) &in[i].addr)
+                 != ntohs(sin.sin_port))
+            okay = false;
+    }
+    ok(okay, "...from the correct address");
+    datagrams_free(out, count);
+    datagrams_free(in, count);
+}
+
+
+/*
+ * Test that receiving with nothing to read times out.  Produces two tests.
+ */
+static void
+test_timeout(socket_type server)
+{
+    struct network_datagram *in;
+    ssize_t status;
+
+    in = datagrams_new(1, 64);
+    alarm(10);
+    status = network_datagram_recv(server, in, 1, 1);
+    alarm(0);
+    is_int(-1, status, "receive with no data fails");
+    is_int(ETIMEDOUT, socket_errno, "...with ETIMEDOUT");
+    datagrams_free(in, 1);
+}
+
+
+/*
+ * Test segmentation offload if available: send one buffer that the kernel
+ * should split into three datagrams, and check that they arrive either
+ * coalesced (with the segment size set) or separately, and check that a
+ * segment size that doesn't fit in 16 bits is rejected.  Produces three
+ * tests.
+ */
+static void
+test_offload(socket_type server, socket_type client)
+{
+    struct network_datagram *out, *in;
+    struct sockaddr_in sin;
+    socklen_t length;
+    ssize_t status;
+    size_t i, total;
+    bool okay;
+
+    if (!network_datagram_offload(server, true)) {
+        skip_block(3, "UDP segmentation offload not supported");
+        return;
+    }
+    length = sizeof(sin);
+    if (getsockname(server, (struct sockaddr *) &sin, &length) < 0)
+        sysbail("cannot getsockname");
+    out = datagrams_new(1, 30);
+    memset(out[0].data, 'a', 30);
+    out[0].length = 30;
+    memcpy(&out[0].addr, &sin, sizeof(sin));
+    out[0].addrlen = sizeof(sin);
+
+    /* A segment size that would be truncated is rejected. */
+    out[0].segment = 70000;
+    status = network_datagram_send(client, out, 1, 5);
+    ok(status == 0 && socket_errno == EINVAL, "oversized segment rejected");
+
+    /* Send a datagram to be split into three. */
+    out[0].segment = 10;
+    status = network_datagram_send(client, out, 1, 5);
+    if (status != 1 && socket_errno == EIO) {
+        skip_block(2, "UDP segmentation offload not supported by device");
+        datagrams_free(out, 1);
+        return;
+    }
+    is_int(1, status, "sent segmented datagram");
+    in = datagrams_new(3, 64);
+    total = 0;
+    okay = true;
+    do {
+        status = network_datagram_recv(server, in, 3, 5);
+        for (i = 0; status > 0 && i < (size_t) status; i++) {
+            total += in[i].length;
+            if (in[i].segment != 0 && in[i].segment != 10)
+                okay = false;
+            if (in[i].segment == 0 && in[i].length != 10)
+                okay = false;
+        }
+    } while (status > 0 && total < 30);
+    ok(okay && total == 30, "...and received all segments");
+    network_datagram_offload(server, false);
+    datagrams_free(out, 1);
+    datagrams_free(in, 3);
+}
+
+
+int
+main(void)
+{
+    socket_type server, client;
+
+    /* Set up the plan. */
+    plan(4 + 4 + 2 + 3);
+
+    /* Create the server and client sockets on ephemeral ports. */
+    server = network_bind_ipv4(SOCK_DGRAM, "127.0.0.1", 0);
+    if (server == INVALID_SOCKET)
+        sysbail("cannot create or bind server socket");
+    client = network_client_create(PF_INET, SOCK_DGRAM, "127.0.0.1");
+    if (client == INVALID_SOCKET)
+        sysbail("cannot create client socket");
+
+    /* Test a small batch and one larger than a single system call. */
+    test_batch(server, client, 10);
+    test_batch(server, client, LARGE_BATCH);
+
+    /* Test the receive timeout and segmentation offload. */
+    test_timeout(server);
+    test_offload(server, client);
+
+    /* Clean up. */
+    socket_close(client);
+    socket_close(server);
+    return 0;
+}
@@ -30,6 +30,7 @@
 
 #include <config.h>
 #include <portable/system.h>
+#include <portable/sd-daemon.h>
 #include <portable/socket.h>
 
 #include <errno.h>
@@ -57,7 +58,7 @@ ipv6_works(void)
     socket_type fd;
 
     /* Create the socket.  If this works, ipv6 is supported. */
-    fd = network_bind_ipv6(SOCK_STREAM, "::1", 11119);
+    fd = network_bind_ipv6(SOCK_STREAM, "::1", 11129);
     if (fd != INVALID_SOCKET) {
         close(fd);
         return true;
@@ -81,7 +82,7 @@ ipv6_works(void)
 
 /*
  * A client writer used to generate data for a server test.  Connect to the
- * given host on port 11119 and send a constant string to a socket.  Takes the
+ * given host on port 11129 and send a constant string to a socket.  Takes the
  * source address as well to pass into network_connect_host.  If the flag is
  * true, expects to succeed in connecting; otherwise, fail the test (by
  * exiting with a non-zero status) if the connection is successful.
@@ -94,7 +95,7 @@ client_writer(const char *host, const char *source, bool succeed)
     socket_type fd;
     FILE *out;
 
-    fd = network_connect_host(host, 11119, source, 0);
+    fd = network_connect_host(host, 11129, source, 0);
     if (fd == INVALID_SOCKET) {
         if (succeed)
             _exit(1);
@@ -111,7 +112,7 @@ client_writer(const char *host, const char *source, bool succeed)
 
 
 /*
- * A client writer for testing UDP.  Sends a UDP packet to port 11119 on
+ * A client writer for testing UDP.  Sends a UDP packet to port 11129 on
  * localhost, from the given source address, containing a constant string.
  * This also verifies that network_client_create works properly.
  */
@@ -126,10 +127,10 @@ client_udp_writer(const char *source)
     if (fd == INVALID_SOCKET)
         _exit(1);
 
-    /* Connect to localhost port 11119. */
+    /* Connect to localhost port 11129. */
     memset(&sin, 0, sizeof(sin));
     sin.sin_family = AF_INET;
-    sin.sin_port = htons(11119);
+    sin.sin_port = htons(11129);
     sin.sin_addr.s_addr = htonl(0x7f000001UL);
     if (connect(fd, (struct sockaddr *) &sin, sizeof(sin)) < 0)
         _exit(1);
@@ -227,7 +228,7 @@ test_server_accept_any(socket_type fds[], unsigned int count)
 
 
 /*
- * Bring up a server on port 11119 on the loopback address and test connecting
+ * Bring up a server on port 11129 on the loopback address and test connecting
  * to it via IPv4.  Takes an optional source address to use for client
  * connections.  For skipping purposes, this produces four tests.
  */
@@ -239,7 +240,7 @@ test_ipv4(const char *source)
     int status;
 
     /* Set up the server socket. */
-    fd = network_bind_ipv4(SOCK_STREAM, "127.0.0.1", 11119);
+    fd = network_bind_ipv4(SOCK_STREAM, "127.0.0.1", 11129);
     if (fd == INVALID_SOCKET)
         sysbail("cannot create or bind socket");
     ok(fd != INVALID_SOCKET, "IPv4 server test");
@@ -262,7 +263,7 @@ test_ipv4(const char *source)
 
 
 /*
- * Bring up a server on port 11119 on the loopback address and test connecting
+ * Bring up a server on port 11129 on the loopback address and test connecting
  * to it via IPv6.  Takes an optional source address to use for client
  * connections.  For skipping purposes, this produces four tests.
  */
@@ -274,7 +275,7 @@ test_ipv6(const char *source)
     int status;
 
     /* Set up the server socket. */
-    fd = network_bind_ipv6(SOCK_STREAM, "::1", 11119);
+    fd = network_bind_ipv6(SOCK_STREAM, "::1", 11129);
     if (fd == INVALID_SOCKET)
         sysbail("cannot create socket");
     ok(fd != INVALID_SOCKET, "IPv6 server test");
@@ -328,7 +329,7 @@ get_sockaddr(socket_type fd)
 
 
 /*
- * Bring up a server on port 11119 on all addresses and try connecting to it
+ * Bring up a server on port 11129 on all addresses and try connecting to it
  * via all of the available protocols.  Takes an optional source address to
  * use for client connections.  For skipping purposes, this produces eight
  * tests.
@@ -343,7 +344,7 @@ test_all(const char *source_ipv4, const char *source_ipv6 UNUSED)
     int status;
 
     /* Bind sockets for all available local addresses. */
-    if (!network_bind_all(SOCK_STREAM, 11119, &fds, &count))
+    if (!network_bind_all(SOCK_STREAM, 11129, &fds, &count))
         sysbail("cannot create or bind socket");
 
     /*
@@ -401,7 +402,7 @@ test_all(const char *source_ipv4, const char *source_ipv6 UNUSED)
 
 
 /*
- * Bring up a server on port 11119 on all addresses and try connecting to it
+ * Bring up a server on port 11129 on all addresses and try connecting to it
  * via 127.0.0.1, using network_accept_any underneath.  For skipping purposes,
  * this runs three tests.
  */
@@ -413,7 +414,7 @@ test_any(void)
     pid_t child;
     int status;
 
-    if (!network_bind_all(SOCK_STREAM, 11119, &fds, &count))
+    if (!network_bind_all(SOCK_STREAM, 11129, &fds, &count))
         sysbail("cannot create or bind socket");
     for (i = 0; i < count; i++)
         if (listen(fds[i], 1) < 0)
@@ -433,7 +434,7 @@ test_any(void)
 
 
 /*
- * Bring up a UDP server on port 11119 on all addresses and try connecting to
+ * Bring up a UDP server on port 11129 on all addresses and try connecting to
  * it via 127.0.0.1, using network_wait_any underneath.  This tests the bind
  * functions for UDP sockets, network_client_create for UDP addresses, and
  * network_wait_any.
@@ -453,7 +454,7 @@ test_any_udp(void)
     socklen_t addrlen;
 
     /* Bind our UDP socket. */
-    if (!network_bind_all(SOCK_DGRAM, 11119, &fds, &count))
+    if (!network_bind_all(SOCK_DGRAM, 11129, &fds, &count))
         sysbail("cannot create or bind socket");
 
     /* Create a child that writes a single UDP packet to the server. */
@@ -477,7 +478,7 @@ test_any_udp(void)
         length = recvfrom(fd, buffer, sizeof(buffer), 0, saddr, &addrlen);
         is_int(13, length, "...of correct length");
         sin.sin_family = AF_INET;
-        sin.sin_port = htons(11119);
+        sin.sin_port = htons(11129);
         sin.sin_addr.s_addr = htonl(0x7f000001UL);
         ok(network_sockaddr_equal((struct sockaddr *) &sin, saddr),
            "...from correct address");
@@ -496,11 +497,103 @@ test_any_udp(void)
 }
 
 
+/*
+ * Test adopting inherited sockets with network_bind_all_inherited.  Bind
+ * wildcard sockets ourselves as if they had been passed in by a service
+ * manager, along with a UDP socket and a TCP socket on a different port that
+ * should not be adopted.  Takes a flag saying whether to also pass in an IPv6
+ * socket.  For skipping purposes, this produces four tests.
+ */
+static void
+test_inherited(bool ipv6)
+{
+    socket_type inherited[4], *fds;
+    unsigned int count, n, i;
+    bool status;
+
+    n = 0;
+    inherited[n++] = network_bind_ipv4(SOCK_DGRAM, "any", 11129);
+    inherited[n++] = network_bind_ipv4(SOCK_STREAM, "any", 11130);
+    inherited[n++] = network_bind_ipv4(SOCK_STREAM, "any", 11129);
+    if (ipv6)
+        inherited[n++] = network_bind_ipv6(SOCK_STREAM, "any", 11129);
+    for (i = 0; i < n; i++)
+        if (inherited[i] == INVALID_SOCKET)
+            sysbail("cannot create or bind socket");
+
+    /* Adopt them and check that no new sockets were created. */
+    status = network_bind_all_inherited(SOCK_STREAM, 11129, inherited, n,
+                                        &fds, &count);
+    ok(status, "network_bind_all_inherited");
+    is_int(ipv6 ? 2 : 1, count, "...adopted only the matching sockets");
+    is_int(inherited[2], count > 0 ? fds[0] : INVALID_SOCKET,
+           "...with the IPv4 socket first");
+    if (ipv6)
+        is_int(inherited[3], count > 1 ? fds[1] : INVALID_SOCKET,
+               "...and the IPv6 socket second");
+    else
+        skip("IPv6 not configured");
+    network_bind_all_free(fds);
+    for (i = 0; i < n; i++)
+        socket_close(inherited[i]);
+}
+
+
+/*
+ * Test network_bind_all_activated by simulating systemd socket activation:
+ * move a listening socket to the first systemd file descriptor and set the
+ * environment variables systemd would set.  This only works if we were built
+ * with systemd support.  For skipping purposes, this produces two tests.
+ */
+#ifdef HAVE_SD_NOTIFY
+
+static void
+test_activated(void)
+{
+    socket_type fd, *fds;
+    unsigned int count, i;
+    char pid[32];
+    bool status;
+
+    fd = network_bind_ipv4(SOCK_STREAM, "any", 11129);
+    if (fd == INVALID_SOCKET)
+        sysbail("cannot create or bind socket");
+    if (fd != SD_LISTEN_FDS_START) {
+        if (dup2(fd, SD_LISTEN_FDS_START) < 0)
+            sysbail("cannot move socket to %d", SD_LISTEN_FDS_START);
+        socket_close(fd);
+    }
+    snprintf(pid, sizeof(pid), "%lu", (unsigned long) getpid());
+    if (setenv("LISTEN_PID", pid, 1) < 0 || setenv("LISTEN_FDS", "1", 1) < 0)
+        sysbail("cannot set systemd environment variables");
+    status = network_bind_all_activated(SOCK_STREAM, 11129, &fds, &count);
+    ok(status, "network_bind_all_activated");
+    is_int(SD_LISTEN_FDS_START, count > 0 ? fds[0] : INVALID_SOCKET,
+           "...adopted the socket from systemd");
+    for (i = 1; i < count; i++)
+        socket_close(fds[i]);
+    network_bind_all_free(fds);
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    socket_close(SD_LISTEN_FDS_START);
+}
+
+#else /* !HAVE_SD_NOTIFY */
+
+static void
+test_activated(void)
+{
+    skip_block(2, "not built with systemd support");
+}
+
+#endif /* !HAVE_SD_NOTIFY */
+
+
 int
 main(void)
 {
     /* Set up the plan. */
-    plan(42);
+    plan(48);
 
     /* Test network_bind functions. */
     test_ipv4(NULL);
@@ -516,10 +609,15 @@ main(void)
         test_ipv6("::1");
         test_all(NULL, NULL);
         test_all("127.0.0.1", "::1");
+        test_inherited(true);
     } else {
         skip_block(24, "IPv6 not configured");
+        test_inherited(false);
     }
 
+    /* Test adopting sockets passed in by systemd. */
+    test_activated();
+
     /* Test network_accept_any. */
     test_any();
 
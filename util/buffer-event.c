@@ -0,0 +1,126 @@
+/*
+ * Zero-copy access to libevent buffers.
+ *
+ * Protocol code in this package is written against struct buffer, but
+ * servers built on libevent receive and send data through evbuffers.  Rather
+ * than copying data from the evbuffer into a struct buffer before parsing it
+ * (and the reverse for output), these functions point a struct buffer at the
+ * memory inside the evbuffer and then consume or commit the data in place.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/event.h>
+#include <portable/system.h>
+
+#include <util/buffer.h>
+#include <util/buffer-event.h>
+
+
+/*
+ * Point a buffer at the given memory, with all of it unused.
+ */
+static void
+buffer_view(struct buffer *view, void *data, size_t size)
+{
+    view->data = data;
+    view->size = size;
+    view->used = 0;
+    view->left = 0;
+}
+
+
+/*
+ * Set the buffer to a view of at least length bytes from the start of the
+ * evbuffer.  Look at the first chain with evbuffer_peek and use it directly
+ * if it's long enough, and only fall back on evbuffer_pullup, which copies
+ * data into one chain, if the requested data spans several chains.
+ */
+bool
+buffer_peek_evbuffer(struct buffer *view, struct evbuffer *source,
+                     size_t length)
+{
+    struct evbuffer_iovec vec;
+    unsigned char *data;
+
+    if (evbuffer_get_length(source) < length)
+        return false;
+    if (evbuffer_peek(source, -1, NULL, &vec, 1) < 1) {
+        buffer_view(view, NULL, 0);
+        return true;
+    }
+    if (vec.iov_len >= length) {
+        buffer_view(view, vec.iov_base, vec.iov_len);
+        view->left = vec.iov_len;
+        return true;
+    }
+    data = evbuffer_pullup(source, length);
+    if (data == NULL)
+        return false;
+    buffer_view(view, data, length);
+    view->left = length;
+    return true;
+}
+
+
+/*
+ * Remove the used portion of a view from the evbuffer and clear the view,
+ * since draining may free the memory it points to.
+ */
+void
+buffer_drain_evbuffer(struct buffer *view, struct evbuffer *source)
+{
+    if (view->used > 0)
+        evbuffer_drain(source, view->used);
+    buffer_view(view, NULL, 0);
+}
+
+
+/*
+ * Reserve at least length bytes of contiguous space at the end of the
+ * evbuffer and point the buffer at it.
+ */
+bool
+buffer_reserve_evbuffer(struct buffer *view, struct evbuffer *sink,
+                        size_t length)
+{
+    struct evbuffer_iovec vec;
+
+    if (evbuffer_reserve_space(sink, length, &vec, 1) < 1)
+        return false;
+    buffer_view(view, vec.iov_base, vec.iov_len);
+    return true;
+}
+
+
+/*
+ * Commit the data written into a reserved view to the evbuffer and clear the
+ * view.  It's an error for the caller to have written more than the reserved
+ * space, but check anyway rather than passing a bogus length to libevent.
+ */
+bool
+buffer_commit_evbuffer(struct buffer *view, struct evbuffer *sink)
+{
+    struct evbuffer_iovec vec;
+    int status;
+
+    if (view->used + view->left > view->size)
+        return false;
+    vec.iov_base = view->data;
+    vec.iov_len = view->used + view->left;
+    status = evbuffer_commit_space(sink, &vec, 1);
+    buffer_view(view, NULL, 0);
+    return (status == 0);
+}
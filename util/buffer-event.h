@@ -0,0 +1,87 @@
+/*
+ * Prototypes for zero-copy access to libevent buffers.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#ifndef UTIL_BUFFER_EVENT_H
+#define UTIL_BUFFER_EVENT_H 1
+
+#include <config.h>
+#include <portable/macros.h>
+#include <portable/stdbool.h>
+
+#include <sys/types.h>
+
+/* Forward declarations to avoid includes. */
+struct buffer;
+struct evbuffer;
+
+BEGIN_DECLS
+
+/* Default to a hidden visibility for all util functions. */
+#pragma GCC visibility push(hidden)
+
+/*
+ * These functions point a struct buffer directly at memory owned by a
+ * libevent evbuffer (such as the input or output buffer of a bufferevent) so
+ * that protocol code written against struct buffer can parse or generate data
+ * in place instead of copying it in and out.  A buffer set up this way is a
+ * view: it must not be passed to buffer_free, buffer_resize, or any other
+ * function that may reallocate data, and it is only valid until the next
+ * call that modifies the evbuffer.  The struct buffer itself may be allocated
+ * however the caller wishes, including on the stack.
+ *
+ * These functions require libevent 2.0.2-alpha or later.
+ */
+
+/*
+ * Set the buffer to a view of at least length bytes from the start of the
+ * evbuffer, with left set to the number of bytes available and used set to
+ * 0.  If the first length bytes are already contiguous in the evbuffer, no
+ * data is copied; otherwise, the evbuffer is rearranged so that they are.  If
+ * length is 0, the view covers whatever is contiguous at the start of the
+ * evbuffer, which never requires a copy.  Returns false if the evbuffer holds
+ * fewer than length bytes.
+ *
+ * Once the caller has parsed some of the view, it should increase used by the
+ * number of bytes processed and then call buffer_drain_evbuffer, which
+ * removes those bytes from the evbuffer and clears the view.
+ */
+bool buffer_peek_evbuffer(struct buffer *, struct evbuffer *, size_t length)
+    __attribute__((__nonnull__));
+void buffer_drain_evbuffer(struct buffer *, struct evbuffer *)
+    __attribute__((__nonnull__));
+
+/*
+ * Set the buffer to a view of at least length bytes of contiguous free space
+ * at the end of the evbuffer, with used and left set to 0 and size set to the
+ * space available.  The caller should write data starting at data and add
+ * the number of bytes written to left, and then call buffer_commit_evbuffer
+ * to append used plus left bytes to the evbuffer.  Nothing is added to the
+ * evbuffer until the commit, and no other function may modify the evbuffer
+ * in between.  Both return false on failure.
+ */
+bool buffer_reserve_evbuffer(struct buffer *, struct evbuffer *,
+                             size_t length)
+    __attribute__((__nonnull__));
+bool buffer_commit_evbuffer(struct buffer *, struct evbuffer *)
+    __attribute__((__nonnull__));
+
+/* Undo default visibility change. */
+#pragma GCC visibility pop
+
+END_DECLS
+
+#endif /* UTIL_BUFFER_EVENT_H */
@@ -0,0 +1,719 @@
+/*
+ * Asynchronous message handlers.
+ *
+ * The standard message handlers do their I/O in the thread that calls warn,
+ * notice, or debug, which can stall a busy thread on a slow terminal, file,
+ * or syslog daemon.  The handlers here instead format the message into a
+ * queue belonging to the calling thread and return, and a background thread
+ * drains all of the queues and writes the messages out in batches.
+ *
+ * Each queue is a single-producer, single-consumer ring buffer of
+ * variable-length records, so logging takes no locks unless the background
+ * thread has to be woken or the queue is full and the overflow policy is to
+ * block.  Queues are never freed while the background thread is running.
+ * When a thread exits, its queue is marked orphaned and reused by the next
+ * new thread that logs a message.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <errno.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+#include <time.h>
+
+#include <util/buffer.h>
+#include <util/macros.h>
+#include <util/messages.h>
+#include <util/messages-async.h>
+#include <util/xwrite.h>
+
+/* Asynchronous logging requires both threads and atomic operations. */
+#if defined(HAVE_PTHREAD) && defined(HAVE_ATOMIC_BUILTINS)
+# define ASYNC_THREADS 1
+#endif
+
+#ifdef ASYNC_THREADS
+
+/* The default and minimum size of each thread's queue. */
+#define ASYNC_DEFAULT_SIZE      (64 * 1024)
+#define ASYNC_MINIMUM_SIZE      1024
+
+/* Write out batched output once this much has accumulated. */
+#define ASYNC_BATCH_SIZE        (64 * 1024)
+
+/*
+ * How long the background thread sleeps when there's nothing to do and how
+ * long a thread blocked on a full queue waits before checking again, in
+ * milliseconds.  Both are normally woken early.
+ */
+#define ASYNC_IDLE_WAIT         100
+#define ASYNC_FULL_WAIT         10
+
+/* Round a record size up to keep records aligned. */
+#define ASYNC_ALIGN(n)          (((n) + 7) & ~(size_t) 7)
+
+/*
+ * A queued message.  The nul-terminated text of the message follows the
+ * header.  A record whose size is 0 is padding to the end of the queue, as
+ * is any space at the end of the queue too small to hold a header.
+ */
+struct async_record {
+    size_t size;                        /* Total size including padding. */
+    size_t length;                      /* Length of the message text. */
+    message_handler_func handler;       /* Synchronous handler to use. */
+    int fd;                             /* Descriptor to write to, or -1. */
+    int err;                            /* errno value to report, if any. */
+};
+
+/*
+ * The queue for one thread.  head is only written by the thread that owns the
+ * queue and tail only by the background thread.  Both count bytes from the
+ * creation of the queue and are reduced modulo size, a power of two, to get
+ * an offset into data.  The dropped count and the destination of the last
+ * dropped message are written by the owning thread and read and reset by the
+ * background thread.
+ */
+struct async_queue {
+    struct async_queue *next;           /* Next queue, fixed once linked. */
+    char *data;                         /* The ring buffer. */
+    size_t size;                        /* Size of data, a power of two. */
+    size_t head;                        /* Bytes written. */
+    size_t tail;                        /* Bytes consumed. */
+    unsigned long dropped;              /* Messages dropped since reported. */
+    message_handler_func drop_handler;  /* Handler of last dropped message. */
+    int drop_fd;                        /* Descriptor of last dropped one. */
+    int orphaned;                       /* Set when the owning thread exits. */
+};
+
+/* Configuration set by message_async_start. */
+static size_t async_size;
+static enum message_async_overflow async_overflow;
+static int async_fd = -1;
+static int (*async_saved_cleanup)(void) = NULL;
+
+/* The list of queues, with new queues added at the head. */
+static struct async_queue *async_queues = NULL;
+static pthread_key_t async_key;
+
+/* The background thread and its batched output, used only by that thread. */
+static pthread_t async_thread;
+static struct buffer *async_batch = NULL;
+static int async_batch_fd = -1;
+
+/*
+ * Whether asynchronous logging is active and whether the background thread
+ * is sleeping and needs to be woken, both accessed atomically, and the total
+ * count of dropped messages.
+ */
+static int async_running = 0;
+static int async_sleeping = 0;
+static unsigned long async_dropped = 0;
+
+/*
+ * State protected by async_lock.  async_wake wakes the background thread and
+ * async_done is broadcast by it after each pass through the queues.
+ */
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t async_done = PTHREAD_COND_INITIALIZER;
+static unsigned long async_flush_requested = 0;
+static unsigned long async_flush_completed = 0;
+static bool async_stopping = false;
+
+
+/*
+ * Call a handler with a va_list containing the given arguments.  This is how
+ * the background thread passes an already-formatted message to one of the
+ * synchronous handlers, using a format of "%s".
+ */
+static void __attribute__((__format__(printf, 4, 5)))
+async_call(message_handler_func handler, size_t length, int err,
+           const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    (*handler)(length, format, args, err);
+    va_end(args);
+}
+
+
+/*
+ * Fill in a timespec with the time the given number of milliseconds from now,
+ * for pthread_cond_timedwait.
+ */
+static void
+async_deadline(struct timespec *deadline, long ms)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+
+/*
+ * Write out the batched output, if any.  Errors are ignored, since there's
+ * nowhere to report them.
+ */
+static void
+async_batch_flush(void)
+{
+    if (async_batch->left > 0 && async_batch_fd >= 0)
+        xwrite(async_batch_fd, async_batch->data + async_batch->used,
+               async_batch->left);
+    buffer_set(async_batch, NULL, 0);
+}
+
+
+/*
+ * Write out a message in the background thread.  If fd is -1, pass it to the
+ * synchronous handler.  Otherwise, format it the same way as
+ * message_log_stderr and add it to the batched output for that descriptor.
+ */
+static void
+async_output(int fd, message_handler_func handler, const char *text,
+             size_t length, int err)
+{
+    if (fd < 0) {
+        async_call(handler, length, err, "%s", text);
+        return;
+    }
+    if (fd != async_batch_fd) {
+        async_batch_flush();
+        async_batch_fd = fd;
+    }
+    if (message_program_name != NULL)
+        buffer_append_sprintf(async_batch, "%s: ", message_program_name);
+    buffer_append(async_batch, text, length);
+    if (err)
+        buffer_append_sprintf(async_batch, ": %s", strerror(err));
+    buffer_append(async_batch, "\n", 1);
+    if (async_batch->left >= ASYNC_BATCH_SIZE)
+        async_batch_flush();
+}
+
+
+/*
+ * Write out all of the messages in one queue and report any messages dropped
+ * since the last pass, if so configured.  Returns the number of messages
+ * written.
+ */
+static size_t
+async_drain_queue(struct async_queue *queue)
+{
+    struct async_record *record;
+    size_t head, tail, offset, count;
+    unsigned long dropped;
+    char report[64];
+    int length;
+
+    dropped = __atomic_exchange_n(&queue->dropped, 0, __ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    tail = queue->tail;
+    count = 0;
+    while (tail != head) {
+        offset = tail & (queue->size - 1);
+        record = (struct async_record *) (void *) (queue->data + offset);
+        if (queue->size - offset < sizeof(*record) || record->size == 0)
+            tail += queue->size - offset;
+        else {
+            async_output(record->fd, record->handler,
+                         (const char *) (record + 1), record->length,
+                         record->err);
+            tail += record->size;
+            count++;
+        }
+        __atomic_store_n(&queue->tail, tail, __ATOMIC_RELEASE);
+    }
+    if (dropped > 0 && async_overflow == MESSAGE_ASYNC_COUNT) {
+        length = snprintf(report, sizeof(report),
+                          "%lu log messages dropped (queue full)", dropped);
+        if (length > 0 && (size_t) length < sizeof(report))
+            async_output(__atomic_load_n(&queue->drop_fd, __ATOMIC_RELAXED),
+                         __atomic_load_n(&queue->drop_handler,
+                                         __ATOMIC_RELAXED),
+                         report, (size_t) length, 0);
+    }
+    return count;
+}
+
+
+/*
+ * Write out the messages in every queue, returning the number written.
+ */
+static size_t
+async_drain(void)
+{
+    struct async_queue *queue;
+    size_t count = 0;
+
+    queue = __atomic_load_n(&async_queues, __ATOMIC_ACQUIRE);
+    for (; queue != NULL; queue = queue->next)
+        count += async_drain_queue(queue);
+    async_batch_flush();
+    return count;
+}
+
+
+/*
+ * Returns true if any queue has messages waiting.
+ */
+static bool
+async_pending(void)
+{
+    struct async_queue *queue;
+    size_t head;
+
+    queue = __atomic_load_n(&async_queues, __ATOMIC_ACQUIRE);
+    for (; queue != NULL; queue = queue->next) {
+        head = __atomic_load_n(&queue->head, __ATOMIC_SEQ_CST);
+        if (head != queue->tail)
+            return true;
+        if (__atomic_load_n(&queue->dropped, __ATOMIC_RELAXED) > 0)
+            return true;
+    }
+    return false;
+}
+
+
+/*
+ * The background thread.  Repeatedly drains all the queues, completing any
+ * flush requests made before the pass started, and sleeps when there's
+ * nothing left to do.  Exits after a final pass once asked to stop.
+ */
+static void *
+async_main(void *data UNUSED)
+{
+    struct timespec deadline;
+    unsigned long requested;
+    bool stopping;
+    size_t count;
+
+    for (;;) {
+        pthread_mutex_lock(&async_lock);
+        requested = async_flush_requested;
+        stopping = async_stopping;
+        pthread_mutex_unlock(&async_lock);
+
+        /* Write everything out and report back to any waiting threads. */
+        count = async_drain();
+        pthread_mutex_lock(&async_lock);
+        async_flush_completed = requested;
+        pthread_cond_broadcast(&async_done);
+        if (stopping) {
+            pthread_mutex_unlock(&async_lock);
+            break;
+        }
+
+        /*
+         * Sleep if there was nothing to do.  Producers check async_sleeping
+         * after publishing a message, so set it and then check the queues
+         * once more before waiting to avoid missing a wakeup.
+         */
+        if (count == 0 && async_flush_requested == requested) {
+            __atomic_store_n(&async_sleeping, 1, __ATOMIC_SEQ_CST);
+            if (!async_pending() && !async_stopping) {
+                async_deadline(&deadline, ASYNC_IDLE_WAIT);
+                pthread_cond_timedwait(&async_wake, &async_lock, &deadline);
+            }
+            __atomic_store_n(&async_sleeping, 0, __ATOMIC_SEQ_CST);
+        }
+        pthread_mutex_unlock(&async_lock);
+    }
+    return NULL;
+}
+
+
+/*
+ * Wake the background thread.
+ */
+static void
+async_wakeup(void)
+{
+    pthread_mutex_lock(&async_lock);
+    pthread_cond_signal(&async_wake);
+    pthread_mutex_unlock(&async_lock);
+}
+
+
+/*
+ * Thread-specific data destructor, called when a thread with a queue exits.
+ * Mark the queue as available for reuse.  The background thread will still
+ * drain any messages left in it.
+ */
+static void
+async_queue_orphan(void *data)
+{
+    struct async_queue *queue = data;
+
+    __atomic_store_n(&queue->orphaned, 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Return the queue for the calling thread, first trying to reuse the queue
+ * of a thread that has exited and otherwise creating a new one.  Returns
+ * NULL if memory allocation fails.  Don't use xmalloc here, since its
+ * failure handler may log through this same path.
+ */
+static struct async_queue *
+async_queue_get(void)
+{
+    struct async_queue *queue;
+    int orphaned;
+
+    queue = pthread_getspecific(async_key);
+    if (queue != NULL)
+        return queue;
+    queue = __atomic_load_n(&async_queues, __ATOMIC_ACQUIRE);
+    for (; queue != NULL; queue = queue->next) {
+        orphaned = 1;
+        if (__atomic_compare_exchange_n(&queue->orphaned, &orphaned, 0, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+    if (queue == NULL) {
+        queue = calloc(1, sizeof(struct async_queue));
+        if (queue == NULL)
+            return NULL;
+        queue->data = malloc(async_size);
+        if (queue->data == NULL) {
+            free(queue);
+            return NULL;
+        }
+        queue->size = async_size;
+        queue->drop_fd = -1;
+        queue->next = __atomic_load_n(&async_queues, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&async_queues, &queue->next,
+                                            queue, false, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+            ;
+    }
+
+    /* If we can't remember the queue, let some other thread reuse it. */
+    if (pthread_setspecific(async_key, queue) != 0)
+        __atomic_store_n(&queue->orphaned, 1, __ATOMIC_RELEASE);
+    return queue;
+}
+
+
+/*
+ * Handle a full queue according to the overflow policy.  Returns true if the
+ * caller should check for space again and false if the message was dropped.
+ */
+static bool
+async_queue_full(struct async_queue *queue, int fd,
+                 message_handler_func handler)
+{
+    struct timespec deadline;
+
+    if (async_overflow != MESSAGE_ASYNC_BLOCK) {
+        __atomic_store_n(&queue->drop_fd, fd, __ATOMIC_RELAXED);
+        __atomic_store_n(&queue->drop_handler, handler, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&queue->dropped, 1, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&async_dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    pthread_mutex_lock(&async_lock);
+    pthread_cond_signal(&async_wake);
+    async_deadline(&deadline, ASYNC_FULL_WAIT);
+    pthread_cond_timedwait(&async_done, &async_lock, &deadline);
+    pthread_mutex_unlock(&async_lock);
+    return true;
+}
+
+
+/*
+ * The common implementation of all the asynchronous handlers.  Format the
+ * message into the calling thread's queue, to be written to fd or, if that's
+ * -1, passed to handler.  If asynchronous logging isn't running, or if this
+ * is the background thread logging a problem, or if there's no queue, call
+ * handler directly instead.
+ */
+static void
+async_log(int fd, message_handler_func handler, size_t length,
+          const char *format, va_list args, int err)
+{
+    struct async_queue *queue = NULL;
+    struct async_record *record;
+    size_t need, head, tail, offset, pad, max;
+
+    if (__atomic_load_n(&async_running, __ATOMIC_ACQUIRE))
+        if (!pthread_equal(pthread_self(), async_thread))
+            queue = async_queue_get();
+    if (queue == NULL) {
+        (*handler)(length, format, args, err);
+        return;
+    }
+
+    /* Truncate the message if needed so that the record always fits. */
+    max = queue->size / 2 - sizeof(struct async_record) - 8;
+    if (length > max)
+        length = max;
+    need = ASYNC_ALIGN(sizeof(struct async_record) + length + 1);
+
+    /*
+     * Find space for the record, skipping to the start of the queue if there
+     * isn't enough contiguous space at the end.
+     */
+    for (;;) {
+        head = queue->head;
+        tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+        offset = head & (queue->size - 1);
+        pad = (queue->size - offset < need) ? queue->size - offset : 0;
+        if (head + pad + need - tail <= queue->size)
+            break;
+        if (!async_queue_full(queue, fd, handler))
+            return;
+    }
+    if (pad > 0) {
+        if (pad >= sizeof(struct async_record)) {
+            record = (struct async_record *) (void *) (queue->data + offset);
+            record->size = 0;
+        }
+        head += pad;
+        offset = 0;
+    }
+
+    /* Write the record and publish it. */
+    record = (struct async_record *) (void *) (queue->data + offset);
+    record->size = need;
+    record->length = length;
+    record->handler = handler;
+    record->fd = fd;
+    record->err = err;
+    vsnprintf((char *) (record + 1), length + 1, format, args);
+    __atomic_store_n(&queue->head, head + need, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&async_sleeping, __ATOMIC_SEQ_CST))
+        async_wakeup();
+}
+
+
+/*
+ * The message_fatal_cleanup function installed by message_async_start.
+ * Flush the queues so that the message from die is written out, and then
+ * call the original cleanup function, if any.
+ */
+static int
+async_fatal_cleanup(void)
+{
+    message_async_flush();
+    if (async_saved_cleanup != NULL)
+        return (*async_saved_cleanup)();
+    return 1;
+}
+
+
+/*
+ * Start asynchronous logging.  Round the queue size up to a power of two and
+ * then create the background thread.
+ */
+bool
+message_async_start(size_t size, enum message_async_overflow overflow,
+                    int fd)
+{
+    int status;
+
+    if (__atomic_load_n(&async_running, __ATOMIC_ACQUIRE)) {
+        errno = EBUSY;
+        return false;
+    }
+    if (size == 0)
+        size = ASYNC_DEFAULT_SIZE;
+    for (async_size = ASYNC_MINIMUM_SIZE; async_size < size; async_size *= 2)
+        ;
+    async_overflow = overflow;
+    async_fd = fd;
+    async_dropped = 0;
+    async_stopping = false;
+    async_flush_requested = 0;
+    async_flush_completed = 0;
+    status = pthread_key_create(&async_key, async_queue_orphan);
+    if (status != 0) {
+        errno = status;
+        return false;
+    }
+    async_batch = buffer_new();
+    async_batch_fd = -1;
+    status = pthread_create(&async_thread, NULL, async_main, NULL);
+    if (status != 0) {
+        pthread_key_delete(async_key);
+        buffer_free(async_batch);
+        async_batch = NULL;
+        errno = status;
+        return false;
+    }
+    async_saved_cleanup = message_fatal_cleanup;
+    message_fatal_cleanup = async_fatal_cleanup;
+    __atomic_store_n(&async_running, 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+/*
+ * Wait for the background thread to complete a pass through the queues that
+ * started after this call.  Skip this in the background thread itself, which
+ * may get here via die.
+ */
+void
+message_async_flush(void)
+{
+    unsigned long ticket;
+
+    if (!__atomic_load_n(&async_running, __ATOMIC_ACQUIRE))
+        return;
+    if (pthread_equal(pthread_self(), async_thread))
+        return;
+    pthread_mutex_lock(&async_lock);
+    ticket = ++async_flush_requested;
+    pthread_cond_signal(&async_wake);
+    while (async_flush_completed < ticket)
+        pthread_cond_wait(&async_done, &async_lock);
+    pthread_mutex_unlock(&async_lock);
+}
+
+
+/*
+ * Stop the background thread after it writes out everything queued and free
+ * all the resources.
+ */
+void
+message_async_stop(void)
+{
+    struct async_queue *queue, *next;
+
+    if (!__atomic_load_n(&async_running, __ATOMIC_ACQUIRE))
+        return;
+    __atomic_store_n(&async_running, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&async_lock);
+    async_stopping = true;
+    pthread_cond_signal(&async_wake);
+    pthread_mutex_unlock(&async_lock);
+    pthread_join(async_thread, NULL);
+    for (queue = async_queues; queue != NULL; queue = next) {
+        next = queue->next;
+        free(queue->data);
+        free(queue);
+    }
+    async_queues = NULL;
+    pthread_key_delete(async_key);
+    buffer_free(async_batch);
+    async_batch = NULL;
+    if (message_fatal_cleanup == async_fatal_cleanup)
+        message_fatal_cleanup = async_saved_cleanup;
+    async_saved_cleanup = NULL;
+    async_fd = -1;
+}
+
+
+/*
+ * Return the number of messages dropped since message_async_start.
+ */
+unsigned long
+message_async_dropped(void)
+{
+    return __atomic_load_n(&async_dropped, __ATOMIC_RELAXED);
+}
+
+#else /* !ASYNC_THREADS */
+
+/* Without thread support, log everything synchronously. */
+static int async_fd = -1;
+
+
+static void
+async_log(int fd UNUSED, message_handler_func handler, size_t length,
+          const char *format, va_list args, int err)
+{
+    (*handler)(length, format, args, err);
+}
+
+
+bool
+message_async_start(size_t size UNUSED,
+                    enum message_async_overflow overflow UNUSED, int fd UNUSED)
+{
+    errno = ENOSYS;
+    return false;
+}
+
+
+void
+message_async_flush(void)
+{
+}
+
+
+void
+message_async_stop(void)
+{
+}
+
+
+unsigned long
+message_async_dropped(void)
+{
+    return 0;
+}
+
+#endif /* !ASYNC_THREADS */
+
+
+/*
+ * The handlers.  Standard output and standard error are written by the
+ * background thread directly, as is the file descriptor given to
+ * message_async_start.  Syslog messages are passed to the synchronous
+ * handler in the background thread.  In each case, the synchronous handler
+ * is used instead when asynchronous logging isn't running.
+ */
+void
+message_log_async_stdout(size_t len, const char *fmt, va_list args, int err)
+{
+    async_log(STDOUT_FILENO, message_log_stdout, len, fmt, args, err);
+}
+
+void
+message_log_async_stderr(size_t len, const char *fmt, va_list args, int err)
+{
+    async_log(STDERR_FILENO, message_log_stderr, len, fmt, args, err);
+}
+
+void
+message_log_async_file(size_t len, const char *fmt, va_list args, int err)
+{
+    async_log(async_fd, message_log_stderr, len, fmt, args, err);
+}
+
+#define ASYNC_SYSLOG_FUNCTION(name)                                         \
+    void                                                                    \
+    message_log_async_syslog_ ## name(size_t l, const char *f, va_list a,   \
+                                      int e)                                \
+    {                                                                       \
+        async_log(-1, message_log_syslog_ ## name, l, f, a, e);             \
+    }
+ASYNC_SYSLOG_FUNCTION(debug)
+ASYNC_SYSLOG_FUNCTION(info)
+ASYNC_SYSLOG_FUNCTION(notice)
+ASYNC_SYSLOG_FUNCTION(warning)
+ASYNC_SYSLOG_FUNCTION(err)
+ASYNC_SYSLOG_FUNCTION(crit)
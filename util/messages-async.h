@@ -0,0 +1,119 @@
+/*
+ * Prototypes for asynchronous message handlers.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#ifndef UTIL_MESSAGES_ASYNC_H
+#define UTIL_MESSAGES_ASYNC_H 1
+
+#include <config.h>
+#include <portable/macros.h>
+#include <portable/stdbool.h>
+
+#include <stdarg.h>
+#include <stddef.h>
+
+/*
+ * What to do with a message when the calling thread's queue is full.
+ * MESSAGE_ASYNC_DROP discards it silently, MESSAGE_ASYNC_COUNT discards it
+ * but later logs how many messages were discarded, and MESSAGE_ASYNC_BLOCK
+ * waits for the background thread to make room.
+ */
+enum message_async_overflow {
+    MESSAGE_ASYNC_DROP,
+    MESSAGE_ASYNC_COUNT,
+    MESSAGE_ASYNC_BLOCK
+};
+
+BEGIN_DECLS
+
+/* Default to a hidden visibility for all util functions. */
+#pragma GCC visibility push(hidden)
+
+/*
+ * Start the background thread that writes out queued messages.  size is the
+ * size in bytes of the queue allocated for each thread that logs a message
+ * (0 for a default of 64KB), and messages longer than half of it are
+ * truncated.  fd is the file descriptor used by message_log_async_file, or
+ * -1 if that handler isn't used; it's not closed by message_async_stop.
+ *
+ * This also sets message_fatal_cleanup to a function that flushes the queues
+ * and then calls the previous message_fatal_cleanup function, if any, so that
+ * the message from die reaches its destination.  Set message_fatal_cleanup
+ * before calling this function, or call message_async_flush from it.
+ *
+ * With MESSAGE_ASYNC_DROP or MESSAGE_ASYNC_COUNT, any message can be dropped
+ * when its queue is full, including the message from die, so use
+ * MESSAGE_ASYNC_BLOCK or a synchronous die handler if that matters.
+ *
+ * Returns false and sets errno on failure, including ENOSYS if the platform
+ * has no thread support, in which case the asynchronous handlers log
+ * synchronously.
+ */
+bool message_async_start(size_t size, enum message_async_overflow, int fd);
+
+/*
+ * Wait until every message queued before the call has been written out.
+ * Does nothing if the background thread isn't running.
+ */
+void message_async_flush(void);
+
+/*
+ * Flush all queued messages, stop the background thread, free the queues,
+ * and restore message_fatal_cleanup.  No other thread may log while this
+ * runs.  Afterwards, the asynchronous handlers log synchronously.  Call this
+ * before exiting normally, or queued messages may be lost.
+ */
+void message_async_stop(void);
+
+/* Returns the number of messages discarded because a queue was full. */
+unsigned long message_async_dropped(void);
+
+/*
+ * Message handlers, intended to be passed to message_handlers_*, that format
+ * the message into the calling thread's queue and return.  The background
+ * thread then writes it out the same way as message_log_stdout,
+ * message_log_stderr, or the corresponding message_log_syslog_* handler, or
+ * to the file descriptor given to message_async_start for
+ * message_log_async_file (formatted like message_log_stderr).  Output to
+ * standard output, standard error, and files is written in batches with one
+ * write per batch, bypassing stdio.  Messages from a single thread are
+ * written in order, but messages from different threads may be reordered.
+ */
+void message_log_async_stdout(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+void message_log_async_stderr(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+void message_log_async_file(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+void message_log_async_syslog_debug(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+void message_log_async_syslog_info(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+void message_log_async_syslog_notice(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+void message_log_async_syslog_warning(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+void message_log_async_syslog_err(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+void message_log_async_syslog_crit(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+
+/* Undo default visibility change. */
+#pragma GCC visibility pop
+
+END_DECLS
+
+#endif /* UTIL_MESSAGES_ASYNC_H */
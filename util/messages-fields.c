@@ -0,0 +1,312 @@
+/*
+ * Structured logging.
+ *
+ * Provides an alternative to warn and notice for messages meant for log
+ * aggregation rather than people.  Instead of a printf format, each message
+ * carries a list of typed fields, which are serialized directly into a
+ * struct buffer as JSON or logfmt so that nothing downstream has to parse
+ * free text and nothing here has to format into temporary memory.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+#include <portable/socket.h>
+
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include <util/buffer.h>
+#include <util/messages.h>
+#include <util/messages-fields.h>
+#include <util/network.h>
+#include <util/xwrite.h>
+
+/* Large enough for any IPv6 address, leaving room for brackets and a port. */
+#define ADDRESS_SIZE 64
+
+/*
+ * Where the *_fields functions write and the reusable buffer they use.  These
+ * are protected by a mutex where threads are available, which also keeps
+ * messages from different threads from being interleaved.
+ */
+static int fields_fd = STDERR_FILENO;
+static enum message_fields_format fields_format = MESSAGE_FIELDS_JSON;
+static struct buffer *fields_buffer = NULL;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t fields_lock = PTHREAD_MUTEX_INITIALIZER;
+# define FIELDS_LOCK()   pthread_mutex_lock(&fields_lock)
+# define FIELDS_UNLOCK() pthread_mutex_unlock(&fields_lock)
+#else
+# define FIELDS_LOCK()   /* empty */
+# define FIELDS_UNLOCK() /* empty */
+#endif
+
+
+/*
+ * Append a string to a buffer as a quoted JSON string.  Runs of characters
+ * that don't need escaping are appended in one call.  This escaping is also
+ * valid for quoted logfmt values.
+ */
+static void
+append_quoted(struct buffer *buffer, const char *string)
+{
+    const char *start, *p;
+    unsigned char c;
+
+    buffer_append(buffer, "\"", 1);
+    for (start = p = string; *p != '\0'; p++) {
+        c = (unsigned char) *p;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        buffer_append(buffer, start, (size_t) (p - start));
+        switch (c) {
+        case '"':  buffer_append(buffer, "\\\"", 2); break;
+        case '\\': buffer_append(buffer, "\\\\", 2); break;
+        case '\n': buffer_append(buffer, "\\n", 2);  break;
+        case '\r': buffer_append(buffer, "\\r", 2);  break;
+        case '\t': buffer_append(buffer, "\\t", 2);  break;
+        default:
+            buffer_append_sprintf(buffer, "\\u%04x", (unsigned int) c);
+            break;
+        }
+        start = p + 1;
+    }
+    buffer_append(buffer, start, (size_t) (p - start));
+    buffer_append(buffer, "\"", 1);
+}
+
+
+/*
+ * Returns whether a logfmt value has to be quoted: if it's empty or contains
+ * spaces, equal signs, quotes, or control characters.
+ */
+static bool
+logfmt_needs_quotes(const char *string)
+{
+    const char *p;
+
+    if (*string == '\0')
+        return true;
+    for (p = string; *p != '\0'; p++)
+        if ((unsigned char) *p <= ' ' || *p == '=' || *p == '"' || *p == '\\')
+            return true;
+    return false;
+}
+
+
+/*
+ * Append the separator and key for a field.  first is true for the first
+ * field in the message.
+ */
+static void
+append_key(struct buffer *buffer, enum message_fields_format format,
+           const char *key, bool first)
+{
+    if (format == MESSAGE_FIELDS_JSON) {
+        buffer_append(buffer, first ? "{" : ",", 1);
+        append_quoted(buffer, key);
+        buffer_append(buffer, ":", 1);
+    } else {
+        if (!first)
+            buffer_append(buffer, " ", 1);
+        buffer_append(buffer, key, strlen(key));
+        buffer_append(buffer, "=", 1);
+    }
+}
+
+
+/*
+ * Append a string value, quoting it as needed for the format.
+ */
+static void
+append_string(struct buffer *buffer, enum message_fields_format format,
+              const char *value)
+{
+    if (format == MESSAGE_FIELDS_JSON) {
+        if (value == NULL)
+            buffer_append(buffer, "null", 4);
+        else
+            append_quoted(buffer, value);
+    } else if (value != NULL) {
+        if (logfmt_needs_quotes(value))
+            append_quoted(buffer, value);
+        else
+            buffer_append(buffer, value, strlen(value));
+    }
+}
+
+
+/*
+ * Append a socket address as the address and port, with IPv6 addresses in
+ * brackets.  Unsupported address families are logged as "unknown".
+ */
+static void
+append_sockaddr(struct buffer *buffer, enum message_fields_format format,
+                const struct sockaddr *addr)
+{
+    char name[ADDRESS_SIZE], address[ADDRESS_SIZE + 8];
+    unsigned short port;
+
+    if (addr == NULL || !network_sockaddr_sprint(name, sizeof(name), addr)) {
+        append_string(buffer, format, "unknown");
+        return;
+    }
+    port = network_sockaddr_port(addr);
+    if (addr->sa_family == AF_INET)
+        snprintf(address, sizeof(address), "%s:%hu", name, port);
+    else
+        snprintf(address, sizeof(address), "[%s]:%hu", name, port);
+    append_string(buffer, format, address);
+}
+
+
+/*
+ * Append a structured message to a buffer, taking the fields as a va_list.
+ */
+void
+buffer_append_vfields(struct buffer *buffer,
+                      enum message_fields_format format, const char *level,
+                      const char *message, va_list args)
+{
+    enum message_field_type type;
+    const char *key;
+
+    append_key(buffer, format, "level", true);
+    append_string(buffer, format, level);
+    if (message_program_name != NULL) {
+        append_key(buffer, format, "program", false);
+        append_string(buffer, format, message_program_name);
+    }
+    append_key(buffer, format, "message", false);
+    append_string(buffer, format, message);
+    for (;;) {
+        type = (enum message_field_type) va_arg(args, int);
+
+        /*
+         * Stop at an unknown type as well as at the end, since we can't tell
+         * what arguments follow it.  This leaves out the rest of the fields
+         * but never emits a key without a value.
+         */
+        if (type == MESSAGE_FIELD_END
+            || (unsigned int) type > MESSAGE_FIELD_SOCKADDR)
+            break;
+        key = va_arg(args, const char *);
+        append_key(buffer, format, key, false);
+        switch (type) {
+        case MESSAGE_FIELD_STRING:
+            append_string(buffer, format, va_arg(args, const char *));
+            break;
+        case MESSAGE_FIELD_INT:
+            buffer_append_sprintf(buffer, "%ld", va_arg(args, long));
+            break;
+        case MESSAGE_FIELD_ERRNO:
+            append_string(buffer, format, strerror(va_arg(args, int)));
+            break;
+        case MESSAGE_FIELD_SOCKADDR:
+            append_sockaddr(buffer, format,
+                            va_arg(args, const struct sockaddr *));
+            break;
+        case MESSAGE_FIELD_END:
+        default:
+            break;
+        }
+    }
+    if (format == MESSAGE_FIELDS_JSON)
+        buffer_append(buffer, "}\n", 2);
+    else
+        buffer_append(buffer, "\n", 1);
+}
+
+
+/*
+ * Append a structured message to a buffer, taking the fields as arguments.
+ */
+void
+buffer_append_fields(struct buffer *buffer, enum message_fields_format format,
+                     const char *level, const char *message, ...)
+{
+    va_list args;
+
+    va_start(args, message);
+    buffer_append_vfields(buffer, format, level, message, args);
+    va_end(args);
+}
+
+
+/*
+ * Set the destination and format for the *_fields functions.
+ */
+void
+message_fields_output(int fd, enum message_fields_format format)
+{
+    FIELDS_LOCK();
+    fields_fd = fd;
+    fields_format = format;
+    FIELDS_UNLOCK();
+}
+
+
+/*
+ * Format a message into the reusable buffer and write it out.
+ */
+static void
+fields_log(const char *level, const char *message, va_list args)
+{
+    FIELDS_LOCK();
+    if (fields_buffer == NULL)
+        fields_buffer = buffer_new();
+    buffer_set(fields_buffer, NULL, 0);
+    buffer_append_vfields(fields_buffer, fields_format, level, message, args);
+    if (fields_fd == STDERR_FILENO)
+        fflush(stdout);
+    xwrite(fields_fd, fields_buffer->data, fields_buffer->left);
+    FIELDS_UNLOCK();
+}
+
+
+/*
+ * The logging functions.  debug_fields and notice_fields honor the same
+ * checks as the debug and notice macros.
+ */
+#define FIELDS_FUNCTION(name, check)                                    \
+    void                                                                \
+    name ## _fields(const char *message, ...)                           \
+    {                                                                   \
+        va_list args;                                                   \
+                                                                        \
+        if (message_level > (check))                                    \
+            return;                                                     \
+        va_start(args, message);                                        \
+        fields_log(#name, message, args);                               \
+        va_end(args);                                                   \
+    }
+FIELDS_FUNCTION(debug,  MESSAGE_LEVEL_DEBUG)
+FIELDS_FUNCTION(notice, MESSAGE_LEVEL_NOTICE)
+FIELDS_FUNCTION(warn,   MESSAGE_LEVEL_WARN)
+
+
+/*
+ * Free the reusable buffer.
+ */
+void
+message_fields_free(void)
+{
+    FIELDS_LOCK();
+    buffer_free(fields_buffer);
+    fields_buffer = NULL;
+    FIELDS_UNLOCK();
+}
@@ -0,0 +1,116 @@
+/*
+ * Prototypes for structured logging.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#ifndef UTIL_MESSAGES_FIELDS_H
+#define UTIL_MESSAGES_FIELDS_H 1
+
+#include <config.h>
+#include <portable/macros.h>
+
+#include <stdarg.h>
+
+/* Forward declarations to avoid extra includes. */
+struct buffer;
+struct sockaddr;
+
+/* The output formats for structured messages. */
+enum message_fields_format {
+    MESSAGE_FIELDS_JSON,        /* One JSON object per line. */
+    MESSAGE_FIELDS_LOGFMT       /* key=value pairs separated by spaces. */
+};
+
+/*
+ * The types of fields.  Fields are passed to the functions below as a list of
+ * arguments ending in MESSAGE_FIELD_END.  Use the macros below to build the
+ * list rather than these directly so that the arguments have the right types.
+ */
+enum message_field_type {
+    MESSAGE_FIELD_END = 0,
+    MESSAGE_FIELD_STRING,
+    MESSAGE_FIELD_INT,
+    MESSAGE_FIELD_ERRNO,
+    MESSAGE_FIELD_SOCKADDR
+};
+
+/*
+ * Fields for the argument lists.  MESSAGE_STRING is a string (NULL is logged
+ * as null in JSON and an empty value in logfmt), MESSAGE_INT is any integer
+ * that fits in a long, MESSAGE_ERRNO is an errno value logged as its
+ * strerror text, and MESSAGE_SOCKADDR is an IPv4 or IPv6 struct sockaddr
+ * logged as the address and port.  For example:
+ *
+ *     warn_fields("connection failed", MESSAGE_SOCKADDR("peer", addr),
+ *                 MESSAGE_ERRNO("error", errno), MESSAGE_FIELD_END);
+ */
+#define MESSAGE_STRING(k, v) \
+    MESSAGE_FIELD_STRING, (const char *) (k), (const char *) (v)
+#define MESSAGE_INT(k, v) \
+    MESSAGE_FIELD_INT, (const char *) (k), (long) (v)
+#define MESSAGE_ERRNO(k, v) \
+    MESSAGE_FIELD_ERRNO, (const char *) (k), (int) (v)
+#define MESSAGE_SOCKADDR(k, v) \
+    MESSAGE_FIELD_SOCKADDR, (const char *) (k), (const struct sockaddr *) (v)
+
+BEGIN_DECLS
+
+/* Default to a hidden visibility for all util functions. */
+#pragma GCC visibility push(hidden)
+
+/*
+ * Append a structured message to a buffer, followed by a newline, without
+ * any intermediate allocation.  level is logged as the level field,
+ * message_program_name (if set) as the program field, and message as the
+ * message field, followed by the fields in the argument list.  A field of
+ * unknown type ends the list, since its arguments can't be interpreted.
+ */
+void buffer_append_fields(struct buffer *, enum message_fields_format,
+                          const char *level, const char *message, ...)
+    __attribute__((__nonnull__(1, 3, 4)));
+void buffer_append_vfields(struct buffer *, enum message_fields_format,
+                           const char *level, const char *message, va_list)
+    __attribute__((__nonnull__(1, 3, 4)));
+
+/*
+ * Set where the *_fields functions write messages and in what format.  The
+ * default is JSON on standard error.  The file descriptor isn't closed.
+ */
+void message_fields_output(int fd, enum message_fields_format);
+
+/*
+ * Log a structured message with the given fields, formatted into a reusable
+ * buffer and written with a single write.  debug_fields and notice_fields
+ * only log if debug or notice messages are enabled for the regular message
+ * functions (see message_level in util/messages.h).  These functions may be
+ * called from multiple threads if threads are available, in which case the
+ * buffer is shared under a lock and each message is written whole.
+ */
+void debug_fields(const char *message, ...)
+    __attribute__((__nonnull__(1)));
+void notice_fields(const char *message, ...)
+    __attribute__((__nonnull__(1)));
+void warn_fields(const char *message, ...)
+    __attribute__((__nonnull__(1)));
+
+/* Free the reusable buffer, for programs that check for memory leaks. */
+void message_fields_free(void);
+
+/* Undo default visibility change. */
+#pragma GCC visibility pop
+
+END_DECLS
+
+#endif /* UTIL_MESSAGES_FIELDS_H */
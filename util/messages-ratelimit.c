@@ -0,0 +1,304 @@
+/*
+ * Rate-limited message handlers.
+ *
+ * Provides a message handler that passes messages on to other handlers
+ * subject to a per-call-site token bucket, so that a failure that produces
+ * the same warning thousands of times a second doesn't drown the log or slow
+ * the program down formatting messages no one will read.  Suppressed
+ * messages are counted and reported in a summary the next time that message
+ * gets through.
+ *
+ * Each format string is hashed by address into a fixed-size table with
+ * linear probing, so colliding format strings each keep their own bucket.
+ * The table never grows.  When it is full, a new format string takes over a
+ * slot whose bucket has refilled and has nothing to report, which loses no
+ * state.  If there is no such slot, messages with the new format are passed
+ * through unlimited until one frees up.
+ *
+ * The table is protected by a mutex where threads are available.  The lock is
+ * not held while calling the downstream handlers, so they may log messages
+ * themselves.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+#include <time.h>
+
+#include <util/messages.h>
+#include <util/messages-ratelimit.h>
+#include <util/xmalloc.h>
+
+/* The number of slots in the table of format strings (a power of two). */
+#define RATELIMIT_SLOTS 256
+
+/* The default limit, 10 messages per 5 seconds. */
+#define RATELIMIT_BURST    10
+#define RATELIMIT_INTERVAL 5
+
+/*
+ * The state for one format string.  tokens is the number of messages that
+ * may currently be logged, refilled at burst / interval per second up to
+ * burst, and suppressed is the number of messages dropped since the last one
+ * logged.
+ */
+struct ratelimit_slot {
+    const char *format;
+    double tokens;
+    time_t last;
+    unsigned long suppressed;
+};
+
+/* The table of format strings. */
+static struct ratelimit_slot slots[RATELIMIT_SLOTS];
+
+/* The lock protecting the table, if we have threads. */
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t slots_lock = PTHREAD_MUTEX_INITIALIZER;
+# define SLOTS_LOCK()   pthread_mutex_lock(&slots_lock)
+# define SLOTS_UNLOCK() pthread_mutex_unlock(&slots_lock)
+#else
+# define SLOTS_LOCK()   /* empty */
+# define SLOTS_UNLOCK() /* empty */
+#endif
+
+/* The handlers to pass messages on to. */
+static message_handler_func default_handlers[2] = {
+    message_log_stderr, NULL
+};
+static message_handler_func *handlers = default_handlers;
+
+/* The current limit. */
+static unsigned long ratelimit_burst = RATELIMIT_BURST;
+static unsigned long ratelimit_interval = RATELIMIT_INTERVAL;
+
+
+/*
+ * Set the handlers to pass messages on to.
+ */
+void
+message_ratelimit_handlers(unsigned int count, ...)
+{
+    va_list args;
+    unsigned int i;
+
+    if (handlers != default_handlers)
+        free(handlers);
+    handlers = xcalloc(count + 1, sizeof(message_handler_func));
+    va_start(args, count);
+    for (i = 0; i < count; i++)
+        handlers[i] = (message_handler_func) va_arg(args, message_handler_func);
+    va_end(args);
+    handlers[count] = NULL;
+}
+
+
+/*
+ * Set the rate limit.  An interval of 0 is treated as 1 to avoid dividing by
+ * zero.  Existing state is kept, but the new limit applies from the next
+ * message.
+ */
+void
+message_ratelimit_set(unsigned long burst, unsigned long interval)
+{
+    ratelimit_burst = burst;
+    ratelimit_interval = (interval == 0) ? 1 : interval;
+}
+
+
+/*
+ * Pass a message, given as a format and arguments, on to all of the handlers.
+ * Used for the summaries of suppressed messages.
+ */
+static void
+ratelimit_log(const char *format, ...)
+{
+    va_list args;
+    message_handler_func *log;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (length < 0)
+        return;
+    for (log = handlers; *log != NULL; log++) {
+        va_start(args, format);
+        (**log)((size_t) length, format, args, 0);
+        va_end(args);
+    }
+}
+
+
+/*
+ * Report a number of suppressed messages for a format, if any.
+ */
+static void
+ratelimit_summary(const char *format, unsigned long count)
+{
+    if (count == 0)
+        return;
+    ratelimit_log("last message repeated %lu times (%s)", count, format);
+}
+
+
+/*
+ * Refill the tokens of a slot for the time that has passed since it was last
+ * used.
+ */
+static void
+ratelimit_refill(struct ratelimit_slot *slot, time_t now)
+{
+    if (now == slot->last)
+        return;
+    if (now > slot->last) {
+        slot->tokens += (double) (now - slot->last) * ratelimit_burst
+                        / ratelimit_interval;
+        if (slot->tokens > (double) ratelimit_burst)
+            slot->tokens = (double) ratelimit_burst;
+    }
+    slot->last = now;
+}
+
+
+/*
+ * Find the slot for a format string, claiming a new one if it has none.
+ * Format strings are usually in read-only data and rarely share alignment, so
+ * mixing the high bits of the address into the low bits is enough for the
+ * starting point, and from there we probe linearly.  Slots are never emptied
+ * except by message_ratelimit_reset, so the search for an existing slot can
+ * stop at the first empty one.
+ *
+ * A new format string gets the first empty slot in its probe sequence or, if
+ * the table is full, the first slot whose bucket is full and has no
+ * suppressed messages, since forgetting that state changes nothing.  Returns
+ * NULL if there is no such slot.  Must be called with the table locked.
+ */
+static struct ratelimit_slot *
+ratelimit_slot(const char *format, time_t now)
+{
+    uintptr_t key = (uintptr_t) format;
+    struct ratelimit_slot *slot;
+    struct ratelimit_slot *idle = NULL;
+    size_t i;
+
+    key ^= key >> 13;
+    key ^= key >> 7;
+    for (i = 0; i < RATELIMIT_SLOTS; i++) {
+        slot = &slots[(key + i) & (RATELIMIT_SLOTS - 1)];
+        if (slot->format == format) {
+            ratelimit_refill(slot, now);
+            return slot;
+        }
+        if (slot->format == NULL) {
+            idle = slot;
+            break;
+        }
+        if (idle == NULL && slot->suppressed == 0) {
+            ratelimit_refill(slot, now);
+            if (slot->tokens >= (double) ratelimit_burst)
+                idle = slot;
+        }
+    }
+    if (idle == NULL)
+        return NULL;
+    idle->format = format;
+    idle->tokens = (double) ratelimit_burst;
+    idle->last = now;
+    idle->suppressed = 0;
+    return idle;
+}
+
+
+/*
+ * The message handler.  Look up the slot for the format string and either
+ * count the message as suppressed or report any suppressed messages and pass
+ * it on.  The decision is made with the table locked, but the logging is done
+ * after releasing the lock.
+ */
+void
+message_log_ratelimit(size_t len, const char *fmt, va_list args, int err)
+{
+    struct ratelimit_slot *slot;
+    message_handler_func *log;
+    va_list args_copy;
+    unsigned long suppressed = 0;
+
+    if (ratelimit_burst > 0) {
+        SLOTS_LOCK();
+        slot = ratelimit_slot(fmt, time(NULL));
+        if (slot != NULL) {
+            if (slot->tokens < 1) {
+                slot->suppressed++;
+                SLOTS_UNLOCK();
+                return;
+            }
+            slot->tokens--;
+            suppressed = slot->suppressed;
+            slot->suppressed = 0;
+        }
+        SLOTS_UNLOCK();
+        ratelimit_summary(fmt, suppressed);
+    }
+    for (log = handlers; *log != NULL; log++) {
+        va_copy(args_copy, args);
+        (**log)(len, fmt, args_copy, err);
+        va_end(args_copy);
+    }
+}
+
+
+/*
+ * Report the suppressed messages for every slot.
+ */
+void
+message_ratelimit_flush(void)
+{
+    size_t i;
+    const char *format;
+    unsigned long suppressed;
+
+    for (i = 0; i < RATELIMIT_SLOTS; i++) {
+        SLOTS_LOCK();
+        format = slots[i].format;
+        suppressed = slots[i].suppressed;
+        slots[i].suppressed = 0;
+        SLOTS_UNLOCK();
+        if (format != NULL)
+            ratelimit_summary(format, suppressed);
+    }
+}
+
+
+/*
+ * Forget all state and restore the defaults.
+ */
+void
+message_ratelimit_reset(void)
+{
+    SLOTS_LOCK();
+    memset(slots, 0, sizeof(slots));
+    SLOTS_UNLOCK();
+    if (handlers != default_handlers) {
+        free(handlers);
+        handlers = default_handlers;
+    }
+    ratelimit_burst = RATELIMIT_BURST;
+    ratelimit_interval = RATELIMIT_INTERVAL;
+}
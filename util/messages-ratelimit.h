@@ -0,0 +1,85 @@
+/*
+ * Prototypes for rate-limited message handlers.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#ifndef UTIL_MESSAGES_RATELIMIT_H
+#define UTIL_MESSAGES_RATELIMIT_H 1
+
+#include <config.h>
+#include <portable/macros.h>
+
+#include <stdarg.h>
+#include <stddef.h>
+
+BEGIN_DECLS
+
+/* Default to a hidden visibility for all util functions. */
+#pragma GCC visibility push(hidden)
+
+/*
+ * Set the handlers that message_log_ratelimit passes messages on to.  Takes a
+ * count of handlers and then that many handler functions, like the
+ * message_handlers_* functions.  Until this is called, messages are passed to
+ * message_log_stderr.
+ */
+void message_ratelimit_handlers(unsigned int count, ...);
+
+/*
+ * Set the rate limit.  Each distinct format string may log up to burst
+ * messages at once, after which it may log burst messages per interval
+ * seconds on average (a token bucket).  The default is 10 messages per 5
+ * seconds.  A burst of 0 disables rate limiting.
+ */
+void message_ratelimit_set(unsigned long burst, unsigned long interval);
+
+/*
+ * A message handler, intended to be passed to message_handlers_*, that
+ * applies the rate limit to each message and passes it on to the handlers
+ * set with message_ratelimit_handlers if it's within the limit.
+ *
+ * Messages are keyed by the address of their format string, so every call
+ * site has its own limit regardless of the message arguments.  A suppressed
+ * message is not formatted and costs a hash table lookup.  The next time a
+ * message with that format is allowed, or when message_ratelimit_flush is
+ * called, a summary of the form "last message repeated N times (<format>)"
+ * is logged first.  Each format string keeps its own limit even if it hashes
+ * to the same place as another.  If more format strings than the table holds
+ * are all being limited at once, messages with the others are passed on
+ * without a limit.
+ *
+ * The rate limit state is locked where threads are available, so this
+ * handler may be used from several threads.  message_ratelimit_handlers,
+ * message_ratelimit_set, and message_ratelimit_reset change global settings
+ * without locking and should be called before other threads start logging.
+ */
+void message_log_ratelimit(size_t, const char *, va_list, int)
+    __attribute__((__nonnull__));
+
+/* Log the summaries of all suppressed messages that haven't been reported. */
+void message_ratelimit_flush(void);
+
+/*
+ * Forget all rate limit state, without logging summaries, and free the
+ * handler list, restoring the default handler and limits.
+ */
+void message_ratelimit_reset(void);
+
+/* Undo default visibility change. */
+#pragma GCC visibility pop
+
+END_DECLS
+
+#endif /* UTIL_MESSAGES_RATELIMIT_H */
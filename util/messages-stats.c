@@ -0,0 +1,145 @@
+/*
+ * Export message statistics.
+ *
+ * Formats the counters kept by util/messages.c in the Prometheus text
+ * exposition format so that a program can serve them from its metrics
+ * endpoint.  This is separate from util/messages.c so that programs that
+ * don't need it don't have to link with util/buffer.c.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <util/buffer.h>
+#include <util/macros.h>
+#include <util/messages.h>
+#include <util/messages-stats.h>
+
+/* The names of the levels, indexed by MESSAGE_LEVEL_*. */
+static const char * const levels[MESSAGE_STATS_LEVELS] = {
+    "debug", "notice", "warn", "die"
+};
+
+/* The upper bounds of the latency buckets in seconds, except the last. */
+static const char * const bounds[MESSAGE_STATS_BUCKETS - 1] = {
+    "1e-06", "1e-05", "0.0001", "0.001", "0.01", "0.1"
+};
+
+
+/*
+ * Append the HELP and TYPE lines for a metric.
+ */
+static void
+append_header(struct buffer *buffer, const char *prefix, const char *name,
+              const char *type, const char *help)
+{
+    buffer_append_sprintf(buffer, "# HELP %s_%s %s\n", prefix, name, help);
+    buffer_append_sprintf(buffer, "# TYPE %s_%s %s\n", prefix, name, type);
+}
+
+
+/*
+ * Append a handler name as a label value, escaping backslashes, double
+ * quotes, and newlines as the exposition format requires.
+ */
+static void
+append_label(struct buffer *buffer, const char *value)
+{
+    const char *p;
+
+    for (p = value; *p != '\0'; p++)
+        switch (*p) {
+        case '\\': buffer_append(buffer, "\\\\", 2); break;
+        case '"':  buffer_append(buffer, "\\\"", 2); break;
+        case '\n': buffer_append(buffer, "\\n", 2);  break;
+        default:   buffer_append(buffer, p, 1);      break;
+        }
+}
+
+
+/*
+ * Append the latency histogram for one handler.  position is used to name
+ * handlers without names.
+ */
+static void
+append_histogram(struct buffer *buffer, const char *prefix,
+                 const struct message_stats_handler *handler, size_t position)
+{
+    char label[32];
+    const char *name = handler->name;
+    unsigned long total = 0;
+    size_t i;
+
+    if (name == NULL) {
+        snprintf(label, sizeof(label), "handler%lu", (unsigned long) position);
+        name = label;
+    }
+    for (i = 0; i < MESSAGE_STATS_BUCKETS; i++) {
+        total += handler->buckets[i];
+        buffer_append_sprintf(buffer, "%s_handler_duration_seconds_bucket"
+                              "{handler=\"", prefix);
+        append_label(buffer, name);
+        buffer_append_sprintf(buffer, "\",le=\"%s\"} %lu\n",
+                              i < ARRAY_SIZE(bounds) ? bounds[i] : "+Inf",
+                              total);
+    }
+    buffer_append_sprintf(buffer, "%s_handler_duration_seconds_sum{handler=\"",
+                          prefix);
+    append_label(buffer, name);
+    buffer_append_sprintf(buffer, "\"} %lu.%06lu\n", handler->usec / 1000000,
+                          handler->usec % 1000000);
+    buffer_append_sprintf(buffer, "%s_handler_duration_seconds_count"
+                          "{handler=\"", prefix);
+    append_label(buffer, name);
+    buffer_append_sprintf(buffer, "\"} %lu\n", handler->calls);
+}
+
+
+/*
+ * Append all of the message statistics to a buffer.
+ */
+void
+message_stats_prometheus(struct buffer *buffer, const char *prefix)
+{
+    struct message_stats stats;
+    size_t i;
+
+    message_stats_get(&stats);
+    append_header(buffer, prefix, "messages_total", "counter",
+                  "Messages passed to message handlers.");
+    for (i = 0; i < MESSAGE_STATS_LEVELS; i++)
+        buffer_append_sprintf(buffer, "%s_messages_total{level=\"%s\"} %lu\n",
+                              prefix, levels[i], stats.levels[i].messages);
+    append_header(buffer, prefix, "message_bytes_total", "counter",
+                  "Length of messages passed to message handlers.");
+    for (i = 0; i < MESSAGE_STATS_LEVELS; i++)
+        buffer_append_sprintf(buffer,
+                              "%s_message_bytes_total{level=\"%s\"} %lu\n",
+                              prefix, levels[i], stats.levels[i].bytes);
+    append_header(buffer, prefix, "messages_suppressed_total", "counter",
+                  "Messages dropped by sampling.");
+    for (i = 0; i < MESSAGE_STATS_LEVELS; i++)
+        buffer_append_sprintf(buffer,
+                              "%s_messages_suppressed_total{level=\"%s\"}"
+                              " %lu\n", prefix, levels[i],
+                              stats.levels[i].suppressed);
+    if (stats.count == 0)
+        return;
+    append_header(buffer, prefix, "handler_duration_seconds", "histogram",
+                  "Time spent in message handlers.");
+    for (i = 0; i < stats.count; i++)
+        append_histogram(buffer, prefix, &stats.handlers[i], i);
+}
@@ -0,0 +1,48 @@
+/*
+ * Prototypes for exporting message statistics.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#ifndef UTIL_MESSAGES_STATS_H
+#define UTIL_MESSAGES_STATS_H 1
+
+#include <config.h>
+#include <portable/macros.h>
+
+/* Forward declarations to avoid extra includes. */
+struct buffer;
+
+BEGIN_DECLS
+
+/* Default to a hidden visibility for all util functions. */
+#pragma GCC visibility push(hidden)
+
+/*
+ * Append the current message statistics (see message_stats_get in
+ * util/messages.h) to a buffer in the Prometheus text exposition format.
+ * Every metric name starts with prefix followed by an underscore.  The
+ * per-level counters are labeled with the level, and the handler latency
+ * histograms with the handler name, or "handler" followed by its position
+ * in the statistics if it has no name.
+ */
+void message_stats_prometheus(struct buffer *, const char *prefix)
+    __attribute__((__nonnull__));
+
+/* Undo default visibility change. */
+#pragma GCC visibility pop
+
+END_DECLS
+
+#endif /* UTIL_MESSAGES_STATS_H */
@@ -50,6 +50,17 @@
  * generates given the format and arguments), a format, an argument list as a
  * va_list, and the applicable errno value (if any).
  *
+ * Each message function counts the messages and bytes it logs.  With
+ * message_stats_timing, the time spent in each handler is also recorded in a
+ * histogram.  message_sample_debug drops a random fraction of debug messages
+ * before they're formatted.  See util/messages-stats.c for exporting these
+ * statistics.
+ *
+ * The syslog handlers normally log via syslog(3).  After a successful call to
+ * message_syslog_open, they instead send RFC 5424 datagrams directly to the
+ * local syslog socket over a persistent connection, falling back on syslog(3)
+ * if that fails.
+ *
  * The canonical version of this file is maintained in the rra-c-util package,
  * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
  *
@@ -80,10 +91,24 @@
 #include <config.h>
 #include <portable/system.h>
 
+#ifndef _WIN32
+# include <portable/socket.h>
+# include <portable/socket-unix.h>
+# include <portable/uio.h>
+#endif
+
 #include <errno.h>
+#ifndef _WIN32
+# include <fcntl.h>
+# include <sys/time.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 #ifdef HAVE_SYSLOG_H
 # include <syslog.h>
 #endif
+#include <time.h>
 
 #ifdef _WIN32
 # include <windows.h>
@@ -99,6 +124,11 @@
 #include <util/messages.h>
 #include <util/xmalloc.h>
 
+/* The functions below are wrapped by macros in util/messages.h. */
+#undef debug
+#undef notice
+#undef sysnotice
+
 /* The default handler lists. */
 static message_handler_func stdout_handlers[2] = {
     message_log_stdout, NULL
@@ -107,34 +137,246 @@ static message_handler_func stderr_handlers[2] = {
     message_log_stderr, NULL
 };
 
-/* The list of logging functions currently in effect. */
+/*
+ * The list of logging functions currently in effect.  These are replaced
+ * atomically, and replaced lists are kept until message_handlers_reset, so
+ * that another thread that's logging with the old list can keep using it.
+ */
 static message_handler_func *debug_handlers  = NULL;
 static message_handler_func *notice_handlers = stdout_handlers;
 static message_handler_func *warn_handlers   = stderr_handlers;
 static message_handler_func *die_handlers    = stderr_handlers;
 
+/*
+ * Every handler list allocated for the global handlers, none of which are
+ * freed before message_handlers_reset.  Setting handlers reuses an existing
+ * list with the same handlers, so this holds one list per distinct set of
+ * handlers rather than growing each time a program reconfigures its logging.
+ */
+struct message_list_node {
+    struct message_list_node *next;
+    message_handler_func *list;
+};
+static struct message_list_node *handler_lists = NULL;
+
+/*
+ * Per-thread handler lists that override the global lists, indexed by the
+ * MESSAGE_LEVEL_* constants, and the number of thread overrides in effect in
+ * all threads.
+ */
+#ifdef HAVE_THREAD_LOCAL
+static THREAD_LOCAL message_handler_func *thread_handlers[4];
+#endif
+static int thread_overrides = 0;
+
+/*
+ * Message statistics.  stats_timing says whether to collect the per-handler
+ * statistics, and debug_sample is the threshold below which a random 32-bit
+ * number must fall for a debug message to be logged, or UINT32_MAX to log
+ * all debug messages.
+ */
+static struct message_stats_level level_stats[MESSAGE_STATS_LEVELS];
+static struct message_stats_handler handler_stats[MESSAGE_STATS_HANDLERS];
+static bool stats_timing = false;
+static uint32_t debug_sample = UINT32_MAX;
+
+/* The state of the random number generator used for sampling. */
+#ifdef HAVE_THREAD_LOCAL
+static THREAD_LOCAL uint32_t sample_state = 0;
+#else
+static uint32_t sample_state = 0;
+#endif
+
+/*
+ * Atomic operations on the handler lists and counters, if available.  Without
+ * them, the lists are not safe to change while other threads are logging and
+ * the counters may lose updates.
+ */
+#ifdef HAVE_ATOMIC_BUILTINS
+# define LIST_LOAD(p)          __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+# define LIST_STORE(p, v)      __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+# define ATOMIC_ADD(p, v)      __atomic_add_fetch(&(p), (v), __ATOMIC_RELAXED)
+# define ATOMIC_LOAD(p)        __atomic_load_n(&(p), __ATOMIC_RELAXED)
+# define ATOMIC_STORE(p, v)    __atomic_store_n(&(p), (v), __ATOMIC_RELAXED)
+# define ATOMIC_CAS(p, old, v)                                              \
+    __atomic_compare_exchange_n(&(p), (old), (v), false, __ATOMIC_ACQ_REL, \
+                                __ATOMIC_ACQUIRE)
+# define NODE_LOAD(p)          __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+# define NODE_PUSH(head, node)                                             \
+    do {                                                                   \
+        (node)->next = __atomic_load_n(&(head), __ATOMIC_RELAXED);         \
+        while (!__atomic_compare_exchange_n(&(head), &(node)->next,        \
+                                            (node), true, __ATOMIC_RELEASE,\
+                                            __ATOMIC_RELAXED))             \
+            ;                                                              \
+    } while (0)
+#else
+# define LIST_LOAD(p)          (p)
+# define LIST_STORE(p, v)      ((p) = (v))
+# define ATOMIC_ADD(p, v)      ((p) += (v))
+# define ATOMIC_LOAD(p)        (p)
+# define ATOMIC_STORE(p, v)    ((p) = (v))
+# define ATOMIC_CAS(p, old, v)                                              \
+    (((p) == *(old)) ? ((p) = (v), true) : (*(old) = (p), false))
+# define NODE_LOAD(p)          (p)
+# define NODE_PUSH(head, node)                                             \
+    do {                                                                   \
+        (node)->next = (head);                                             \
+        (head) = (node);                                                   \
+    } while (0)
+#endif
+
+/* The lowest message level with handlers, checked by the macro wrappers. */
+int message_level = MESSAGE_LEVEL_NOTICE;
+
 /* If non-NULL, called before exit and its return value passed to exit. */
 int (*message_fatal_cleanup)(void) = NULL;
 
 /* If non-NULL, prepended (followed by ": ") to messages. */
 const char *message_program_name = NULL;
 
+/*
+ * The size of the buffer on the stack used to format syslog messages.
+ * Longer messages are formatted into a buffer allocated on the heap.
+ */
+#define SYSLOG_BUFFER_SIZE 1024
+
+/* The size of the buffer used for the RFC 5424 header of a message. */
+#define SYSLOG_HEADER_SIZE 512
 
 /*
- * Set the handlers for a particular message function.  Takes a pointer to the
- * handler list, the count of handlers, and the argument list.
+ * The connection to the local syslog daemon opened by message_syslog_open,
+ * the address to reconnect to, the facility to log with, and the local
+ * hostname.  syslog_fd is -1 if message_syslog_open hasn't been called.  All
+ * of these are protected by syslog_lock where threads are available, so that
+ * one thread can't close the descriptor while another is writing to it or
+ * reconnecting.
+ */
+#ifndef _WIN32
+static int syslog_fd = -1;
+static struct sockaddr_un syslog_address;
+static int syslog_facility;
+static char syslog_hostname[256];
+# ifdef HAVE_PTHREAD
+static pthread_mutex_t syslog_lock = PTHREAD_MUTEX_INITIALIZER;
+#  define SYSLOG_LOCK()   pthread_mutex_lock(&syslog_lock)
+#  define SYSLOG_UNLOCK() pthread_mutex_unlock(&syslog_lock)
+# else
+#  define SYSLOG_LOCK()   /* empty */
+#  define SYSLOG_UNLOCK() /* empty */
+# endif
+#endif
+
+
+/*
+ * Return the handler list to use for a message: the calling thread's
+ * override if it has one and otherwise the global list.
+ */
+#ifdef HAVE_THREAD_LOCAL
+# define message_current(list, index)                                   \
+    ((thread_handlers[(index)] != NULL) ? thread_handlers[(index)]      \
+                                        : LIST_LOAD(list))
+#else
+# define message_current(list, index) LIST_LOAD(list)
+#endif
+
+
+/*
+ * Recalculate message_level after the handlers have changed.  If any thread
+ * has its own handlers, the macro wrappers can't tell which thread they're
+ * in, so always call the functions.
  */
 static void
-message_handlers(message_handler_func **list, unsigned int count, va_list args)
+message_level_update(void)
 {
+    message_handler_func *list;
+
+    list = LIST_LOAD(debug_handlers);
+    if (ATOMIC_LOAD(thread_overrides) > 0 || (list != NULL && list[0] != NULL))
+        ATOMIC_STORE(message_level, MESSAGE_LEVEL_DEBUG);
+    else if (LIST_LOAD(notice_handlers)[0] != NULL)
+        ATOMIC_STORE(message_level, MESSAGE_LEVEL_NOTICE);
+    else
+        ATOMIC_STORE(message_level, MESSAGE_LEVEL_WARN);
+}
+
+
+/*
+ * Build a new handler list from a count and an argument list.
+ */
+static message_handler_func *
+message_list_new(unsigned int count, va_list args)
+{
+    message_handler_func *list;
     unsigned int i;
 
-    if (*list != stdout_handlers && *list != stderr_handlers)
-        free(*list);
-    *list = xcalloc(count + 1, sizeof(message_handler_func));
+    list = xcalloc(count + 1, sizeof(message_handler_func));
     for (i = 0; i < count; i++)
-        (*list)[i] = (message_handler_func) va_arg(args, message_handler_func);
-    (*list)[count] = NULL;
+        list[i] = (message_handler_func) va_arg(args, message_handler_func);
+    list[count] = NULL;
+    return list;
+}
+
+
+/*
+ * Returns whether two handler lists contain the same handlers.
+ */
+static bool
+message_list_equal(const message_handler_func *a,
+                   const message_handler_func *b)
+{
+    size_t i;
+
+    for (i = 0; a[i] != NULL && a[i] == b[i]; i++)
+        ;
+    return a[i] == b[i];
+}
+
+
+/*
+ * Return a global handler list with the handlers from a count and an argument
+ * list.  If the default lists or a list allocated earlier have the same
+ * handlers, return that list instead of a new one; otherwise, record the new
+ * list in handler_lists.
+ */
+static message_handler_func *
+message_list_shared(unsigned int count, va_list args)
+{
+    message_handler_func *list;
+    struct message_list_node *node;
+
+    list = message_list_new(count, args);
+    if (message_list_equal(list, stdout_handlers)) {
+        free(list);
+        return stdout_handlers;
+    }
+    if (message_list_equal(list, stderr_handlers)) {
+        free(list);
+        return stderr_handlers;
+    }
+    for (node = NODE_LOAD(handler_lists); node != NULL; node = node->next)
+        if (message_list_equal(list, node->list)) {
+            free(list);
+            return node->list;
+        }
+    node = xmalloc(sizeof(struct message_list_node));
+    node->list = list;
+    NODE_PUSH(handler_lists, node);
+    return list;
+}
+
+
+/*
+ * Set the handlers for a particular message function.  Takes a pointer to the
+ * handler list, the count of handlers, and the argument list.  The new list
+ * is swapped in atomically, and the old one is left allocated since another
+ * thread may be in the middle of logging with it.
+ */
+static void
+message_handlers(message_handler_func **list, unsigned int count, va_list args)
+{
+    LIST_STORE(*list, message_list_shared(count, args));
+    message_level_update();
 }
 
 
@@ -160,27 +402,95 @@ HANDLER_FUNCTION(die)
 
 
 /*
- * Reset all handlers back to the defaults and free all allocated memory.
- * This is primarily useful for programs that undergo comprehensive memory
- * allocation analysis.
+ * Set the calling thread's handlers for a particular message function.  Only
+ * this thread reads its own lists, so the old one can be freed immediately.
+ * Returns false and sets errno to ENOSYS without thread-local storage.
+ */
+#ifdef HAVE_THREAD_LOCAL
+static bool
+message_thread_handlers(int index, unsigned int count, va_list args)
+{
+    message_handler_func *old;
+
+    old = thread_handlers[index];
+    thread_handlers[index] = message_list_new(count, args);
+    if (old == NULL)
+        ATOMIC_ADD(thread_overrides, 1);
+    free(old);
+    message_level_update();
+    return true;
+}
+#else
+static bool
+message_thread_handlers(int index UNUSED, unsigned int count UNUSED,
+                        va_list args UNUSED)
+{
+    errno = ENOSYS;
+    return false;
+}
+#endif
+
+#define THREAD_HANDLER_FUNCTION(type, index)                    \
+    bool                                                        \
+    message_thread_handlers_ ## type(unsigned int count, ...)   \
+    {                                                           \
+        va_list args;                                           \
+        bool status;                                            \
+                                                                \
+        va_start(args, count);                                  \
+        status = message_thread_handlers((index), count, args); \
+        va_end(args);                                           \
+        return status;                                          \
+    }
+THREAD_HANDLER_FUNCTION(debug,  MESSAGE_LEVEL_DEBUG)
+THREAD_HANDLER_FUNCTION(notice, MESSAGE_LEVEL_NOTICE)
+THREAD_HANDLER_FUNCTION(warn,   MESSAGE_LEVEL_WARN)
+THREAD_HANDLER_FUNCTION(die,    MESSAGE_LEVEL_DIE)
+
+
+/*
+ * Remove all of the calling thread's handler overrides and free them, so
+ * that the thread goes back to using the global handlers.
+ */
+void
+message_thread_handlers_reset(void)
+{
+#ifdef HAVE_THREAD_LOCAL
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(thread_handlers); i++)
+        if (thread_handlers[i] != NULL) {
+            free(thread_handlers[i]);
+            thread_handlers[i] = NULL;
+            ATOMIC_ADD(thread_overrides, -1);
+        }
+    message_level_update();
+#endif
+}
+
+
+/*
+ * Reset all handlers back to the defaults and free all allocated memory,
+ * including replaced handler lists.  This is primarily useful for programs
+ * that undergo comprehensive memory allocation analysis, and no other thread
+ * may be logging while it runs.
  */
 void
 message_handlers_reset(void)
 {
-    free(debug_handlers);
-    debug_handlers = NULL;
-    if (notice_handlers != stdout_handlers) {
-        free(notice_handlers);
-        notice_handlers = stdout_handlers;
-    }
-    if (warn_handlers != stderr_handlers) {
-        free(warn_handlers);
-        warn_handlers = stderr_handlers;
-    }
-    if (die_handlers != stderr_handlers) {
-        free(die_handlers);
-        die_handlers = stderr_handlers;
+    struct message_list_node *node, *next;
+
+    LIST_STORE(debug_handlers, NULL);
+    LIST_STORE(notice_handlers, stdout_handlers);
+    LIST_STORE(warn_handlers, stderr_handlers);
+    LIST_STORE(die_handlers, stderr_handlers);
+    for (node = handler_lists; node != NULL; node = next) {
+        next = node->next;
+        free(node->list);
+        free(node);
     }
+    handler_lists = NULL;
+    message_level_update();
 }
 
 
@@ -217,30 +527,215 @@ message_log_stderr(size_t len UNUSED, const char *fmt, va_list args, int err)
 }
 
 
+#ifdef _WIN32
+
+/*
+ * Logging directly to the syslog daemon isn't supported on Windows.
+ */
+bool
+message_syslog_open(const char *path UNUSED, int facility UNUSED)
+{
+    errno = ENOSYS;
+    return false;
+}
+
+void
+message_syslog_close(void)
+{
+}
+
+#else /* !_WIN32 */
+
+/*
+ * Connect to the syslog daemon at the saved address, returning the new file
+ * descriptor or -1 on failure with errno set.
+ */
+static int
+message_syslog_connect(void)
+{
+    int fd, oerrno;
+
+    fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (connect(fd, (struct sockaddr *) &syslog_address,
+                SUN_LEN(&syslog_address)) < 0) {
+        oerrno = errno;
+        close(fd);
+        errno = oerrno;
+        return -1;
+    }
+    return fd;
+}
+
+
+/*
+ * Open a persistent connection to the local syslog daemon, used by the syslog
+ * handlers from then on in place of syslog(3).  path is the path to its
+ * socket, or NULL for /dev/log, and facility is the syslog facility to log
+ * with.  Returns false and sets errno on failure.
+ */
+bool
+message_syslog_open(const char *path, int facility)
+{
+    int fd, oerrno;
+
+    if (path == NULL)
+        path = "/dev/log";
+    if (strlen(path) >= sizeof(syslog_address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    SYSLOG_LOCK();
+    if (syslog_fd >= 0) {
+        close(syslog_fd);
+        syslog_fd = -1;
+    }
+    memset(&syslog_address, 0, sizeof(syslog_address));
+    syslog_address.sun_family = AF_UNIX;
+    strlcpy(syslog_address.sun_path, path, sizeof(syslog_address.sun_path));
+    fd = message_syslog_connect();
+    if (fd < 0) {
+        oerrno = errno;
+        SYSLOG_UNLOCK();
+        errno = oerrno;
+        return false;
+    }
+    if (gethostname(syslog_hostname, sizeof(syslog_hostname)) < 0
+        || syslog_hostname[0] == '\0')
+        strlcpy(syslog_hostname, "-", sizeof(syslog_hostname));
+    syslog_hostname[sizeof(syslog_hostname) - 1] = '\0';
+    syslog_facility = facility;
+    syslog_fd = fd;
+    SYSLOG_UNLOCK();
+    return true;
+}
+
+
+/*
+ * Close the connection to the syslog daemon, if any, so that the syslog
+ * handlers go back to using syslog(3).
+ */
+void
+message_syslog_close(void)
+{
+    SYSLOG_LOCK();
+    if (syslog_fd >= 0) {
+        close(syslog_fd);
+        syslog_fd = -1;
+    }
+    SYSLOG_UNLOCK();
+}
+
+
+/*
+ * Write a message to the syslog daemon as an RFC 5424 datagram.  The header
+ * and the message are sent with one writev, so the message isn't copied
+ * again.  If the daemon has been restarted since we connected, reconnect and
+ * try once more.  Must be called with syslog_lock held and syslog_fd open.
+ */
+static bool
+message_syslog_write(int pri, const char *message)
+{
+    char header[SYSLOG_HEADER_SIZE];
+    char timestamp[32];
+    struct iovec iov[2];
+    struct timeval now;
+    struct tm tm;
+    time_t seconds;
+    const char *app;
+    int length, fd;
+
+    gettimeofday(&now, NULL);
+    seconds = now.tv_sec;
+    if (gmtime_r(&seconds, &tm) == NULL)
+        return false;
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    app = (message_program_name == NULL) ? "-" : message_program_name;
+    length = snprintf(header, sizeof(header), "<%d>1 %s.%06ldZ %s %.48s %ld"
+                      " - - ", pri | syslog_facility, timestamp,
+                      (long) now.tv_usec, syslog_hostname, app,
+                      (long) getpid());
+    if (length < 0)
+        return false;
+    if ((size_t) length >= sizeof(header))
+        length = sizeof(header) - 1;
+    iov[0].iov_base = header;
+    iov[0].iov_len = length;
+    iov[1].iov_base = (char *) message;
+    iov[1].iov_len = strlen(message);
+    if (writev(syslog_fd, iov, 2) >= 0)
+        return true;
+    if (errno != ECONNREFUSED && errno != ENOTCONN)
+        return false;
+    fd = message_syslog_connect();
+    if (fd < 0)
+        return false;
+    close(syslog_fd);
+    syslog_fd = fd;
+    return writev(syslog_fd, iov, 2) >= 0;
+}
+
+
+/*
+ * Send a message to the syslog daemon over the connection opened by
+ * message_syslog_open, if any.  Returns false if there is no connection or
+ * the message couldn't be sent, in which case the caller should fall back on
+ * syslog(3).
+ */
+static bool
+message_syslog_send(int pri, const char *message)
+{
+    bool status;
+
+    SYSLOG_LOCK();
+    status = (syslog_fd >= 0 && message_syslog_write(pri, message));
+    SYSLOG_UNLOCK();
+    return status;
+}
+
+#endif /* !_WIN32 */
+
+
 /*
  * Log a message to syslog.  This is a helper function used to implement all
  * of the syslog message log handlers.  It takes the same arguments as a
  * regular message handler function but with an additional priority argument.
  *
+ * The message and the error string, if any, are formatted once into a buffer
+ * on the stack, and a buffer is only allocated for messages that don't fit.
+ * If that allocation fails, the message is truncated rather than lost.
+ *
  * This needs further attention on Windows.  For example, it currently doesn't
  * log the errno information.
  */
 static void
 message_log_syslog(int pri, size_t len, const char *fmt, va_list args, int err)
 {
-    char *buffer;
+    char stack[SYSLOG_BUFFER_SIZE];
+    char *buffer = stack;
+    const char *error = NULL;
+    size_t size;
     int status;
 
-    buffer = malloc(len + 1);
-    if (buffer == NULL) {
-        fprintf(stderr, "failed to malloc %lu bytes at %s line %d: %s",
-                (unsigned long) len + 1, __FILE__, __LINE__, strerror(errno));
-        exit(message_fatal_cleanup ? (*message_fatal_cleanup)() : 1);
+    size = len + 1;
+    if (err != 0) {
+        error = strerror(err);
+        size += strlen(error) + 2;
     }
-    status = vsnprintf(buffer, len + 1, fmt, args);
+    if (size > sizeof(stack)) {
+        buffer = malloc(size);
+        if (buffer == NULL) {
+            buffer = stack;
+            size = sizeof(stack);
+        }
+    }
+    status = vsnprintf(buffer, size, fmt, args);
     if (status < 0) {
         warn("failed to format output with vsnprintf in syslog handler");
-        free(buffer);
+        if (buffer != stack)
+            free(buffer);
         return;
     }
 #ifdef _WIN32
@@ -254,12 +749,15 @@ message_log_syslog(int pri, size_t len, const char *fmt, va_list args, int err)
         }
     }
 #else /* !_WIN32 */
-    if (err == 0)
+    if (error != NULL) {
+        strlcat(buffer, ": ", size);
+        strlcat(buffer, error, size);
+    }
+    if (!message_syslog_send(pri, buffer))
         syslog(pri, "%s", buffer);
-    else
-        syslog(pri, "%s: %s", buffer, strerror(err));
 #endif /* !_WIN32 */
-    free(buffer);
+    if (buffer != stack)
+        free(buffer);
 }
 
 
@@ -282,126 +780,354 @@ SYSLOG_FUNCTION(crit,    CRIT)
 
 
 /*
- * All of the message handlers.  There's a lot of code duplication here too,
- * but each one is still *slightly* different and va_start has to be called
- * multiple times, so it's hard to get rid of the duplication.
+ * Return the current time in microseconds, for timing handlers.  This only
+ * needs to be accurate over short intervals, so wrapping is harmless, but it
+ * has to be monotonic so that a clock step while a handler runs doesn't
+ * record a huge or negative time.  Fall back on gettimeofday if there is no
+ * monotonic clock.
+ */
+#ifdef _WIN32
+static unsigned long
+message_clock(void)
+{
+    return (unsigned long) GetTickCount() * 1000UL;
+}
+#elif defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+static unsigned long
+message_clock(void)
+{
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) < 0)
+        return 0;
+    return (unsigned long) now.tv_sec * 1000000UL
+           + (unsigned long) now.tv_nsec / 1000UL;
+}
+#else
+static unsigned long
+message_clock(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (unsigned long) now.tv_sec * 1000000UL
+           + (unsigned long) now.tv_usec;
+}
+#endif
+
+
+/*
+ * Find the statistics slot for a handler, claiming an empty one if the
+ * handler doesn't have one yet.  Returns NULL if the table is full.
+ */
+static struct message_stats_handler *
+message_stats_slot(message_handler_func handler)
+{
+    message_handler_func current;
+    size_t i;
+
+    for (i = 0; i < MESSAGE_STATS_HANDLERS; i++) {
+        current = ATOMIC_LOAD(handler_stats[i].handler);
+        if (current == NULL) {
+            if (ATOMIC_CAS(handler_stats[i].handler, &current, handler))
+                return &handler_stats[i];
+        }
+        if (current == handler)
+            return &handler_stats[i];
+    }
+    return NULL;
+}
+
+
+/*
+ * Record one call to a handler that took the given number of microseconds.
+ */
+static void
+message_stats_record(message_handler_func handler, unsigned long usec)
+{
+    struct message_stats_handler *slot;
+    unsigned long bound;
+    size_t bucket;
+
+    slot = message_stats_slot(handler);
+    if (slot == NULL)
+        return;
+    bucket = 0;
+    for (bound = 1; bucket < MESSAGE_STATS_BUCKETS - 1; bound *= 10) {
+        if (usec <= bound)
+            break;
+        bucket++;
+    }
+    ATOMIC_ADD(slot->calls, 1);
+    ATOMIC_ADD(slot->usec, usec);
+    ATOMIC_ADD(slot->buckets[bucket], 1);
+}
+
+
+/*
+ * Return the name of one of the standard handlers, or NULL if the handler
+ * isn't one of them.
+ */
+static const char *
+message_stats_default_name(message_handler_func handler)
+{
+    static const struct {
+        message_handler_func handler;
+        const char *name;
+    } names[] = {
+        { message_log_stdout,         "stdout"         },
+        { message_log_stderr,         "stderr"         },
+        { message_log_syslog_debug,   "syslog_debug"   },
+        { message_log_syslog_info,    "syslog_info"    },
+        { message_log_syslog_notice,  "syslog_notice"  },
+        { message_log_syslog_warning, "syslog_warning" },
+        { message_log_syslog_err,     "syslog_err"     },
+        { message_log_syslog_crit,    "syslog_crit"    },
+    };
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(names); i++)
+        if (names[i].handler == handler)
+            return names[i].name;
+    return NULL;
+}
+
+
+/*
+ * Copy the message statistics into the provided struct.
  */
+void
+message_stats_get(struct message_stats *stats)
+{
+    struct message_stats_level *level;
+    struct message_stats_handler *handler;
+    size_t i, j;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < MESSAGE_STATS_LEVELS; i++) {
+        level = &stats->levels[i];
+        level->messages = ATOMIC_LOAD(level_stats[i].messages);
+        level->bytes = ATOMIC_LOAD(level_stats[i].bytes);
+        level->suppressed = ATOMIC_LOAD(level_stats[i].suppressed);
+    }
+    for (i = 0; i < MESSAGE_STATS_HANDLERS; i++) {
+        handler = &stats->handlers[stats->count];
+        handler->handler = ATOMIC_LOAD(handler_stats[i].handler);
+        if (handler->handler == NULL)
+            break;
+        handler->name = ATOMIC_LOAD(handler_stats[i].name);
+        if (handler->name == NULL)
+            handler->name = message_stats_default_name(handler->handler);
+        handler->calls = ATOMIC_LOAD(handler_stats[i].calls);
+        handler->usec = ATOMIC_LOAD(handler_stats[i].usec);
+        for (j = 0; j < MESSAGE_STATS_BUCKETS; j++)
+            handler->buckets[j] = ATOMIC_LOAD(handler_stats[i].buckets[j]);
+        stats->count++;
+    }
+}
+
 
+/*
+ * Enable or disable the per-handler statistics.
+ */
 void
-debug(const char *format, ...)
+message_stats_timing(bool enable)
+{
+    ATOMIC_STORE(stats_timing, enable);
+}
+
+
+/*
+ * Set the name of a handler in the statistics.
+ */
+bool
+message_stats_name(message_handler_func handler, const char *name)
+{
+    struct message_stats_handler *slot;
+
+    slot = message_stats_slot(handler);
+    if (slot == NULL)
+        return false;
+    ATOMIC_STORE(slot->name, name);
+    return true;
+}
+
+
+/*
+ * Reset all statistics.  Not safe to call while other threads are logging.
+ */
+void
+message_stats_reset(void)
+{
+    memset(level_stats, 0, sizeof(level_stats));
+    memset(handler_stats, 0, sizeof(handler_stats));
+}
+
+
+/*
+ * Set the fraction of debug messages to log.  Rates at or above 1 log
+ * everything.
+ */
+void
+message_sample_debug(double rate)
+{
+    uint32_t threshold;
+
+    if (rate >= 1)
+        threshold = UINT32_MAX;
+    else if (rate <= 0)
+        threshold = 0;
+    else
+        threshold = (uint32_t) (rate * 4294967296.0);
+    ATOMIC_STORE(debug_sample, threshold);
+}
+
+
+/*
+ * Decide whether to log a debug message, using a per-thread xorshift
+ * generator, which is plenty random enough for sampling and much cheaper
+ * than anything in libc.  The generator is seeded from the time and the
+ * address of its state, which differs between threads.
+ */
+static bool
+message_sample(void)
+{
+    uint32_t threshold, x;
+
+    threshold = ATOMIC_LOAD(debug_sample);
+    if (threshold == UINT32_MAX)
+        return true;
+    x = sample_state;
+    if (x == 0)
+        x = (uint32_t) time(NULL) ^ (uint32_t) (uintptr_t) &sample_state;
+    if (x == 0)
+        x = 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sample_state = x;
+    return x < threshold;
+}
+
+
+/*
+ * Format the length of a message and pass it to each handler in a list,
+ * updating the statistics.  Handlers each get their own copy of the argument
+ * list.
+ */
+static void
+message_dispatch(message_handler_func *list, int level, const char *format,
+                 va_list args, int error)
 {
-    va_list args;
     message_handler_func *log;
+    va_list args_copy;
     ssize_t length;
+    unsigned long start = 0;
+    bool timing;
 
-    if (debug_handlers == NULL)
-        return;
-    va_start(args, format);
-    length = vsnprintf(NULL, 0, format, args);
-    va_end(args);
+    va_copy(args_copy, args);
+    length = vsnprintf(NULL, 0, format, args_copy);
+    va_end(args_copy);
     if (length < 0)
         return;
-    for (log = debug_handlers; *log != NULL; log++) {
-        va_start(args, format);
-        (**log)((size_t) length, format, args, 0);
-        va_end(args);
+    ATOMIC_ADD(level_stats[level].messages, 1);
+    ATOMIC_ADD(level_stats[level].bytes, (unsigned long) length);
+    timing = ATOMIC_LOAD(stats_timing);
+    for (log = list; *log != NULL; log++) {
+        if (timing)
+            start = message_clock();
+        va_copy(args_copy, args);
+        (**log)((size_t) length, format, args_copy, error);
+        va_end(args_copy);
+        if (timing)
+            message_stats_record(*log, message_clock() - start);
     }
 }
 
+
+/*
+ * All of the message functions.  Each picks the handler list for its level,
+ * with the calling thread's list taking precedence, and dispatches to it.
+ */
+
+void
+debug(const char *format, ...)
+{
+    va_list args;
+    message_handler_func *list;
+
+    list = message_current(debug_handlers, MESSAGE_LEVEL_DEBUG);
+    if (list == NULL)
+        return;
+    if (!message_sample()) {
+        ATOMIC_ADD(level_stats[MESSAGE_LEVEL_DEBUG].suppressed, 1);
+        return;
+    }
+    va_start(args, format);
+    message_dispatch(list, MESSAGE_LEVEL_DEBUG, format, args, 0);
+    va_end(args);
+}
+
 void
 notice(const char *format, ...)
 {
     va_list args;
-    message_handler_func *log;
-    ssize_t length;
+    message_handler_func *list;
 
+    list = message_current(notice_handlers, MESSAGE_LEVEL_NOTICE);
     va_start(args, format);
-    length = vsnprintf(NULL, 0, format, args);
+    message_dispatch(list, MESSAGE_LEVEL_NOTICE, format, args, 0);
     va_end(args);
-    if (length < 0)
-        return;
-    for (log = notice_handlers; *log != NULL; log++) {
-        va_start(args, format);
-        (**log)((size_t) length, format, args, 0);
-        va_end(args);
-    }
 }
 
 void
 sysnotice(const char *format, ...)
 {
     va_list args;
-    message_handler_func *log;
-    ssize_t length;
+    message_handler_func *list;
     int error = errno;
 
+    list = message_current(notice_handlers, MESSAGE_LEVEL_NOTICE);
     va_start(args, format);
-    length = vsnprintf(NULL, 0, format, args);
+    message_dispatch(list, MESSAGE_LEVEL_NOTICE, format, args, error);
     va_end(args);
-    if (length < 0)
-        return;
-    for (log = notice_handlers; *log != NULL; log++) {
-        va_start(args, format);
-        (**log)((size_t) length, format, args, error);
-        va_end(args);
-    }
 }
 
 void
 warn(const char *format, ...)
 {
     va_list args;
-    message_handler_func *log;
-    ssize_t length;
+    message_handler_func *list;
 
+    list = message_current(warn_handlers, MESSAGE_LEVEL_WARN);
     va_start(args, format);
-    length = vsnprintf(NULL, 0, format, args);
+    message_dispatch(list, MESSAGE_LEVEL_WARN, format, args, 0);
     va_end(args);
-    if (length < 0)
-        return;
-    for (log = warn_handlers; *log != NULL; log++) {
-        va_start(args, format);
-        (**log)((size_t) length, format, args, 0);
-        va_end(args);
-    }
 }
 
 void
 syswarn(const char *format, ...)
 {
     va_list args;
-    message_handler_func *log;
-    ssize_t length;
+    message_handler_func *list;
     int error = errno;
 
+    list = message_current(warn_handlers, MESSAGE_LEVEL_WARN);
     va_start(args, format);
-    length = vsnprintf(NULL, 0, format, args);
+    message_dispatch(list, MESSAGE_LEVEL_WARN, format, args, error);
     va_end(args);
-    if (length < 0)
-        return;
-    for (log = warn_handlers; *log != NULL; log++) {
-        va_start(args, format);
-        (**log)((size_t) length, format, args, error);
-        va_end(args);
-    }
 }
 
 void
 die(const char *format, ...)
 {
     va_list args;
-    message_handler_func *log;
-    ssize_t length;
+    message_handler_func *list;
 
+    list = message_current(die_handlers, MESSAGE_LEVEL_DIE);
     va_start(args, format);
-    length = vsnprintf(NULL, 0, format, args);
+    message_dispatch(list, MESSAGE_LEVEL_DIE, format, args, 0);
     va_end(args);
-    if (length >= 0)
-        for (log = die_handlers; *log != NULL; log++) {
-            va_start(args, format);
-            (**log)((size_t) length, format, args, 0);
-            va_end(args);
-        }
     exit(message_fatal_cleanup ? (*message_fatal_cleanup)() : 1);
 }
 
@@ -409,18 +1135,12 @@ void
 sysdie(const char *format, ...)
 {
     va_list args;
-    message_handler_func *log;
-    ssize_t length;
+    message_handler_func *list;
     int error = errno;
 
+    list = message_current(die_handlers, MESSAGE_LEVEL_DIE);
     va_start(args, format);
-    length = vsnprintf(NULL, 0, format, args);
+    message_dispatch(list, MESSAGE_LEVEL_DIE, format, args, error);
     va_end(args);
-    if (length >= 0)
-        for (log = die_handlers; *log != NULL; log++) {
-            va_start(args, format);
-            (**log)((size_t) length, format, args, error);
-            va_end(args);
-        }
     exit(message_fatal_cleanup ? (*message_fatal_cleanup)() : 1);
 }
@@ -32,6 +32,7 @@
 
 #include <config.h>
 #include <portable/macros.h>
+#include <portable/stdbool.h>
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -64,8 +65,12 @@ void sysdie(const char *, ...)
 /*
  * Set the handlers for various message functions.  All of these functions
  * take a count of the number of handlers and then function pointers for each
- * of those handlers.  These functions are not thread-safe; they set global
- * variables.
+ * of those handlers.  Where the compiler supports atomic builtins, these may
+ * be called while other threads are logging: the new list is swapped in
+ * atomically and the old list is kept until message_handlers_reset, so each
+ * message goes to either the old or the new handlers.  Otherwise, they are
+ * not thread-safe.  Lists with the same handlers are shared, so setting the
+ * same handlers again (such as on every reload) doesn't use more memory.
  */
 void message_handlers_debug(unsigned int count, ...);
 void message_handlers_notice(unsigned int count, ...);
@@ -74,10 +79,31 @@ void message_handlers_die(unsigned int count, ...);
 
 /*
  * Reset all message handlers back to the defaults and free any memory that
- * was allocated by the other message_handlers_* functions.
+ * was allocated by the other message_handlers_* functions, including old
+ * handler lists.  No other thread may be logging while this runs.
  */
 void message_handlers_reset(void);
 
+/*
+ * Set handlers for the calling thread only, which override the global
+ * handlers set above in that thread.  This is useful for capturing the
+ * messages from a worker thread or a single request.  These return false and
+ * set errno to ENOSYS if the platform doesn't support thread-local storage.
+ * While any thread has its own handlers, the debug and notice macros always
+ * call the underlying functions, since they can't check the thread's lists.
+ */
+bool message_thread_handlers_debug(unsigned int count, ...);
+bool message_thread_handlers_notice(unsigned int count, ...);
+bool message_thread_handlers_warn(unsigned int count, ...);
+bool message_thread_handlers_die(unsigned int count, ...);
+
+/*
+ * Remove the calling thread's handlers, returning it to the global handlers,
+ * and free them.  Each thread that sets its own handlers should call this
+ * before it exits.
+ */
+void message_thread_handlers_reset(void);
+
 /*
  * Some useful handlers, intended to be passed to message_handlers_*.  All
  * handlers take the length of the formatted message, the format, a variadic
@@ -100,6 +126,18 @@ void message_log_syslog_err(size_t, const char *, va_list, int)
 void message_log_syslog_crit(size_t, const char *, va_list, int)
     __attribute__((__nonnull__));
 
+/*
+ * Send the messages from the syslog handlers directly to the local syslog
+ * daemon as RFC 5424 datagrams over a persistent connection instead of
+ * through syslog(3).  path is the path to the daemon's socket, or NULL for
+ * /dev/log, and facility is the syslog facility (such as LOG_DAEMON).  The
+ * identity is message_program_name.  Returns false and sets errno if the
+ * socket can't be opened, in which case syslog(3) is still used.
+ * message_syslog_close goes back to using syslog(3).
+ */
+bool message_syslog_open(const char *path, int facility);
+void message_syslog_close(void);
+
 /* The type of a message handler. */
 typedef void (*message_handler_func)(size_t, const char *, va_list, int);
 
@@ -112,9 +150,142 @@ extern int (*message_fatal_cleanup)(void);
  */
 extern const char *message_program_name;
 
+/*
+ * The message levels that can be filtered before a message is formatted,
+ * used with MESSAGE_LEVEL_MIN and message_level.  warn and die are always
+ * compiled in.
+ */
+#define MESSAGE_LEVEL_DEBUG  0
+#define MESSAGE_LEVEL_NOTICE 1
+#define MESSAGE_LEVEL_WARN   2
+#define MESSAGE_LEVEL_DIE    3
+
+/*
+ * The lowest message level that has any handlers.  This is maintained by the
+ * message_handlers_* functions and should not be set directly.
+ */
+extern int message_level;
+
+/*
+ * Limits for the message statistics.  Handler latencies are counted in
+ * buckets whose upper bounds are powers of ten microseconds, from 1us for the
+ * first bucket to 100ms for the next to last, and the last bucket counts
+ * everything slower.
+ */
+#define MESSAGE_STATS_LEVELS   4
+#define MESSAGE_STATS_HANDLERS 16
+#define MESSAGE_STATS_BUCKETS  7
+
+/*
+ * Counters for one message level: the number of messages passed to the
+ * handlers, the total length of those messages, and the number of messages
+ * dropped by sampling.
+ */
+struct message_stats_level {
+    unsigned long messages;
+    unsigned long bytes;
+    unsigned long suppressed;
+};
+
+/*
+ * Counters for one handler, collected only if enabled with
+ * message_stats_timing.  name is the name set by message_stats_name, the
+ * name of one of the handlers below, or NULL.  usec is the total time spent
+ * in the handler in microseconds.
+ */
+struct message_stats_handler {
+    message_handler_func handler;
+    const char *name;
+    unsigned long calls;
+    unsigned long usec;
+    unsigned long buckets[MESSAGE_STATS_BUCKETS];
+};
+
+/*
+ * A snapshot of all the message statistics.  levels is indexed by the
+ * MESSAGE_LEVEL_* constants, and the first count elements of handlers are
+ * filled in, in the order in which the handlers were first called.
+ */
+struct message_stats {
+    struct message_stats_level levels[MESSAGE_STATS_LEVELS];
+    size_t count;
+    struct message_stats_handler handlers[MESSAGE_STATS_HANDLERS];
+};
+
+/*
+ * Copy the current message statistics into the provided struct.  Counters
+ * are updated without locking, so a snapshot taken while other threads are
+ * logging may be slightly inconsistent.
+ */
+void message_stats_get(struct message_stats *)
+    __attribute__((__nonnull__));
+
+/*
+ * Enable or disable the per-handler counters and latency histograms, which
+ * cost two calls to gettimeofday per handler per message.  The per-level
+ * counters are always kept.  Disabled by default.
+ */
+void message_stats_timing(bool);
+
+/*
+ * Set the name reported for a handler in the statistics.  The string is not
+ * copied and must remain valid.  Returns false if the table of handlers is
+ * full.
+ */
+bool message_stats_name(message_handler_func, const char *)
+    __attribute__((__nonnull__));
+
+/* Reset all message statistics to zero and forget all handler names. */
+void message_stats_reset(void);
+
+/*
+ * Pass only a random sample of debug messages to the debug handlers.  rate is
+ * the fraction of messages to keep, from 0 (drop everything) to 1 (keep
+ * everything, the default).  Dropped messages aren't formatted and are
+ * counted as suppressed.
+ */
+void message_sample_debug(double rate);
+
 /* Undo default visibility change. */
 #pragma GCC visibility pop
 
 END_DECLS
 
+/*
+ * Where variadic macros are available, debug, notice, and sysnotice are
+ * wrapped in macros that check message_level before evaluating their
+ * arguments, so that disabled debugging costs only a comparison.  The macros
+ * are void expressions like the function calls they replace, and since they
+ * are function-like, the functions can still be named without arguments (to
+ * take their address, for instance).  Define MESSAGE_LEVEL_MIN to
+ * MESSAGE_LEVEL_NOTICE or MESSAGE_LEVEL_WARN before including this header (or
+ * on the compiler command line) to remove lower level calls entirely at
+ * compile time.  Define MESSAGE_NO_LEVEL_MACROS to always call the functions.
+ *
+ * message_level is read with a relaxed atomic load where available, since
+ * other threads may change the handlers, and with them the level, at any
+ * time.
+ */
+#ifndef MESSAGE_LEVEL_MIN
+# define MESSAGE_LEVEL_MIN MESSAGE_LEVEL_DEBUG
+#endif
+#ifdef HAVE_ATOMIC_BUILTINS
+# define MESSAGE_LEVEL_LOAD() __atomic_load_n(&message_level, __ATOMIC_RELAXED)
+#else
+# define MESSAGE_LEVEL_LOAD() (message_level)
+#endif
+#if !defined(MESSAGE_NO_LEVEL_MACROS) \
+    && (__STDC_VERSION__ >= 199901L || defined(__GNUC__))
+# define MESSAGE_LEVEL_CALL(level, function, ...)                       \
+    ((MESSAGE_LEVEL_MIN <= (level) && MESSAGE_LEVEL_LOAD() <= (level))  \
+         ? (function)(__VA_ARGS__)                                      \
+         : (void) 0)
+# define debug(...)     MESSAGE_LEVEL_CALL(MESSAGE_LEVEL_DEBUG, debug,    \
+                                           __VA_ARGS__)
+# define notice(...)    MESSAGE_LEVEL_CALL(MESSAGE_LEVEL_NOTICE, notice,  \
+                                           __VA_ARGS__)
+# define sysnotice(...) MESSAGE_LEVEL_CALL(MESSAGE_LEVEL_NOTICE,          \
+                                           sysnotice, __VA_ARGS__)
+#endif
+
 #endif /* UTIL_MESSAGES_H */
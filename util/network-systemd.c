@@ -0,0 +1,72 @@
+/*
+ * Network socket creation with systemd socket activation.
+ *
+ * Provides network_bind_all_activated, which adopts the listening sockets
+ * passed in by systemd before binding any others.  This is kept separate
+ * from the rest of the network utility functions so that only programs that
+ * use socket activation need to link with the systemd daemon library.
+ *
+ * The canonical version of this file is maintained in the rra-c-util package,
+ * which can be found at <http://www.eyrie.org/~eagle/software/rra-c-util/>.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ *
+ * The authors hereby relinquish any claim to any copyright that they may have
+ * in this work, whether granted under contract or by operation of law or
+ * international treaty, and hereby commit to the public, at large, that they
+ * shall not, at any time in the future, seek to enforce any copyright in this
+ * work against any person or entity, or prevent any person or entity from
+ * copying, publishing, distributing or creating derivative works of this
+ * work.
+ */
+
+#include <config.h>
+#include <portable/system.h>
+#include <portable/sd-daemon.h>
+#include <portable/socket.h>
+
+#include <util/messages.h>
+#include <util/network.h>
+#include <util/xmalloc.h>
+
+
+/*
+ * Create and bind sockets for every local address, first adopting any
+ * matching sockets passed to us via systemd socket activation.  Pass 0 to
+ * sd_listen_fds so that the environment variables are left alone, allowing
+ * this to be called again for a different socket type.  Without systemd
+ * support, there are never any inherited sockets.
+ */
+#ifdef HAVE_SD_NOTIFY
+
+bool
+network_bind_all_activated(int type, unsigned short port, socket_type **fds,
+                           unsigned int *count)
+{
+    socket_type *inherited;
+    int n, i;
+    bool status;
+
+    n = sd_listen_fds(0);
+    if (n < 0)
+        warn("cannot get sockets from systemd: %s", strerror(-n));
+    if (n <= 0)
+        return network_bind_all(type, port, fds, count);
+    inherited = xcalloc(n, sizeof(socket_type));
+    for (i = 0; i < n; i++)
+        inherited[i] = SD_LISTEN_FDS_START + i;
+    status = network_bind_all_inherited(type, port, inherited, n, fds, count);
+    free(inherited);
+    return status;
+}
+
+#else /* !HAVE_SD_NOTIFY */
+
+bool
+network_bind_all_activated(int type, unsigned short port, socket_type **fds,
+                           unsigned int *count)
+{
+    return network_bind_all(type, port, fds, count);
+}
+
+#endif /* !HAVE_SD_NOTIFY */
@@ -47,8 +47,15 @@
 #include <config.h>
 #include <portable/system.h>
 #include <portable/socket.h>
+#include <portable/uio.h>
 
 #include <errno.h>
+#ifdef HAVE_NETINET_TCP_H
+# include <netinet/tcp.h>
+#endif
+#ifdef HAVE_NETINET_UDP_H
+# include <netinet/udp.h>
+#endif
 #ifdef HAVE_SYS_SELECT_H
 # include <sys/select.h>
 #endif
@@ -57,6 +64,7 @@
 #endif
 #include <time.h>
 
+#include <util/buffer.h>
 #include <util/fdflag.h>
 #include <util/macros.h>
 #include <util/messages.h>
@@ -88,6 +96,83 @@
 # define network_set_freebind(fd)       /* empty */
 #endif
 
+/*
+ * Socket options used by network_options_set that may not be available, under
+ * local names so that we don't define the reserved system names.  Setting an
+ * option that is defined to -1 fails with ENOPROTOOPT.
+ */
+#ifdef TCP_NODELAY
+# define NETWORK_TCP_NODELAY            TCP_NODELAY
+#else
+# define NETWORK_TCP_NODELAY            -1
+#endif
+#ifdef TCP_QUICKACK
+# define NETWORK_TCP_QUICKACK           TCP_QUICKACK
+#else
+# define NETWORK_TCP_QUICKACK           -1
+#endif
+#ifdef TCP_FASTOPEN
+# define NETWORK_TCP_FASTOPEN           TCP_FASTOPEN
+#else
+# define NETWORK_TCP_FASTOPEN           -1
+#endif
+#ifdef TCP_FASTOPEN_CONNECT
+# define NETWORK_TCP_FASTOPEN_CONNECT   TCP_FASTOPEN_CONNECT
+#else
+# define NETWORK_TCP_FASTOPEN_CONNECT   -1
+#endif
+#ifdef SO_BUSY_POLL
+# define NETWORK_SO_BUSY_POLL           SO_BUSY_POLL
+#else
+# define NETWORK_SO_BUSY_POLL           -1
+#endif
+
+/*
+ * Whether a socket error means that an operation on a nonblocking socket
+ * would block.  Some platforms use EWOULDBLOCK, which may differ from EAGAIN,
+ * and Windows uses WSAEWOULDBLOCK.
+ */
+#if defined(_WIN32)
+# define network_would_block(e)         ((e) == WSAEWOULDBLOCK)
+#elif defined(EWOULDBLOCK) && EWOULDBLOCK != EAGAIN
+# define network_would_block(e)         ((e) == EAGAIN || (e) == EWOULDBLOCK)
+#else
+# define network_would_block(e)         ((e) == EAGAIN)
+#endif
+
+/*
+ * The maximum number of datagrams handed to the kernel in one system call by
+ * the batched datagram functions.  Larger requests are split into chunks.
+ */
+#define DATAGRAM_BATCH 64
+
+/*
+ * Use the kernel's struct mmsghdr for the batched datagram functions if
+ * either recvmmsg or sendmmsg is available.  Otherwise, define an equivalent
+ * struct so that the fallback code can use the same layout.  Windows has
+ * neither recvmsg nor sendmsg, so the batched datagram functions aren't
+ * supported there.
+ */
+#ifndef _WIN32
+# if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+#  define datagram_msg mmsghdr
+# else
+struct datagram_msg {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+# endif
+
+/*
+ * Ancillary data space for one datagram, used to carry the segment size for
+ * UDP segmentation offload.  The union ensures proper cmsghdr alignment.
+ */
+union datagram_control {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+};
+#endif /* !_WIN32 */
+
 /*
  * Windows requires a different function when sending to sockets, but can't
  * return short writes on blocking sockets.
@@ -147,12 +232,87 @@ network_set_freebind(socket_type fd)
 #endif
 
 
+/*
+ * Set an integer socket option, returning true on success and false on
+ * failure with the socket errno set.  Options that aren't available on this
+ * platform are defined to -1 above and fail with ENOPROTOOPT.
+ */
+static bool
+network_setsockopt(socket_type fd, int level, int option, int value)
+{
+    const void *valueaddr = &value;
+
+    if (option < 0) {
+        socket_set_errno(ENOPROTOOPT);
+        return false;
+    }
+    return setsockopt(fd, level, option, valueaddr, sizeof(value)) == 0;
+}
+
+
+/*
+ * Apply a socket options profile to a newly created socket of the given type
+ * before it is bound or connected.  client says whether the socket will be
+ * used to connect, which changes the meaning of fastopen.  Every requested
+ * option is attempted even if an earlier one fails.  Returns true if all
+ * succeeded and false otherwise, with the socket errno normally left from
+ * the last failure.
+ *
+ * TCP_QUICKACK is only set here and is not re-armed after reads, so it only
+ * affects acknowledgements until the kernel next leaves quickack mode.
+ */
+static bool
+network_options_set(socket_type fd, int type,
+                    const struct network_options *options, bool client)
+{
+    bool okay = true;
+    int level = SOL_SOCKET;
+
+    if (options == NULL)
+        return true;
+    if (options->sndbuf > 0)
+        okay &= network_setsockopt(fd, level, SO_SNDBUF, options->sndbuf);
+    if (options->rcvbuf > 0)
+        okay &= network_setsockopt(fd, level, SO_RCVBUF, options->rcvbuf);
+    if (options->busy_poll > 0)
+        okay &= network_setsockopt(fd, level, NETWORK_SO_BUSY_POLL,
+                                   options->busy_poll);
+    if (type != SOCK_STREAM)
+        return okay;
+    level = IPPROTO_TCP;
+    if (options->nodelay)
+        okay &= network_setsockopt(fd, level, NETWORK_TCP_NODELAY, 1);
+    if (options->quickack)
+        okay &= network_setsockopt(fd, level, NETWORK_TCP_QUICKACK, 1);
+    if (options->fastopen > 0 && client)
+        okay &= network_setsockopt(fd, level, NETWORK_TCP_FASTOPEN_CONNECT,
+                                   1);
+    else if (options->fastopen > 0)
+        okay &= network_setsockopt(fd, level, NETWORK_TCP_FASTOPEN,
+                                   options->fastopen);
+    return okay;
+}
+
+
 /*
  * Create an IPv4 socket and bind it, returning the resulting file descriptor
  * (or INVALID_SOCKET on a failure).
  */
 socket_type
 network_bind_ipv4(int type, const char *address, unsigned short port)
+{
+    return network_bind_ipv4_options(type, address, port, NULL);
+}
+
+
+/*
+ * Create an IPv4 socket, apply the socket options profile, and bind it,
+ * returning the resulting file descriptor (or INVALID_SOCKET on a failure).
+ * Failure to set options is reported but not fatal.
+ */
+socket_type
+network_bind_ipv4_options(int type, const char *address, unsigned short port,
+                          const struct network_options *options)
 {
     socket_type fd;
     struct sockaddr_in server;
@@ -165,6 +325,8 @@ network_bind_ipv4(int type, const char *address, unsigned short port)
         return INVALID_SOCKET;
     }
     network_set_reuseaddr(fd);
+    if (!network_options_set(fd, type, options, false))
+        syswarn("cannot set socket options for %s, port %hu", address, port);
 
     /* Accept "any" or "all" in the bind address to mean 0.0.0.0. */
     if (!strcmp(address, "any") || !strcmp(address, "all"))
@@ -201,10 +363,22 @@ network_bind_ipv4(int type, const char *address, unsigned short port)
  * systems like many Linux hosts where IPv6 is available in userland but the
  * kernel doesn't support it.
  */
+socket_type
+network_bind_ipv6(int type, const char *address, unsigned short port)
+{
+    return network_bind_ipv6_options(type, address, port, NULL);
+}
+
+
+/*
+ * Like network_bind_ipv6, but applies a socket options profile to the socket
+ * before binding it.  Failure to set options is reported but not fatal.
+ */
 #if HAVE_INET6
 
 socket_type
-network_bind_ipv6(int type, const char *address, unsigned short port)
+network_bind_ipv6_options(int type, const char *address, unsigned short port,
+                          const struct network_options *options)
 {
     socket_type fd;
     struct sockaddr_in6 server;
@@ -219,6 +393,8 @@ network_bind_ipv6(int type, const char *address, unsigned short port)
         return INVALID_SOCKET;
     }
     network_set_reuseaddr(fd);
+    if (!network_options_set(fd, type, options, false))
+        syswarn("cannot set socket options for %s, port %hu", address, port);
 
     /*
      * Restrict the socket to IPv6 only if possible.  The default behavior is
@@ -270,7 +446,9 @@ network_bind_ipv6(int type, const char *address, unsigned short port)
 #else /* HAVE_INET6 */
 
 socket_type
-network_bind_ipv6(int type UNUSED, const char *address, unsigned short port)
+network_bind_ipv6_options(int type UNUSED, const char *address,
+                          unsigned short port,
+                          const struct network_options *options UNUSED)
 {
     warn("cannot bind %s, port %hu: IPv6 not supported", address, port);
     socket_set_errno(EPROTONOSUPPORT);
@@ -280,52 +458,205 @@ network_bind_ipv6(int type UNUSED, const char *address, unsigned short port)
 #endif /* HAVE_INET6 */
 
 
+/*
+ * Returns true if the address in a sockaddr is the wildcard address for its
+ * family.
+ */
+static bool
+network_sockaddr_any(const struct sockaddr *sa)
+{
+    const struct sockaddr_in *sin;
+#ifdef HAVE_INET6
+    const struct sockaddr_in6 *sin6;
+
+    if (sa->sa_family == AF_INET6) {
+        sin6 = (const struct sockaddr_in6 *) (const void *) sa;
+        return IN6_IS_ADDR_UNSPECIFIED(&sin6->sin6_addr);
+    }
+#endif
+    if (sa->sa_family != AF_INET)
+        return false;
+    sin = (const struct sockaddr_in *) (const void *) sa;
+    return (sin->sin_addr.s_addr == htonl(INADDR_ANY));
+}
+
+
+/*
+ * Check whether an inherited socket is of the given type and bound to the
+ * given port on an IPv4 or IPv6 address.  If so, store the address to which
+ * it's bound in the provided sockaddr_storage and return true.
+ */
+static bool
+network_inherited_match(socket_type fd, int type, unsigned short port,
+                        struct sockaddr_storage *addr)
+{
+    int fdtype;
+    socklen_t length;
+
+    length = sizeof(fdtype);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, (void *) &fdtype, &length) < 0)
+        return false;
+    if (fdtype != type)
+        return false;
+    length = sizeof(*addr);
+    if (getsockname(fd, (struct sockaddr *) addr, &length) < 0)
+        return false;
+    if (addr->ss_family != AF_INET && addr->ss_family != AF_INET6)
+        return false;
+    return (network_sockaddr_port((struct sockaddr *) addr) == port);
+}
+
+
+/*
+ * Check whether an inherited socket fd, bound to the address bound, already
+ * receives traffic for the local address wanted, so that there's no need to
+ * bind a new socket for wanted.  A wildcard bind covers every address of the
+ * same family, and an IPv6 wildcard bind without IPV6_V6ONLY (the systemd
+ * default) covers IPv4 as well.  Conversely, if wanted is the wildcard
+ * address, any inherited socket of the same family covers it, since the
+ * administrator chose specific addresses and binding the wildcard address
+ * would conflict with them.
+ */
+static bool
+network_inherited_covers(socket_type fd UNUSED, const struct sockaddr *bound,
+                         const struct sockaddr *wanted)
+{
+    if (bound->sa_family == wanted->sa_family) {
+        if (network_sockaddr_any(bound) || network_sockaddr_any(wanted))
+            return true;
+        return network_sockaddr_equal(bound, wanted);
+    }
+#if defined(HAVE_INET6) && defined(IPV6_V6ONLY)
+    if (bound->sa_family == AF_INET6 && wanted->sa_family == AF_INET) {
+        int flag;
+        socklen_t length = sizeof(flag);
+
+        if (!network_sockaddr_any(bound))
+            return false;
+        if (getsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, (void *) &flag,
+                       &length) < 0)
+            return false;
+        return (flag == 0);
+    }
+#endif
+    return false;
+}
+
+
+/*
+ * Adopt the sockets from an array of inherited sockets that match the given
+ * type and port, storing them in fds and their bound addresses in bound (both
+ * of which must have room for ninherited entries).  Returns the number of
+ * sockets adopted.
+ */
+static unsigned int
+network_inherited_adopt(int type, unsigned short port,
+                        const socket_type inherited[], unsigned int ninherited,
+                        socket_type *fds, struct sockaddr_storage *bound)
+{
+    unsigned int i, count;
+
+    for (count = 0, i = 0; i < ninherited; i++)
+        if (network_inherited_match(inherited[i], type, port, &bound[count]))
+            fds[count++] = inherited[i];
+    return count;
+}
+
+
+/*
+ * Returns true if any of the adopted sockets covers the given local address.
+ */
+static bool
+network_inherited_covered(const socket_type fds[],
+                          const struct sockaddr_storage bound[],
+                          unsigned int count, const struct sockaddr *wanted)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+        if (network_inherited_covers(fds[i], (const void *) &bound[i],
+                                     wanted))
+            return true;
+    return false;
+}
+
+
 /*
  * Create and bind sockets for every local address, as determined by
  * getaddrinfo if IPv6 is available (otherwise, just use the IPv4 loopback
- * address).  Takes the socket type and port number, and then a pointer to an
- * array of integers and a pointer to a count of them.  Allocates a new array
- * to hold the file descriptors and stores the count in the fourth argument.
+ * address).  Takes the socket type and port number, an array of inherited
+ * sockets and its length, and then a pointer to an array of integers and a
+ * pointer to a count of them.  Inherited sockets that match the type and port
+ * are adopted first, and then only the addresses they don't cover are bound.
+ * Allocates a new array to hold the file descriptors and stores the count in
+ * the last argument.  Returns false only if no socket could be adopted or
+ * bound, so a failure to find the local addresses isn't fatal if there were
+ * suitable inherited sockets.
  */
 #if HAVE_INET6
 
 bool
-network_bind_all(int type, unsigned short port, socket_type **fds,
-                 unsigned int *count)
+network_bind_all_inherited(int type, unsigned short port,
+                           const socket_type inherited[],
+                           unsigned int ninherited, socket_type **fds,
+                           unsigned int *count)
 {
     struct addrinfo hints, *addrs, *addr;
-    unsigned int size;
+    struct sockaddr_storage *bound;
+    unsigned int size, adopted;
     int status;
     socket_type fd;
     char service[16], name[INET6_ADDRSTRLEN];
 
     *count = 0;
-
-    /* Do the query to find all the available addresses. */
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG;
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = type;
     status = snprintf(service, sizeof(service), "%hu", port);
     if (status < 0 || (size_t) status > sizeof(service)) {
         warn("cannot convert port %hu to string", port);
         socket_set_errno_einval();
         return false;
     }
+
+    /*
+     * Adopt any matching inherited sockets first, so that they're used even
+     * if the local addresses can't be determined.  Start the fds array with
+     * room for the inherited sockets plus two entries, assuming an IPv6 and
+     * IPv4 socket, and grow it by two when necessary.
+     */
+    size = ninherited + 2;
+    *fds = xcalloc(size, sizeof(socket_type));
+    bound = NULL;
+    adopted = 0;
+    if (ninherited > 0) {
+        bound = xcalloc(ninherited, sizeof(struct sockaddr_storage));
+        adopted = network_inherited_adopt(type, port, inherited, ninherited,
+                                          *fds, bound);
+        *count = adopted;
+    }
+
+    /*
+     * Do the query to find all the available addresses.  If it fails, make
+     * do with the inherited sockets if there are any.
+     */
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = type;
     status = getaddrinfo(NULL, service, &hints, &addrs);
-    if (status < 0) {
+    if (status != 0) {
         warn("getaddrinfo for %s failed: %s", service, gai_strerror(status));
+        free(bound);
+        if (adopted > 0)
+            return true;
+        free(*fds);
+        *fds = NULL;
         socket_set_errno_einval();
         return false;
     }
 
-    /*
-     * Now, try to bind each of them.  Start the fds array at two entries,
-     * assuming an IPv6 and IPv4 socket, and grow it by two when necessary.
-     */
-    size = 2;
-    *fds = xcalloc(size, sizeof(socket_type));
+    /* Try to bind each of the addresses the inherited sockets don't cover. */
     for (addr = addrs; addr != NULL; addr = addr->ai_next) {
+        if (network_inherited_covered(*fds, bound, adopted, addr->ai_addr))
+            continue;
         network_sockaddr_sprint(name, sizeof(name), addr->ai_addr);
         if (addr->ai_family == AF_INET)
             fd = network_bind_ipv4(type, name, port);
@@ -342,6 +673,7 @@ network_bind_all(int type, unsigned short port, socket_type **fds,
             (*count)++;
         }
     }
+    free(bound);
     freeaddrinfo(addrs);
     return (*count > 0);
 }
@@ -349,26 +681,60 @@ network_bind_all(int type, unsigned short port, socket_type **fds,
 #else /* HAVE_INET6 */
 
 bool
-network_bind_all(int type, unsigned short port, socket_type **fds,
-                 unsigned int *count)
+network_bind_all_inherited(int type, unsigned short port,
+                           const socket_type inherited[],
+                           unsigned int ninherited, socket_type **fds,
+                           unsigned int *count)
 {
+    struct sockaddr_storage *bound;
+    struct sockaddr_in any;
     socket_type fd;
 
-    fd = network_bind_ipv4(type, "0.0.0.0", port);
-    if (fd == INVALID_SOCKET) {
+    *fds = xcalloc(ninherited + 1, sizeof(socket_type));
+    bound = NULL;
+    *count = 0;
+    if (ninherited > 0) {
+        bound = xcalloc(ninherited, sizeof(struct sockaddr_storage));
+        *count = network_inherited_adopt(type, port, inherited, ninherited,
+                                         *fds, bound);
+    }
+
+    /* Bind the IPv4 wildcard address unless an inherited socket covers it. */
+    memset(&any, 0, sizeof(any));
+    any.sin_family = AF_INET;
+    any.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (!network_inherited_covered(*fds, bound, *count,
+                                   (struct sockaddr *) &any)) {
+        fd = network_bind_ipv4(type, "0.0.0.0", port);
+        if (fd != INVALID_SOCKET) {
+            (*fds)[*count] = fd;
+            (*count)++;
+        }
+    }
+    free(bound);
+    if (*count == 0) {
+        free(*fds);
         *fds = NULL;
-        *count = 0;
         return false;
     }
-    *fds = xmalloc(sizeof(socket_type));
-    *fds[0] = fd;
-    *count = 1;
     return true;
 }
 
 #endif /* HAVE_INET6 */
 
 
+/*
+ * Create and bind sockets for every local address.  This is the same as
+ * network_bind_all_inherited without any inherited sockets.
+ */
+bool
+network_bind_all(int type, unsigned short port, socket_type **fds,
+                 unsigned int *count)
+{
+    return network_bind_all_inherited(type, port, NULL, 0, fds, count);
+}
+
+
 /*
  * Free the array of file descriptors allocated by network_bind_all.  This is
  * a simple wrapper around free, needed on platforms where libraries allocate
@@ -559,6 +925,19 @@ connect_wait(socket_type fd, time_t timeout)
  */
 socket_type
 network_connect(const struct addrinfo *ai, const char *source, time_t timeout)
+{
+    return network_connect_options(ai, source, timeout, NULL);
+}
+
+
+/*
+ * Like network_connect, but applies a socket options profile to each socket
+ * before connecting it.  The options are tuning hints, so failure to set
+ * them is ignored.
+ */
+socket_type
+network_connect_options(const struct addrinfo *ai, const char *source,
+                        time_t timeout, const struct network_options *options)
 {
     socket_type fd = INVALID_SOCKET;
     int oerrno, status;
@@ -569,6 +948,7 @@ network_connect(const struct addrinfo *ai, const char *source, time_t timeout)
         fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
         if (fd == INVALID_SOCKET)
             continue;
+        network_options_set(fd, ai->ai_socktype, options, true);
         if (!network_source(fd, ai->ai_family, source))
             continue;
         if (timeout == 0)
@@ -640,6 +1020,19 @@ network_connect_host(const char *host, unsigned short port,
  */
 socket_type
 network_client_create(int domain, int type, const char *source)
+{
+    return network_client_create_options(domain, type, source, NULL);
+}
+
+
+/*
+ * Like network_client_create, but applies a socket options profile to the
+ * socket before binding it.  As with network_connect_options, failure to set
+ * the options is ignored.
+ */
+socket_type
+network_client_create_options(int domain, int type, const char *source,
+                              const struct network_options *options)
 {
     socket_type fd;
     int oerrno;
@@ -647,6 +1040,7 @@ network_client_create(int domain, int type, const char *source)
     fd = socket(domain, type, 0);
     if (fd == INVALID_SOCKET)
         return INVALID_SOCKET;
+    network_options_set(fd, type, options, true);
     if (!network_source(fd, domain, source)) {
         oerrno = socket_errno;
         socket_close(fd);
@@ -679,7 +1073,7 @@ socket_xread(socket_type fd, void *buffer, size_t size)
         else if (status == 0)
             break;
         else {
-            if ((socket_errno != EINTR) && (socket_errno != EAGAIN))
+            if (socket_errno != EINTR && !network_would_block(socket_errno))
                 break;
             status = 0;
         }
@@ -820,6 +1214,420 @@ fail:
 }
 
 
+/*
+ * Make room in a buffer for at least the given number of additional bytes of
+ * data after the unused data, compacting the buffer first if that would
+ * avoid growing it.
+ */
+static void
+network_buffer_space(struct buffer *buffer, size_t needed)
+{
+    size_t end;
+
+    end = buffer->used + buffer->left;
+    if (buffer->size - end >= needed)
+        return;
+    if (buffer->used > 0 && buffer->size - buffer->left >= needed) {
+        buffer_compact(buffer);
+        return;
+    }
+    buffer_resize(buffer, buffer->used + buffer->left + needed);
+}
+
+
+/*
+ * Read from a nonblocking socket into a buffer until it holds at least total
+ * bytes of unused data or the read would block.  If total is 0, read until
+ * the read would block into whatever space the buffer has free, compacting it
+ * if needed and doubling it only when it's full, so that a caller that
+ * leaves some data unconsumed between reads doesn't grow the buffer on each
+ * call.  Returns
+ * NETWORK_IO_DONE, NETWORK_IO_AGAIN, NETWORK_IO_EOF, or NETWORK_IO_ERROR (with
+ * the socket errno set).  Whatever data was read before the socket would
+ * block or the peer closed the connection is left in the buffer.
+ */
+enum network_io
+network_read_buffer(socket_type fd, struct buffer *buffer, size_t total)
+{
+    size_t end;
+    ssize_t status;
+
+    while (total == 0 || buffer->left < total) {
+        end = buffer->used + buffer->left;
+        if (total > 0)
+            network_buffer_space(buffer, total - buffer->left);
+        else if (buffer->size == 0)
+            network_buffer_space(buffer, 1024);
+        else if (buffer->left == buffer->size)
+            network_buffer_space(buffer, buffer->size);
+        else if (end == buffer->size)
+            buffer_compact(buffer);
+        end = buffer->used + buffer->left;
+        status = socket_read(fd, buffer->data + end, buffer->size - end);
+        if (status > 0)
+            buffer->left += status;
+        else if (status == 0)
+            return NETWORK_IO_EOF;
+        else if (socket_errno == EINTR)
+            continue;
+        else if (network_would_block(socket_errno))
+            return NETWORK_IO_AGAIN;
+        else
+            return NETWORK_IO_ERROR;
+    }
+    return NETWORK_IO_DONE;
+}
+
+
+/*
+ * Write the unused data in a buffer to a nonblocking socket, consuming it as
+ * it is written, until the buffer is empty or the write would block.
+ * Returns NETWORK_IO_DONE, NETWORK_IO_AGAIN, or NETWORK_IO_ERROR (with the
+ * socket errno set).
+ */
+enum network_io
+network_write_buffer(socket_type fd, struct buffer *buffer)
+{
+    ssize_t status;
+
+    while (buffer->left > 0) {
+        status = socket_write(fd, buffer->data + buffer->used, buffer->left);
+        if (status > 0) {
+            buffer->used += status;
+            buffer->left -= status;
+        } else if (status < 0 && socket_errno == EINTR)
+            continue;
+        else if (status < 0 && network_would_block(socket_errno))
+            return NETWORK_IO_AGAIN;
+        else
+            return NETWORK_IO_ERROR;
+    }
+    buffer->used = 0;
+    return NETWORK_IO_DONE;
+}
+
+
+#ifdef _WIN32
+
+/*
+ * The batched datagram functions are built on recvmsg and sendmsg, which
+ * Windows doesn't provide.
+ */
+ssize_t
+network_datagram_recv(socket_type fd UNUSED,
+                      struct network_datagram *dgrams UNUSED,
+                      size_t count UNUSED, time_t timeout UNUSED)
+{
+    socket_set_errno(WSAEOPNOTSUPP);
+    return -1;
+}
+
+ssize_t
+network_datagram_send(socket_type fd UNUSED,
+                      const struct network_datagram *dgrams UNUSED,
+                      size_t count UNUSED, time_t timeout UNUSED)
+{
+    socket_set_errno(WSAEOPNOTSUPP);
+    return 0;
+}
+
+#else /* !_WIN32 */
+
+/*
+ * Wait for a socket to become ready for reading or writing, giving up at the
+ * provided deadline (an absolute time, or 0 to wait forever).  Returns true
+ * if the socket is ready and false on timeout or error, setting the socket
+ * errno.  The wait is restarted if interrupted by a signal.
+ */
+static bool
+datagram_wait(socket_type fd, bool writing, time_t deadline)
+{
+    fd_set set;
+    struct timeval tv, *tvp;
+    time_t now;
+    int status;
+
+    do {
+        FD_ZERO(&set);
+        FD_SET(fd, &set);
+        tvp = NULL;
+        if (deadline != 0) {
+            now = time(NULL);
+            if (now >= deadline) {
+                socket_set_errno(ETIMEDOUT);
+                return false;
+            }
+            tv.tv_sec = deadline - now;
+            tv.tv_usec = 0;
+            tvp = &tv;
+        }
+        if (writing)
+            status = select(fd + 1, NULL, &set, NULL, tvp);
+        else
+            status = select(fd + 1, &set, NULL, NULL, tvp);
+    } while (status < 0 && socket_errno == EINTR);
+    if (status == 0)
+        socket_set_errno(ETIMEDOUT);
+    return (status > 0);
+}
+
+
+/*
+ * Fill out a msghdr for a single datagram.  For sending, the segment size is
+ * attached as ancillary data if set; for receiving, space is provided for the
+ * kernel to report one.  Returns false, setting the socket errno to EINVAL, if
+ * the datagram asks for segmentation offload and the platform doesn't support
+ * it or the segment size doesn't fit in the 16 bits the kernel accepts.
+ */
+static bool
+datagram_prepare(struct msghdr *msg, struct iovec *iov,
+                 union datagram_control *control,
+                 const struct network_datagram *dgram, bool sending)
+{
+    memset(msg, 0, sizeof(*msg));
+    iov->iov_base = dgram->data;
+    iov->iov_len = sending ? dgram->length : dgram->size;
+    msg->msg_iov = iov;
+    msg->msg_iovlen = 1;
+    if (!sending || dgram->addrlen > 0) {
+        msg->msg_name = (void *) &dgram->addr;
+        msg->msg_namelen = sending ? dgram->addrlen : sizeof(dgram->addr);
+    }
+    if (!sending) {
+        msg->msg_control = control->buf;
+        msg->msg_controllen = sizeof(control->buf);
+    } else if (dgram->segment > 0) {
+#if defined(UDP_GRO) && defined(UDP_SEGMENT)
+        struct cmsghdr *cmsg;
+        uint16_t segment;
+
+        if (dgram->segment > UINT16_MAX) {
+            socket_set_errno_einval();
+            return false;
+        }
+        segment = (uint16_t) dgram->segment;
+        memset(control, 0, sizeof(*control));
+        msg->msg_control = control->buf;
+        msg->msg_controllen = CMSG_SPACE(sizeof(segment));
+        cmsg = CMSG_FIRSTHDR(msg);
+        cmsg->cmsg_level = IPPROTO_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(segment));
+        memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+#else
+        socket_set_errno_einval();
+        return false;
+#endif
+    }
+    return true;
+}
+
+
+/*
+ * Copy the results of receiving a datagram from its msghdr back into the
+ * caller's struct, including the segment size if the kernel coalesced
+ * several datagrams.
+ */
+static void
+datagram_finish(struct msghdr *msg, size_t length,
+                struct network_datagram *dgram)
+{
+    dgram->length = length;
+    dgram->addrlen = msg->msg_namelen;
+    dgram->segment = 0;
+#if defined(UDP_GRO) && defined(UDP_SEGMENT)
+    {
+        struct cmsghdr *cmsg;
+        int segment;
+
+        for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(msg, cmsg)) {
+            if (cmsg->cmsg_level != IPPROTO_UDP)
+                continue;
+            if (cmsg->cmsg_type != UDP_GRO)
+                continue;
+            memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+            if (segment > 0)
+                dgram->segment = segment;
+        }
+    }
+#endif
+}
+
+
+/*
+ * Receive up to count datagrams without blocking, using recvmmsg if
+ * available and a loop over recvmsg otherwise.  Returns the number of
+ * datagrams received or -1 on error, with the same semantics as recvmmsg.
+ */
+static int
+datagram_recv_some(socket_type fd, struct datagram_msg *msgs,
+                   unsigned int count)
+{
+#ifdef HAVE_RECVMMSG
+    return recvmmsg(fd, msgs, count, MSG_DONTWAIT, NULL);
+#else
+    unsigned int i;
+    ssize_t status;
+
+    for (i = 0; i < count; i++) {
+        status = recvmsg(fd, &msgs[i].msg_hdr, MSG_DONTWAIT);
+        if (status < 0)
+            return (i > 0) ? (int) i : -1;
+        msgs[i].msg_len = status;
+    }
+    return count;
+#endif
+}
+
+
+/*
+ * Send up to count datagrams without blocking, using sendmmsg if available
+ * and a loop over sendmsg otherwise.  Returns the number of datagrams sent or
+ * -1 on error, with the same semantics as sendmmsg.
+ */
+static int
+datagram_send_some(socket_type fd, struct datagram_msg *msgs,
+                   unsigned int count)
+{
+#ifdef HAVE_SENDMMSG
+    return sendmmsg(fd, msgs, count, MSG_DONTWAIT);
+#else
+    unsigned int i;
+    ssize_t status;
+
+    for (i = 0; i < count; i++) {
+        status = sendmsg(fd, &msgs[i].msg_hdr, MSG_DONTWAIT);
+        if (status < 0)
+            return (i > 0) ? (int) i : -1;
+        msgs[i].msg_len = status;
+    }
+    return count;
+#endif
+}
+
+
+/*
+ * Receive a batch of datagrams, enforcing a timeout (in seconds) on the wait
+ * for the first one.  timeout may be 0 to never time out.  Once at least one
+ * datagram has arrived, receive as many more as are available without
+ * waiting, up to count.  Returns the number of datagrams received, or -1 on
+ * failure with the socket errno set.  An error after some datagrams have
+ * already been received ends the batch early but is not reported.
+ */
+ssize_t
+network_datagram_recv(socket_type fd, struct network_datagram *dgrams,
+                      size_t count, time_t timeout)
+{
+    struct datagram_msg msgs[DATAGRAM_BATCH];
+    struct iovec iov[DATAGRAM_BATCH];
+    union datagram_control control[DATAGRAM_BATCH];
+    size_t got = 0;
+    unsigned int i, n;
+    time_t deadline;
+    int status;
+
+    deadline = (timeout == 0) ? 0 : time(NULL) + timeout;
+    while (got < count) {
+        n = (count - got > DATAGRAM_BATCH) ? DATAGRAM_BATCH : count - got;
+        for (i = 0; i < n; i++)
+            datagram_prepare(&msgs[i].msg_hdr, &iov[i], &control[i],
+                             &dgrams[got + i], false);
+        status = datagram_recv_some(fd, msgs, n);
+        if (status < 0) {
+            if (socket_errno == EINTR)
+                continue;
+            if (got > 0)
+                break;
+            if (!network_would_block(socket_errno))
+                return -1;
+            if (!datagram_wait(fd, false, deadline))
+                return -1;
+            continue;
+        }
+        for (i = 0; i < (unsigned int) status; i++)
+            datagram_finish(&msgs[i].msg_hdr, msgs[i].msg_len,
+                            &dgrams[got + i]);
+        got += status;
+        if ((unsigned int) status < n)
+            break;
+    }
+    return got;
+}
+
+
+/*
+ * Send a batch of datagrams, enforcing a timeout (in seconds) on the whole
+ * batch.  timeout may be 0 to never time out.  Returns the number of
+ * datagrams sent, which will be less than count only on failure, in which
+ * case the socket errno is set.
+ */
+ssize_t
+network_datagram_send(socket_type fd, const struct network_datagram *dgrams,
+                      size_t count, time_t timeout)
+{
+    struct datagram_msg msgs[DATAGRAM_BATCH];
+    struct iovec iov[DATAGRAM_BATCH];
+    union datagram_control control[DATAGRAM_BATCH];
+    size_t sent = 0;
+    unsigned int i, n;
+    time_t deadline;
+    int status;
+
+    deadline = (timeout == 0) ? 0 : time(NULL) + timeout;
+    while (sent < count) {
+        n = (count - sent > DATAGRAM_BATCH) ? DATAGRAM_BATCH : count - sent;
+        for (i = 0; i < n; i++)
+            if (!datagram_prepare(&msgs[i].msg_hdr, &iov[i], &control[i],
+                                  &dgrams[sent + i], true))
+                return sent;
+        status = datagram_send_some(fd, msgs, n);
+        if (status < 0) {
+            if (socket_errno == EINTR)
+                continue;
+            if (!network_would_block(socket_errno))
+                return sent;
+            if (!datagram_wait(fd, true, deadline))
+                return sent;
+            continue;
+        }
+        sent += status;
+    }
+    return sent;
+}
+
+#endif /* !_WIN32 */
+
+
+/*
+ * Enable or disable UDP segmentation offload on a socket.  On receive, this
+ * lets the kernel coalesce consecutive datagrams from the same peer into a
+ * single buffer.  Sending with a segment size needs no socket option, but is
+ * only supported on the same platforms.  Returns true on success and false
+ * (setting the socket errno) on failure or if not supported.
+ */
+#if defined(UDP_GRO) && defined(UDP_SEGMENT)
+
+bool
+network_datagram_offload(socket_type fd, bool flag)
+{
+    int mode = flag ? 1 : 0;
+
+    return setsockopt(fd, IPPROTO_UDP, UDP_GRO, &mode, sizeof(mode)) == 0;
+}
+
+#else /* !(UDP_GRO && UDP_SEGMENT) */
+
+bool
+network_datagram_offload(socket_type fd UNUSED, bool flag UNUSED)
+{
+    socket_set_errno(ENOPROTOOPT);
+    return false;
+}
+
+#endif /* !(UDP_GRO && UDP_SEGMENT) */
+
+
 /*
  * Print an ASCII representation of the address of the given sockaddr into the
  * provided buffer.  This buffer must hold at least INET_ADDRSTRLEN characters
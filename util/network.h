@@ -39,6 +39,52 @@
 
 #include <sys/types.h>
 
+/* Forward declarations to avoid includes. */
+struct buffer;
+
+/*
+ * The result of a nonblocking read or write with network_read_buffer or
+ * network_write_buffer.  NETWORK_IO_AGAIN means that the socket would block
+ * and the call should be repeated once the socket is ready again.
+ */
+enum network_io {
+    NETWORK_IO_DONE,            /* All requested data transferred. */
+    NETWORK_IO_AGAIN,           /* Wait for readiness and call again. */
+    NETWORK_IO_EOF,             /* The peer closed the connection. */
+    NETWORK_IO_ERROR            /* Failure, socket errno is set. */
+};
+
+/*
+ * A socket options profile, applied to new sockets by the *_options variants
+ * of the socket creation functions before they are bound or connected.  Zero
+ * or false for any field leaves the system default alone, so initialize the
+ * struct with memset or a designated initializer.  The TCP options are only
+ * applied to stream sockets, and options not supported by the platform (most
+ * of these are Linux-specific) fail to be set.
+ *
+ * fastopen enables TCP Fast Open.  For sockets that will listen, it is the
+ * maximum number of pending Fast Open requests.  For client sockets, any
+ * positive value asks the kernel to send the first data written with the SYN
+ * once it has a Fast Open cookie for the server, which saves a round trip
+ * when reconnecting.  Both sides must also be enabled in the
+ * net.ipv4.tcp_fastopen sysctl on Linux.
+ *
+ * quickack is not persistent.  Linux leaves quickack mode again on its own
+ * after it has sent some acknowledgements, so setting it when the socket is
+ * created only speeds up the acknowledgements at the start of the connection
+ * (such as for the first request on a short-lived connection).  Callers that
+ * want it for the life of the connection must set TCP_QUICKACK again
+ * themselves after each read.
+ */
+struct network_options {
+    bool nodelay;               /* Disable Nagle's algorithm (TCP_NODELAY). */
+    bool quickack;              /* Initial quick ACKs (TCP_QUICKACK). */
+    int fastopen;               /* TCP Fast Open (see above). */
+    int busy_poll;              /* Microseconds to busy poll (SO_BUSY_POLL). */
+    int sndbuf;                 /* Send buffer size (SO_SNDBUF). */
+    int rcvbuf;                 /* Receive buffer size (SO_RCVBUF). */
+};
+
 BEGIN_DECLS
 
 /* Default to a hidden visibility for all util functions. */
@@ -55,6 +101,20 @@ socket_type network_bind_ipv4(int type, const char *addr, unsigned short port)
 socket_type network_bind_ipv6(int type, const char *addr, unsigned short port)
     __attribute__((__nonnull__));
 
+/*
+ * Like network_bind_ipv4 and network_bind_ipv6, but also apply a socket
+ * options profile, which may be NULL.  Failure to set the options produces a
+ * warning but the socket is still bound.
+ */
+socket_type network_bind_ipv4_options(int type, const char *addr,
+                                      unsigned short port,
+                                      const struct network_options *)
+    __attribute__((__nonnull__(2)));
+socket_type network_bind_ipv6_options(int type, const char *addr,
+                                      unsigned short port,
+                                      const struct network_options *)
+    __attribute__((__nonnull__(2)));
+
 /*
  * Create and bind sockets of the given type for every local address (normally
  * two, one for IPv4 and one for IPv6, if IPv6 support is enabled).  If IPv6
@@ -71,6 +131,31 @@ bool network_bind_all(int type, unsigned short port, socket_type **fds,
     __attribute__((__nonnull__));
 void network_bind_all_free(socket_type *fds);
 
+/*
+ * Like network_bind_all, but first adopt any sockets from the inherited array
+ * that are already bound to the given port with the given socket type, and
+ * then create and bind new sockets only for local addresses that those don't
+ * already cover.  Inherited sockets that don't match are left alone.  The
+ * adopted sockets come first in fds, in the order given.
+ */
+bool network_bind_all_inherited(int type, unsigned short port,
+                                const socket_type inherited[],
+                                unsigned int ninherited, socket_type **fds,
+                                unsigned int *count)
+    __attribute__((__nonnull__(5, 6)));
+
+/*
+ * Like network_bind_all_inherited, but adopts the listening sockets passed in
+ * by systemd socket activation (see sd_listen_fds), if any.  The environment
+ * is left untouched so that this can be called once for each socket type.
+ * Without systemd support, this is equivalent to network_bind_all.  This
+ * function is in util/network-systemd.c, and programs that call it must also
+ * link with the systemd daemon library.
+ */
+bool network_bind_all_activated(int type, unsigned short port,
+                                socket_type **fds, unsigned int *count)
+    __attribute__((__nonnull__));
+
 /*
  * Wait on an array of file descriptor for one of them to select ready for
  * read, and return the first file descriptor that does so.  This is primarily
@@ -115,6 +200,16 @@ socket_type network_connect_host(const char *host, unsigned short port,
                                  const char *source, time_t)
     __attribute__((__nonnull__(1)));
 
+/*
+ * Like network_connect, but also apply a socket options profile, which may be
+ * NULL, to each socket before connecting.  The options are treated as tuning
+ * hints and failure to set them is ignored.
+ */
+socket_type network_connect_options(const struct addrinfo *,
+                                    const char *source, time_t,
+                                    const struct network_options *)
+    __attribute__((__nonnull__(1)));
+
 /*
  * Creates a socket of the specified domain and type and binds it to the
  * appropriate source address, either the one supplied or all addresses if the
@@ -126,6 +221,11 @@ socket_type network_connect_host(const char *host, unsigned short port,
  */
 socket_type network_client_create(int domain, int type, const char *source);
 
+/* Like network_client_create, but with a socket options profile as above. */
+socket_type network_client_create_options(int domain, int type,
+                                          const char *source,
+                                          const struct network_options *);
+
 /*
  * Read or write the specified number of bytes to the network, enforcing a
  * timeout.  Both return true on success and false on failure; on failure, the
@@ -140,6 +240,81 @@ bool network_read(socket_type, void *, size_t, time_t)
 bool network_write(socket_type, const void *, size_t, time_t)
     __attribute__((__nonnull__));
 
+/*
+ * Incremental I/O on a nonblocking socket for use with an event loop, such as
+ * epoll directly or libevent via portable/event.h.  Each call transfers as
+ * much as it can without blocking, records its progress in the buffer, and
+ * returns NETWORK_IO_AGAIN if it has to wait, at which point the caller
+ * should wait for the socket to be readable or writable (as appropriate) and
+ * then call the same function again with the same buffer.  The socket must
+ * already be nonblocking (see fdflag_nonblocking).
+ *
+ * network_read_buffer appends data to the buffer until it holds at least
+ * total bytes of unused data, growing the buffer as needed.  If total is 0,
+ * it instead reads everything currently available and returns
+ * NETWORK_IO_AGAIN once the socket would block, which is what an
+ * edge-triggered caller needs.  Note that with a non-zero total, data may
+ * still be waiting after NETWORK_IO_DONE, so edge-triggered callers must
+ * call again before waiting for the next readiness notification.
+ *
+ * network_write_buffer writes the unused data in the buffer, consuming it as
+ * it is written, and returns NETWORK_IO_DONE once the buffer is empty.
+ */
+enum network_io network_read_buffer(socket_type, struct buffer *,
+                                    size_t total)
+    __attribute__((__nonnull__));
+enum network_io network_write_buffer(socket_type, struct buffer *)
+    __attribute__((__nonnull__));
+
+/*
+ * A single datagram for the batched datagram I/O functions.  The caller
+ * supplies data and size.  On receive, length, addr, addrlen, and segment are
+ * filled in.  On send, length bytes of data are sent to addr (or to the
+ * connected peer if addrlen is 0).
+ *
+ * segment is used for UDP segmentation offload.  On receive, it is set to
+ * the size of the individual datagrams if the kernel coalesced several
+ * datagrams from the same peer into data, and to 0 otherwise.  On send, a
+ * non-zero segment asks the kernel to split data into datagrams of that size,
+ * which must be at most UINT16_MAX.  Both require a successful call to
+ * network_datagram_offload first.
+ */
+struct network_datagram {
+    char *data;                         /* Datagram contents. */
+    size_t size;                        /* Allocated size of data. */
+    size_t length;                      /* Length of the datagram. */
+    struct sockaddr_storage addr;       /* Address of the peer. */
+    socklen_t addrlen;                  /* Length of addr, 0 for none. */
+    size_t segment;                     /* Offload segment size or 0. */
+};
+
+/*
+ * Receive or send an array of datagrams, using recvmmsg and sendmmsg where
+ * available so that many datagrams are handled per system call.  The timeout
+ * is in seconds and may be 0 to never time out.
+ *
+ * network_datagram_recv waits for at least one datagram and then receives as
+ * many as are immediately available, up to count.  It returns the number of
+ * datagrams received or -1 on failure, setting the socket errno (ETIMEDOUT
+ * on timeout).
+ *
+ * network_datagram_send returns the number of datagrams sent, which is less
+ * than count only on failure, in which case the socket errno is set.
+ */
+ssize_t network_datagram_recv(socket_type, struct network_datagram *,
+                              size_t count, time_t)
+    __attribute__((__nonnull__));
+ssize_t network_datagram_send(socket_type, const struct network_datagram *,
+                              size_t count, time_t)
+    __attribute__((__nonnull__));
+
+/*
+ * Enable or disable UDP segmentation offload (GRO on receive, GSO on send)
+ * for a socket.  Returns false and sets the socket errno if the platform does
+ * not support it, in which case segment must not be used.
+ */
+bool network_datagram_offload(socket_type, bool flag);
+
 /*
  * Put an ASCII representation of the address in a sockaddr into the provided
  * buffer, which should hold at least INET6_ADDRSTRLEN characters.